@@ -84,6 +84,7 @@ int strncpy_s( char *strDest, size_t numberOfElements, const char *strSource, si
 CWaves::CWaves()
 {
 	memset(&m_WaveIDs, 0, sizeof(m_WaveIDs));
+	m_lNumMappings = 0;
 }
 
 CWaves::~CWaves()
@@ -94,7 +95,7 @@ CWaves::~CWaves()
 	{
 		if (m_WaveIDs[lLoop])
 		{
-			if (m_WaveIDs[lLoop]->pData)
+			if (m_WaveIDs[lLoop]->pData && !m_WaveIDs[lLoop]->pMapping)
 				delete m_WaveIDs[lLoop]->pData;
 
 			if (m_WaveIDs[lLoop]->pFile)
@@ -104,6 +105,14 @@ CWaves::~CWaves()
 			m_WaveIDs[lLoop] = 0;
 		}
 	}
+
+	for (lLoop = 0; lLoop < m_lNumMappings; lLoop++)
+	{
+		UnmapViewOfFile(m_Mappings[lLoop].pView);
+		CloseHandle(m_Mappings[lLoop].hMapping);
+		CloseHandle(m_Mappings[lLoop].hFile);
+	}
+	m_lNumMappings = 0;
 }
 
 
@@ -168,6 +177,45 @@ WAVERESULT CWaves::LoadWaveFile(const char *szFilename, WAVEID *pWaveID)
 }
 
 
+WAVERESULT CWaves::MapWaveFile(const char *szFilename, WAVEID *pWaveID)
+{
+	WAVERESULT wr;
+	LPWAVEMAPPING pMapping;
+	LPWAVEFILEINFO pWaveInfo;
+
+	if (!szFilename || !pWaveID)
+		return WR_INVALIDPARAM;
+
+	if (FAILED(wr = GetMapping(szFilename, &pMapping)))
+		return wr;
+
+	wr = WR_OUTOFMEMORY;
+	pWaveInfo = new WAVEFILEINFO;
+	if (pWaveInfo)
+	{
+		// pData points into the mapping, so nothing is read or copied here
+		memcpy(pWaveInfo, &pMapping->WaveInfo, sizeof(WAVEFILEINFO));
+
+		long lLoop = 0;
+		for (lLoop = 0; lLoop < MAX_NUM_WAVEID; lLoop++)
+		{
+			if (!m_WaveIDs[lLoop])
+			{
+				m_WaveIDs[lLoop] = pWaveInfo;
+				*pWaveID = lLoop;
+				wr = WR_OK;
+				break;
+			}
+		}
+
+		if (wr != WR_OK)
+			delete pWaveInfo;
+	}
+
+	return wr;
+}
+
+
 WAVERESULT CWaves::OpenWaveFile(const char *szFilename, WAVEID *pWaveID)
 {
 	WAVERESULT wr = WR_OUTOFMEMORY;
@@ -355,13 +403,145 @@ WAVERESULT CWaves::ParseFile(const char *szFilename, LPWAVEFILEINFO pWaveInfo)
 }
 
 
+WAVERESULT CWaves::GetMapping(const char *szFilename, LPWAVEMAPPING *ppMapping)
+{
+	LPWAVEMAPPING	pMapping;
+	LARGE_INTEGER	liFileSize;
+	WAVERESULT		wr = WR_FILEERROR;
+	long			lLoop;
+
+	// A file that was mapped before is used as it is
+	for (lLoop = 0; lLoop < m_lNumMappings; lLoop++)
+	{
+		if (!_stricmp(m_Mappings[lLoop].szFilename, szFilename))
+		{
+			*ppMapping = &m_Mappings[lLoop];
+			return WR_OK;
+		}
+	}
+
+	if (strlen(szFilename) >= MAX_PATH)
+		return WR_INVALIDFILENAME;
+
+	if (m_lNumMappings == MAX_NUM_WAVEMAPPING)
+		return WR_OUTOFMEMORY;
+
+	pMapping = &m_Mappings[m_lNumMappings];
+	memset(pMapping, 0, sizeof(WAVEMAPPING));
+	pMapping->hFile = CreateFile(szFilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (pMapping->hFile == INVALID_HANDLE_VALUE)
+		return WR_INVALIDFILENAME;
+
+	if (GetFileSizeEx(pMapping->hFile, &liFileSize) && (liFileSize.HighPart == 0))
+	{
+		pMapping->ulSize = liFileSize.LowPart;
+
+		// An empty file can't be mapped, but it isn't a wave file either
+		if (pMapping->ulSize == 0)
+			wr = WR_BADWAVEFILE;
+		else
+			pMapping->hMapping = CreateFileMapping(pMapping->hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (pMapping->hMapping)
+			pMapping->pView = (char *)MapViewOfFile(pMapping->hMapping, FILE_MAP_READ, 0, 0, 0);
+		if (pMapping->pView)
+			wr = ParseMapping(pMapping);
+	}
+
+	if (wr != WR_OK)
+	{
+		if (pMapping->pView)
+			UnmapViewOfFile(pMapping->pView);
+		if (pMapping->hMapping)
+			CloseHandle(pMapping->hMapping);
+		CloseHandle(pMapping->hFile);
+		return wr;
+	}
+
+	strcpy(pMapping->szFilename, szFilename);
+	m_lNumMappings++;
+	*ppMapping = pMapping;
+
+	return WR_OK;
+}
+
+WAVERESULT CWaves::ParseMapping(LPWAVEMAPPING pMapping)
+{
+	WAVEFILEHEADER	waveFileHeader;
+	RIFFCHUNK		riffChunk;
+	WAVEFMT			waveFmt;
+	LPWAVEFILEINFO	pWaveInfo = &pMapping->WaveInfo;
+	unsigned long	ulOffset;
+
+	memset(pWaveInfo, 0, sizeof(WAVEFILEINFO));
+
+	// The same walk as ParseFile, but over the view, checking that every chunk is inside the file
+	if (pMapping->ulSize < sizeof(WAVEFILEHEADER))
+		return WR_BADWAVEFILE;
+
+	memcpy(&waveFileHeader, pMapping->pView, sizeof(WAVEFILEHEADER));
+	if (_strnicmp(waveFileHeader.szRIFF, "RIFF", 4) || _strnicmp(waveFileHeader.szWAVE, "WAVE", 4))
+		return WR_BADWAVEFILE;
+
+	ulOffset = sizeof(WAVEFILEHEADER);
+	while (ulOffset + sizeof(RIFFCHUNK) <= pMapping->ulSize)
+	{
+		memcpy(&riffChunk, pMapping->pView + ulOffset, sizeof(RIFFCHUNK));
+		ulOffset += sizeof(RIFFCHUNK);
+
+		// A truncated chunk ends the file (a truncated data chunk leaves it without data)
+		if (riffChunk.ulChunkSize > pMapping->ulSize - ulOffset)
+			break;
+
+		if (!_strnicmp(riffChunk.szChunkName, "fmt ", 4))
+		{
+			if (riffChunk.ulChunkSize <= sizeof(WAVEFMT))
+			{
+				memcpy(&waveFmt, pMapping->pView + ulOffset, riffChunk.ulChunkSize);
+
+				// Determine if this is a WAVEFORMATEX or WAVEFORMATEXTENSIBLE wave file
+				if (waveFmt.usFormatTag == WAVE_FORMAT_PCM)
+				{
+					pWaveInfo->wfType = WF_EX;
+					memcpy(&pWaveInfo->wfEXT.Format, &waveFmt, sizeof(PCMWAVEFORMAT));
+				}
+				else if (waveFmt.usFormatTag == WAVE_FORMAT_EXTENSIBLE)
+				{
+					pWaveInfo->wfType = WF_EXT;
+					memcpy(&pWaveInfo->wfEXT, &waveFmt, sizeof(WAVEFORMATEXTENSIBLE));
+				}
+			}
+		}
+		else if (!_strnicmp(riffChunk.szChunkName, "data", 4))
+		{
+			pWaveInfo->ulDataSize = riffChunk.ulChunkSize;
+			pWaveInfo->ulDataOffset = ulOffset;
+		}
+
+		ulOffset += riffChunk.ulChunkSize;
+
+		// Ensure that we are correctly aligned for next chunk
+		if (riffChunk.ulChunkSize & 1)
+			ulOffset++;
+	}
+
+	if (!pWaveInfo->ulDataSize || !pWaveInfo->ulDataOffset || ((pWaveInfo->wfType != WF_EX) && (pWaveInfo->wfType != WF_EXT)))
+		return WR_BADWAVEFILE;
+
+	pWaveInfo->pData = pMapping->pView + pWaveInfo->ulDataOffset;
+	pWaveInfo->pMapping = pMapping;
+
+	return WR_OK;
+}
+
+
 WAVERESULT CWaves::DeleteWaveFile(WAVEID WaveID)
 {
 	WAVERESULT wr = WR_OK;
 
 	if (IsWaveID(WaveID))
 	{
-		if (m_WaveIDs[WaveID]->pData)
+		// A mapped file stays mapped, so loading it again costs nothing
+		if (m_WaveIDs[WaveID]->pData && !m_WaveIDs[WaveID]->pMapping)
 			delete m_WaveIDs[WaveID]->pData;
 
 		if (m_WaveIDs[WaveID]->pFile)
@@ -9,6 +9,7 @@
 #include <stdio.h>
 
 #define MAX_NUM_WAVEID			1024
+#define MAX_NUM_WAVEMAPPING		64
 
 enum WAVEFILETYPE
 {
@@ -75,8 +76,20 @@ typedef struct
 	unsigned long	ulDataSize;
 	FILE			*pFile;
 	unsigned long	ulDataOffset;
+	struct tWAVEMAPPING	*pMapping;	// Set if pData points into a mapped file (which then owns it)
 } WAVEFILEINFO, *LPWAVEFILEINFO;
 
+// A wave file mapped into memory by MapWaveFile, kept until the CWaves is destroyed
+typedef struct tWAVEMAPPING
+{
+	char			szFilename[MAX_PATH];
+	HANDLE			hFile;
+	HANDLE			hMapping;
+	char			*pView;
+	unsigned long	ulSize;
+	WAVEFILEINFO	WaveInfo;			// Parsed once when the file is mapped
+} WAVEMAPPING, *LPWAVEMAPPING;
+
 typedef int (__cdecl *PFNALGETENUMVALUE)( const char *szEnumName );
 typedef int	WAVEID;
 
@@ -87,6 +100,7 @@ public:
 	virtual ~CWaves();
 
 	WAVERESULT LoadWaveFile(const char *szFilename, WAVEID *WaveID);
+	WAVERESULT MapWaveFile(const char *szFilename, WAVEID *WaveID);
 	WAVERESULT OpenWaveFile(const char *szFilename, WAVEID *WaveID);
 	WAVERESULT ReadWaveData(WAVEID WaveID, void *pData, unsigned long ulDataSize, unsigned long *pulBytesWritten);
 	WAVERESULT SetWaveDataOffset(WAVEID WaveID, unsigned long ulOffset);
@@ -105,9 +119,13 @@ public:
 
 private:
 	WAVERESULT ParseFile(const char *szFilename, LPWAVEFILEINFO pWaveInfo);
+	WAVERESULT ParseMapping(LPWAVEMAPPING pMapping);
+	WAVERESULT GetMapping(const char *szFilename, LPWAVEMAPPING *ppMapping);
 	WAVEID InsertWaveID(LPWAVEFILEINFO pWaveFileInfo);
 	
 	LPWAVEFILEINFO	m_WaveIDs[MAX_NUM_WAVEID];
+	WAVEMAPPING		m_Mappings[MAX_NUM_WAVEMAPPING];
+	long			m_lNumMappings;
 };
 
 #endif // _CWAVES_H_
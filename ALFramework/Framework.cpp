@@ -172,7 +172,8 @@ ALboolean ALFWLoadWaveToBuffer(const char *szWaveFile, ALuint uiBufferID, ALenum
 	bReturn = AL_FALSE;
 	if (g_pWaveLoader)
 	{
-		if (SUCCEEDED(g_pWaveLoader->LoadWaveFile(szWaveFile, &WaveID)))
+		// The data is handed to alBufferData straight out of the mapped file
+		if (SUCCEEDED(g_pWaveLoader->MapWaveFile(szWaveFile, &WaveID)))
 		{
 			if ((SUCCEEDED(g_pWaveLoader->GetWaveSize(WaveID, (unsigned long*)&iDataSize))) &&
 				(SUCCEEDED(g_pWaveLoader->GetWaveData(WaveID, (void**)&pData))) &&
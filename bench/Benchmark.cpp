@@ -0,0 +1,1220 @@
+// Benchmark.cpp
+//
+// A console program that times the engine's hot paths with fixed inputs.
+// Usage: AtmosphereBench [-filter=<text>] [-json=<file>] [-time=<ms>] [-simd=<level>] [-accuracy]
+// -simd= forces the kernels down to scalar, sse2, avx, or avx2 (the default is the best the CPU has).
+// -accuracy checks SIMDMath.h against libm at every level the CPU supports instead of timing
+// anything, and exits with 1 if any function's error is larger than its documented bound. It also
+// reports how far the half and 16-bit normalized optical depth tables are from the float ones,
+// how far CMixer's vector kernels are from its scalar one, and whether CSpectrumAnalyzer puts sines
+// in the right bands at the right levels.
+
+#include "Master.h"
+#include "GameEngine.h"
+#include "Mixer.h"
+#include "SpectrumAnalyzer.h"
+
+CWinApp *CWinApp::m_pMainApp;
+
+#define INPUT_COUNT		4096			// Size of each table of random inputs (a power of 2)
+#define MAX_RESULTS		256
+
+struct SResult
+{
+	char szName[64];
+	char szParams[64];
+	double dNsPerOp;
+	double dOpsPerSec;
+	double dIterations;
+};
+
+typedef void (*PFNBENCHMARK)(void *pParam, int nIterations);
+
+/*******************************************************************************
+* Class: CBenchmark
+********************************************************************************
+* Runs each benchmark with more and more iterations until one run takes at
+* least m_fMinTime, then reports the best of three runs of that length. Each
+* benchmark says how many operations one iteration stands for, so a batch
+* routine and its one-at-a-time counterpart report comparable ns/op numbers.
+*******************************************************************************/
+class CBenchmark
+{
+protected:
+	const char *m_pszFilter;
+	float m_fMinTime;				// In seconds
+	SResult m_result[MAX_RESULTS];
+	int m_nResults;
+	double m_dFrequency;
+
+	double GetTime()
+	{
+		LARGE_INTEGER n;
+		QueryPerformanceCounter(&n);
+		return (double)n.QuadPart / m_dFrequency;
+	}
+
+public:
+	CBenchmark(const char *pszFilter, float fMinTime)
+	{
+		m_pszFilter = pszFilter;
+		m_fMinTime = fMinTime;
+		m_nResults = 0;
+		LARGE_INTEGER n;
+		QueryPerformanceFrequency(&n);
+		m_dFrequency = (double)n.QuadPart;
+	}
+
+	bool IsEnabled(const char *pszName)	{ return !m_pszFilter || strstr(pszName, m_pszFilter) != NULL; }
+
+	void Run(const char *pszName, const char *pszParams, PFNBENCHMARK pfn, void *pParam, int nOpsPerIteration=1)
+	{
+		if(!IsEnabled(pszName) || m_nResults == MAX_RESULTS)
+			return;
+
+		// Warm up the caches, then find an iteration count that runs long enough to time
+		pfn(pParam, 1);
+		int nIterations = 1;
+		double dTime;
+		for(;;)
+		{
+			double dStart = GetTime();
+			pfn(pParam, nIterations);
+			dTime = GetTime() - dStart;
+			if(dTime >= m_fMinTime || nIterations >= (1 << 30))
+				break;
+			nIterations = (dTime <= 0) ? nIterations * 16 : Max(nIterations * 2, (int)Min(nIterations * 1.5 * m_fMinTime / dTime, (double)(1 << 30)));
+		}
+		for(int i=0; i<2; i++)
+		{
+			double dStart = GetTime();
+			pfn(pParam, nIterations);
+			dTime = Min(dTime, GetTime() - dStart);
+		}
+
+		SResult *p = &m_result[m_nResults++];
+		strncpy(p->szName, pszName, sizeof(p->szName)-1);
+		p->szName[sizeof(p->szName)-1] = 0;
+		strncpy(p->szParams, pszParams, sizeof(p->szParams)-1);
+		p->szParams[sizeof(p->szParams)-1] = 0;
+		double dOps = (double)nIterations * nOpsPerIteration;
+		p->dNsPerOp = dTime * 1e9 / dOps;
+		p->dOpsPerSec = dOps / dTime;
+		p->dIterations = nIterations;
+		printf("%-36s %-30s %12.2f ns/op %14.0f ops/s\n", p->szName, p->szParams, p->dNsPerOp, p->dOpsPerSec);
+	}
+
+	bool WriteJSON(const char *pszFile)
+	{
+		FILE *pFile = fopen(pszFile, "wt");
+		if(!pFile)
+			return false;
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		fprintf(pFile, "{\n  \"processors\": %d,\n  \"simd\": \"%s\",\n  \"simd_width\": %d,\n  \"results\": [\n",
+			(int)si.dwNumberOfProcessors, CKernels::GetLevelName(CKernels::Get().nLevel), CKernels::Get().nWidth);
+		for(int i=0; i<m_nResults; i++)
+		{
+			SResult *p = &m_result[i];
+			fprintf(pFile, "    {\"name\": \"%s\", \"params\": \"%s\", \"ns_per_op\": %.4f, \"ops_per_sec\": %.1f, \"iterations\": %.0f}%s\n",
+				p->szName, p->szParams, p->dNsPerOp, p->dOpsPerSec, p->dIterations, (i < m_nResults-1) ? "," : "");
+		}
+		fprintf(pFile, "  ]\n}\n");
+		fclose(pFile);
+		return true;
+	}
+};
+
+// Keeps the compiler from throwing away results that are never used
+volatile float g_fSink;
+
+// Fixed random inputs in [0, 1), shared by all the benchmarks (aligned, since some are read with F::Load())
+SIMD_ALIGN float g_fInput[INPUT_COUNT * 4];
+
+
+/*******************************************************************************
+* Scattering
+*******************************************************************************/
+struct SSphereBench
+{
+	CGameEngine *pEngine;
+	CSphere *pSphere;
+	int *pIndex;			// The front-facing vertices, like RenderFrame() colors them
+	int nCount;
+};
+
+static void InitSphereBench(SSphereBench &b, CGameEngine *pEngine, CSphere *pSphere)
+{
+	b.pEngine = pEngine;
+	b.pSphere = pSphere;
+	b.pIndex = new int[pSphere->GetVertexCount()];
+	b.nCount = 0;
+	CVector vCamera = pEngine->GetCamera()->GetPosition();
+	SVertex *pVertex = pSphere->GetVertexBuffer();
+	for(int i=0; i<pSphere->GetVertexCount(); i++)
+	{
+		if((vCamera | pVertex[i].vPos) > 0)
+			b.pIndex[b.nCount++] = i;
+	}
+}
+
+static void BenchSetColor(void *pParam, int nIterations)
+{
+	SSphereBench *p = (SSphereBench *)pParam;
+	SVertex *pVertex = p->pSphere->GetVertexBuffer();
+	for(int n=0; n<nIterations; n++)
+	{
+		for(int i=0; i<p->nCount; i++)
+			p->pEngine->SetColor(&pVertex[p->pIndex[i]]);
+	}
+}
+
+static void BenchSetColors(void *pParam, int nIterations)
+{
+	SSphereBench *p = (SSphereBench *)pParam;
+	for(int n=0; n<nIterations; n++)
+		p->pEngine->SetColors(p->pSphere->GetVertexBuffer(), p->pIndex, p->nCount);
+}
+
+static void BenchUpdateColors(void *pParam, int nIterations)
+{
+	SSphereBench *p = (SSphereBench *)pParam;
+	for(int n=0; n<nIterations; n++)
+	{
+		p->pSphere->InvalidateColors();
+		p->pEngine->UpdateColors(*p->pSphere);
+	}
+}
+
+// Nothing changes between frames, like an installation waiting for its next visitor
+static void BenchUpdateColorsIdle(void *pParam, int nIterations)
+{
+	SSphereBench *p = (SSphereBench *)pParam;
+	for(int n=0; n<nIterations; n++)
+		p->pEngine->UpdateColors(*p->pSphere);
+}
+
+// The camera orbits slowly (about 0.01 degrees per frame), so most rays stay within the reuse tolerance from one frame to the next
+static void BenchUpdateColorsOrbit(void *pParam, int nIterations)
+{
+	SSphereBench *p = (SSphereBench *)pParam;
+	static float fAngle = 0;
+	for(int n=0; n<nIterations; n++)
+	{
+		fAngle += 0.0002f;
+		p->pEngine->GetCamera()->SetPosition(CDoubleVector(25.0 * sin(fAngle), 0, 25.0 * cos(fAngle)));
+		p->pEngine->UpdateColors(*p->pSphere);
+	}
+}
+
+struct STableBench
+{
+	SScatterParams params;
+	CPixelBuffer pbOpticalDepth;
+	C4DBuffer table;
+};
+
+static void BenchScatteringTable(void *pParam, int nIterations)
+{
+	STableBench *p = (STableBench *)pParam;
+	for(int n=0; n<nIterations; n++)
+		CScatteringTable::Build(p->table, p->params, p->pbOpticalDepth);
+}
+
+static void RunScatteringBenchmarks(CBenchmark &bench, CGameEngine *pEngine)
+{
+	char szParams[64];
+	int nSamples = pEngine->GetSamples();
+
+	// Sweep the number of samples on the outer sphere (the one RenderFrame spends most of its time on)
+	static const int nSampleSweep[] = {2, 4, 8, 16};
+	SSphereBench b;
+	InitSphereBench(b, pEngine, pEngine->GetOuterSphere());
+	for(int i=0; i<sizeof(nSampleSweep)/sizeof(int); i++)
+	{
+		pEngine->SetSamples(nSampleSweep[i]);
+		sprintf(szParams, "samples=%d", nSampleSweep[i]);
+		bench.Run("CGameEngine::SetColor", szParams, BenchSetColor, &b, b.nCount);
+		bench.Run("CGameEngine::SetColors", szParams, BenchSetColors, &b, b.nCount);
+	}
+	pEngine->SetSamples(nSamples);
+
+	// The same with the phase functions evaluated directly instead of looked up
+	pEngine->UsePhaseTable(false);
+	sprintf(szParams, "samples=%d,phase=direct", nSamples);
+	bench.Run("CGameEngine::SetColor", szParams, BenchSetColor, &b, b.nCount);
+	bench.Run("CGameEngine::SetColors", szParams, BenchSetColors, &b, b.nCount);
+	pEngine->UsePhaseTable(true);
+
+	// And with the optical depth table stored in each compact format
+	static const int nTableType[] = {HalfFloatType, UnsignedShortType};
+	static const char *pszTableType[] = {"half", "unorm16"};
+	for(int i=0; i<sizeof(nTableType)/sizeof(int); i++)
+	{
+		pEngine->SetOpticalDepthType(nTableType[i]);
+		sprintf(szParams, "samples=%d,table=%s", nSamples, pszTableType[i]);
+		bench.Run("CGameEngine::SetColor", szParams, BenchSetColor, &b, b.nCount);
+		bench.Run("CGameEngine::SetColors", szParams, BenchSetColors, &b, b.nCount);
+	}
+	pEngine->SetOpticalDepthType(FloatType);
+	delete[] b.pIndex;
+
+	// Sweep the tessellation of the sphere
+	static const int nTessellationSweep[] = {50, 100, 200};
+	for(int i=0; i<sizeof(nTessellationSweep)/sizeof(int); i++)
+	{
+		CSphere sphere;
+		sphere.Init(10.25f, nTessellationSweep[i], nTessellationSweep[i]);
+		b.pEngine = pEngine;
+		b.pSphere = &sphere;
+		sprintf(szParams, "sphere=%dx%d,samples=%d", nTessellationSweep[i], nTessellationSweep[i], nSamples);
+		bench.Run("CGameEngine::UpdateColors", szParams, BenchUpdateColors, &b, sphere.GetVertexCount());
+	}
+
+	// Build a scattering table (this runs in the background in the demo)
+	STableBench t;
+	t.params = pEngine->GetScatterParams();
+	t.pbOpticalDepth.MakeOpticalDepthBuffer(t.params.fInnerRadius, t.params.fOuterRadius, 0.25f, 0.1f);
+	sprintf(szParams, "%dx%dx%dx%d,samples=%d", SCATTER_TABLE_NU, SCATTER_TABLE_MU, SCATTER_TABLE_MUS, SCATTER_TABLE_R, nSamples);
+	bench.Run("CScatteringTable::Build", szParams, BenchScatteringTable, &t, SCATTER_TABLE_NU * SCATTER_TABLE_MU * SCATTER_TABLE_MUS * SCATTER_TABLE_R);
+
+	// And the same tessellation sweep with the colors looked up in it (wait for the first table before timing anything)
+	pEngine->UseScatteringTable(true);
+	while(!pEngine->GetScatteringTable()->IsReady())
+	{
+		pEngine->UpdateColors(*pEngine->GetOuterSphere());
+		Sleep(1);
+	}
+	for(int i=0; i<sizeof(nTessellationSweep)/sizeof(int); i++)
+	{
+		CSphere sphere;
+		sphere.Init(10.25f, nTessellationSweep[i], nTessellationSweep[i]);
+		b.pEngine = pEngine;
+		b.pSphere = &sphere;
+		sprintf(szParams, "sphere=%dx%d,table", nTessellationSweep[i], nTessellationSweep[i]);
+		bench.Run("CGameEngine::UpdateColors", szParams, BenchUpdateColors, &b, sphere.GetVertexCount());
+	}
+	pEngine->UseScatteringTable(false);
+
+	// The incremental paths, on the sphere RenderFrame() draws
+	b.pSphere = pEngine->GetOuterSphere();
+	CDoubleVector vPosition = pEngine->GetCamera()->GetPosition();
+	sprintf(szParams, "camera=idle,samples=%d", nSamples);
+	bench.Run("CGameEngine::UpdateColors", szParams, BenchUpdateColorsIdle, &b, b.pSphere->GetVertexCount());
+	sprintf(szParams, "camera=orbit,tolerance=%g", pEngine->GetColorTolerance());
+	bench.Run("CGameEngine::UpdateColors", szParams, BenchUpdateColorsOrbit, &b, b.pSphere->GetVertexCount());
+	pEngine->GetCamera()->SetPosition(vPosition);
+}
+
+
+/*******************************************************************************
+* Lookup tables
+*******************************************************************************/
+static void BenchInterpolate2D(void *pParam, int nIterations)
+{
+	C3DBuffer *pBuffer = (C3DBuffer *)pParam;
+	float f[4], fSum = 0;
+	for(int n=0; n<nIterations; n++)
+	{
+		for(int i=0; i<INPUT_COUNT; i++)
+		{
+			pBuffer->Interpolate(f, g_fInput[i*2], g_fInput[i*2+1]);
+			fSum += f[0] + f[1] + f[2] + f[3];
+		}
+	}
+	g_fSink = fSum;
+}
+
+static void BenchInterpolate3D(void *pParam, int nIterations)
+{
+	C3DBuffer *pBuffer = (C3DBuffer *)pParam;
+	float f[4], fSum = 0;
+	for(int n=0; n<nIterations; n++)
+	{
+		for(int i=0; i<INPUT_COUNT; i++)
+		{
+			pBuffer->Interpolate(f, g_fInput[i*3], g_fInput[i*3+1], g_fInput[i*3+2]);
+			fSum += f[0] + f[1] + f[2] + f[3];
+		}
+	}
+	g_fSink = fSum;
+}
+
+// The same lookups through the kernel table's InterpolateBatch, with the coordinates in separate arrays
+static float g_fBatchOut[4][INPUT_COUNT];
+
+static void BenchInterpolateBatch2D(void *pParam, int nIterations)
+{
+	const TBuffer<float, 4> &buf = *(const TBuffer<float, 4> *)pParam;
+	float *ppOut[4] = {g_fBatchOut[0], g_fBatchOut[1], g_fBatchOut[2], g_fBatchOut[3]};
+	for(int n=0; n<nIterations; n++)
+		CKernels::Get().pfnInterpolateBatch2D(buf, g_fInput, g_fInput + INPUT_COUNT, INPUT_COUNT, ppOut);
+	g_fSink = g_fBatchOut[0][INPUT_COUNT-1];
+}
+
+static void BenchInterpolateBatch3D(void *pParam, int nIterations)
+{
+	const TBuffer<float, 4> &buf = *(const TBuffer<float, 4> *)pParam;
+	float *ppOut[4] = {g_fBatchOut[0], g_fBatchOut[1], g_fBatchOut[2], g_fBatchOut[3]};
+	for(int n=0; n<nIterations; n++)
+		CKernels::Get().pfnInterpolateBatch3D(buf, g_fInput, g_fInput + INPUT_COUNT, g_fInput + INPUT_COUNT*2, INPUT_COUNT, ppOut);
+	g_fSink = g_fBatchOut[0][INPUT_COUNT-1];
+}
+
+// The phase functions for INPUT_COUNT random angles, F::Width at a time (p.pPhase picks the table or the direct path)
+template <class F> static void BenchPhase(void *pParam, int nIterations)
+{
+	const SScatterParams &p = *(const SScatterParams *)pParam;
+	F fSum(0.0f);
+	for(int n=0; n<nIterations; n++)
+	{
+		for(int i=0; i<INPUT_COUNT; i+=F::Width)
+		{
+			F fRayleighPhase, fMiePhase;
+			GetPhase(p, F::Load(&g_fInput[i]) * 2.0f - 1.0f, fRayleighPhase, fMiePhase);
+			fSum += fMiePhase;
+		}
+	}
+	SIMD_ALIGN float f[F::Width];
+	fSum.Store(f);
+	F::EndBatch();
+	g_fSink = f[0];
+}
+static const PFNBENCHMARK g_pfnBenchPhase[SIMD_LEVELS] = {BenchPhase<CFloat1>, BenchPhase<CFloat4>, BenchPhase<CFloat8>, BenchPhase<CFloat8>};
+
+struct SOpticalDepthBench
+{
+	CPixelBuffer pbOpticalDepth;
+	int nSize;
+	int nSamples;
+	CThreadPool *pPool;
+};
+
+static void BenchOpticalDepth(void *pParam, int nIterations)
+{
+	SOpticalDepthBench *b = (SOpticalDepthBench *)pParam;
+	for(int n=0; n<nIterations; n++)
+		b->pbOpticalDepth.MakeOpticalDepthBuffer(10.0f, 10.15f, 0.25f, 0.1f, b->nSize, b->nSamples, b->pPool);
+}
+
+static void RunBufferBenchmarks(CBenchmark &bench)
+{
+	// Table size and samples per texel, from the default up to a high-quality table
+	static const int nQuality[][2] = {{128, 10}, {256, 20}, {512, 50}};
+	CThreadPool pool;
+	pool.Init();
+	SOpticalDepthBench b;
+	char szParams[64];
+	for(int q=0; q<sizeof(nQuality)/sizeof(nQuality[0]); q++)
+	{
+		b.nSize = nQuality[q][0];
+		b.nSamples = nQuality[q][1];
+		b.pPool = NULL;
+		sprintf(szParams, "size=%d,samples=%d,threads=1", b.nSize, b.nSamples);
+		bench.Run("CPixelBuffer::MakeOpticalDepthBuffer", szParams, BenchOpticalDepth, &b);
+		if(pool.GetThreadCount())
+		{
+			b.pPool = &pool;
+			sprintf(szParams, "size=%d,samples=%d,threads=%d", b.nSize, b.nSamples, pool.GetThreadCount()+1);
+			bench.Run("CPixelBuffer::MakeOpticalDepthBuffer", szParams, BenchOpticalDepth, &b);
+		}
+	}
+	pool.Cleanup();
+
+	CPixelBuffer pbOpticalDepth;
+	pbOpticalDepth.MakeOpticalDepthBuffer(10.0f, 10.15f, 0.25f, 0.1f);
+	bench.Run("C3DBuffer::Interpolate2D", "128x128x4", BenchInterpolate2D, &pbOpticalDepth, INPUT_COUNT);
+
+	// A 256x256 table is 1 MB as floats and 512 KB in either compact format
+	CPixelBuffer pbLarge;
+	pbLarge.MakeOpticalDepthBuffer(10.0f, 10.15f, 0.25f, 0.1f, 256, 20);
+	C3DBuffer pbHalf, pbUnorm;
+	pbHalf.Convert(pbLarge, HalfFloatType);
+	pbUnorm.Convert(pbLarge, UnsignedShortType);
+	bench.Run("C3DBuffer::Interpolate2D", "256x256x4", BenchInterpolate2D, &pbLarge, INPUT_COUNT);
+	bench.Run("C3DBuffer::Interpolate2D", "256x256x4,half", BenchInterpolate2D, &pbHalf, INPUT_COUNT);
+	bench.Run("C3DBuffer::Interpolate2D", "256x256x4,unorm16", BenchInterpolate2D, &pbUnorm, INPUT_COUNT);
+
+	C3DBuffer buf3D(32, 32, 32, GL_FLOAT, 4);
+	float *pData = (float *)buf3D.GetBuffer();
+	for(int i=0; i<32*32*32*4; i++)
+		pData[i] = g_fInput[i & (INPUT_COUNT*4-1)];
+	bench.Run("C3DBuffer::Interpolate3D", "32x32x32x4", BenchInterpolate3D, &buf3D, INPUT_COUNT);
+
+	// Random trilinear lookups in volumes from L2-sized to far larger than the caches, in each layout
+	static const int nVolumeSize[] = {32, 64, 128, 256};
+	static const char *pszLayout[] = {"linear", "brick"};
+	for(int v=0; v<sizeof(nVolumeSize)/sizeof(int); v++)
+	{
+		int nSize = nVolumeSize[v];
+		for(int nLayout=LinearLayout; nLayout<=BrickLayout; nLayout++)
+		{
+			// 4 float channels, and 2 byte channels like Make3DNoise() (the larger float volumes take too long to fill with noise)
+			if(nSize <= 128)
+			{
+				C3DBuffer volume(nSize, nSize, nSize, GL_FLOAT, 4, NULL, nLayout);
+				for(size_t i=0; i<volume.GetBufferSize()/sizeof(float); i++)
+					((float *)volume.GetBuffer())[i] = g_fInput[i & (INPUT_COUNT*4-1)];
+				sprintf(szParams, "%dx%dx%dx4,%s", nSize, nSize, nSize, pszLayout[nLayout]);
+				bench.Run("C3DBuffer::Interpolate3D", szParams, BenchInterpolate3D, &volume, INPUT_COUNT);
+			}
+			CPixelBuffer pbNoise;
+			pbNoise.Init(nSize, nSize, nSize, 2, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, NULL, nLayout);
+			for(size_t i=0; i<pbNoise.GetBufferSize(); i++)
+				((unsigned char *)pbNoise.GetBuffer())[i] = (unsigned char)(g_fInput[i & (INPUT_COUNT*4-1)] * 255);
+			sprintf(szParams, "%dx%dx%dx2,unorm8,%s", nSize, nSize, nSize, pszLayout[nLayout]);
+			bench.Run("C3DBuffer::Interpolate3D", szParams, BenchInterpolate3D, &pbNoise, INPUT_COUNT);
+		}
+	}
+
+	TBuffer<float, 4> view2D = pbOpticalDepth.GetView<float, 4>(), view3D = buf3D.GetView<float, 4>();
+	sprintf(szParams, "128x128x4,simd=%s", CKernels::GetLevelName(CKernels::Get().nLevel));
+	bench.Run("InterpolateBatch2D", szParams, BenchInterpolateBatch2D, &view2D, INPUT_COUNT);
+	sprintf(szParams, "32x32x32x4,simd=%s", CKernels::GetLevelName(CKernels::Get().nLevel));
+	bench.Run("InterpolateBatch3D", szParams, BenchInterpolateBatch3D, &view3D, INPUT_COUNT);
+
+	// The engine's default constants
+	SScatterParams p;
+	p.fKr = 0.0025f;
+	p.fKm = 0.0025f;
+	p.fESun = 15.0f;
+	p.g = -0.75f;
+	CPixelBuffer pbPhase;
+	pbPhase.MakePhaseBuffer(p.fESun, p.fKr, p.fKm, p.g);
+	p.pPhase = NULL;
+	bench.Run("GetPhase", "direct", g_pfnBenchPhase[CKernels::Get().nLevel], &p, INPUT_COUNT);
+	p.pPhase = (const float *)pbPhase.GetBuffer();
+	p.nPhaseSize = pbPhase.GetWidth();
+	sprintf(szParams, "table=%d", p.nPhaseSize);
+	bench.Run("GetPhase", szParams, g_pfnBenchPhase[CKernels::Get().nLevel], &p, INPUT_COUNT);
+}
+
+
+/*******************************************************************************
+* Math
+*******************************************************************************/
+typedef float (*PFNSCALARMATH)(float x, float y);
+typedef double (*PFNREFERENCEMATH)(double x, double y);
+
+enum EMathFunction { MATH_EXP, MATH_LOG, MATH_POW, MATH_ACOS };
+
+// Calls one of SIMDMath.h's functions (the switch is the same every time it's called in a loop, so it predicts perfectly)
+template <class F> inline F VectorMath(EMathFunction nFunction, const F &x, const F &y)
+{
+	switch(nFunction)
+	{
+		case MATH_EXP:	return Exp(x);
+		case MATH_LOG:	return Log(x);
+		case MATH_POW:	return Pow(x, y);
+		default:		return Acos(x);
+	}
+}
+
+static float ScalarExp(float x, float y)						{ return expf(x); }
+static float ScalarLog(float x, float y)						{ return logf(x); }
+static float ScalarPow(float x, float y)						{ return powf(x, y); }
+static float ScalarAcos(float x, float y)						{ return acosf(x); }
+static double ReferenceExp(double x, double y)					{ return exp(x); }
+static double ReferenceLog(double x, double y)					{ return log(x); }
+static double ReferencePow(double x, double y)					{ return pow(x, y); }
+static double ReferenceAcos(double x, double y)					{ return acos(x); }
+
+/*******************************************************************************
+* Each function in SIMDMath.h, the range AtmosphereBench -accuracy sweeps it
+* over, and the maximum error documented for it there. Ranges with bLogSweep
+* set are stepped through evenly in float bit patterns (so every power of 2
+* gets the same number of samples), the rest are stepped through linearly.
+* Pow's y comes from the random inputs, scaled to [-4, 4).
+*******************************************************************************/
+struct SMathFunction
+{
+	const char *pszName;
+	EMathFunction nFunction;
+	PFNSCALARMATH pfnScalar;			// What the engine's scalar code calls
+	PFNREFERENCEMATH pfnReference;
+	float fMin, fMax;
+	bool bLogSweep;
+	double dMaxUlp;				// Allowed error in ulps of the correctly rounded result
+	double dUlpPerLog;			// Extra ulps allowed per unit of |y ln x| (for Pow)
+	double dMaxAbsolute;		// Errors below this are always allowed (for results near 0)
+};
+
+static const SMathFunction g_math[] = {
+	{"Exp", MATH_EXP, ScalarExp, ReferenceExp, -87.0f, 88.0f, false, 2, 0, 0},
+	{"Log", MATH_LOG, ScalarLog, ReferenceLog, 1.17549435e-38f, 3.40282347e+38f, true, 2, 0, 0},
+	{"Pow", MATH_POW, ScalarPow, ReferencePow, 1.0f / 1048576, 1048576.0f, true, 2, 2, 0},
+	{"Acos", MATH_ACOS, ScalarAcos, ReferenceAcos, -1.0f, 1.0f, false, 2, 0, 1.2e-7},
+};
+
+struct SMathBench
+{
+	const SMathFunction *pFunction;
+	SIMD_ALIGN float fX[INPUT_COUNT];
+	SIMD_ALIGN float fY[INPUT_COUNT];
+};
+static SMathBench g_mathBench;		// Static to keep the inputs aligned
+
+template <class F> static void BenchVectorMath(void *pParam, int nIterations)
+{
+	SMathBench *p = (SMathBench *)pParam;
+	EMathFunction nFunction = p->pFunction->nFunction;
+	F fSum = 0.0f;
+	for(int n=0; n<nIterations; n++)
+		for(int i=0; i<INPUT_COUNT; i+=F::Width)
+			fSum += VectorMath(nFunction, F::Load(p->fX + i), F::Load(p->fY + i));
+	SIMD_ALIGN float fLane[F::Width];
+	fSum.Store(fLane);
+	F::EndBatch();
+	g_fSink = fLane[0];
+}
+static const PFNBENCHMARK g_pfnBenchVectorMath[SIMD_LEVELS] = {BenchVectorMath<CFloat1>, BenchVectorMath<CFloat4>, BenchVectorMath<CFloat8>, BenchVectorMath<CFloat8>};
+
+static void BenchScalarMath(void *pParam, int nIterations)
+{
+	SMathBench *p = (SMathBench *)pParam;
+	float fSum = 0;
+	for(int n=0; n<nIterations; n++)
+		for(int i=0; i<INPUT_COUNT; i++)
+			fSum += p->pFunction->pfnScalar(p->fX[i], p->fY[i]);
+	g_fSink = fSum;
+}
+
+// Returns input i of nCount spread over the function's range
+static float GetMathInput(const SMathFunction &f, int i, int nCount)
+{
+	if(!f.bLogSweep)
+		return f.fMin + (f.fMax - f.fMin) * ((double)i / (nCount-1));
+	unsigned int nMin = *(const unsigned int *)&f.fMin, nMax = *(const unsigned int *)&f.fMax;
+	unsigned int nBits = nMin + (unsigned int)((double)(nMax - nMin) * i / (nCount-1));
+	return *(float *)&nBits;
+}
+
+static void RunMathBenchmarks(CBenchmark &bench)
+{
+	char szParams[64];
+	ESIMDLevel nLevel = CKernels::Get().nLevel;
+	SMathBench *p = &g_mathBench;
+	for(int f=0; f<sizeof(g_math)/sizeof(g_math[0]); f++)
+	{
+		p->pFunction = &g_math[f];
+		for(int i=0; i<INPUT_COUNT; i++)
+		{
+			p->fX[i] = GetMathInput(g_math[f], (int)(g_fInput[i] * INPUT_COUNT), INPUT_COUNT);
+			p->fY[i] = g_fInput[INPUT_COUNT + i] * 8.0f - 4.0f;
+		}
+		sprintf(szParams, "simd=%s", CKernels::GetLevelName(nLevel));
+		bench.Run(g_math[f].pszName, szParams, g_pfnBenchVectorMath[nLevel], p, INPUT_COUNT);
+		bench.Run(g_math[f].pszName, "libm", BenchScalarMath, p, INPUT_COUNT);
+	}
+}
+
+// Sweeps one function for vector type F against the double precision libm version, returns the worst error in ulps
+template <class F> static double CheckMathAccuracy(const SMathFunction &fn, bool &bFailed, double &dWorstX, double &dWorstY)
+{
+	const int nCount = 1 << 22;
+	SIMD_ALIGN float fX[F::Width], fY[F::Width], fResult[F::Width];
+	double dWorst = 0;
+	bFailed = false;
+	for(int i=0; i<nCount; i+=F::Width)
+	{
+		for(int l=0; l<F::Width; l++)
+		{
+			fX[l] = GetMathInput(fn, i+l, nCount);
+			fY[l] = g_fInput[(i+l) & (INPUT_COUNT*4-1)] * 8.0f - 4.0f;
+		}
+		VectorMath(fn.nFunction, F::Load(fX), F::Load(fY)).Store(fResult);
+		F::EndBatch();
+		for(int l=0; l<F::Width; l++)
+		{
+			// Measure the error in units of the spacing between floats at the correctly rounded result
+			double dReference = fn.pfnReference(fX[l], fY[l]);
+			float fRounded = (float)fabs(dReference);
+			int nExponent;
+			frexp(fRounded, &nExponent);
+			double dUlp = ldexp(1.0, nExponent - 24);
+			double dError = fabs(fResult[l] - dReference);
+			double dBound = fn.dMaxUlp;
+			if(fn.dUlpPerLog)
+				dBound += fn.dUlpPerLog * fabs(fY[l] * log((double)fX[l]));
+			if(dError <= fn.dMaxAbsolute)
+				continue;
+			if(!(dError <= dBound * dUlp))
+				bFailed = true;
+			if(!(dError / dUlp <= dWorst))
+			{
+				dWorst = dError / dUlp;
+				dWorstX = fX[l];
+				dWorstY = fY[l];
+			}
+		}
+	}
+	return dWorst;
+}
+
+// Checks every function at every level this CPU supports against its documented bound
+static bool CheckMathAccuracy()
+{
+	bool bPassed = true;
+	printf("%-8s %-8s %-28s %18s %14s %10s\n", "Function", "SIMD", "Range", "Worst input", "Max error", "Bound");
+	for(int nLevel=SIMD_SCALAR; nLevel<SIMD_AVX2; nLevel++)
+	{
+		if(!CKernels::IsSupported((ESIMDLevel)nLevel))
+			continue;
+		for(int f=0; f<sizeof(g_math)/sizeof(g_math[0]); f++)
+		{
+			const SMathFunction &fn = g_math[f];
+			bool bFailed;
+			double dWorst, dWorstX = 0, dWorstY = 0;
+			if(nLevel == SIMD_SCALAR)
+				dWorst = CheckMathAccuracy<CFloat1>(fn, bFailed, dWorstX, dWorstY);
+			else if(nLevel == SIMD_SSE2)
+				dWorst = CheckMathAccuracy<CFloat4>(fn, bFailed, dWorstX, dWorstY);
+			else
+				dWorst = CheckMathAccuracy<CFloat8>(fn, bFailed, dWorstX, dWorstY);
+
+			char szRange[64], szWorst[64];
+			sprintf(szRange, "[%g, %g]", fn.fMin, fn.fMax);
+			if(fn.dUlpPerLog)
+				sprintf(szWorst, "%g^%g", dWorstX, dWorstY);
+			else
+				sprintf(szWorst, "%g", dWorstX);
+			printf("%-8s %-8s %-28s %18s %10.2f ulp %10g %s\n", fn.pszName, CKernels::GetLevelName((ESIMDLevel)nLevel), szRange, szWorst, dWorst, fn.dMaxUlp, bFailed ? "FAILED" : "ok");
+			bPassed = bPassed && !bFailed;
+		}
+	}
+	return bPassed;
+}
+
+/*******************************************************************************
+* Compact tables
+********************************************************************************
+* Samples a half and a 16-bit normalized copy of the optical depth table at
+* INPUT_COUNT random points and compares them to the float table. Errors are
+* listed per channel, both absolute and as a fraction of the largest value in
+* the channel (the optical depths grow to about 80 along grazing rays, while
+* the density ratios stay at or below 1). The vector kernels at every level
+* the CPU supports must also match C3DBuffer::Interpolate() on the same compact
+* table to within 1e-5 of that range, or the check fails.
+*******************************************************************************/
+template <class F, class G, class T> static void InterpolateTable(const C3DBuffer &buf, float *ppOut[4])
+{
+	InterpolateBatch<F, G>(buf.GetView<T, 4>(), g_fInput, g_fInput + INPUT_COUNT, INPUT_COUNT, ppOut);
+	F::EndBatch();
+}
+
+template <class T> static void InterpolateTable(ESIMDLevel nLevel, const C3DBuffer &buf, float *ppOut[4])
+{
+	if(nLevel == SIMD_SCALAR)
+		InterpolateTable<CFloat1, TGather<CFloat1>, T>(buf, ppOut);
+	else if(nLevel == SIMD_SSE2)
+		InterpolateTable<CFloat4, TGather<CFloat4>, T>(buf, ppOut);
+#ifdef SIMD_AVX2_INTRINSICS
+	else if(nLevel == SIMD_AVX2)
+		InterpolateTable<CFloat8, SGatherAVX2, T>(buf, ppOut);
+#endif
+	else
+		InterpolateTable<CFloat8, TGather<CFloat8>, T>(buf, ppOut);
+}
+
+static bool CheckTableAccuracy()
+{
+	static const int nQuality[][2] = {{128, 10}, {256, 20}};
+	static const int nTableType[] = {HalfFloatType, UnsignedShortType};
+	static const char *pszTableType[] = {"half", "unorm16"};
+	static float fOut[4][INPUT_COUNT];
+	float *ppOut[4] = {fOut[0], fOut[1], fOut[2], fOut[3]};
+	bool bPassed = true;
+
+	printf("\n%-8s %-8s %-8s %10s %10s %10s %10s\n", "Table", "Format", "Channel", "Max", "Max error", "Of max", "SIMD");
+	for(int q=0; q<sizeof(nQuality)/sizeof(nQuality[0]); q++)
+	{
+		CPixelBuffer pbFloat;
+		pbFloat.MakeOpticalDepthBuffer(10.0f, 10.25f, 0.25f, 0.1f, nQuality[q][0], nQuality[q][1]);
+		float fMax[4] = {0, 0, 0, 0};
+		const float *pTexel = (const float *)pbFloat.GetBuffer();
+		for(int i=0; i<pbFloat.GetWidth()*pbFloat.GetHeight()*4; i++)
+			fMax[i & 3] = Max(fMax[i & 3], Abs(pTexel[i]));
+
+		for(int t=0; t<sizeof(nTableType)/sizeof(int); t++)
+		{
+			C3DBuffer pbCompact;
+			pbCompact.Convert(pbFloat, nTableType[t]);
+			float fError[4] = {0, 0, 0, 0}, fMismatch[4] = {0, 0, 0, 0};
+			for(int i=0; i<INPUT_COUNT; i++)
+			{
+				float fReference[4], fCompact[4];
+				pbFloat.Interpolate(fReference, g_fInput[i], g_fInput[INPUT_COUNT + i]);
+				pbCompact.Interpolate(fCompact, g_fInput[i], g_fInput[INPUT_COUNT + i]);
+				for(int c=0; c<4; c++)
+					fError[c] = Max(fError[c], Abs(fCompact[c] - fReference[c]));
+			}
+
+			// Run the same points through the kernels at every level and keep the furthest any of them got from the scalar path
+			for(int nLevel=SIMD_SCALAR; nLevel<SIMD_LEVELS; nLevel++)
+			{
+				if(!CKernels::IsSupported((ESIMDLevel)nLevel))
+					continue;
+				if(nTableType[t] == HalfFloatType)
+					InterpolateTable<SHalf>((ESIMDLevel)nLevel, pbCompact, ppOut);
+				else
+					InterpolateTable<unsigned short>((ESIMDLevel)nLevel, pbCompact, ppOut);
+				for(int i=0; i<INPUT_COUNT; i++)
+				{
+					float fCompact[4];
+					pbCompact.Interpolate(fCompact, g_fInput[i], g_fInput[INPUT_COUNT + i]);
+					for(int c=0; c<4; c++)
+						fMismatch[c] = Max(fMismatch[c], Abs(fOut[c][i] - fCompact[c]));
+				}
+			}
+
+			char szTable[32];
+			sprintf(szTable, "%dx%d", nQuality[q][0], nQuality[q][0]);
+			for(int c=0; c<4; c++)
+			{
+				bool bFailed = !(fMismatch[c] <= fMax[c] * 1e-5f);
+				printf("%-8s %-8s %-8d %10.4g %10.3g %10.3g %10s\n", szTable, pszTableType[t], c, fMax[c], fError[c], fError[c] / fMax[c], bFailed ? "FAILED" : "ok");
+				bPassed = bPassed && !bFailed;
+			}
+		}
+	}
+	return bPassed;
+}
+
+/*******************************************************************************
+* Noise
+*******************************************************************************/
+struct SNoiseBench
+{
+	CFractal fractal;
+	int nDimensions;
+	float fOctaves;
+};
+
+// Reads nDimensions coordinates in [-8, 8) for input i
+#define NOISE_INPUT(p, i)	float f[4]; for(int d=0; d<p->nDimensions; d++) f[d] = g_fInput[(i*4+d) & (INPUT_COUNT*4-1)] * 16.0f - 8.0f;
+
+static void BenchNoise(void *pParam, int nIterations)
+{
+	SNoiseBench *p = (SNoiseBench *)pParam;
+	float fSum = 0;
+	for(int n=0; n<nIterations; n++)
+		for(int i=0; i<INPUT_COUNT; i++)
+		{
+			NOISE_INPUT(p, i);
+			fSum += p->fractal.Noise(f);
+		}
+	g_fSink = fSum;
+}
+
+static void BenchfBm(void *pParam, int nIterations)
+{
+	SNoiseBench *p = (SNoiseBench *)pParam;
+	float fSum = 0;
+	for(int n=0; n<nIterations; n++)
+		for(int i=0; i<INPUT_COUNT; i++)
+		{
+			NOISE_INPUT(p, i);
+			fSum += p->fractal.fBm(f, p->fOctaves);
+		}
+	g_fSink = fSum;
+}
+
+static void BenchTurbulence(void *pParam, int nIterations)
+{
+	SNoiseBench *p = (SNoiseBench *)pParam;
+	float fSum = 0;
+	for(int n=0; n<nIterations; n++)
+		for(int i=0; i<INPUT_COUNT; i++)
+		{
+			NOISE_INPUT(p, i);
+			fSum += p->fractal.Turbulence(f, p->fOctaves);
+		}
+	g_fSink = fSum;
+}
+
+static void BenchMultifractal(void *pParam, int nIterations)
+{
+	SNoiseBench *p = (SNoiseBench *)pParam;
+	float fSum = 0;
+	for(int n=0; n<nIterations; n++)
+		for(int i=0; i<INPUT_COUNT; i++)
+		{
+			NOISE_INPUT(p, i);
+			fSum += p->fractal.Multifractal(f, p->fOctaves, 0.3f);
+		}
+	g_fSink = fSum;
+}
+
+static void BenchHeterofractal(void *pParam, int nIterations)
+{
+	SNoiseBench *p = (SNoiseBench *)pParam;
+	float fSum = 0;
+	for(int n=0; n<nIterations; n++)
+		for(int i=0; i<INPUT_COUNT; i++)
+		{
+			NOISE_INPUT(p, i);
+			fSum += p->fractal.Heterofractal(f, p->fOctaves, 0.3f);
+		}
+	g_fSink = fSum;
+}
+
+static void BenchHybridMultifractal(void *pParam, int nIterations)
+{
+	SNoiseBench *p = (SNoiseBench *)pParam;
+	float fSum = 0;
+	for(int n=0; n<nIterations; n++)
+		for(int i=0; i<INPUT_COUNT; i++)
+		{
+			NOISE_INPUT(p, i);
+			fSum += p->fractal.HybridMultifractal(f, p->fOctaves, 0.3f, 2.0f);
+		}
+	g_fSink = fSum;
+}
+
+static void BenchRidgedMultifractal(void *pParam, int nIterations)
+{
+	SNoiseBench *p = (SNoiseBench *)pParam;
+	float fSum = 0;
+	for(int n=0; n<nIterations; n++)
+		for(int i=0; i<INPUT_COUNT; i++)
+		{
+			NOISE_INPUT(p, i);
+			fSum += p->fractal.RidgedMultifractal(f, p->fOctaves, 1.0f, 2.0f);
+		}
+	g_fSink = fSum;
+}
+
+static void RunNoiseBenchmarks(CBenchmark &bench)
+{
+	char szParams[64];
+	SNoiseBench b;
+	for(int nDimensions=1; nDimensions<=4; nDimensions++)
+	{
+		b.fractal.Init(nDimensions, 1234, 0.5f, 2.0f);
+		b.nDimensions = nDimensions;
+		sprintf(szParams, "dim=%d", nDimensions);
+		bench.Run("CNoise::Noise", szParams, BenchNoise, &b, INPUT_COUNT);
+	}
+
+	static const struct { const char *pszName; PFNBENCHMARK pfn; } fractals[] =
+	{
+		{"CFractal::fBm", BenchfBm},
+		{"CFractal::Turbulence", BenchTurbulence},
+		{"CFractal::Multifractal", BenchMultifractal},
+		{"CFractal::Heterofractal", BenchHeterofractal},
+		{"CFractal::HybridMultifractal", BenchHybridMultifractal},
+		{"CFractal::RidgedMultifractal", BenchRidgedMultifractal},
+	};
+	static const float fOctaveSweep[] = {2.0f, 4.0f, 8.0f};
+	b.fractal.Init(3, 1234, 0.5f, 2.0f);
+	b.nDimensions = 3;
+	for(int i=0; i<sizeof(fractals)/sizeof(fractals[0]); i++)
+	{
+		for(int j=0; j<sizeof(fOctaveSweep)/sizeof(float); j++)
+		{
+			b.fOctaves = fOctaveSweep[j];
+			sprintf(szParams, "dim=3,octaves=%g", fOctaveSweep[j]);
+			bench.Run(fractals[i].pszName, szParams, fractals[i].pfn, &b, INPUT_COUNT);
+		}
+	}
+}
+
+
+/*******************************************************************************
+* Matrices and quaternions
+*******************************************************************************/
+static CMatrix g_mat[64];
+static CQuaternion g_quat[64];
+
+static void BenchMatrixMultiply(void *pParam, int nIterations)
+{
+	CMatrix m;
+	float fSum = 0;
+	for(int n=0; n<nIterations; n++)
+		for(int i=0; i<64; i++)
+		{
+			m = g_mat[i] * g_mat[(i+1) & 63];
+			fSum += m.f11;
+		}
+	g_fSink = fSum;
+}
+
+static void BenchQuaternionMultiply(void *pParam, int nIterations)
+{
+	CQuaternion q;
+	float fSum = 0;
+	for(int n=0; n<nIterations; n++)
+		for(int i=0; i<64; i++)
+		{
+			q = g_quat[i] * g_quat[(i+1) & 63];
+			fSum += q.w;
+		}
+	g_fSink = fSum;
+}
+
+static void RunMatrixBenchmarks(CBenchmark &bench)
+{
+	for(int i=0; i<64; i++)
+	{
+		g_quat[i] = CQuaternion(CVector(g_fInput[i*3], g_fInput[i*3+1], g_fInput[i*3+2]) - CVector(0.5f), g_fInput[i*3+3] * 2*PI);
+		g_quat[i].Normalize();
+		g_mat[i].ModelMatrix(g_quat[i], CVector(g_fInput[i], g_fInput[i+1], g_fInput[i+2]));
+	}
+	bench.Run("CMatrix::operator*", "4x4", BenchMatrixMultiply, NULL, 64);
+	bench.Run("CQuaternion::operator*", "", BenchQuaternionMultiply, NULL, 64);
+}
+
+
+/*******************************************************************************
+* Audio mixing
+********************************************************************************
+* Renders blocks of a second of looping stereo noise through CMixer into a
+* CNullSink, with every voice but the first detuned so they take the
+* resampling path, and reports the time per output frame. With -accuracy, the
+* same mix is rendered at every SIMD level the CPU supports, and each one has
+* to come within 1 LSB of the scalar kernel's 16-bit output.
+*******************************************************************************/
+#define MIXER_BENCH_RATE		48000
+
+struct SMixerBench
+{
+	CMixer mixer;
+	CNullSink sink;
+	int nSample;
+};
+
+// Keeps every frame it's given, for comparing two mixes
+class CCaptureSink : public CAudioSink
+{
+public:
+	short nFrames[MIXER_BENCH_RATE * 2];
+	int nCount;
+
+	CCaptureSink()				{ nCount = 0; }
+	virtual int GetSpace()		{ return MIXER_BENCH_RATE - nCount; }
+	virtual void Write(const short *pFrames, int n)
+	{
+		memcpy(nFrames + nCount * 2, pFrames, n * 4);
+		nCount += n;
+	}
+};
+
+static void InitMixerBench(SMixerBench &b)
+{
+	static float fNoise[MIXER_BENCH_RATE * 2];
+	for(int i=0; i<MIXER_BENCH_RATE*2; i++)
+		fNoise[i] = g_fInput[i & (INPUT_COUNT*4-1)] * 2.0f - 1.0f;
+	b.mixer.Init(MIXER_BENCH_RATE);
+	b.nSample = b.mixer.AddSample(fNoise, MIXER_BENCH_RATE, 2, MIXER_BENCH_RATE, true);
+}
+
+static void PlayMixerVoices(SMixerBench &b, int nVoices, int nInterpolation)
+{
+	b.mixer.StopAll();
+	b.mixer.SetInterpolation(nInterpolation);
+	for(int v=0; v<nVoices; v++)
+		b.mixer.Play(b.nSample, 1.0f / nVoices, v * 2.0f / nVoices - 1.0f, v == 0 ? 1.0f : 0.5f + g_fInput[v]);
+}
+
+static void BenchMixer(void *pParam, int nIterations)
+{
+	SMixerBench *p = (SMixerBench *)pParam;
+	for(int n=0; n<nIterations; n++)
+		p->mixer.Render(&p->sink, MIXER_BLOCK_SIZE);
+}
+
+static void RunMixerBenchmarks(CBenchmark &bench)
+{
+	static SMixerBench b;
+	static const int nVoiceSweep[] = {1, 16, 256};
+	static const char *pszInterpolation[] = {"linear", "cubic"};
+	char szParams[64];
+	InitMixerBench(b);
+	for(int i=0; i<2; i++)
+	{
+		for(int j=0; j<sizeof(nVoiceSweep)/sizeof(int); j++)
+		{
+			PlayMixerVoices(b, nVoiceSweep[j], i);
+			sprintf(szParams, "voices=%d,%s,simd=%s", nVoiceSweep[j], pszInterpolation[i], CKernels::GetLevelName(CKernels::Get().nLevel));
+			bench.Run("CMixer::Render", szParams, BenchMixer, &b, MIXER_BLOCK_SIZE);
+		}
+	}
+}
+
+static bool CheckMixerAccuracy()
+{
+	static SMixerBench b;
+	static CCaptureSink scalar, vector;
+	static const char *pszInterpolation[] = {"linear", "cubic"};
+	ESIMDLevel nBest = CKernels::Get().nLevel;
+	bool bPassed = true;
+	InitMixerBench(b);
+
+	printf("\n%-8s %-8s %10s %10s\n", "Mixer", "SIMD", "Max error", "Peak");
+	for(int i=0; i<2; i++)
+	{
+		CKernels::Init(SIMD_SCALAR);
+		PlayMixerVoices(b, 16, i);
+		scalar.nCount = 0;
+		b.mixer.Render(&scalar, MIXER_BENCH_RATE);
+		for(int nLevel=SIMD_SSE2; nLevel<SIMD_LEVELS; nLevel++)
+		{
+			if(!CKernels::IsSupported((ESIMDLevel)nLevel))
+				continue;
+			CKernels::Init((ESIMDLevel)nLevel);
+			PlayMixerVoices(b, 16, i);
+			vector.nCount = 0;
+			b.mixer.Render(&vector, MIXER_BENCH_RATE);
+			int nError = 0, nPeak = 0;
+			for(int n=0; n<MIXER_BENCH_RATE*2; n++)
+			{
+				nError = Max(nError, abs(vector.nFrames[n] - scalar.nFrames[n]));
+				nPeak = Max(nPeak, abs((int)scalar.nFrames[n]));
+			}
+			printf("%-8s %-8s %10d %10d %s\n", pszInterpolation[i], CKernels::GetLevelName((ESIMDLevel)nLevel), nError, nPeak, nError > 1 ? "FAILED" : "ok");
+			bPassed = bPassed && nError <= 1;
+		}
+	}
+	CKernels::Init(nBest);
+	return bPassed;
+}
+
+
+/*******************************************************************************
+* Spectrum analysis
+********************************************************************************
+* Feeds CSpectrumAnalyzer 16-bit stereo noise at 48 kHz, one hop at a time,
+* and reports the time per hop (each one is a window analyzed, which has to
+* take well under SPECTRUM_HOP_MS to keep up). With -accuracy, a second of a
+* full-scale sine at a frequency in each band has to make that band the
+* loudest. From SPECTRUM_BENCH_WIDE_BAND up, the band itself has to come out
+* within 0.1 dB of -3 dB. The bands below it are only a bin or two wide, so
+* the window spreads a bass sine into the next band (the leakage is reported,
+* not checked), and only the whole window's level is held to the 0.1 dB,
+* except in the lowest band, where part of the sine is lost to DC as well.
+*******************************************************************************/
+#define SPECTRUM_BENCH_WIDE_BAND	2		// The first band wide enough to hold all of a sine
+
+struct SSpectrumBench
+{
+	CSpectrumAnalyzer analyzer;
+	short nFrames[MIXER_BENCH_RATE * 2];
+	int nNext;
+};
+
+static void BenchSpectrum(void *pParam, int nIterations)
+{
+	SSpectrumBench *p = (SSpectrumBench *)pParam;
+	int nHop = p->analyzer.GetHopSize();
+	for(int n=0; n<nIterations; n++)
+	{
+		if(p->nNext + nHop > MIXER_BENCH_RATE)
+			p->nNext = 0;
+		p->analyzer.Write(p->nFrames + p->nNext * 2, nHop);
+		p->nNext += nHop;
+	}
+}
+
+static void RunSpectrumBenchmarks(CBenchmark &bench)
+{
+	static SSpectrumBench b;
+	char szParams[64];
+	b.analyzer.Init(MIXER_BENCH_RATE);
+	for(int i=0; i<MIXER_BENCH_RATE*2; i++)
+		b.nFrames[i] = (short)(g_fInput[i & (INPUT_COUNT*4-1)] * 65535.0f - 32768.0f);
+	b.nNext = 0;
+	sprintf(szParams, "fft=%d,hop=%d", SPECTRUM_FFT_SIZE, b.analyzer.GetHopSize());
+	bench.Run("CSpectrumAnalyzer::Write", szParams, BenchSpectrum, &b, 1);
+}
+
+static bool CheckSpectrumAccuracy()
+{
+	static SSpectrumBench b;
+	static const float fFrequency[SPECTRUM_BANDS] = {47, 100, 300, 700, 1800, 4000, 9000, 16000};
+	bool bPassed = true;
+
+	printf("\n%-8s %8s %8s %8s\n", "Spectrum", "Level", "Band", "Leakage");
+	for(int i=0; i<SPECTRUM_BANDS; i++)
+	{
+		for(int n=0; n<MIXER_BENCH_RATE; n++)
+			b.nFrames[n*2] = b.nFrames[n*2+1] = (short)floor(32767.0 * sin(6.283185307179586 * fFrequency[i] * n / MIXER_BENCH_RATE) + 0.5);
+		b.analyzer.Init(MIXER_BENCH_RATE);
+		b.analyzer.Write(b.nFrames, MIXER_BENCH_RATE);
+		b.analyzer.Update();
+		const SSpectrumSnapshot &s = b.analyzer.GetSnapshot();
+		float fLeakage = s.fLevel - s.fBand[i];
+		bool bOK = i == 0 || fabsf(s.fLevel + 3.01f) < 0.1f;
+		if(i >= SPECTRUM_BENCH_WIDE_BAND)
+			bOK = bOK && fabsf(s.fBand[i] + 3.01f) < 0.1f;
+		for(int j=0; j<SPECTRUM_BANDS; j++)
+			bOK = bOK && s.fBand[j] <= s.fBand[i];
+		printf("%5.0f Hz %8.2f %8.2f %8.3f %s\n", fFrequency[i], s.fLevel, s.fBand[i], fLeakage, bOK ? "ok" : "FAILED");
+		bPassed = bPassed && bOK;
+	}
+	return bPassed;
+}
+
+
+int main(int argc, char *argv[])
+{
+	const char *pszFilter = NULL;
+	const char *pszJSON = NULL;
+	float fMinTime = 0.2f;
+	bool bAccuracy = false;
+	const char *pszLevel = NULL;
+	for(int i=1; i<argc; i++)
+	{
+		if(strncmp(argv[i], "-filter=", 8) == 0)
+			pszFilter = argv[i] + 8;
+		else if(strncmp(argv[i], "-json=", 6) == 0)
+			pszJSON = argv[i] + 6;
+		else if(strncmp(argv[i], "-time=", 6) == 0)
+			fMinTime = (float)atof(argv[i] + 6) * 0.001f;
+		else if(strncmp(argv[i], "-simd=", 6) == 0)
+			pszLevel = argv[i] + 6;
+		else if(strcmp(argv[i], "-accuracy") == 0)
+			bAccuracy = true;
+		else
+		{
+			printf("Usage: %s [-filter=<text>] [-json=<file>] [-time=<ms>] [-simd=<level>] [-accuracy]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if(!CKernels::Init(pszLevel))
+	{
+		printf("This CPU can't run -simd=%s\n", pszLevel);
+		return 1;
+	}
+	printf("SIMD: %s (%d wide)\n", CKernels::GetLevelName(CKernels::Get().nLevel), CKernels::Get().nWidth);
+
+	// Use the same fixed inputs every run
+	CRandom random(42);
+	for(int i=0; i<INPUT_COUNT*4; i++)
+		g_fInput[i] = (float)random.RandomD(0.0, 0.999999);
+	if(bAccuracy)
+	{
+		bool bPassed = CheckMathAccuracy();
+		bPassed = CheckTableAccuracy() && bPassed;
+		bPassed = CheckMixerAccuracy() && bPassed;
+		bPassed = CheckSpectrumAccuracy() && bPassed;
+		return bPassed ? 0 : 1;
+	}
+
+	CBenchmark bench(pszFilter, fMinTime);
+	CGameEngine engine(NULL, true);
+	RunScatteringBenchmarks(bench, &engine);
+	RunBufferBenchmarks(bench);
+	RunMathBenchmarks(bench);
+	RunNoiseBenchmarks(bench);
+	RunMatrixBenchmarks(bench);
+	RunMixerBenchmarks(bench);
+	RunSpectrumBenchmarks(bench);
+
+	if(pszJSON && !bench.WriteJSON(pszJSON))
+	{
+		printf("Unable to write %s\n", pszJSON);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,179 @@
+// AudioEngine.h
+//
+
+#ifndef __AudioEngine_h__
+#define __AudioEngine_h__
+
+#include "RingQueue.h"
+#include "SpectrumAnalyzer.h"
+
+#define AUDIO_MAX_SAMPLES		16
+#define AUDIO_MAX_VOICES		16		// OpenAL sources created by Init()
+#define AUDIO_QUEUE_SIZE		64		// Commands that can be waiting for the audio thread (a power of two)
+#define AUDIO_UPDATE_INTERVAL	20		// Milliseconds between checks for voices that finished playing (and streams to refill)
+#define AUDIO_MAX_STREAMS		4
+#define AUDIO_STREAM_BUFFERS	4		// OpenAL buffers queued on a streaming voice
+#define AUDIO_STREAM_BUFFER_SIZE	32768	// Bytes in each one (about 0.19 seconds of 44.1 kHz 16-bit stereo)
+#define AUDIO_ANALYSIS_INTERVAL	SPECTRUM_HOP_MS	// Milliseconds between updates while a stream is being analyzed
+
+class CWaves;
+
+enum EAudioCommand
+{
+	AUDIO_PLAY,
+	AUDIO_PLAY_STREAM,
+	AUDIO_STOP,
+	AUDIO_STOP_ALL
+};
+
+struct SAudioCommand
+{
+	int nCommand;				// EAudioCommand
+	unsigned int nVoiceID;		// From Play() or PlayStream()
+	int nSample;				// From LoadSample() (or OpenStream() for AUDIO_PLAY_STREAM)
+	int nPriority;
+	bool bLoop;
+	float fGain;
+};
+
+// A wave file loaded into an OpenAL buffer
+struct SAudioSample
+{
+	char szFile[_MAX_PATH];
+	unsigned int nBuffer;
+};
+
+// A wave file that is read a piece at a time while it plays
+struct SAudioStream
+{
+	char szFile[_MAX_PATH];
+	int nWaveID;				// The file in CAudioEngine's CWaves (it stays open)
+	unsigned long nFormat, nFrequency;
+	unsigned long nBlockAlign;	// Bytes per sample frame (every read is a multiple of this)
+	unsigned long nDataSize;
+	int nChannels, nBitsPerSample;
+	unsigned int nBuffer[AUDIO_STREAM_BUFFERS];
+	unsigned char *pData;		// What was read into each buffer, AUDIO_STREAM_BUFFER_SIZE bytes apiece (kept for the analyzer)
+	unsigned long nFilled[AUDIO_STREAM_BUFFERS];	// Bytes of it in each
+	int nHead;					// The buffer at the front of the voice's queue (they are always queued in order)
+	int nQueued;
+	unsigned long nAnalyzed;	// Bytes from the front of the queue that the analyzer has been given
+	int nVoice;					// The voice playing it, or -1
+	bool bLoop;
+	bool bEnd;					// Everything has been read and queued (never set if it loops)
+};
+
+// One OpenAL source and what it is playing
+struct SAudioVoice
+{
+	unsigned int nSource;
+	unsigned int nID;			// The ID Play() returned for what it is playing, or 0 if it is free
+	int nPriority;
+	unsigned int nStarted;		// When it was started, in Play commands executed (for stealing the oldest one)
+	int nStream;				// The stream it's playing, or -1 if it's playing a sample
+};
+
+/*******************************************************************************
+* Class: CAudioEngine
+********************************************************************************
+* Plays preloaded samples on a fixed pool of OpenAL sources, from one thread
+* that makes every OpenAL call once it is started. LoadSample() decodes each
+* wave file once into a buffer (asking for the same file again returns the
+* same sample), and has to be called before Start(). After that, Play(),
+* StopVoice(), and StopAll() just push a command onto a TRingQueue and wake
+* the audio thread, so they never block, allocate, or touch the disk. They
+* are meant to be called from one thread at a time (the render thread).
+*
+* Long sounds can be opened as streams instead, which only keep a few small
+* buffers queued on their source. The audio thread refills each buffer as
+* the source finishes with it, and a looping stream goes straight from the
+* end of the file back to the start inside the same buffer, so the loop is
+* seamless down to the sample. A stream plays on one voice at a time, so
+* playing it again restarts it.
+*
+* One stream can also be analyzed as it plays. What was read into each of
+* its buffers is kept until the source has played it, and the audio thread
+* gives a CSpectrumAnalyzer everything before the source's play position,
+* waking up every AUDIO_ANALYSIS_INTERVAL instead of AUDIO_UPDATE_INTERVAL
+* so that happens once a hop (Start() asks for a 1 ms timer resolution while
+* it runs, since the default tick of about 15.6 ms is three hops long). The
+* analyzer hears the sound when the speakers do rather than when it's read
+* (which is a few buffers earlier), and the render thread takes the results
+* with UpdateSpectrum() and GetSpectrum().
+*
+* When every source is busy, Play() steals the one with the lowest priority
+* (the oldest of those), as long as it isn't higher than the new sound's, and
+* otherwise drops the new sound. Looping background sounds should be given a
+* higher priority than one-shot effects so the effects can't cut them off.
+*******************************************************************************/
+class CAudioEngine
+{
+protected:
+	bool m_bInit;
+	SAudioSample m_sample[AUDIO_MAX_SAMPLES];
+	int m_nSamples;
+	SAudioVoice m_voice[AUDIO_MAX_VOICES];
+	int m_nVoices;
+	unsigned int m_nPlays;
+	char m_szError[_MAX_PATH + 64];
+	CWaves *m_pWaves;			// The streams' files (only the audio thread reads them once it's started)
+	SAudioStream m_stream[AUDIO_MAX_STREAMS];
+	int m_nStreams;
+	int m_nAnalysisStream;		// The stream m_analyzer listens to, or -1
+	CSpectrumAnalyzer m_analyzer;
+
+	TRingQueue<SAudioCommand, AUDIO_QUEUE_SIZE> m_queue;
+	HANDLE m_hThread;
+	HANDLE m_hWake;				// Set when a command is pushed
+	volatile bool m_bQuit;
+	volatile LONG m_nNextID;
+	volatile LONG m_nDropped;	// Commands lost because the queue was full
+
+	static unsigned __stdcall ThreadProc(void *pParam);
+	void Post(SAudioCommand &cmd);
+	void Execute(const SAudioCommand &cmd);
+	void UpdateVoices();
+	int FindVoice(int nPriority);
+	void FreeVoice(SAudioVoice &voice);
+	bool FillBuffer(SAudioStream &stream, int nSlot);
+	bool QueueBuffer(SAudioStream &stream, const SAudioVoice &voice, int nSlot);
+	void StartStream(int nStream, int nVoice);
+	void UpdateStream(SAudioVoice &voice);
+	void AnalyzeStream(SAudioStream &stream, const SAudioVoice &voice, int nProcessed);
+
+public:
+	CAudioEngine();
+	~CAudioEngine()				{ Cleanup(); }
+
+	// Opens the default device and creates the sources, returns false if there's no sound
+	bool Init();
+	// Stops the thread and closes the device
+	void Cleanup();
+	bool IsInitialized()		{ return m_bInit; }
+	const char *GetError()		{ return m_szError; }
+
+	// Loads a wave file (or finds it if it was already loaded), returns -1 if it couldn't be loaded
+	int LoadSample(const char *pszFile);
+
+	// Opens a wave file for streaming, returns -1 if it couldn't be opened
+	int OpenStream(const char *pszFile);
+	// Has the analyzer listen to a stream (8- or 16-bit PCM) as it's heard, returns false if it can't
+	bool SetAnalysisStream(int nStream);
+
+	// Starts the audio thread (nothing can be loaded or opened after this)
+	void Start();
+	void Stop();
+
+	// Returns an ID for StopVoice(), or 0 if the sound can't be played
+	unsigned int Play(int nSample, bool bLoop=false, int nPriority=0, float fGain=1.0f);
+	unsigned int PlayStream(int nStream, bool bLoop=false, int nPriority=0, float fGain=1.0f);
+	void StopVoice(unsigned int nVoiceID);
+	void StopAll();
+	int GetDroppedCount()		{ return m_nDropped; }
+
+	// Takes the analyzer's newest snapshot, and returns false if there wasn't a new one (it never blocks)
+	bool UpdateSpectrum()		{ return m_analyzer.Update(); }
+	const SSpectrumSnapshot &GetSpectrum()	{ return m_analyzer.GetSnapshot(); }
+};
+
+#endif // __AudioEngine_h__
@@ -7,6 +7,7 @@
 #define BUFFER_OFFSET(i) ((char *) NULL + (i))
 
 #include "Texture.h"
+#include "../openGL/glext.h"
 
 
 class CGLUtil
@@ -18,11 +19,19 @@ protected:
 	HGLRC m_hGLRC;
 
 	// Members for GL_ARB_vertex_buffer_object
-	unsigned int m_nVertexBuffer;
+	bool m_bVertexBufferObjects;
 
 public:
 	static CGLUtil *m_pMain;
 
+	// GL_ARB_vertex_buffer_object entry points (only valid if HasVertexBufferObjects() returns true)
+	PFNGLGENBUFFERSARBPROC glGenBuffersARB;
+	PFNGLDELETEBUFFERSARBPROC glDeleteBuffersARB;
+	PFNGLBINDBUFFERARBPROC glBindBufferARB;
+	PFNGLBUFFERDATAARBPROC glBufferDataARB;
+	PFNGLMAPBUFFERARBPROC glMapBufferARB;
+	PFNGLUNMAPBUFFERARBPROC glUnmapBufferARB;
+
 // Operations
 public:
 	CGLUtil();
@@ -33,6 +42,7 @@ public:
 
 	HDC GetHDC()					{ return m_hDC; }
 	HGLRC GetHGLRC()				{ return m_hGLRC; }
+	bool HasVertexBufferObjects()	{ return m_bVertexBufferObjects; }
 
 
 	void BeginOrtho2D(int nWidth=640, int nHeight=480)
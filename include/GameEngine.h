@@ -36,138 +36,33 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "Texture.h"
 #include "Font.h"
 #include "Viewer.h"
+#include "Scattering.h"
+#include "ScatteringTable.h"
+#include "Kernels.h"
+#include "ThreadPool.h"
+#include "LUTCache.h"
+#include "TaskGraph.h"
+#include "SkeletonTracker.h"
+#include "AudioEngine.h"
+#include "Sphere.h"
 
 
 #define SAMPLE_SIZE		5
-
-struct SVertex
-{
-	CVector vPos;
-	CColor cColor;
-};
-
-class CSphere
-{
-protected:
-	float m_fRadius;
-	int m_nSlices;
-	int m_nSections;
-
-	SVertex *m_pVertex;
-	unsigned short m_nVertices;
-
-public:
-	CSphere()	{}
-
-	int GetVertexCount()		{ return m_nVertices; }
-	SVertex *GetVertexBuffer()	{ return m_pVertex; }
-	int i;
-
-	void Init(float fRadius, int nSlices, int nSections)
-	{
-		
-		m_fRadius = fRadius;
-		m_nSlices = nSlices;
-		m_nSections = nSections;
-
-		m_nVertices = nSlices * (nSections-1) + 2;
-		m_pVertex = new SVertex[m_nVertices];
-
-		float fSliceArc = 2*PI / nSlices;
-		float fSectionArc = PI / nSections;
-		float *fRingz = new float[nSections+1];
-		float *fRingSize = new float[nSections+1];
-		float *fRingx = new float[nSlices+1];
-		float *fRingy = new float[nSlices+1];
-		for(int i=0; i<=nSections; i++)
-		{
-			fRingz[i] = cosf(fSectionArc * i);
-			fRingSize[i] = sinf(fSectionArc * i);
-		}
-		for(i=0; i<=nSlices; i++)
-		{
-			fRingx[i] = cosf(fSliceArc * i);
-			fRingy[i] = sinf(fSliceArc * i);
-		}
-
-		int nIndex = 0;
-		m_pVertex[nIndex++].vPos = CVector(0, 0, fRadius);
-		for(int j=1; j<nSections; j++)
-		{
-			for(int i=0; i<nSlices; i++)
-			{
-				CVector v;
-				v.x = fRingx[i] * fRingSize[j];
-				v.y = fRingy[i] * fRingSize[j];
-				v.z = fRingz[j];
-				v *= fRadius / v.Magnitude();
-				m_pVertex[nIndex++].vPos = v;
-			}
-		}
-
-		m_pVertex[nIndex++].vPos = CVector(0, 0, -fRadius);
-	}
-
-	void Draw()
-	{
-		int i;
-		glBegin(GL_TRIANGLE_FAN);
-		glColor4ubv(m_pVertex[0].cColor);
-		glVertex3fv(m_pVertex[0].vPos);
-		for(i=0; i<m_nSlices; i++)
-		{
-			glColor4ubv(m_pVertex[i+1].cColor);
-			glVertex3fv(m_pVertex[i+1].vPos);
-		}
-		glColor4ubv(m_pVertex[1].cColor);
-		glVertex3fv(m_pVertex[1].vPos);
-		glEnd();
-
-		int nIndex1 = 1;
-		int nIndex2 = 1 + m_nSlices;
-		for(int j=1; j<m_nSections-1; j++)
-		{
-			glBegin(GL_TRIANGLE_STRIP);
-			for(int i=0; i<m_nSlices; i+=2)
-			{
-				glColor4ubv(m_pVertex[nIndex1+i].cColor);
-				glVertex3fv(m_pVertex[nIndex1+i].vPos);
-				glColor4ubv(m_pVertex[nIndex2+i].cColor);
-				glVertex3fv(m_pVertex[nIndex2+i].vPos);
-				glColor4ubv(m_pVertex[nIndex1+1+i].cColor);
-				glVertex3fv(m_pVertex[nIndex1+1+i].vPos);
-				glColor4ubv(m_pVertex[nIndex2+1+i].cColor);
-				glVertex3fv(m_pVertex[nIndex2+1+i].vPos);
-			}
-			glColor4ubv(m_pVertex[nIndex1].cColor);
-			glVertex3fv(m_pVertex[nIndex1].vPos);
-			glColor4ubv(m_pVertex[nIndex2].cColor);
-			glVertex3fv(m_pVertex[nIndex2].vPos);
-			glEnd();
-			nIndex1 += m_nSlices;
-			nIndex2 += m_nSlices;
-		}
-
-
-		glBegin(GL_TRIANGLE_FAN);
-		glColor4ubv(m_pVertex[m_nVertices-1].cColor);
-		glVertex3fv(m_pVertex[m_nVertices-1].vPos);
-		for(i=0; i<m_nSlices; i++)
-		{
-			glColor4ubv(m_pVertex[m_nVertices-2-i].cColor);
-			glVertex3fv(m_pVertex[m_nVertices-2-i].vPos);
-		}
-		glColor4ubv(m_pVertex[m_nVertices-2].cColor);
-		glVertex3fv(m_pVertex[m_nVertices-2].vPos);
-		glEnd();
-	}
-};
-
+#define SOUND_PRIORITY_LOOP	1		// Higher than the default priority of 0 that one-shot sounds get
+#define SUN_BASS_FLOOR		-45.0f	// The bass level (in dB) below which the music doesn't brighten the sun
+#define SUN_BASS_CEILING	-10.0f	// And the level where it brightens it the most
+#define SUN_BASS_BOOST		0.3f	// How much brighter the loudest bass makes the sun
+#define SUN_ONSET_BOOST		0.4f	// How much brighter it flashes on an onset
+#define SUN_ONSET_TIME		0.25f	// Seconds the flash takes to fade
 
 class CGameEngine
 {
 protected:
+	bool m_bHeadless;			// No window, GL context, sound or sensor (see CHeadlessRenderer)
 	float m_fFPS;
+	float m_fSensorFPS;			// How many new skeletons m_skeleton published per second
+	int m_nSensorFrames;		// Skeletons taken since m_fSensorFPS was last updated
+	CSkeletonTracker m_skeleton;	// Reads the sensor on its own thread
 	int m_nTime;
 	CFont m_fFont;
 
@@ -183,6 +78,11 @@ protected:
 	float m_Km, m_Km4PI;
 	float m_ESun;
 	float m_g;
+	bool m_bAudioReactive;		// Let the music brighten the sun
+	float m_fESunScale;			// What the music does to the sun right now, applied when the spheres are drawn (exactly 1 when it does nothing)
+	float m_fAudioBass;			// The bass level, from 0 (SUN_BASS_FLOOR) to 1 (SUN_BASS_CEILING)
+	float m_fAudioFlash;		// What's left of the last onset's flash, from 1 down to 0
+	unsigned int m_nAudioOnsets;	// The onset count in the last spectrum snapshot taken
 
 	float m_fInnerRadius;
 	float m_fOuterRadius;
@@ -191,21 +91,55 @@ protected:
 	float m_fWavelength4[3];
 	float m_fRayleighScaleDepth;
 	float m_fMieScaleDepth;
+	int m_nOpticalDepthSize;		// Width and height of the optical depth table
+	int m_nOpticalDepthSamples;		// Samples per texel used to build it
+	int m_nOpticalDepthType;		// FloatType, HalfFloatType, or UnsignedShortType (the CPU lookups read the table in this format)
 	CPixelBuffer m_pbOpticalDepth;
+	int m_nOpticalDepthVersion;		// Bumped every time the table is rebuilt
+	bool m_bPhaseTable;				// Look the phase functions up in m_pbPhase instead of evaluating them
+	CPixelBuffer m_pbPhase;
+	float m_fPhaseConstants[4];		// The ESun, Kr, Km, and g m_pbPhase was built with
+	float m_fColorTolerance;		// How far a vertex's view ray may move (in radians, roughly) before it is recolored
+	bool m_bScatteringTable;		// Look the vertex colors up in m_scatteringTable instead of integrating them
+	CScatteringTable m_scatteringTable;
 
 	CSphere m_sphereInner;
 	CSphere m_sphereOuter;
+	bool m_bLOD;					// Draw m_lodInner and m_lodOuter instead of the uniform spheres
+	bool m_bCulling;				// Skip the vertices outside the view frustum or behind the planet
+	float m_fFOV, m_fAspect;		// The projection the spheres are drawn with (the frustum is built from these and m_3DCamera)
+	float m_fNear, m_fFar;
+	CLODSphere m_lodInner;
+	CLODSphere m_lodOuter;
+	CThreadPool m_threadPool;
+	CLUTCache m_lutCache;			// The tables saved by earlier runs (in the LUTCache directory)
+	CAudioEngine m_audio;
+	int m_nLoopStream[2];			// The background loops, streamed and played with SOUND_PRIORITY_LOOP so gestures can't steal them
+	int m_nChordSample;				// Played when the head moves far enough to fly
 	SampleViewer * sampleViewer;
 
 	bool initial, headFront, headBack, headLeft, headRight, handLeft, handRight, goingIn, startFly;
 	int skip, jointIdx;
 
-	nite::SkeletonJoint jointHistoryH[1000], jointHistoryRH[1000];
+	SSkeletonJoint jointHistoryH[1000], jointHistoryRH[1000];
 	float initialH_x, initialRH_x;
 	float initialH_z, initialRH_z;
 
+	// The startup stages the constructor runs as a CTaskGraph (pParam is the engine)
+	static void StartupGL(void *pParam);
+	static void StartupTextures(void *pParam);
+	static void StartupSensor(void *pParam);
+	static void StartupAudio(void *pParam);
+	static void StartupSamples(void *pParam);
+	static void StartupSounds(void *pParam);
+	static void StartupInnerSphere(void *pParam);
+	static void StartupOuterSphere(void *pParam);
+	static void StartupInnerLOD(void *pParam);
+	static void StartupOuterLOD(void *pParam);
+	static void StartupSphereBuffers(void *pParam);
+
 public:
-	CGameEngine(SampleViewer * s);
+	CGameEngine(SampleViewer * s, bool bHeadless=false);
 	~CGameEngine();
 	void RenderFrame(int nMilliseconds);
 	void Pause()	{}
@@ -213,8 +147,40 @@ public:
 	void HandleInput(float fSeconds);
 	void OnChar(WPARAM c);
 
+	SScatterParams GetScatterParams();
 	void SetColor(SVertex *pVertex);
-	//void PlayWav(void * param);
+	void SetColors(SVertex *pVertex, const int *pIndex, int nCount);
+	void UpdateColors(CSphere &sphere);
+	// Loads or builds the optical depth table (only startup saves it, so switching settings at run time doesn't fill the cache)
+	void UpdateOpticalDepth(bool bSave=false);
+	void UpdatePhaseTable();
+	void UpdateLOD();
+	// Moves the camera with the head and hand gestures in a new skeleton from the sensor thread
+	void UpdateGestures(const SSkeletonSnapshot &skeleton);
+	// Takes the newest spectrum from the audio thread and works out m_fESunScale
+	void UpdateAudio(float fSeconds);
+	float GetESunScale()			{ return m_fESunScale; }
+
+	int GetSamples()				{ return m_nSamples; }
+	void SetSamples(int n)			{ m_nSamples = Max(1, n); }
+	bool IsUsingPhaseTable()		{ return m_bPhaseTable; }
+	void UsePhaseTable(bool b)		{ m_bPhaseTable = b; }
+	bool IsUsingScatteringTable()	{ return m_bScatteringTable; }
+	void UseScatteringTable(bool b)	{ m_bScatteringTable = b; }
+	CScatteringTable *GetScatteringTable()	{ return &m_scatteringTable; }
+	float GetColorTolerance()		{ return m_fColorTolerance; }
+	void SetColorTolerance(float f)	{ m_fColorTolerance = Max(0.0f, f); }
+	void SetOpticalDepthQuality(int nSize, int nSamples)	{ m_nOpticalDepthSize = Max(2, nSize); m_nOpticalDepthSamples = Max(1, nSamples); UpdateOpticalDepth(); }
+	int GetOpticalDepthType()		{ return m_nOpticalDepthType; }
+	void SetOpticalDepthType(int n)	{ m_nOpticalDepthType = n; UpdateOpticalDepth(); }
+	C3DObject *GetCamera()			{ return &m_3DCamera; }
+	void SetPerspective(float fFOV, float fAspect, float fNear, float fFar)	{ m_fFOV = fFOV; m_fAspect = fAspect; m_fNear = fNear; m_fFar = fFar; }
+	bool IsCulling()				{ return m_bCulling; }
+	void UseCulling(bool b)			{ m_bCulling = b; }
+	bool IsUsingLOD()				{ return m_bLOD; }
+	void UseLOD(bool b)				{ m_bLOD = b; }
+	CSphere *GetInnerSphere()		{ return m_bLOD ? (CSphere *)&m_lodInner : &m_sphereInner; }
+	CSphere *GetOuterSphere()		{ return m_bLOD ? (CSphere *)&m_lodOuter : &m_sphereOuter; }
 };
 
 #endif // __GameEngine_h__
@@ -0,0 +1,74 @@
+// Headless.h
+//
+
+#ifndef __Headless_h__
+#define __Headless_h__
+
+#include "GameEngine.h"
+
+// A vertex after it has been transformed, lit, and projected to window coordinates
+struct SScreenVertex
+{
+	float x, y;				// Window coordinates (origin at the bottom-left, like OpenGL)
+	float fInvW;			// 1/w, interpolated linearly in screen space for depth and perspective correction
+	float r, g, b;			// Color divided by w
+};
+
+/*******************************************************************************
+* Class: CHeadlessRenderer
+********************************************************************************
+* Drives a headless CGameEngine without a window or an OpenGL context. It moves
+* the engine's camera, runs the same vertex coloring the windowed version uses,
+* and draws the two spheres with a small software rasterizer into a CPixelBuffer.
+* The rasterizer follows the same rules as the GL path: a 45 degree perspective
+* projection with the near plane from CGameApp::OnSize(), Gouraud shading, a
+* depth test, and back-face culling with the outer sphere's winding flipped.
+* Everything after the vertex coloring is single-threaded and uses no timing
+* information, so the same build always produces the same images, and a run can
+* check its frames against a reference set saved by an earlier one. Like the
+* rest of the engine it's built for Windows, and it runs when the program is
+* started with -headless (see RunHeadless()).
+*******************************************************************************/
+class CHeadlessRenderer
+{
+protected:
+	CGameEngine *m_pEngine;
+	int m_nWidth, m_nHeight;
+	float m_fFOV;
+	float m_fNear;
+	CPixelBuffer m_pbColor;		// RGB bytes, bottom row first
+	C3DBuffer m_pbDepth;		// 1/w for each pixel, 0 meaning nothing has been drawn
+
+	CMatrix m_mView;			// Rotation part of the camera's view matrix
+	CVector m_vCamera;
+
+	void DrawSphere(CSphere *pSphere, bool bFrontCW);
+	void DrawPolygon(SScreenVertex *pVertex, int nVertices, bool bFrontCW);
+	void DrawTriangle(const SScreenVertex &v0, const SScreenVertex &v1, const SScreenVertex &v2, bool bFrontCW);
+
+public:
+	CHeadlessRenderer(CGameEngine *pEngine, int nWidth=640, int nHeight=480);
+
+	// Places the engine's camera at vFrom, looking at vAt
+	void SetCamera(const CVector &vFrom, const CVector &vAt, const CVector &vUp=CVector(0, 1, 0));
+
+	// Updates the vertex colors and rasterizes the spheres, returning the time spent in each step (in milliseconds)
+	void RenderFrame(float *pfColorTime=NULL, float *pfDrawTime=NULL);
+
+	CPixelBuffer *GetImage()	{ return &m_pbColor; }
+	bool WritePPM(const char *pszFile);
+	bool WritePNG(const char *pszFile);
+	// Returns the largest difference in any channel between the image and a file written by WritePPM() or WritePNG(),
+	// or -1 if the file can't be read or is a different size
+	int CompareImage(const char *pszFile);
+
+	// Renders nFrames along a fixed camera path into pszPath, writing per-frame timing to pszPath/timing.txt. With
+	// pszReference, each frame is also compared to the one with the same name there, and any that differ by more
+	// than nTolerance are listed in timing.txt and make it return false.
+	bool RunCameraPath(const char *pszPath, int nFrames, bool bPNG=true, const char *pszReference=NULL, int nTolerance=0);
+};
+
+// Parses the "-headless" command-line options and runs the camera path (returns the process exit code)
+int RunHeadless(const char *pszCmdLine);
+
+#endif // __Headless_h__
@@ -0,0 +1,101 @@
+// Kernels.h
+//
+
+#ifndef __Kernels_h__
+#define __Kernels_h__
+
+#include "Scattering.h"
+#include "PixelKernels.h"
+#include "MixerKernels.h"
+
+class CScatteringTable;
+
+// The instruction sets the kernels can be bound to, from slowest to fastest
+enum ESIMDLevel
+{
+	SIMD_SCALAR,			// CFloat1, for CPUs without SSE2
+	SIMD_SSE2,				// CFloat4
+	SIMD_AVX,				// CFloat8
+	SIMD_AVX2,				// CFloat8, fetching from tables with AVX2's gathers (SGatherAVX2)
+	SIMD_LEVELS
+};
+
+// CPU feature bits from CKernels::GetFeatures()
+#define CPU_SSE2			0x0001
+#define CPU_SSE41			0x0002
+#define CPU_AVX				0x0004		// Only set if the OS saves the YMM registers too
+#define CPU_FMA				0x0008
+#define CPU_AVX2			0x0010
+#define CPU_AVX512F			0x0020		// Only set if the OS saves the ZMM registers too
+#define CPU_F16C			0x0040		// Only set along with CPU_AVX
+
+/*******************************************************************************
+* Struct: SKernels
+********************************************************************************
+* Every kernel that has versions for more than one vector type, bound to the
+* versions for one ESIMDLevel. Callers go through CKernels::Get() instead of
+* instantiating the templates themselves.
+*******************************************************************************/
+struct SKernels
+{
+	ESIMDLevel nLevel;
+	int nWidth;				// How many floats each vector holds
+
+	void (*pfnScatterBatch)(const SScatterParams &p, const C3DBuffer &pbOpticalDepth, SVertex *pVertex, const int *pIndex, int nCount, float *pSums);
+	void (*pfnLookupBatch)(const CScatteringTable &table, const SScatterParams &p, SVertex *pVertex, const int *pIndex, int nCount);
+	void (*pfnMakeOpticalDepthRows)(const SOpticalDepthJob &job, int nStart, int nEnd);
+	void (*pfnMakeCloudRow)(float *pRow, int nWidth, float fDy, float fExpose, float fSizeDisc);
+
+	// Interpolate nCount points in a 4-channel float table (see InterpolateBatch() in PixelKernels.h)
+	void (*pfnInterpolateBatch1D)(const TBuffer<float, 4> &buf, const float *pX, int nCount, float *ppOut[4]);
+	void (*pfnInterpolateBatch2D)(const TBuffer<float, 4> &buf, const float *pX, const float *pY, int nCount, float *ppOut[4]);
+	void (*pfnInterpolateBatch3D)(const TBuffer<float, 4> &buf, const float *pX, const float *pY, const float *pZ, int nCount, float *ppOut[4]);
+
+	// Resample one voice into CMixer's block (see MixVoice() in MixerKernels.h)
+	void (*pfnMixVoice)(const SMixJob &job);
+};
+
+/*******************************************************************************
+* Class: CKernels
+********************************************************************************
+* Detects the CPU's features once with cpuid and binds the kernel table to the
+* fastest level the CPU and OS support. WinMain() calls Init() with whatever
+* followed "-simd=" on the command line (scalar, sse2, avx, or avx2), so one
+* build can be forced down to a lower level for testing. Code that runs before
+* that (or programs that never call Init(), like the benchmark) gets the best
+* level the first time it calls Get().
+*
+* The project is built for plain SSE2, so the only code that ever runs AVX
+* instructions is the CFloat8 kernels bound here. The AVX2 level only differs
+* from the AVX level in its table fetches (which also use F16C for half
+* tables), and only if the compiler has the AVX2 intrinsics (see SIMD.h).
+* AVX-512 is reported by GetFeatures() but has no level, since Visual C++ 2010
+* can't compile it.
+*******************************************************************************/
+class CKernels
+{
+protected:
+	static SKernels m_kernels;
+	static unsigned int m_nFeatures;
+	static bool m_bDetected;
+
+public:
+	static unsigned int GetFeatures();
+	static ESIMDLevel GetBestLevel();
+	static bool IsSupported(ESIMDLevel nLevel);
+	static const char *GetLevelName(ESIMDLevel nLevel);
+
+	// Binds the kernels for nLevel, or the best level if the CPU doesn't support it
+	static void Init(ESIMDLevel nLevel);
+	// Binds the kernels for a level named on the command line (NULL picks the best level), returns false if it can't be used
+	static bool Init(const char *pszLevel);
+
+	static const SKernels &Get()
+	{
+		if(!m_kernels.pfnScatterBatch)
+			Init(GetBestLevel());
+		return m_kernels;
+	}
+};
+
+#endif // __Kernels_h__
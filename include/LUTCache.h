@@ -0,0 +1,127 @@
+// LUTCache.h
+//
+
+#ifndef __LUTCache_h__
+#define __LUTCache_h__
+
+#include "PixelBuffer.h"
+
+#define LUT_CACHE_VERSION	1			// Bump when SLUTHeader or the way buffers are written changes
+#define LUT_DATA_OFFSET		128			// Where the data starts in the file (a multiple of ALIGN_SIZE, with room for SLUTHeader)
+#define LUT_MAX_MAPPINGS	16
+#define LUT_MAX_FILES		32			// Save() deletes the oldest tables when the directory has more than this many
+#define LUT_MAX_SIZE		(64 << 20)	// or when they add up to more than this many bytes
+
+/*******************************************************************************
+* Class: CLUTKey
+********************************************************************************
+* A 64-bit FNV-1a hash of everything a lookup table is generated from. Start it
+* with the table's name and the version of the code that builds it (bump that
+* whenever the generator's output changes), then Add() every parameter. Floats
+* are hashed by their bits, so any change at all gives a new key.
+*******************************************************************************/
+class CLUTKey
+{
+protected:
+	unsigned __int64 m_nHash;
+
+public:
+	CLUTKey(const char *pszName, const int nVersion)
+	{
+		m_nHash = 14695981039346656037ULL;
+		Add(pszName, strlen(pszName));
+		Add(nVersion);
+	}
+
+	void Add(const void *p, size_t nSize)
+	{
+		const unsigned char *pByte = (const unsigned char *)p;
+		for(size_t i=0; i<nSize; i++)
+		{
+			m_nHash ^= pByte[i];
+			m_nHash *= 1099511628211ULL;
+		}
+	}
+	void Add(const int n)			{ Add(&n, sizeof(n)); }
+	void Add(const float f)			{ Add(&f, sizeof(f)); }
+
+	unsigned __int64 Get() const	{ return m_nHash; }
+};
+
+// The start of every file in the cache (the buffer's elements follow at LUT_DATA_OFFSET)
+struct SLUTHeader
+{
+	char szMagic[4];				// "LUT" followed by a 0
+	unsigned int nVersion;			// LUT_CACHE_VERSION
+	unsigned __int64 nKey;			// CLUTKey::Get(), also in the file name
+	unsigned __int64 nDataSize;		// C3DBuffer::GetBufferSize()
+	int nWidth, nHeight, nDepth;
+	int nDataType, nChannels, nLayout;
+	int nFormat;					// CPixelBuffer::GetFormat()
+	float fScale[4];
+};
+
+/*******************************************************************************
+* Class: CLUTCache
+********************************************************************************
+* A directory of lookup tables saved by earlier runs, so they only have to be
+* generated the first time a program starts with a given set of parameters.
+* Each table is one file named after its key, holding an SLUTHeader and then
+* the CPixelBuffer's elements exactly as they are in memory (with the same
+* data type and layout, so the files are only meant to be read back on the
+* same kind of machine).
+*
+* Load() maps the file into memory read-only and points the buffer straight at
+* it, so nothing is read or copied until the table is sampled, and the pages
+* are shared with the OS file cache. The buffer doesn't own that memory: it
+* stays mapped until Release() or Cleanup(), and the buffer must not be
+* written to (calling Init() on it again is fine, since that allocates new
+* memory). Save() writes to a temporary file and renames it, so a run that is
+* killed halfway through never leaves a partial table behind. Any file that is
+* missing, truncated, or from another version just fails to load, and the
+* caller builds the table and saves it again. After each save the oldest
+* tables are deleted until the directory is back under LUT_MAX_FILES and
+* LUT_MAX_SIZE (a table that is still mapped can't be deleted, so trimming
+* stops there until the next save).
+*
+* The mappings are kept under a critical section, so tables can be loaded and
+* released from more than one thread at once (the startup tasks do).
+*******************************************************************************/
+class CLUTCache
+{
+protected:
+	struct SMapping
+	{
+		HANDLE hFile;
+		HANDLE hMapping;
+		void *pView;
+	};
+
+	char m_szDirectory[_MAX_PATH];
+	SMapping m_mapping[LUT_MAX_MAPPINGS];
+	int m_nMappings;
+	CRITICAL_SECTION m_cs;		// Guards m_mapping and m_nMappings
+
+	void GetPath(char *pszPath, const char *pszName, const CLUTKey &key);
+	// Deletes the oldest tables other than pszKeep until the directory is within the limits
+	void Trim(const char *pszKeep);
+
+public:
+	CLUTCache()			{ m_szDirectory[0] = 0; m_nMappings = 0; InitializeCriticalSection(&m_cs); }
+	~CLUTCache()		{ Cleanup(); DeleteCriticalSection(&m_cs); }
+
+	// Creates the directory if it isn't there yet (an empty name turns the cache off)
+	void Init(const char *pszDirectory);
+	// Unmaps every table Load() returned
+	void Cleanup();
+	bool IsEnabled() const		{ return m_szDirectory[0] != 0; }
+
+	// Points pb at the table saved under pszName and key, returns false if there isn't one
+	bool Load(const char *pszName, const CLUTKey &key, CPixelBuffer &pb);
+	// Saves the contents of pb under pszName and key, returns false if the file couldn't be written
+	bool Save(const char *pszName, const CLUTKey &key, const CPixelBuffer &pb);
+	// Unmaps the table a buffer was pointed at by Load() (it does nothing for any other pointer)
+	void Release(const void *pBuffer);
+};
+
+#endif // __LUTCache_h__
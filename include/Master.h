@@ -43,6 +43,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <malloc.h>
 #include <GL\GL.h>
 #include <GL\GLU.h>
 
@@ -888,13 +888,45 @@ public:
 };
 
 
+/*******************************************************************************
+* Class: CFrustum
+********************************************************************************
+* The six planes of a view frustum, with their normals pointing in. Init() with
+* no arguments reads the current matrices back from OpenGL, the other one
+* builds the same planes from a camera's position and orientation and the
+* projection it is rendered with (the way gluPerspective() takes it), which
+* doesn't stall the pipeline and works without a GL context.
+*******************************************************************************/
 class CFrustum
 {
 protected:
 	CPlane m_plFrustum[6];
 
+	void SetPlane(int i, const CVector &vNormal, const CVector &vPos)
+	{
+		m_plFrustum[i].m_vNormal = vNormal;
+		m_plFrustum[i].m_vNormal.Normalize();
+		m_plFrustum[i].D = -(vPos | m_plFrustum[i].m_vNormal);
+	}
+
 public:
 	CFrustum() {}
+	void Init(const CVector &vPos, const CQuaternion &qView, float fFOV, float fAspect, float fNear, float fFar)
+	{
+		CVector vView = qView.GetViewAxis();
+		CVector vUp = qView.GetUpAxis();
+		CVector vRight = qView.GetRightAxis();
+		float fTanY = tanf(DEGTORAD(fFOV * 0.5f));
+		float fTanX = fTanY * fAspect;
+
+		// Same order as the GL version: right, left, bottom, top, far, near
+		SetPlane(0, vView * fTanX - vRight, vPos);
+		SetPlane(1, vView * fTanX + vRight, vPos);
+		SetPlane(2, vView * fTanY + vUp, vPos);
+		SetPlane(3, vView * fTanY - vUp, vPos);
+		SetPlane(4, -vView, vPos + vView * fFar);
+		SetPlane(5, vView, vPos + vView * fNear);
+	}
 	void Init()
 	{
 		float   proj[16];
@@ -0,0 +1,202 @@
+// Mixer.h
+//
+
+#ifndef __Mixer_h__
+#define __Mixer_h__
+
+#include "MixerKernels.h"
+
+#define MIXER_MAX_SAMPLES		64
+#define MIXER_MAX_VOICES		256
+#define MIXER_BLOCK_SIZE		256		// Frames mixed at a time (and the most a sink is ever given at once)
+#define MIXER_SINK_BUFFERS		8		// OpenAL buffers COpenALSink keeps queued (each one holds a block)
+
+/*******************************************************************************
+* Class: CAudioSink
+********************************************************************************
+* Where CMixer sends what it mixes, as interleaved 16-bit stereo frames at the
+* mixer's rate. Each kind of sink has its own Open() and Close().
+*******************************************************************************/
+class CAudioSink
+{
+public:
+	virtual ~CAudioSink()		{}
+
+	// How many frames Write() can take right now
+	virtual int GetSpace() = 0;
+	virtual void Write(const short *pFrames, int nFrames) = 0;
+};
+
+/*******************************************************************************
+* Class: CNullSink
+********************************************************************************
+* Throws the frames away, keeping a count, the loudest sample, and an FNV-1a
+* hash of everything it was given, so two runs can be compared exactly.
+*******************************************************************************/
+class CNullSink : public CAudioSink
+{
+protected:
+	unsigned int m_nFrames;
+	unsigned int m_nHash;
+	int m_nPeak;
+
+public:
+	CNullSink()					{ Reset(); }
+	void Reset()				{ m_nFrames = 0; m_nHash = 2166136261u; m_nPeak = 0; }
+
+	virtual int GetSpace()		{ return 0x7FFFFFFF; }
+	virtual void Write(const short *pFrames, int nFrames);
+
+	unsigned int GetFrames()	{ return m_nFrames; }
+	unsigned int GetHash()		{ return m_nHash; }
+	int GetPeak()				{ return m_nPeak; }
+};
+
+/*******************************************************************************
+* Class: CWaveSink
+********************************************************************************
+* Writes a 16-bit stereo PCM wave file. The sizes in the header are filled in
+* by Close().
+*******************************************************************************/
+class CWaveSink : public CAudioSink
+{
+protected:
+	FILE *m_pFile;
+	int m_nFrequency;
+	unsigned int m_nFrames;
+
+	void WriteHeader();
+
+public:
+	CWaveSink()					{ m_pFile = NULL; m_nFrequency = 0; m_nFrames = 0; }
+	~CWaveSink()				{ Close(); }
+
+	bool Open(const char *pszFile, int nFrequency);
+	void Close();
+
+	virtual int GetSpace()		{ return m_pFile ? 0x7FFFFFFF : 0; }
+	virtual void Write(const short *pFrames, int nFrames);
+};
+
+/*******************************************************************************
+* Class: COpenALSink
+********************************************************************************
+* Plays the frames on an OpenAL source through a queue of MIXER_SINK_BUFFERS
+* buffers. GetSpace() takes back the buffers the source has finished with, so
+* it reports how far the mixer can get ahead of the device. It needs an OpenAL
+* context (from ALFWInitOpenAL()), and has to be used from one thread.
+*******************************************************************************/
+class COpenALSink : public CAudioSink
+{
+protected:
+	int m_nFrequency;
+	unsigned int m_nSource;
+	unsigned int m_nBuffer[MIXER_SINK_BUFFERS];
+	unsigned int m_nFree[MIXER_SINK_BUFFERS];	// Buffers that aren't queued
+	int m_nFreeCount;
+
+public:
+	COpenALSink()				{ m_nFrequency = 0; m_nFreeCount = 0; }
+	~COpenALSink()				{ Close(); }
+
+	bool Open(int nFrequency);
+	void Close();
+
+	virtual int GetSpace();
+	virtual void Write(const short *pFrames, int nFrames);
+};
+
+// A sound converted to floats, with MIXER_GUARD_FRAMES before and after each channel
+struct SMixerSample
+{
+	char szFile[_MAX_PATH];
+	float *pAlloc;
+	float *pChannel[2];			// The first frame of each channel (the same pointer twice for mono)
+	int nFrames;
+	int nFrequency;
+	bool bLoop;
+};
+
+struct SMixerVoice
+{
+	int nSample;				// -1 if the voice is free
+	unsigned int nID;
+	double dPosition;			// In source frames
+	float fGain, fPan, fPitch;
+};
+
+struct SMixerStats
+{
+	unsigned int nFrames;		// Frames mixed since the mixer was initialized
+	double dSeconds;			// Time spent mixing and converting them
+	int nPeakVoices;			// Most voices playing in one block
+};
+
+/*******************************************************************************
+* Class: CMixer
+********************************************************************************
+* A software mixer that doesn't need a sound device. Samples are converted to
+* floats once, with each channel stored separately. Render() mixes a block of
+* MIXER_BLOCK_SIZE frames at a time: each playing voice is resampled (linear
+* or Catmull-Rom) by the pfnMixVoice kernel and added into a float block with
+* its gain and pan, and then the block is clipped to 16 bits and handed to a
+* CAudioSink. The kernel comes from CKernels, so it runs at the same SIMD level
+* as the rest of the engine.
+*
+* A sample either loops or doesn't, which is decided when it's loaded: the
+* guard frames around a looping sample hold the frames from its other end, so
+* interpolating across the loop point is seamless, and the ones around a
+* one-shot sample are silent. Nothing depends on the clock, so the same calls
+* always produce the same frames, which is what makes it useful for testing
+* and benchmarking with CNullSink or CWaveSink. To drive a device, call
+* Render() with COpenALSink's GetSpace().
+*
+* None of it is thread-safe; it is meant to belong to one thread.
+*******************************************************************************/
+class CMixer
+{
+protected:
+	int m_nFrequency;
+	int m_nInterpolation;
+	SMixerSample m_sample[MIXER_MAX_SAMPLES];
+	int m_nSamples;
+	SMixerVoice m_voice[MIXER_MAX_VOICES];
+	int m_nVoices;				// Voices up to the last one that was used
+	unsigned int m_nNextID;
+	SMixerStats m_stats;
+
+	// The block being mixed, with room for a vector past the end
+	float m_fBlock[2][MIXER_BLOCK_SIZE + MIXER_GUARD_FRAMES];
+	short m_nPCM[MIXER_BLOCK_SIZE * 2];
+
+	SMixerVoice *FindVoice(unsigned int nID);
+	void MixBlock(int nFrames);
+
+public:
+	CMixer();
+	~CMixer()					{ Cleanup(); }
+
+	void Init(int nFrequency=44100, int nInterpolation=MIXER_LINEAR);
+	void Cleanup();
+	int GetFrequency()			{ return m_nFrequency; }
+	void SetInterpolation(int nInterpolation)	{ m_nInterpolation = nInterpolation; }
+
+	// Adds nFrames of interleaved float frames (1 or 2 channels), returns -1 if there's no room
+	int AddSample(const float *pFrames, int nFrames, int nChannels, int nFrequency, bool bLoop=false);
+	// Loads an 8- or 16-bit PCM wave file (or finds it if it was already loaded), returns -1 if it can't
+	int LoadSample(const char *pszFile, bool bLoop=false);
+
+	// Returns an ID for the other voice functions, or 0 if every voice is playing
+	unsigned int Play(int nSample, float fGain=1.0f, float fPan=0.0f, float fPitch=1.0f);
+	// fPan goes from -1 (left) to 1 (right), fPitch is a playback rate (1 is the sample's own rate)
+	void SetVoice(unsigned int nID, float fGain, float fPan, float fPitch);
+	void Stop(unsigned int nID);
+	void StopAll();
+	bool IsPlaying(unsigned int nID)	{ return FindVoice(nID) != NULL; }
+
+	// Mixes nFrames and writes them to pSink, which has to have room for them
+	void Render(CAudioSink *pSink, int nFrames);
+	const SMixerStats &GetStats()		{ return m_stats; }
+};
+
+#endif // __Mixer_h__
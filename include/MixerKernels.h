@@ -0,0 +1,105 @@
+// MixerKernels.h
+//
+
+#ifndef __MixerKernels_h__
+#define __MixerKernels_h__
+
+#include "SIMD.h"
+
+#define MIXER_GUARD_FRAMES		8		// Frames kept before and after every sample's data (at least the widest vector)
+
+enum EMixerInterpolation
+{
+	MIXER_LINEAR,
+	MIXER_CUBIC				// Catmull-Rom through the 4 nearest frames
+};
+
+// One voice's share of a block, for MixVoice()
+struct SMixJob
+{
+	const float *pChannel[2];	// The sample's left and right channels (the same pointer twice for a mono sample)
+	double dPosition;			// Where the first output frame reads from, in source frames
+	float fStep;				// Source frames per output frame
+	float fGain[2];				// Left and right gains, with the pan already applied
+	int nInterpolation;			// EMixerInterpolation
+	float *pOut[2];				// Where the first output frame is added (with room for a vector past the end)
+	int nCount;					// Output frames
+};
+
+/*******************************************************************************
+* Voice mixing
+********************************************************************************
+* MixVoice() resamples one voice and adds it into the mixer's block, F::Width
+* output frames at a time. Positions are kept relative to the source frame the
+* job starts in, so floats are exact enough over one block. The source frames
+* are fetched with the gather policy G (see TGather in SIMD.h), and lanes past
+* the end of the job are clamped to its last frame and then masked off, so the
+* only frames read outside the job are the ones interpolation needs around it
+* (which is what the sample's guard frames are for). A voice that plays at the
+* output rate without a fractional offset is just loaded and scaled.
+*******************************************************************************/
+template <class F, class G> inline F InterpolateFrames(const float *p, const int *pOffset, const F &t, int nInterpolation)
+{
+	F p1 = G::Gather(p, pOffset);
+	F p2 = G::Gather(p+1, pOffset);
+	if(nInterpolation == MIXER_LINEAR)
+		return p1 + (p2 - p1) * t;
+	F p0 = G::Gather(p-1, pOffset);
+	F p3 = G::Gather(p+2, pOffset);
+	return p1 + F(0.5f) * t * (p2 - p0 + t * (F(2.0f)*p0 - F(5.0f)*p1 + F(4.0f)*p2 - p3 + t * (F(3.0f)*(p1 - p2) + p3 - p0)));
+}
+
+template <class F, class G> void MixVoice(const SMixJob &job)
+{
+	int nBase = (int)floor(job.dPosition);
+	float fStart = (float)(job.dPosition - nBase);
+	int nChannels = job.pChannel[0] == job.pChannel[1] ? 1 : 2;
+	const float *pSource[2] = {job.pChannel[0] + nBase, job.pChannel[1] + nBase};
+	F fGain[2] = {F(job.fGain[0]), F(job.fGain[1])};
+
+	SIMD_ALIGN float fLane[F::Width];
+	SIMD_ALIGN int nOffset[F::Width];
+	for(int l=0; l<F::Width; l++)
+		fLane[l] = (float)l;
+	F fLaneIndex = F::Load(fLane);
+
+	if(job.fStep == 1.0f && fStart == 0.0f)
+	{
+		for(int i=0; i<job.nCount; i+=F::Width)
+		{
+			F fMask = fLaneIndex < F((float)(job.nCount - i));
+			F fValue;
+			for(int c=0; c<2; c++)
+			{
+				if(c < nChannels)
+					fValue = F::LoadUnaligned(pSource[c] + i);
+				(F::LoadUnaligned(job.pOut[c] + i) + ((fValue * fGain[c]) & fMask)).StoreUnaligned(job.pOut[c] + i);
+			}
+		}
+		return;
+	}
+
+	F fStep(job.fStep);
+	F fLast(fStart + (job.nCount - 1) * job.fStep);
+	for(int i=0; i<job.nCount; i+=F::Width)
+	{
+		F fIndex = fLaneIndex + F((float)i);
+		F fPos = Min(F(fStart) + fIndex * fStep, fLast);
+		F fFloor = Floor(fPos);
+		F t = fPos - fFloor;
+		fFloor.Store(fLane);
+		for(int l=0; l<F::Width; l++)
+			nOffset[l] = (int)fLane[l];
+
+		F fMask = fIndex < F((float)job.nCount);
+		F fValue;
+		for(int c=0; c<2; c++)
+		{
+			if(c < nChannels)
+				fValue = InterpolateFrames<F, G>(pSource[c], nOffset, t, job.nInterpolation);
+			(F::LoadUnaligned(job.pOut[c] + i) + ((fValue * fGain[c]) & fMask)).StoreUnaligned(job.pOut[c] + i);
+		}
+	}
+}
+
+#endif // __MixerKernels_h__
@@ -32,10 +32,25 @@ POSSIBILITY OF SUCH DAMAGE.
 #define __PixelBuffer_h__
 
 #include "Matrix.h"
+#include "Storage.h"
+
+class CThreadPool;
 
 #define ALIGN_SIZE		64
 #define ALIGN_MASK		(ALIGN_SIZE-1)
-#define ALIGN(x)		(((unsigned int)x+ALIGN_MASK) & ~ALIGN_MASK)
+#define ALIGN(x)		(((size_t)(x)+ALIGN_MASK) & ~(size_t)ALIGN_MASK)
+
+// How a C3DBuffer's elements are ordered in memory
+enum BufferLayout
+{
+	LinearLayout,				// Row-major, x then y then z (what OpenGL expects)
+	BrickLayout					// In BRICK_SIZE^3 bricks, with the elements of each brick in Morton order (see TBrickBuffer)
+};
+#define BRICK_SIZE		4
+
+#ifndef GL_HALF_FLOAT_ARB
+#define GL_HALF_FLOAT_ARB	0x140B
+#endif
 
 typedef enum
 {
@@ -46,7 +61,8 @@ typedef enum
 	UnsignedIntType = GL_UNSIGNED_INT,
 	SignedIntType = GL_INT,
 	FloatType = GL_FLOAT,
-	DoubleType = GL_DOUBLE
+	DoubleType = GL_DOUBLE,
+	HalfFloatType = GL_HALF_FLOAT_ARB
 } BufferDataType;
 
 inline const int GetDataTypeSize(const int nDataType)
@@ -60,6 +76,7 @@ inline const int GetDataTypeSize(const int nDataType)
 			break;
 		case UnsignedShortType:
 		case SignedShortType:
+		case HalfFloatType:
 			nSize = 2;
 			break;
 		case UnsignedIntType:
@@ -77,6 +94,268 @@ inline const int GetDataTypeSize(const int nDataType)
 	return nSize;
 }
 
+/*******************************************************************************
+* Class: TBuffer
+********************************************************************************
+* A typed view of a 3D buffer, with the element type and the number of
+* channels fixed at compile time. It doesn't own its memory; C3DBuffer hands
+* these out for its own buffer with GetView(). Offsets are computed with size_t
+* so nothing is truncated in 64-bit builds, and since Channels is a constant,
+* the channel loops in Interpolate() have a fixed trip count the compiler can
+* unroll. Interpolate() takes normalized coordinates like C3DBuffer's.
+*
+* T can be any of the types in Storage.h. For the normalized integer types,
+* Interpolate() multiplies each channel by its scale after blending.
+*******************************************************************************/
+template <class T, int Channels> class TBuffer
+{
+protected:
+	T *m_pBuffer;
+	int m_nWidth;
+	int m_nHeight;
+	int m_nDepth;
+	size_t m_nRowStride;		// The number of Ts in one row (x axis)
+	size_t m_nSliceStride;		// The number of Ts in one slice (x and y axes)
+	float m_fScale[Channels];	// What each channel is multiplied by when it is sampled (only for normalized types)
+
+public:
+	enum { ChannelCount = Channels };
+
+	TBuffer()						{ Init(NULL, 0, 0, 0); }
+	TBuffer(T *pBuffer, const int nWidth, const int nHeight=1, const int nDepth=1, const float *pScale=NULL)	{ Init(pBuffer, nWidth, nHeight, nDepth, pScale); }
+
+	void Init(T *pBuffer, const int nWidth, const int nHeight=1, const int nDepth=1, const float *pScale=NULL)
+	{
+		m_pBuffer = pBuffer;
+		m_nWidth = nWidth;
+		m_nHeight = nHeight;
+		m_nDepth = nDepth;
+		m_nRowStride = (size_t)nWidth * Channels;
+		m_nSliceStride = m_nRowStride * nHeight;
+		for(int i=0; i<Channels; i++)
+			m_fScale[i] = pScale ? pScale[i] : 1.0f;
+	}
+
+	int GetWidth() const			{ return m_nWidth; }
+	int GetHeight() const			{ return m_nHeight; }
+	int GetDepth() const			{ return m_nDepth; }
+	size_t GetRowStride() const		{ return m_nRowStride; }
+	size_t GetSliceStride() const	{ return m_nSliceStride; }
+	T *GetBuffer() const			{ return m_pBuffer; }
+	float GetScale(const int i) const	{ return m_fScale[i]; }
+
+	size_t GetOffset(const int x, const int y=0, const int z=0) const
+	{
+		return (size_t)x * Channels + (size_t)y * m_nRowStride + (size_t)z * m_nSliceStride;
+	}
+	T *operator()(const int x, const int y=0, const int z=0) const
+	{
+		return m_pBuffer + GetOffset(x, y, z);
+	}
+
+	// Multiplies each channel of a sample by its scale if T is a normalized type
+	void ApplyScale(float *p) const
+	{
+		if(TStorage<T>::Normalized)
+		{
+			for(int i=0; i<Channels; i++)
+				p[i] *= m_fScale[i];
+		}
+	}
+
+	void Interpolate(float *p, const float x) const
+	{
+		float fX = x*(m_nWidth-1);
+		int nX = Min(m_nWidth-2, Max(0, (int)fX));
+		float fRatioX = fX - nX;
+		const T *pValue = m_pBuffer + GetOffset(nX);
+		for(int i=0; i<Channels; i++)
+			p[i] =	ToFloat(pValue[i]) * (1-fRatioX) + ToFloat(pValue[Channels+i]) * (fRatioX);
+		ApplyScale(p);
+	}
+	void Interpolate(float *p, const float x, const float y) const
+	{
+		float fX = x*(m_nWidth-1);
+		float fY = y*(m_nHeight-1);
+		int nX = Min(m_nWidth-2, Max(0, (int)fX));
+		int nY = Min(m_nHeight-2, Max(0, (int)fY));
+		float fRatioX = fX - nX;
+		float fRatioY = fY - nY;
+		const T *pValue = m_pBuffer + GetOffset(nX, nY);
+		const T *pNext = pValue + m_nRowStride;
+		for(int i=0; i<Channels; i++)
+		{
+			p[i] =	ToFloat(pValue[i]) * (1-fRatioX) * (1-fRatioY) +
+					ToFloat(pValue[Channels+i]) * (fRatioX) * (1-fRatioY) +
+					ToFloat(pNext[i]) * (1-fRatioX) * (fRatioY) +
+					ToFloat(pNext[Channels+i]) * (fRatioX) * (fRatioY);
+		}
+		ApplyScale(p);
+	}
+	void Interpolate(float *p, const float x, const float y, const float z) const
+	{
+		float fX = x*(m_nWidth-1);
+		float fY = y*(m_nHeight-1);
+		float fZ = z*(m_nDepth-1);
+		int nX = Min(m_nWidth-2, Max(0, (int)fX));
+		int nY = Min(m_nHeight-2, Max(0, (int)fY));
+		int nZ = Min(m_nDepth-2, Max(0, (int)fZ));
+		float fRatioX = fX - nX;
+		float fRatioY = fY - nY;
+		float fRatioZ = fZ - nZ;
+		const T *pValue = m_pBuffer + GetOffset(nX, nY, nZ);
+		const T *pNext = pValue + m_nRowStride;
+		const T *pValue2 = pValue + m_nSliceStride;
+		const T *pNext2 = pValue2 + m_nRowStride;
+		for(int i=0; i<Channels; i++)
+		{
+			p[i] =	ToFloat(pValue[i]) * (1-fRatioX) * (1-fRatioY) * (1-fRatioZ) +
+					ToFloat(pValue[Channels+i]) * (fRatioX) * (1-fRatioY) * (1-fRatioZ) +
+					ToFloat(pNext[i]) * (1-fRatioX) * (fRatioY) * (1-fRatioZ) +
+					ToFloat(pNext[Channels+i]) * (fRatioX) * (fRatioY) * (1-fRatioZ) +
+					ToFloat(pValue2[i]) * (1-fRatioX) * (1-fRatioY) * (fRatioZ) +
+					ToFloat(pValue2[Channels+i]) * (fRatioX) * (1-fRatioY) * (fRatioZ) +
+					ToFloat(pNext2[i]) * (1-fRatioX) * (fRatioY) * (fRatioZ) +
+					ToFloat(pNext2[Channels+i]) * (fRatioX) * (fRatioY) * (fRatioZ);
+		}
+		ApplyScale(p);
+	}
+};
+
+/*******************************************************************************
+* Class: TBrickBuffer
+********************************************************************************
+* The same as TBuffer, but for a buffer stored in BrickLayout. The volume is
+* split into bricks of BRICK_SIZE elements along each axis the buffer is more
+* than 1 element long on (so a 2D buffer has 4x4 bricks), padded out to a
+* whole number of bricks. The bricks are stored in row-major order, and the
+* elements in each brick in Morton (Z) order, with the bits of x, y, and z
+* interleaved. That puts the 8 corners of a trilinear lookup in one brick most
+* of the time (often in one or two cache lines), where the linear layout puts
+* them in 4 lines spread over 2 slices.
+*
+* An element's offset is still a sum of one term for each axis, so the view
+* looks them up in 3 tables (built by C3DBuffer) instead of multiplying by the
+* strides, and Interpolate() fetches the 2 terms for each axis once.
+*******************************************************************************/
+template <class T, int Channels> class TBrickBuffer
+{
+protected:
+	T *m_pBuffer;
+	int m_nWidth;
+	int m_nHeight;
+	int m_nDepth;
+	const size_t *m_pAxisOffset[3];	// The element offset for each x, y, and z
+	float m_fScale[Channels];		// What each channel is multiplied by when it is sampled (only for normalized types)
+
+public:
+	enum { ChannelCount = Channels };
+
+	TBrickBuffer(T *pBuffer, const int nWidth, const int nHeight, const int nDepth, const size_t *pAxisOffset, const float *pScale=NULL)
+	{
+		m_pBuffer = pBuffer;
+		m_nWidth = nWidth;
+		m_nHeight = nHeight;
+		m_nDepth = nDepth;
+		m_pAxisOffset[0] = pAxisOffset;
+		m_pAxisOffset[1] = pAxisOffset + nWidth;
+		m_pAxisOffset[2] = pAxisOffset + nWidth + nHeight;
+		for(int i=0; i<Channels; i++)
+			m_fScale[i] = pScale ? pScale[i] : 1.0f;
+	}
+
+	int GetWidth() const			{ return m_nWidth; }
+	int GetHeight() const			{ return m_nHeight; }
+	int GetDepth() const			{ return m_nDepth; }
+	T *GetBuffer() const			{ return m_pBuffer; }
+	float GetScale(const int i) const	{ return m_fScale[i]; }
+
+	size_t GetOffset(const int x, const int y=0, const int z=0) const
+	{
+		return (m_pAxisOffset[0][x] + m_pAxisOffset[1][y] + m_pAxisOffset[2][z]) * Channels;
+	}
+	T *operator()(const int x, const int y=0, const int z=0) const
+	{
+		return m_pBuffer + GetOffset(x, y, z);
+	}
+
+	void ApplyScale(float *p) const
+	{
+		if(TStorage<T>::Normalized)
+		{
+			for(int i=0; i<Channels; i++)
+				p[i] *= m_fScale[i];
+		}
+	}
+
+	void Interpolate(float *p, const float x) const
+	{
+		float fX = x*(m_nWidth-1);
+		int nX = Min(m_nWidth-2, Max(0, (int)fX));
+		float fRatioX = fX - nX;
+		const T *pValue = m_pBuffer + m_pAxisOffset[0][nX] * Channels;
+		const T *pValueX = m_pBuffer + m_pAxisOffset[0][nX+1] * Channels;
+		for(int i=0; i<Channels; i++)
+			p[i] =	ToFloat(pValue[i]) * (1-fRatioX) + ToFloat(pValueX[i]) * (fRatioX);
+		ApplyScale(p);
+	}
+	void Interpolate(float *p, const float x, const float y) const
+	{
+		float fX = x*(m_nWidth-1);
+		float fY = y*(m_nHeight-1);
+		int nX = Min(m_nWidth-2, Max(0, (int)fX));
+		int nY = Min(m_nHeight-2, Max(0, (int)fY));
+		float fRatioX = fX - nX;
+		float fRatioY = fY - nY;
+		size_t nX0 = m_pAxisOffset[0][nX], nX1 = m_pAxisOffset[0][nX+1];
+		size_t nY0 = m_pAxisOffset[1][nY], nY1 = m_pAxisOffset[1][nY+1];
+		const T *pCorner[4] = {
+			m_pBuffer + (nX0 + nY0) * Channels, m_pBuffer + (nX1 + nY0) * Channels,
+			m_pBuffer + (nX0 + nY1) * Channels, m_pBuffer + (nX1 + nY1) * Channels
+		};
+		for(int i=0; i<Channels; i++)
+		{
+			p[i] =	ToFloat(pCorner[0][i]) * (1-fRatioX) * (1-fRatioY) +
+					ToFloat(pCorner[1][i]) * (fRatioX) * (1-fRatioY) +
+					ToFloat(pCorner[2][i]) * (1-fRatioX) * (fRatioY) +
+					ToFloat(pCorner[3][i]) * (fRatioX) * (fRatioY);
+		}
+		ApplyScale(p);
+	}
+	void Interpolate(float *p, const float x, const float y, const float z) const
+	{
+		float fX = x*(m_nWidth-1);
+		float fY = y*(m_nHeight-1);
+		float fZ = z*(m_nDepth-1);
+		int nX = Min(m_nWidth-2, Max(0, (int)fX));
+		int nY = Min(m_nHeight-2, Max(0, (int)fY));
+		int nZ = Min(m_nDepth-2, Max(0, (int)fZ));
+		float fRatioX = fX - nX;
+		float fRatioY = fY - nY;
+		float fRatioZ = fZ - nZ;
+		size_t nX0 = m_pAxisOffset[0][nX], nX1 = m_pAxisOffset[0][nX+1];
+		size_t nY0 = m_pAxisOffset[1][nY], nY1 = m_pAxisOffset[1][nY+1];
+		size_t nZ0 = m_pAxisOffset[2][nZ], nZ1 = m_pAxisOffset[2][nZ+1];
+		const T *pCorner[8] = {
+			m_pBuffer + (nX0 + nY0 + nZ0) * Channels, m_pBuffer + (nX1 + nY0 + nZ0) * Channels,
+			m_pBuffer + (nX0 + nY1 + nZ0) * Channels, m_pBuffer + (nX1 + nY1 + nZ0) * Channels,
+			m_pBuffer + (nX0 + nY0 + nZ1) * Channels, m_pBuffer + (nX1 + nY0 + nZ1) * Channels,
+			m_pBuffer + (nX0 + nY1 + nZ1) * Channels, m_pBuffer + (nX1 + nY1 + nZ1) * Channels
+		};
+		for(int i=0; i<Channels; i++)
+		{
+			p[i] =	ToFloat(pCorner[0][i]) * (1-fRatioX) * (1-fRatioY) * (1-fRatioZ) +
+					ToFloat(pCorner[1][i]) * (fRatioX) * (1-fRatioY) * (1-fRatioZ) +
+					ToFloat(pCorner[2][i]) * (1-fRatioX) * (fRatioY) * (1-fRatioZ) +
+					ToFloat(pCorner[3][i]) * (fRatioX) * (fRatioY) * (1-fRatioZ) +
+					ToFloat(pCorner[4][i]) * (1-fRatioX) * (1-fRatioY) * (fRatioZ) +
+					ToFloat(pCorner[5][i]) * (fRatioX) * (1-fRatioY) * (fRatioZ) +
+					ToFloat(pCorner[6][i]) * (1-fRatioX) * (fRatioY) * (fRatioZ) +
+					ToFloat(pCorner[7][i]) * (fRatioX) * (fRatioY) * (fRatioZ);
+		}
+		ApplyScale(p);
+	}
+};
 
 class C3DBuffer
 {
@@ -87,119 +366,212 @@ protected:
 	int m_nDataType;			// The data type stored in the buffer (i.e. GL_UNSIGNED_BYTE, GL_FLOAT)
 	int m_nChannels;			// The number of channels of data stored in the buffer
 	int m_nElementSize;			// The size of one element in the buffer
+	int m_nLayout;				// LinearLayout or BrickLayout
+	size_t m_nElementCount;		// The number of elements allocated (BrickLayout pads each axis to a whole number of bricks)
+	size_t *m_pAxisOffset;		// For BrickLayout, the element offset of each x, then each y, then each z (see TBrickBuffer)
+	float m_fScale[4];			// What the first 4 channels are multiplied by when sampled (only for normalized types)
 	void *m_pAlloc;				// The pointer to the pixel buffer
 	void *m_pBuffer;			// A byte-aligned pointer (for faster memory access)
 
+	// Dispatches the float Interpolate() calls for a buffer of Ts to the view with the right layout and channel count
+	// (there are only views for 1 to 4 channels, so any other count asserts and leaves p alone)
+	template <class T> void InterpolateAs(float *p, const float x) const
+	{
+		if(m_nLayout == BrickLayout)
+		{
+			switch(m_nChannels)
+			{
+				case 1: GetBrickView<T, 1>().Interpolate(p, x); break;
+				case 2: GetBrickView<T, 2>().Interpolate(p, x); break;
+				case 3: GetBrickView<T, 3>().Interpolate(p, x); break;
+				case 4: GetBrickView<T, 4>().Interpolate(p, x); break;
+				default: ASSERT(m_nChannels >= 1 && m_nChannels <= 4); break;
+			}
+			return;
+		}
+		switch(m_nChannels)
+		{
+			case 1: GetView<T, 1>().Interpolate(p, x); break;
+			case 2: GetView<T, 2>().Interpolate(p, x); break;
+			case 3: GetView<T, 3>().Interpolate(p, x); break;
+			case 4: GetView<T, 4>().Interpolate(p, x); break;
+			default: ASSERT(m_nChannels >= 1 && m_nChannels <= 4); break;
+		}
+	}
+	template <class T> void InterpolateAs(float *p, const float x, const float y) const
+	{
+		if(m_nLayout == BrickLayout)
+		{
+			switch(m_nChannels)
+			{
+				case 1: GetBrickView<T, 1>().Interpolate(p, x, y); break;
+				case 2: GetBrickView<T, 2>().Interpolate(p, x, y); break;
+				case 3: GetBrickView<T, 3>().Interpolate(p, x, y); break;
+				case 4: GetBrickView<T, 4>().Interpolate(p, x, y); break;
+				default: ASSERT(m_nChannels >= 1 && m_nChannels <= 4); break;
+			}
+			return;
+		}
+		switch(m_nChannels)
+		{
+			case 1: GetView<T, 1>().Interpolate(p, x, y); break;
+			case 2: GetView<T, 2>().Interpolate(p, x, y); break;
+			case 3: GetView<T, 3>().Interpolate(p, x, y); break;
+			case 4: GetView<T, 4>().Interpolate(p, x, y); break;
+			default: ASSERT(m_nChannels >= 1 && m_nChannels <= 4); break;
+		}
+	}
+	template <class T> void InterpolateAs(float *p, const float x, const float y, const float z) const
+	{
+		if(m_nLayout == BrickLayout)
+		{
+			switch(m_nChannels)
+			{
+				case 1: GetBrickView<T, 1>().Interpolate(p, x, y, z); break;
+				case 2: GetBrickView<T, 2>().Interpolate(p, x, y, z); break;
+				case 3: GetBrickView<T, 3>().Interpolate(p, x, y, z); break;
+				case 4: GetBrickView<T, 4>().Interpolate(p, x, y, z); break;
+				default: ASSERT(m_nChannels >= 1 && m_nChannels <= 4); break;
+			}
+			return;
+		}
+		switch(m_nChannels)
+		{
+			case 1: GetView<T, 1>().Interpolate(p, x, y, z); break;
+			case 2: GetView<T, 2>().Interpolate(p, x, y, z); break;
+			case 3: GetView<T, 3>().Interpolate(p, x, y, z); break;
+			case 4: GetView<T, 4>().Interpolate(p, x, y, z); break;
+			default: ASSERT(m_nChannels >= 1 && m_nChannels <= 4); break;
+		}
+	}
+
+
+	// Pads m_nElementCount out to whole bricks and builds m_pAxisOffset for BrickLayout
+	void InitBricks();
 public:
-	C3DBuffer()						{ m_pAlloc = m_pBuffer = NULL; }
-	C3DBuffer(const C3DBuffer &buf)	{ *this = buf; }
-	C3DBuffer(const int nWidth, const int nHeight, const int nDepth, const int nDataType, const int nChannels=1, void *pBuffer=NULL)
+	C3DBuffer()						{ m_pAlloc = m_pBuffer = NULL; m_pAxisOffset = NULL; }
+	C3DBuffer(const C3DBuffer &buf)	{ m_pAlloc = m_pBuffer = NULL; m_pAxisOffset = NULL; *this = buf; }
+	C3DBuffer(const int nWidth, const int nHeight, const int nDepth, const int nDataType, const int nChannels=1, void *pBuffer=NULL, const int nLayout=LinearLayout)
 	{
 		m_pAlloc = m_pBuffer = NULL;
-		Init(nWidth, nHeight, nDepth, nDataType, nChannels, pBuffer);
+		m_pAxisOffset = NULL;
+		Init(nWidth, nHeight, nDepth, nDataType, nChannels, pBuffer, nLayout);
 	}
 	~C3DBuffer()					{ Cleanup(); }
 
 	void operator=(const C3DBuffer &buf)
 	{
-		Init(buf.m_nWidth, buf.m_nHeight, buf.m_nDepth, buf.m_nDataType, buf.m_nChannels);
+		Init(buf.m_nWidth, buf.m_nHeight, buf.m_nDepth, buf.m_nDataType, buf.m_nChannels, NULL, buf.m_nLayout);
 		memcpy(m_pBuffer, buf.m_pBuffer, GetBufferSize());
+		memcpy(m_fScale, buf.m_fScale, sizeof(m_fScale));
 	}
 	bool operator==(const C3DBuffer &buf)
 	{
-		return (m_nWidth == buf.m_nWidth && m_nHeight == buf.m_nHeight && m_nDepth == buf.m_nDepth && m_nDataType == buf.m_nDataType && m_nChannels == buf.m_nChannels);
+		return (m_nWidth == buf.m_nWidth && m_nHeight == buf.m_nHeight && m_nDepth == buf.m_nDepth && m_nDataType == buf.m_nDataType && m_nChannels == buf.m_nChannels && m_nLayout == buf.m_nLayout);
 	}
 
+	// Returns where element (x, y, z) is stored, counted in elements from the start of the buffer
+	size_t GetIndex(const int x, const int y=0, const int z=0) const
+	{
+		if(m_nLayout == BrickLayout)
+			return m_pAxisOffset[x] + m_pAxisOffset[m_nWidth + y] + m_pAxisOffset[m_nWidth + m_nHeight + z];
+		return ((size_t)m_nHeight * z + y) * m_nWidth + x;
+	}
+	// Returns the nIndex'th element in memory order (which is only the same as x, y, z order for LinearLayout)
+	void *GetElement(const size_t nIndex) const
+	{
+		return (unsigned char *)m_pBuffer + nIndex * m_nElementSize;
+	}
 	void *operator[](const int n)
 	{
-		return (void *)((unsigned int)m_pBuffer + n * m_nElementSize);
+		return GetElement(n);
 	}
 	void *operator()(const int x, const int y, const int z)
 	{
-		return (void *)((unsigned int)m_pBuffer + m_nElementSize * (m_nWidth * (m_nHeight * z + y) + x));
+		return GetElement(GetIndex(x, y, z));
 	}
 
 	void *operator()(const float x)
 	{
 		int nX = Min(m_nWidth-1, Max(0, (int)(x*(m_nWidth-1)+0.5f)));
-		return (void *)((unsigned long)m_pBuffer + m_nElementSize * nX);
+		return GetElement(nX);
 	}
 	void *operator()(const float x, const float y)
 	{
 		int nX = Min(m_nWidth-1, Max(0, (int)(x*(m_nWidth-1)+0.5f)));
 		int nY = Min(m_nHeight-1, Max(0, (int)(y*(m_nHeight-1)+0.5f)));
-		return (void *)((unsigned long)m_pBuffer + m_nElementSize * (m_nWidth * nY + nX));
+		return GetElement(GetIndex(nX, nY));
 	}
 	void *operator()(const float x, const float y, const float z)
 	{
 		int nX = Min(m_nWidth-1, Max(0, (int)(x*(m_nWidth-1)+0.5f)));
 		int nY = Min(m_nHeight-1, Max(0, (int)(y*(m_nHeight-1)+0.5f)));
 		int nZ = Min(m_nDepth-1, Max(0, (int)(z*(m_nDepth-1)+0.5f)));
-		return (void *)((unsigned long)m_pBuffer + m_nElementSize * (m_nWidth * (m_nHeight * nZ + nY) + nX));
+		return GetElement(GetIndex(nX, nY, nZ));
 	}
 
-	void Interpolate(float *p, const float x)
+	// Returns a typed view of the buffer (T and Channels must match the data type and channel count it was initialized with)
+	template <class T, int Channels> TBuffer<T, Channels> GetView() const
 	{
-		float fX = x*(m_nWidth-1);
-		int nX = Min(m_nWidth-2, Max(0, (int)fX));
-		float fRatioX = fX - nX;
-		float *pValue = (float *)((unsigned long)m_pBuffer + m_nElementSize * nX);
-		for(int i=0; i<m_nChannels; i++)
+		ASSERT(sizeof(T) == GetDataTypeSize(m_nDataType) && Channels == m_nChannels && m_nLayout == LinearLayout);
+		return TBuffer<T, Channels>((T *)m_pBuffer, m_nWidth, m_nHeight, m_nDepth, m_fScale);
+	}
+	// The same for a buffer in BrickLayout
+	template <class T, int Channels> TBrickBuffer<T, Channels> GetBrickView() const
+	{
+		ASSERT(sizeof(T) == GetDataTypeSize(m_nDataType) && Channels == m_nChannels && m_nLayout == BrickLayout);
+		return TBrickBuffer<T, Channels>((T *)m_pBuffer, m_nWidth, m_nHeight, m_nDepth, m_pAxisOffset, m_fScale);
+	}
+
+	// These work on float, half float, and normalized unsigned short or byte buffers with 1 to 4 channels
+	void Interpolate(float *p, const float x) const
+	{
+		switch(m_nDataType)
 		{
-			p[i] =	pValue[0] * (1-fRatioX) + pValue[m_nChannels] * (fRatioX);
-			pValue++;
+			case HalfFloatType: InterpolateAs<SHalf>(p, x); break;
+			case UnsignedShortType: InterpolateAs<unsigned short>(p, x); break;
+			case UnsignedByteType: InterpolateAs<unsigned char>(p, x); break;
+			default: InterpolateAs<float>(p, x); break;
 		}
 	}
-	void Interpolate(float *p, const float x, const float y)
+	void Interpolate(float *p, const float x, const float y) const
 	{
-		float fX = x*(m_nWidth-1);
-		float fY = y*(m_nHeight-1);
-		int nX = Min(m_nWidth-2, Max(0, (int)fX));
-		int nY = Min(m_nHeight-2, Max(0, (int)fY));
-		float fRatioX = fX - nX;
-		float fRatioY = fY - nY;
-		float *pValue = (float *)((unsigned long)m_pBuffer + m_nElementSize * (m_nWidth * nY + nX));
-		for(int i=0; i<m_nChannels; i++)
+		switch(m_nDataType)
 		{
-			p[i] =	pValue[0] * (1-fRatioX) * (1-fRatioY) +
-					pValue[m_nChannels*1] * (fRatioX) * (1-fRatioY) +
-					pValue[m_nChannels*m_nWidth] * (1-fRatioX) * (fRatioY) +
-					pValue[m_nChannels*(m_nWidth+1)] * (fRatioX) * (fRatioY);
-			pValue++;
+			case HalfFloatType: InterpolateAs<SHalf>(p, x, y); break;
+			case UnsignedShortType: InterpolateAs<unsigned short>(p, x, y); break;
+			case UnsignedByteType: InterpolateAs<unsigned char>(p, x, y); break;
+			default: InterpolateAs<float>(p, x, y); break;
 		}
 	}
-	void Interpolate(float *p, const float x, const float y, const float z)
+	void Interpolate(float *p, const float x, const float y, const float z) const
 	{
-		float fX = x*(m_nWidth-1);
-		float fY = y*(m_nHeight-1);
-		float fZ = z*(m_nDepth-1);
-		int nX = Min(m_nWidth-2, Max(0, (int)fX));
-		int nY = Min(m_nHeight-2, Max(0, (int)fY));
-		int nZ = Min(m_nDepth-2, Max(0, (int)fZ));
-		float fRatioX = fX - nX;
-		float fRatioY = fY - nY;
-		float fRatioZ = fZ - nZ;
-		float *pValue = (float *)((unsigned long)m_pBuffer + m_nElementSize * (m_nWidth * (m_nHeight * nZ + nY) + nX));
-		float *pValue2 = (float *)((unsigned long)m_pBuffer + m_nElementSize * (m_nWidth * (m_nHeight * (nZ+1) + nY) + nX));
-		for(int i=0; i<m_nChannels; i++)
+		switch(m_nDataType)
 		{
-			p[i] =	pValue[0] * (1-fRatioX) * (1-fRatioY) * (1-fRatioZ) +
-					pValue[m_nChannels*1] * (fRatioX) * (1-fRatioY) * (1-fRatioZ) +
-					pValue[m_nChannels*m_nWidth] * (1-fRatioX) * (fRatioY) * (1-fRatioZ) +
-					pValue[m_nChannels*(m_nWidth+1)] * (fRatioX) * (fRatioY) * (1-fRatioZ) +
-					pValue2[0] * (1-fRatioX) * (1-fRatioY) * (fRatioZ) +
-					pValue2[m_nChannels*1] * (fRatioX) * (1-fRatioY) * (fRatioZ) +
-					pValue2[m_nChannels*m_nWidth] * (1-fRatioX) * (fRatioY) * (fRatioZ) +
-					pValue2[m_nChannels*(m_nWidth+1)] * (fRatioX) * (fRatioY) * (fRatioZ);
-			pValue++;
-			pValue2++;
+			case HalfFloatType: InterpolateAs<SHalf>(p, x, y, z); break;
+			case UnsignedShortType: InterpolateAs<unsigned short>(p, x, y, z); break;
+			case UnsignedByteType: InterpolateAs<unsigned char>(p, x, y, z); break;
+			default: InterpolateAs<float>(p, x, y, z); break;
 		}
 	}
 
-	void Init(const int nWidth, const int nHeight, const int nDepth, const int nDataType, const int nChannels=1, void *pBuffer=NULL)
+	// Makes this a copy of the float buffer buf (with up to 4 channels) stored as HalfFloatType or UnsignedShortType,
+	// which halves its size. Each channel of an UnsignedShortType copy is scaled to fit its largest value, and negative values become 0.
+	// With FloatType, buf can be of any type, and the copy holds the values Interpolate() would read (with the scales applied).
+	void Convert(const C3DBuffer &buf, const int nDataType);
+	// Reorders the elements into nLayout (CTexture uploads a LinearLayout copy of buffers in any other layout)
+	void SetLayout(const int nLayout);
+
+	// A buffer passed in as pBuffer must be GetBufferSize() bytes long, which is larger than the volume for BrickLayout
+	void Init(const int nWidth, const int nHeight, const int nDepth, const int nDataType, const int nChannels=1, void *pBuffer=NULL, const int nLayout=LinearLayout)
 	{
+		// Normalized types default to the full range of the type mapping to [0, 1]
+		float fScale = nDataType == UnsignedShortType ? 1.0f / 65535.0f : nDataType == UnsignedByteType ? 1.0f / 255.0f : 1.0f;
+		for(int i=0; i<4; i++)
+			m_fScale[i] = fScale;
+
 		// If the buffer is already initialized to the specified settings, then nothing needs to be done
-		if(m_pAlloc && m_nWidth == nWidth && m_nHeight == nHeight && m_nDataType == nDataType && m_nChannels == nChannels)
+		if(m_pAlloc && m_nWidth == nWidth && m_nHeight == nHeight && m_nDepth == nDepth && m_nDataType == nDataType && m_nChannels == nChannels && m_nLayout == nLayout)
 			return;
 
 		Cleanup();
@@ -209,6 +581,10 @@ public:
 		m_nDataType = nDataType;
 		m_nChannels = nChannels;
 		m_nElementSize = m_nChannels * GetDataTypeSize(m_nDataType);
+		m_nLayout = nLayout;
+		m_nElementCount = (size_t)m_nWidth * m_nHeight * m_nDepth;
+		if(m_nLayout == BrickLayout)
+			InitBricks();
 		if(pBuffer)
 			m_pBuffer = pBuffer;
 		else
@@ -222,9 +598,14 @@ public:
 	{
 		if(m_pAlloc)
 		{
-			delete m_pAlloc;
+			delete[] (unsigned char *)m_pAlloc;
 			m_pAlloc = m_pBuffer = NULL;
 		}
+		if(m_pAxisOffset)
+		{
+			delete[] m_pAxisOffset;
+			m_pAxisOffset = NULL;
+		}
 	}
 
 	int GetWidth() const 		{ return m_nWidth; }
@@ -232,7 +613,10 @@ public:
 	int GetDepth() const		{ return m_nDepth; }
 	int GetDataType() const		{ return m_nDataType; }
 	int GetChannels() const		{ return m_nChannels; }
-	int GetBufferSize() const	{ return m_nWidth * m_nHeight * m_nDepth * m_nElementSize; }
+	int GetLayout() const		{ return m_nLayout; }
+	float GetScale(const int i) const			{ return m_fScale[i]; }
+	void SetScale(const int i, const float f)	{ m_fScale[i] = f; }
+	size_t GetBufferSize() const	{ return m_nElementCount * m_nElementSize; }
 	void *GetBuffer() const		{ return m_pBuffer; }
 
 	void ClearBuffer()			{ memset(m_pBuffer, 0, GetBufferSize()); }
@@ -242,17 +626,25 @@ public:
 		ASSERT(*this == buf);
 		SWAP(m_pAlloc, buf.m_pAlloc, pTemp);
 		SWAP(m_pBuffer, buf.m_pBuffer, pTemp);
+		size_t *pOffsetTemp;
+		SWAP(m_pAxisOffset, buf.m_pAxisOffset, pOffsetTemp);
+		for(int i=0; i<4; i++)
+		{
+			float fTemp;
+			SWAP(m_fScale[i], buf.m_fScale[i], fTemp);
+		}
 	}
 
 	float LinearSample2D(int nChannel, float x, float y)
 	{
+		ASSERT(m_nLayout == LinearLayout);
 		x = Min(Max(x, 0.0001f), 0.9999f);
 		y = Min(Max(y, 0.0001f), 0.9999f);
 		x *= m_nWidth;
 		y *= m_nHeight;
 		int n[2] = {(int)x, (int)y};
 		float fRatio[2] = {x - n[0], y - n[1]};
-		float *pBase = (float *)((unsigned int)m_pBuffer + (m_nWidth * n[1] + n[0]) * m_nChannels * sizeof(float));
+		float *pBase = (float *)m_pBuffer + ((size_t)m_nWidth * n[1] + n[0]) * m_nChannels;
 		//if(n[0] == m_nWidth-1 || n[1] == m_nHeight-1)
 			return pBase[nChannel];
 		float *p[4] = {
@@ -268,14 +660,113 @@ public:
 	}
 };
 
+/*******************************************************************************
+* Class: C4DBuffer
+********************************************************************************
+* A float-only relative of C3DBuffer with a fourth axis, for lookup tables that
+* depend on four parameters. The x axis varies fastest and the w axis slowest.
+* Interpolate() takes normalized coordinates like C3DBuffer's and blends the
+* 16 elements around the point (quadrilinear interpolation).
+*******************************************************************************/
+class C4DBuffer
+{
+protected:
+	int m_nSize[4];				// The number of elements along the x, y, z, and w axes
+	int m_nChannels;			// The number of floats stored in each element
+	float *m_pBuffer;
+
+	C4DBuffer(const C4DBuffer &buf);		// Not implemented (tables are too big to copy by accident)
+	void operator=(const C4DBuffer &buf);
+
+public:
+	C4DBuffer()						{ m_pBuffer = NULL; }
+	C4DBuffer(const int nWidth, const int nHeight, const int nDepth, const int nLength, const int nChannels=1)
+	{
+		m_pBuffer = NULL;
+		Init(nWidth, nHeight, nDepth, nLength, nChannels);
+	}
+	~C4DBuffer()					{ Cleanup(); }
+
+	void Init(const int nWidth, const int nHeight, const int nDepth, const int nLength, const int nChannels=1)
+	{
+		Cleanup();
+		m_nSize[0] = nWidth;
+		m_nSize[1] = nHeight;
+		m_nSize[2] = nDepth;
+		m_nSize[3] = nLength;
+		m_nChannels = nChannels;
+		m_pBuffer = new float[GetElementCount() * m_nChannels];
+	}
+	void Cleanup()
+	{
+		delete[] m_pBuffer;
+		m_pBuffer = NULL;
+	}
+
+	int GetWidth() const		{ return m_nSize[0]; }
+	int GetHeight() const		{ return m_nSize[1]; }
+	int GetDepth() const		{ return m_nSize[2]; }
+	int GetLength() const		{ return m_nSize[3]; }
+	int GetChannels() const		{ return m_nChannels; }
+	size_t GetElementCount() const	{ return (size_t)m_nSize[0] * m_nSize[1] * m_nSize[2] * m_nSize[3]; }
+	size_t GetBufferSize() const	{ return GetElementCount() * m_nChannels * sizeof(float); }
+	float *GetBuffer() const	{ return m_pBuffer; }
+	void ClearBuffer()			{ memset(m_pBuffer, 0, GetBufferSize()); }
+
+	float *operator()(const int x, const int y, const int z, const int w)
+	{
+		return m_pBuffer + m_nChannels * (((size_t)m_nSize[1] * ((size_t)m_nSize[2] * w + z) + y) * m_nSize[0] + x);
+	}
+
+	void Interpolate(float *p, const float x, const float y, const float z, const float w) const
+	{
+		// Find the element below the point and the ratio to the next one along each axis
+		const float fCoord[4] = {x, y, z, w};
+		float fRatio[4];
+		size_t nStride[4];
+		size_t nOffset = 0;
+		size_t nStep = m_nChannels;
+		for(int d=0; d<4; d++)
+		{
+			float f = fCoord[d] * (m_nSize[d]-1);
+			int n = Min(m_nSize[d]-2, Max(0, (int)f));
+			fRatio[d] = f - n;
+			nStride[d] = nStep;
+			nOffset += n * nStep;
+			nStep *= m_nSize[d];
+		}
+
+		// Blend pairs of elements along x, weighted by the other three axes
+		for(int i=0; i<m_nChannels; i++)
+			p[i] = 0;
+		for(int nCorner=0; nCorner<8; nCorner++)
+		{
+			float fWeight = 1;
+			const float *pValue = m_pBuffer + nOffset;
+			for(int d=1; d<4; d++)
+			{
+				if(nCorner & (1 << (d-1)))
+				{
+					fWeight *= fRatio[d];
+					pValue += nStride[d];
+				}
+				else
+					fWeight *= 1 - fRatio[d];
+			}
+			for(int i=0; i<m_nChannels; i++)
+				p[i] += (pValue[i] * (1-fRatio[0]) + pValue[m_nChannels+i] * fRatio[0]) * fWeight;
+		}
+	}
+};
+
 /*******************************************************************************
 * Class: CPixelBuffer
 ********************************************************************************
 * This class implements a general-purpose pixel buffer to be used for anything.
 * It is often used by CTexture to set up OpenGL textures, so many of the
 * parameters you use to initialize it look like the parameters you would pass
-* to glTexImage1D or glTexImage2D. Some of the standard pixel buffer routines
-* call fast MMX functions implemented in PixelBuffer.asm.
+* to glTexImage1D or glTexImage2D. Use GetView() for typed access to the
+* pixels.
 *******************************************************************************/
 class CPixelBuffer : public C3DBuffer
 {
@@ -289,20 +780,23 @@ public:
 		m_nFormat = nFormat;
 	}
 
-	int GetFormat()				{ return m_nFormat; }
+	int GetFormat() const		{ return m_nFormat; }
 
-	void Init(int nWidth, int nHeight, int nDepth, int nChannels=3, int nFormat=GL_RGB, int nDataType=GL_UNSIGNED_BYTE, void *pBuffer=NULL)
+	void Init(int nWidth, int nHeight, int nDepth, int nChannels=3, int nFormat=GL_RGB, int nDataType=GL_UNSIGNED_BYTE, void *pBuffer=NULL, int nLayout=LinearLayout)
 	{
-		C3DBuffer::Init(nWidth, nHeight, nDepth, nDataType, nChannels, pBuffer);
+		C3DBuffer::Init(nWidth, nHeight, nDepth, nDataType, nChannels, pBuffer, nLayout);
 		m_nFormat = nFormat;
 	}
 
 	// Miscellaneous initalization routines
 	void MakeCloudCell(float fExpose, float fSizeDisc);
+	// Fills a 2-channel unsigned byte volume (in either layout) with fBm noise
 	void Make3DNoise(int nSeed);
 	void MakeGlow1D();
-	void MakeOpticalDepthBuffer(float fInnerRadius, float fOuterRadius, float fRayleighScaleHeight, float fMieScaleHeight);
-	void MakePhaseBuffer(float ESun, float Kr, float Km, float g);
+	// Builds an nSize x nSize table, integrating nSamples points along each ray (the rows are split across pPool's threads if it is not NULL)
+	void MakeOpticalDepthBuffer(float fInnerRadius, float fOuterRadius, float fRayleighScaleHeight, float fMieScaleHeight, int nSize=128, int nSamples=10, CThreadPool *pPool=NULL);
+	// Builds an nSize x 1 table of the Rayleigh and Mie phase functions (see PhaseCoord() in Scattering.h for its x coordinate)
+	void MakePhaseBuffer(float ESun, float Kr, float Km, float g, int nSize=1024);
 };
 
 #endif // __PixelBuffer_h__
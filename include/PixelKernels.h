@@ -0,0 +1,314 @@
+// PixelKernels.h
+//
+
+#ifndef __PixelKernels_h__
+#define __PixelKernels_h__
+
+#include "PixelBuffer.h"
+#include "SIMDMath.h"
+
+// Everything one row of the optical depth table needs, shared by all the rows being built
+struct SOpticalDepthJob
+{
+	float *pTable;
+	int nSize;
+	int nSamples;
+	float fInnerRadius;
+	float fOuterRadius;
+	float fScale;
+	float fRayleighScaleHeight;
+	float fMieScaleHeight;
+};
+
+#define SHADOW_MARKER	-1.0f		// Density ratios are never negative, so this marks texels for the soft-shadow pass
+
+// Builds one angle row, running a vector's worth of heights through the sample loop at a time
+template <class F> void MakeOpticalDepthRow(const SOpticalDepthJob &job, int nAngle)
+{
+	const int nSize = job.nSize;
+	const float fInnerRadius = job.fInnerRadius;
+
+	// As the y tex coord goes from 0 to 1, the angle goes from 0 to 180 degrees
+	float fCos = 1.0f - (nAngle+nAngle) / (float)nSize;
+	F fRayX = sqrtf(1.0f - fCos*fCos), fRayY = fCos;	// Ray pointing to the viewpoint (sin(acos(x)) is sqrt(1-x^2))
+
+	F fInnerRadius2 = fInnerRadius*fInnerRadius;
+	F fOuterRadius2 = job.fOuterRadius*job.fOuterRadius;
+	F fRayleighFactor = -1.0f / job.fRayleighScaleHeight;
+	F fMieFactor = -1.0f / job.fMieScaleHeight;
+	F fInvSamples = 1.0f / job.nSamples;
+
+	SIMD_ALIGN float fLane[4][F::Width];
+	float *pRow = job.pTable + (size_t)nAngle * nSize * 4;
+	for(int nHeight=0; nHeight<nSize; nHeight+=F::Width)
+	{
+		// As the x tex coord goes from 0 to 1, the height goes from the bottom of the atmosphere to the top
+		for(int l=0; l<F::Width; l++)
+			fLane[0][l] = DELTA + fInnerRadius + ((job.fOuterRadius - fInnerRadius) * (nHeight+l)) / nSize;
+		F fHeight = F::Load(fLane[0]);		// The camera is at (0, fHeight, 0)
+
+		// If the ray from the camera intersects the inner radius (i.e. the planet), then this spot is not visible from the viewpoint
+		F B = fHeight * fRayY * 2.0f;
+		F Bsq = B * B;
+		F Cpart = fHeight * fHeight;
+		F fDet = Bsq - (Cpart - fInnerRadius2) * 4.0f;
+		F fRoot = Sqrt(Max(fDet, 0.0f));
+		F bVisible = (fDet < 0.0f) | (((-B - fRoot) * 0.5f <= 0.0f) & ((-B + fRoot) * 0.5f <= 0.0f));
+		F fAltitude = (fHeight - fInnerRadius) * job.fScale;
+		F fRayleighDensityRatio = Select(bVisible, Exp(fAltitude * fRayleighFactor), SHADOW_MARKER);
+		F fMieDensityRatio = Select(bVisible, Exp(fAltitude * fMieFactor), SHADOW_MARKER);
+
+		// Determine where the ray intersects the outer radius (the top of the atmosphere)
+		// This is the end of our ray for determining the optical depth (the camera is the start)
+		fDet = Bsq - (Cpart - fOuterRadius2) * 4.0f;
+		F fFar = (Sqrt(fDet) - B) * 0.5f;
+
+		// Next determine the length of each sample, scale the sample ray, and make sure position checks are at the center of a sample ray
+		F fSampleLength = fFar * fInvSamples;
+		F fScaledLength = fSampleLength * job.fScale;
+		F fSampleX = fRayX * fSampleLength, fSampleY = fRayY * fSampleLength;
+		F fPosX = fSampleX * 0.5f, fPosY = fHeight + fSampleY * 0.5f;
+
+		// Iterate through the samples to sum up the optical depth for the distance the ray travels through the atmosphere
+		F fRayleighDepth = 0.0f;
+		F fMieDepth = 0.0f;
+		for(int i=0; i<job.nSamples; i++)
+		{
+			F fSampleHeight = Sqrt(fPosX*fPosX + fPosY*fPosY);
+			F fSampleAltitude = Max((fSampleHeight - fInnerRadius) * job.fScale, 0.0f);
+			fRayleighDepth += Exp(fSampleAltitude * fRayleighFactor);
+			fMieDepth += Exp(fSampleAltitude * fMieFactor);
+			fPosX += fSampleX;
+			fPosY += fSampleY;
+		}
+
+		// Store the results for Rayleigh to the light source, Rayleigh to the camera, Mie to the light source, and Mie to the camera
+		fRayleighDensityRatio.Store(fLane[0]);
+		(fRayleighDepth * fScaledLength).Store(fLane[1]);
+		fMieDensityRatio.Store(fLane[2]);
+		(fMieDepth * fScaledLength).Store(fLane[3]);
+		int nLanes = nSize - nHeight < F::Width ? nSize - nHeight : F::Width;
+		float *pTexel = pRow + nHeight * 4;
+		for(int l=0; l<nLanes; l++)
+		{
+			*pTexel++ = fLane[0][l];
+			*pTexel++ = fLane[1][l];
+			*pTexel++ = fLane[2][l];
+			*pTexel++ = fLane[3][l];
+		}
+	}
+}
+
+// Fills in one row of CPixelBuffer::MakeCloudCell()'s intensities, a vector's worth of pixels at a time (2^x is e^(x ln 2))
+template <class F> void MakeCloudRow(float *pRow, int nWidth, float fDy, float fExpose, float fSizeDisc)
+{
+	SIMD_ALIGN float fLane[F::Width];
+	for(int x=0; x<nWidth; x+=F::Width)
+	{
+		for(int l=0; l<F::Width; l++)
+			fLane[l] = (x+l+0.5f)/nWidth - 0.5f;
+		F fDx = F::Load(fLane);
+		F fDist = Sqrt(fDx*fDx + fDy*fDy);
+		F fIntensity = F(2.0f) - Min(F(2.0f), Exp(Max(fDist-fSizeDisc, 0.0f) * (fExpose * 0.693147181f)));
+		fIntensity.Store(fLane);
+
+		int nLanes = Min(nWidth - x, (int)F::Width);
+		for(int l=0; l<nLanes; l++)
+			pRow[x+l] = fLane[l];
+	}
+}
+
+/*******************************************************************************
+* Vector interpolation
+********************************************************************************
+* The same blends as TBuffer's Interpolate() functions, for F::Width points at
+* once, with channel i of every lane returned in pOut[i]. The corners are
+* fetched with the gather policy G (see TGather in SIMD.h), using int offsets
+* from the start of the buffer, so a table can't hold more than 2^31 elements.
+* Tables of normalized types are blended as raw integers and scaled once at the
+* end, like TBuffer does.
+*
+* InterpolateBatch() runs them over arrays of nCount coordinates and writes the
+* results in SoA form, with channel i of point n in ppOut[i][n]. CKernels binds
+* the versions for 4-channel float tables.
+*******************************************************************************/
+
+// Finds the cell each lane of x (a normalized coordinate) falls in along an axis of nSize elements, and the ratio to the next one
+template <class F> inline F GetCell(const F &x, const int nSize, F &fRatio)
+{
+	F f = x * (float)(nSize-1);
+	F fCell = Truncate(Min(Max(f, F(0.0f)), F((float)(nSize-2))));
+	fRatio = f - fCell;
+	return fCell;
+}
+
+// Fetches every channel of an element for each lane, using G's transposing Gather4() for 4-channel tables
+template <class F, class G, class T, int Channels> inline void GatherChannels(const T *pBase, const int *pOffset, F *pOut)
+{
+	if(Channels == 4)
+		G::Gather4(pBase, pOffset, pOut);
+	else
+	{
+		for(int i=0; i<Channels; i++)
+			pOut[i] = G::Gather(pBase + i, pOffset);
+	}
+}
+
+// Multiplies each channel by the buffer's scale if T is a normalized type
+template <class F, class T, int Channels> inline void ApplyScale(const TBuffer<T, Channels> &buf, F *pOut)
+{
+	if(TStorage<T>::Normalized)
+	{
+		for(int i=0; i<Channels; i++)
+			pOut[i] *= buf.GetScale(i);
+	}
+}
+
+template <class F, class G, class T, int Channels> inline void Interpolate(const TBuffer<T, Channels> &buf, const F &x, F *pOut)
+{
+	F fRatioX;
+	F fCellX = GetCell(x, buf.GetWidth(), fRatioX);
+	F fInvX = F(1.0f) - fRatioX;
+
+	SIMD_ALIGN float fCell[F::Width];
+	SIMD_ALIGN int nOffset[F::Width];
+	fCellX.Store(fCell);
+	for(int l=0; l<F::Width; l++)
+		nOffset[l] = (int)fCell[l] * Channels;
+
+	const T *pBase = buf.GetBuffer();
+	F v[2][Channels];
+	GatherChannels<F, G, T, Channels>(pBase, nOffset, v[0]);
+	GatherChannels<F, G, T, Channels>(pBase + Channels, nOffset, v[1]);
+	for(int i=0; i<Channels; i++)
+		pOut[i] = v[0][i] * fInvX + v[1][i] * fRatioX;
+	ApplyScale(buf, pOut);
+}
+
+template <class F, class G, class T, int Channels> inline void Interpolate(const TBuffer<T, Channels> &buf, const F &x, const F &y, F *pOut)
+{
+	F fRatioX, fRatioY;
+	F fCellX = GetCell(x, buf.GetWidth(), fRatioX);
+	F fCellY = GetCell(y, buf.GetHeight(), fRatioY);
+	F fInvX = F(1.0f) - fRatioX;
+	F fInvY = F(1.0f) - fRatioY;
+
+	SIMD_ALIGN float fCell[2][F::Width];
+	SIMD_ALIGN int nOffset[F::Width];
+	fCellX.Store(fCell[0]);
+	fCellY.Store(fCell[1]);
+	const int nRow = (int)buf.GetRowStride();
+	for(int l=0; l<F::Width; l++)
+		nOffset[l] = (int)fCell[1][l] * nRow + (int)fCell[0][l] * Channels;
+
+	const T *pBase = buf.GetBuffer();
+	F v[4][Channels];
+	GatherChannels<F, G, T, Channels>(pBase, nOffset, v[0]);
+	GatherChannels<F, G, T, Channels>(pBase + Channels, nOffset, v[1]);
+	GatherChannels<F, G, T, Channels>(pBase + nRow, nOffset, v[2]);
+	GatherChannels<F, G, T, Channels>(pBase + nRow + Channels, nOffset, v[3]);
+	for(int i=0; i<Channels; i++)
+		pOut[i] = v[0][i] * fInvX * fInvY + v[1][i] * fRatioX * fInvY + v[2][i] * fInvX * fRatioY + v[3][i] * fRatioX * fRatioY;
+	ApplyScale(buf, pOut);
+}
+
+template <class F, class G, class T, int Channels> inline void Interpolate(const TBuffer<T, Channels> &buf, const F &x, const F &y, const F &z, F *pOut)
+{
+	F fRatioX, fRatioY, fRatioZ;
+	F fCellX = GetCell(x, buf.GetWidth(), fRatioX);
+	F fCellY = GetCell(y, buf.GetHeight(), fRatioY);
+	F fCellZ = GetCell(z, buf.GetDepth(), fRatioZ);
+	F fInvX = F(1.0f) - fRatioX;
+	F fInvY = F(1.0f) - fRatioY;
+	F fInvZ = F(1.0f) - fRatioZ;
+
+	SIMD_ALIGN float fCell[3][F::Width];
+	SIMD_ALIGN int nOffset[F::Width];
+	fCellX.Store(fCell[0]);
+	fCellY.Store(fCell[1]);
+	fCellZ.Store(fCell[2]);
+	const int nRow = (int)buf.GetRowStride();
+	const int nSlice = (int)buf.GetSliceStride();
+	for(int l=0; l<F::Width; l++)
+		nOffset[l] = (int)fCell[2][l] * nSlice + (int)fCell[1][l] * nRow + (int)fCell[0][l] * Channels;
+
+	const T *pBase = buf.GetBuffer();
+	F v[8][Channels];
+	for(int nCorner=0; nCorner<8; nCorner++)
+		GatherChannels<F, G, T, Channels>(pBase + ((nCorner & 4) ? nSlice : 0) + ((nCorner & 2) ? nRow : 0) + ((nCorner & 1) ? Channels : 0), nOffset, v[nCorner]);
+	for(int i=0; i<Channels; i++)
+	{
+		pOut[i] = v[0][i] * fInvX * fInvY * fInvZ +
+				  v[1][i] * fRatioX * fInvY * fInvZ +
+				  v[2][i] * fInvX * fRatioY * fInvZ +
+				  v[3][i] * fRatioX * fRatioY * fInvZ +
+				  v[4][i] * fInvX * fInvY * fRatioZ +
+				  v[5][i] * fRatioX * fInvY * fRatioZ +
+				  v[6][i] * fInvX * fRatioY * fRatioZ +
+				  v[7][i] * fRatioX * fRatioY * fRatioZ;
+	}
+	ApplyScale(buf, pOut);
+}
+
+// Loads a vector of coordinates starting at pIn[nStart], padding the last one by repeating its last coordinate
+template <class F> inline F LoadCoords(const float *pIn, int nStart, int nLanes)
+{
+	if(nLanes == F::Width)
+		return F::LoadUnaligned(pIn + nStart);
+	SIMD_ALIGN float f[F::Width];
+	for(int l=0; l<F::Width; l++)
+		f[l] = pIn[nStart + Min(l, nLanes-1)];
+	return F::Load(f);
+}
+
+// Writes the first nLanes lanes of each channel in v to ppOut[i][nStart...]
+template <class F, int Channels> inline void StoreChannels(const F *v, float *ppOut[Channels], int nStart, int nLanes)
+{
+	SIMD_ALIGN float f[F::Width];
+	for(int i=0; i<Channels; i++)
+	{
+		if(nLanes == F::Width)
+			v[i].StoreUnaligned(ppOut[i] + nStart);
+		else
+		{
+			v[i].Store(f);
+			for(int l=0; l<nLanes; l++)
+				ppOut[i][nStart + l] = f[l];
+		}
+	}
+}
+
+template <class F, class G, class T, int Channels> void InterpolateBatch(const TBuffer<T, Channels> &buf, const float *pX, int nCount, float *ppOut[Channels])
+{
+	F v[Channels];
+	for(int nStart=0; nStart<nCount; nStart+=F::Width)
+	{
+		int nLanes = Min(nCount - nStart, (int)F::Width);
+		Interpolate<F, G>(buf, LoadCoords<F>(pX, nStart, nLanes), v);
+		StoreChannels<F, Channels>(v, ppOut, nStart, nLanes);
+	}
+}
+
+template <class F, class G, class T, int Channels> void InterpolateBatch(const TBuffer<T, Channels> &buf, const float *pX, const float *pY, int nCount, float *ppOut[Channels])
+{
+	F v[Channels];
+	for(int nStart=0; nStart<nCount; nStart+=F::Width)
+	{
+		int nLanes = Min(nCount - nStart, (int)F::Width);
+		Interpolate<F, G>(buf, LoadCoords<F>(pX, nStart, nLanes), LoadCoords<F>(pY, nStart, nLanes), v);
+		StoreChannels<F, Channels>(v, ppOut, nStart, nLanes);
+	}
+}
+
+template <class F, class G, class T, int Channels> void InterpolateBatch(const TBuffer<T, Channels> &buf, const float *pX, const float *pY, const float *pZ, int nCount, float *ppOut[Channels])
+{
+	F v[Channels];
+	for(int nStart=0; nStart<nCount; nStart+=F::Width)
+	{
+		int nLanes = Min(nCount - nStart, (int)F::Width);
+		Interpolate<F, G>(buf, LoadCoords<F>(pX, nStart, nLanes), LoadCoords<F>(pY, nStart, nLanes), LoadCoords<F>(pZ, nStart, nLanes), v);
+		StoreChannels<F, Channels>(v, ppOut, nStart, nLanes);
+	}
+}
+
+#endif // __PixelKernels_h__
@@ -0,0 +1,25 @@
+// Platform.h
+//
+
+#ifndef __Platform_h__
+#define __Platform_h__
+
+// Small wrappers for the OS calls that the engine's own code makes in more than
+// one place (the headless renderer, the startup graph, and the table cache)
+
+// Seconds from a fixed but arbitrary point, with the resolution of the performance counter
+inline double GetTimerSeconds()
+{
+	LARGE_INTEGER nFrequency, nNow;
+	QueryPerformanceFrequency(&nFrequency);
+	QueryPerformanceCounter(&nNow);
+	return (double)nNow.QuadPart / (double)nFrequency.QuadPart;
+}
+
+// Creates a directory, and returns true if it's there afterwards (whether or not it was before)
+inline bool MakeDirectory(const char *pszPath)
+{
+	return CreateDirectory(pszPath, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+}
+
+#endif // __Platform_h__
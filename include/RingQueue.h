@@ -0,0 +1,53 @@
+// RingQueue.h
+//
+
+#ifndef __RingQueue_h__
+#define __RingQueue_h__
+
+/*******************************************************************************
+* Template: TRingQueue
+********************************************************************************
+* A fixed-size FIFO for passing Ts from one writer thread to one reader thread
+* without locks. Size has to be a power of two. The writer only moves the tail
+* and the reader only moves the head, each with an InterlockedExchange() after
+* copying the item (which is also a full memory barrier), so neither thread
+* ever waits: Push() returns false when the queue is full and Pop() returns
+* false when it is empty.
+*******************************************************************************/
+template <class T, int Size> class TRingQueue
+{
+protected:
+	T m_item[Size];
+	volatile LONG m_nHead;		// How many items have been popped
+	volatile LONG m_nTail;		// How many items have been pushed
+
+public:
+	TRingQueue()				{ m_nHead = m_nTail = 0; }
+
+	// The writer's side
+	bool Push(const T &t)
+	{
+		unsigned int nTail = (unsigned int)m_nTail;
+		if(nTail - (unsigned int)m_nHead == Size)
+			return false;
+		m_item[nTail & (Size-1)] = t;
+		InterlockedExchange(&m_nTail, (LONG)(nTail + 1));
+		return true;
+	}
+
+	// The reader's side
+	bool Pop(T &t)
+	{
+		unsigned int nHead = (unsigned int)m_nHead;
+		if(nHead == (unsigned int)m_nTail)
+			return false;
+		t = m_item[nHead & (Size-1)];
+		InterlockedExchange(&m_nHead, (LONG)(nHead + 1));
+		return true;
+	}
+
+	// Only exact if neither thread is using the queue
+	int GetCount()				{ return (int)((unsigned int)m_nTail - (unsigned int)m_nHead); }
+};
+
+#endif // __RingQueue_h__
@@ -0,0 +1,371 @@
+// SIMD.h
+//
+
+#ifndef __SIMD_h__
+#define __SIMD_h__
+
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#include <math.h>
+#include <immintrin.h>		// Visual C++ compiles the AVX intrinsics without /arch:AVX, so CFloat8 is always built
+#include "Storage.h"
+
+#define SIMD_ALIGN		__declspec(align(32))
+
+/*******************************************************************************
+* Class: CFloat1
+********************************************************************************
+* The scalar fallback, with the same interface as CFloat4 but one float wide,
+* so the same kernel templates run on CPUs without SSE2. Masks are floats with
+* all their bits set, just like one lane of an SSE mask, so the bitwise
+* operators and Select() work on the raw bits.
+*******************************************************************************/
+class CFloat1
+{
+public:
+	enum { Width = 1 };
+	float m;
+
+	CFloat1()									{}
+	CFloat1(const float f)						{ m = f; }
+
+	static CFloat1 Load(const float *p)			{ return *p; }
+	static CFloat1 LoadUnaligned(const float *p){ return *p; }
+	void Store(float *p) const					{ *p = m; }
+	void StoreUnaligned(float *p) const			{ *p = m; }
+	static void EndBatch()						{}
+
+	static CFloat1 FromBits(unsigned int n)		{ CFloat1 f; *(unsigned int *)&f.m = n; return f; }
+	static CFloat1 Mask(bool b)					{ return FromBits(b ? 0xFFFFFFFF : 0); }
+	unsigned int GetBits() const				{ return *(const unsigned int *)&m; }
+
+	CFloat1 operator-() const					{ return -m; }
+	CFloat1 operator+(const CFloat1 &v) const	{ return m + v.m; }
+	CFloat1 operator-(const CFloat1 &v) const	{ return m - v.m; }
+	CFloat1 operator*(const CFloat1 &v) const	{ return m * v.m; }
+	CFloat1 operator/(const CFloat1 &v) const	{ return m / v.m; }
+	void operator+=(const CFloat1 &v)			{ m += v.m; }
+	void operator-=(const CFloat1 &v)			{ m -= v.m; }
+	void operator*=(const CFloat1 &v)			{ m *= v.m; }
+	void operator/=(const CFloat1 &v)			{ m /= v.m; }
+
+	CFloat1 operator<(const CFloat1 &v) const	{ return Mask(m < v.m); }
+	CFloat1 operator<=(const CFloat1 &v) const	{ return Mask(m <= v.m); }
+	CFloat1 operator>(const CFloat1 &v) const	{ return Mask(m > v.m); }
+	CFloat1 operator>=(const CFloat1 &v) const	{ return Mask(m >= v.m); }
+	CFloat1 operator&(const CFloat1 &v) const	{ return FromBits(GetBits() & v.GetBits()); }
+	CFloat1 operator|(const CFloat1 &v) const	{ return FromBits(GetBits() | v.GetBits()); }
+};
+
+inline CFloat1 Min(const CFloat1 &a, const CFloat1 &b)		{ return a.m < b.m ? a : b; }
+inline CFloat1 Max(const CFloat1 &a, const CFloat1 &b)		{ return a.m > b.m ? a : b; }
+inline CFloat1 Sqrt(const CFloat1 &a)						{ return sqrtf(a.m); }
+inline CFloat1 Truncate(const CFloat1 &a)					{ return (float)(int)a.m; }
+inline CFloat1 Select(const CFloat1 &mask, const CFloat1 &a, const CFloat1 &b)	{ return mask.GetBits() ? a : b; }
+inline int MoveMask(const CFloat1 &mask)					{ return mask.GetBits() >> 31; }
+inline CFloat1 Abs(const CFloat1 &a)						{ return CFloat1::FromBits(a.GetBits() & 0x7FFFFFFF); }
+inline CFloat1 Floor(const CFloat1 &a)						{ return floorf(a.m); }
+inline CFloat1 Pow2(const CFloat1 &n)						{ return CFloat1::FromBits((unsigned int)((int)n.m + 0x7F) << 23); }
+inline CFloat1 SplitExponent(const CFloat1 &a, CFloat1 &fExponent)
+{
+	unsigned int n = a.GetBits();
+	fExponent = (float)((int)(n >> 23) - 126);
+	return CFloat1::FromBits((n & 0x807FFFFF) | 0x3F000000);
+}
+
+/*******************************************************************************
+* Class: CFloat4
+********************************************************************************
+* This class wraps an SSE register holding 4 floats so that kernels can be
+* written with normal arithmetic operators and then compiled for any vector
+* width. Comparison operators return a mask (all bits set in lanes where the
+* comparison is true) which can be passed to Select() to blend two values.
+* Kernels are written as templates on the vector type, so any new wrapper only
+* has to provide the same set of operators and functions.
+*******************************************************************************/
+class CFloat4
+{
+public:
+	enum { Width = 4 };
+	__m128 m;
+
+	CFloat4()									{}
+	CFloat4(const __m128 v)						{ m = v; }
+	CFloat4(const float f)						{ m = _mm_set1_ps(f); }
+
+	static CFloat4 Load(const float *p)			{ return _mm_load_ps(p); }
+	static CFloat4 LoadUnaligned(const float *p){ return _mm_loadu_ps(p); }
+	void Store(float *p) const					{ _mm_store_ps(p, m); }
+	void StoreUnaligned(float *p) const			{ _mm_storeu_ps(p, m); }
+	static void EndBatch()						{}
+
+	CFloat4 operator-() const					{ return _mm_sub_ps(_mm_setzero_ps(), m); }
+	CFloat4 operator+(const CFloat4 &v) const	{ return _mm_add_ps(m, v.m); }
+	CFloat4 operator-(const CFloat4 &v) const	{ return _mm_sub_ps(m, v.m); }
+	CFloat4 operator*(const CFloat4 &v) const	{ return _mm_mul_ps(m, v.m); }
+	CFloat4 operator/(const CFloat4 &v) const	{ return _mm_div_ps(m, v.m); }
+	void operator+=(const CFloat4 &v)			{ m = _mm_add_ps(m, v.m); }
+	void operator-=(const CFloat4 &v)			{ m = _mm_sub_ps(m, v.m); }
+	void operator*=(const CFloat4 &v)			{ m = _mm_mul_ps(m, v.m); }
+	void operator/=(const CFloat4 &v)			{ m = _mm_div_ps(m, v.m); }
+
+	CFloat4 operator<(const CFloat4 &v) const	{ return _mm_cmplt_ps(m, v.m); }
+	CFloat4 operator<=(const CFloat4 &v) const	{ return _mm_cmple_ps(m, v.m); }
+	CFloat4 operator>(const CFloat4 &v) const	{ return _mm_cmpgt_ps(m, v.m); }
+	CFloat4 operator>=(const CFloat4 &v) const	{ return _mm_cmpge_ps(m, v.m); }
+	CFloat4 operator&(const CFloat4 &v) const	{ return _mm_and_ps(m, v.m); }
+	CFloat4 operator|(const CFloat4 &v) const	{ return _mm_or_ps(m, v.m); }
+};
+
+inline CFloat4 Min(const CFloat4 &a, const CFloat4 &b)		{ return _mm_min_ps(a.m, b.m); }
+inline CFloat4 Max(const CFloat4 &a, const CFloat4 &b)		{ return _mm_max_ps(a.m, b.m); }
+inline CFloat4 Sqrt(const CFloat4 &a)						{ return _mm_sqrt_ps(a.m); }
+inline CFloat4 Truncate(const CFloat4 &a)					{ return _mm_cvtepi32_ps(_mm_cvttps_epi32(a.m)); }
+inline CFloat4 Select(const CFloat4 &mask, const CFloat4 &a, const CFloat4 &b)	{ return _mm_or_ps(_mm_and_ps(mask.m, a.m), _mm_andnot_ps(mask.m, b.m)); }
+inline int MoveMask(const CFloat4 &mask)					{ return _mm_movemask_ps(mask.m); }
+
+inline CFloat4 Abs(const CFloat4 &a)						{ return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.m); }
+
+// Rounds toward negative infinity (only valid for lanes that fit in an int)
+inline CFloat4 Floor(const CFloat4 &a)
+{
+	CFloat4 n = Truncate(a);
+	return n - ((n > a) & CFloat4(1.0f));		// Truncate rounds toward 0, so fix it up to be a floor
+}
+
+// Returns 2^n for lanes holding whole numbers from -126 to 127 by stuffing n into the exponent bits
+inline CFloat4 Pow2(const CFloat4 &n)
+{
+	__m128i e = _mm_add_epi32(_mm_cvttps_epi32(n.m), _mm_set1_epi32(0x7F));
+	return _mm_castsi128_ps(_mm_slli_epi32(e, 23));
+}
+
+// Like frexpf(): splits positive normal lanes into a mantissa in [0.5, 1) (returned) and a power of 2 (stored in fExponent)
+inline CFloat4 SplitExponent(const CFloat4 &a, CFloat4 &fExponent)
+{
+	__m128i i = _mm_castps_si128(a.m);
+	fExponent = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(i, 23), _mm_set1_epi32(126)));
+	i = _mm_or_si128(_mm_and_si128(i, _mm_set1_epi32(0x807FFFFF)), _mm_set1_epi32(0x3F000000));
+	return _mm_castsi128_ps(i);
+}
+
+
+/*******************************************************************************
+* Class: CFloat8
+********************************************************************************
+* The AVX version of CFloat4, holding 8 floats. The project is not built with
+* /arch:AVX (so the rest of the code still runs on any CPU), which means only
+* the kernels CKernels picks for CPUs with AVX may use this class. They call
+* EndBatch() before returning to code that uses the old SSE encodings.
+*******************************************************************************/
+class CFloat8
+{
+public:
+	enum { Width = 8 };
+	__m256 m;
+
+	CFloat8()									{}
+	CFloat8(const __m256 v)						{ m = v; }
+	CFloat8(const float f)						{ m = _mm256_set1_ps(f); }
+
+	static CFloat8 Load(const float *p)			{ return _mm256_load_ps(p); }
+	static CFloat8 LoadUnaligned(const float *p){ return _mm256_loadu_ps(p); }
+	void Store(float *p) const					{ _mm256_store_ps(p, m); }
+	void StoreUnaligned(float *p) const			{ _mm256_storeu_ps(p, m); }
+	static void EndBatch()						{ _mm256_zeroupper(); }	// Avoids the penalty for switching back to SSE code
+
+	CFloat8 operator-() const					{ return _mm256_sub_ps(_mm256_setzero_ps(), m); }
+	CFloat8 operator+(const CFloat8 &v) const	{ return _mm256_add_ps(m, v.m); }
+	CFloat8 operator-(const CFloat8 &v) const	{ return _mm256_sub_ps(m, v.m); }
+	CFloat8 operator*(const CFloat8 &v) const	{ return _mm256_mul_ps(m, v.m); }
+	CFloat8 operator/(const CFloat8 &v) const	{ return _mm256_div_ps(m, v.m); }
+	void operator+=(const CFloat8 &v)			{ m = _mm256_add_ps(m, v.m); }
+	void operator-=(const CFloat8 &v)			{ m = _mm256_sub_ps(m, v.m); }
+	void operator*=(const CFloat8 &v)			{ m = _mm256_mul_ps(m, v.m); }
+	void operator/=(const CFloat8 &v)			{ m = _mm256_div_ps(m, v.m); }
+
+	CFloat8 operator<(const CFloat8 &v) const	{ return _mm256_cmp_ps(m, v.m, _CMP_LT_OQ); }
+	CFloat8 operator<=(const CFloat8 &v) const	{ return _mm256_cmp_ps(m, v.m, _CMP_LE_OQ); }
+	CFloat8 operator>(const CFloat8 &v) const	{ return _mm256_cmp_ps(m, v.m, _CMP_GT_OQ); }
+	CFloat8 operator>=(const CFloat8 &v) const	{ return _mm256_cmp_ps(m, v.m, _CMP_GE_OQ); }
+	CFloat8 operator&(const CFloat8 &v) const	{ return _mm256_and_ps(m, v.m); }
+	CFloat8 operator|(const CFloat8 &v) const	{ return _mm256_or_ps(m, v.m); }
+};
+
+inline CFloat8 Min(const CFloat8 &a, const CFloat8 &b)		{ return _mm256_min_ps(a.m, b.m); }
+inline CFloat8 Max(const CFloat8 &a, const CFloat8 &b)		{ return _mm256_max_ps(a.m, b.m); }
+inline CFloat8 Sqrt(const CFloat8 &a)						{ return _mm256_sqrt_ps(a.m); }
+inline CFloat8 Truncate(const CFloat8 &a)					{ return _mm256_round_ps(a.m, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+inline CFloat8 Select(const CFloat8 &mask, const CFloat8 &a, const CFloat8 &b)	{ return _mm256_blendv_ps(b.m, a.m, mask.m); }
+inline int MoveMask(const CFloat8 &mask)					{ return _mm256_movemask_ps(mask.m); }
+
+inline CFloat8 Abs(const CFloat8 &a)						{ return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.m); }
+inline CFloat8 Floor(const CFloat8 &a)						{ return _mm256_floor_ps(a.m); }
+
+// AVX1 has no 256-bit integer instructions, so the bit twiddling below is done in two SSE halves
+inline CFloat8 Pow2(const CFloat8 &n)
+{
+	__m256i i = _mm256_cvttps_epi32(n.m);
+	__m128i lo = _mm_slli_epi32(_mm_add_epi32(_mm256_castsi256_si128(i), _mm_set1_epi32(0x7F)), 23);
+	__m128i hi = _mm_slli_epi32(_mm_add_epi32(_mm256_extractf128_si256(i, 1), _mm_set1_epi32(0x7F)), 23);
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_castsi128_ps(lo)), _mm_castsi128_ps(hi), 1);
+}
+
+inline CFloat8 SplitExponent(const CFloat8 &a, CFloat8 &fExponent)
+{
+	CFloat4 lo(_mm256_castps256_ps128(a.m)), hi(_mm256_extractf128_ps(a.m, 1));
+	CFloat4 fLoExponent, fHiExponent;
+	lo = SplitExponent(lo, fLoExponent);
+	hi = SplitExponent(hi, fHiExponent);
+	fExponent = _mm256_insertf128_ps(_mm256_castps128_ps256(fLoExponent.m), fHiExponent.m, 1);
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(lo.m), hi.m, 1);
+}
+
+/*******************************************************************************
+* Gathers
+********************************************************************************
+* Kernels that fetch from tables take a gather policy G along with F. G has a
+* static Gather() that loads one element per lane, lane l from
+* pBase[pOffset[l]] (pOffset must be aligned like a vector), and a Gather4()
+* that loads the 4 elements starting there and returns them transposed, with
+* element c of every lane in pOut[c] (for tables with 4 channels per element).
+* Both are templates on the element type T (any type in Storage.h), and both
+* return the elements converted to floats without any scaling.
+*
+* TGather fetches one lane at a time and works with every vector type, and
+* builds Gather4()'s vectors with one unaligned load per lane and a transpose.
+* SGatherAVX2 uses AVX2's vgatherdps with CFloat8 for Gather() on float
+* tables. For Gather4() it uses TGather's loads and transpose, since four
+* gathers measured slower (about 10.5 ns against 8.5 ns per bilinear lookup in
+* the optical depth table), but it converts half tables with F16C's vcvtph2ps,
+* which every CPU with AVX2 has. It only exists when the compiler has the AVX2
+* intrinsics (Visual C++ 2012 or later), so with older compilers the AVX2 level
+* binds TGather.
+*******************************************************************************/
+#if !defined(SIMD_AVX2_INTRINSICS) && (_MSC_VER >= 1700 || (defined(__AVX2__) && defined(__F16C__)))
+#define SIMD_AVX2_INTRINSICS
+#endif
+
+// Loads the 4 elements starting at p as floats
+inline __m128 Load4(const float *p)				{ return _mm_loadu_ps(p); }
+inline __m128 Load4(const unsigned short *p)	{ return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)p), _mm_setzero_si128())); }
+inline __m128 Load4(const unsigned char *p)
+{
+	__m128i n = _mm_unpacklo_epi8(_mm_cvtsi32_si128(*(const int *)p), _mm_setzero_si128());
+	return _mm_cvtepi32_ps(_mm_unpacklo_epi16(n, _mm_setzero_si128()));
+}
+
+// Without F16C, halves are converted the same way as HalfToFloat(), with masks in place of the branches
+inline __m128 Load4(const SHalf *p)
+{
+	__m128i h = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)p), _mm_setzero_si128());
+	__m128i nAbs = _mm_and_si128(h, _mm_set1_epi32(0x7FFF));
+	__m128i nSign = _mm_slli_epi32(_mm_xor_si128(h, nAbs), 16);
+	__m128i bInfNaN = _mm_cmpgt_epi32(nAbs, _mm_set1_epi32(0x7BFF));
+	__m128i bDenormal = _mm_cmplt_epi32(nAbs, _mm_set1_epi32(0x0400));
+	__m128i n = _mm_slli_epi32(nAbs, 13);
+	__m128i nNormal = _mm_add_epi32(_mm_add_epi32(n, _mm_set1_epi32((127 - 15) << 23)), _mm_and_si128(bInfNaN, _mm_set1_epi32((128 - 16) << 23)));
+	__m128 fDenormal = _mm_sub_ps(_mm_castsi128_ps(_mm_add_epi32(n, _mm_set1_epi32(113 << 23))), _mm_castsi128_ps(_mm_set1_epi32(113 << 23)));
+	__m128 f = _mm_or_ps(_mm_and_ps(_mm_castsi128_ps(bDenormal), fDenormal), _mm_andnot_ps(_mm_castsi128_ps(bDenormal), _mm_castsi128_ps(nNormal)));
+	return _mm_or_ps(f, _mm_castsi128_ps(nSign));
+}
+
+template <class F> struct TGather
+{
+	template <class T> static F Gather(const T *pBase, const int *pOffset)
+	{
+		SIMD_ALIGN float f[F::Width];
+		for(int l=0; l<F::Width; l++)
+			f[l] = ToFloat(pBase[pOffset[l]]);
+		return F::Load(f);
+	}
+	template <class T> static void Gather4(const T *pBase, const int *pOffset, F *pOut)
+	{
+		SIMD_ALIGN float f[4][F::Width];
+		for(int l=0; l<F::Width; l++)
+		{
+			for(int c=0; c<4; c++)
+				f[c][l] = ToFloat(pBase[pOffset[l] + c]);
+		}
+		for(int c=0; c<4; c++)
+			pOut[c] = F::Load(f[c]);
+	}
+};
+
+// Building the vectors in registers avoids the stall from loading a vector right after storing its lanes one at a time
+template <> struct TGather<CFloat1>
+{
+	template <class T> static CFloat1 Gather(const T *pBase, const int *pOffset)	{ return ToFloat(pBase[pOffset[0]]); }
+	template <class T> static void Gather4(const T *pBase, const int *pOffset, CFloat1 *pOut)
+	{
+		for(int c=0; c<4; c++)
+			pOut[c] = ToFloat(pBase[pOffset[0] + c]);
+	}
+};
+
+template <> struct TGather<CFloat4>
+{
+	template <class T> static CFloat4 Gather(const T *pBase, const int *pOffset)
+	{
+		return _mm_set_ps(ToFloat(pBase[pOffset[3]]), ToFloat(pBase[pOffset[2]]), ToFloat(pBase[pOffset[1]]), ToFloat(pBase[pOffset[0]]));
+	}
+	template <class T> static void Gather4(const T *pBase, const int *pOffset, CFloat4 *pOut)
+	{
+		__m128 r0 = Load4(pBase + pOffset[0]), r1 = Load4(pBase + pOffset[1]);
+		__m128 r2 = Load4(pBase + pOffset[2]), r3 = Load4(pBase + pOffset[3]);
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		pOut[0] = r0;
+		pOut[1] = r1;
+		pOut[2] = r2;
+		pOut[3] = r3;
+	}
+};
+
+template <> struct TGather<CFloat8>
+{
+	template <class T> static CFloat8 Gather(const T *pBase, const int *pOffset)
+	{
+		return _mm256_set_ps(ToFloat(pBase[pOffset[7]]), ToFloat(pBase[pOffset[6]]), ToFloat(pBase[pOffset[5]]), ToFloat(pBase[pOffset[4]]),
+							 ToFloat(pBase[pOffset[3]]), ToFloat(pBase[pOffset[2]]), ToFloat(pBase[pOffset[1]]), ToFloat(pBase[pOffset[0]]));
+	}
+	// Lanes 0-3 go in the low halves and lanes 4-7 in the high halves, then both halves are transposed at once like _MM_TRANSPOSE4_PS
+	template <class T> static void Gather4(const T *pBase, const int *pOffset, CFloat8 *pOut)
+	{
+		__m256 r[4];
+		for(int l=0; l<4; l++)
+			r[l] = _mm256_insertf128_ps(_mm256_castps128_ps256(Load4(pBase + pOffset[l])), Load4(pBase + pOffset[l+4]), 1);
+		Transpose(r, pOut);
+	}
+	static void Transpose(const __m256 *r, CFloat8 *pOut)
+	{
+		__m256 t0 = _mm256_unpacklo_ps(r[0], r[1]), t1 = _mm256_unpackhi_ps(r[0], r[1]);
+		__m256 t2 = _mm256_unpacklo_ps(r[2], r[3]), t3 = _mm256_unpackhi_ps(r[2], r[3]);
+		pOut[0] = _mm256_shuffle_ps(t0, t2, 0x44);
+		pOut[1] = _mm256_shuffle_ps(t0, t2, 0xEE);
+		pOut[2] = _mm256_shuffle_ps(t1, t3, 0x44);
+		pOut[3] = _mm256_shuffle_ps(t1, t3, 0xEE);
+	}
+};
+
+#ifdef SIMD_AVX2_INTRINSICS
+struct SGatherAVX2
+{
+	template <class T> static CFloat8 Gather(const T *pBase, const int *pOffset)	{ return TGather<CFloat8>::Gather(pBase, pOffset); }
+	static CFloat8 Gather(const float *pBase, const int *pOffset)	{ return _mm256_i32gather_ps(pBase, _mm256_load_si256((const __m256i *)pOffset), 4); }
+
+	template <class T> static void Gather4(const T *pBase, const int *pOffset, CFloat8 *pOut)	{ TGather<CFloat8>::Gather4(pBase, pOffset, pOut); }
+	// Lanes l and l+4 are loaded together and converted with one vcvtph2ps
+	static void Gather4(const SHalf *pBase, const int *pOffset, CFloat8 *pOut)
+	{
+		__m256 r[4];
+		for(int l=0; l<4; l++)
+		{
+			__m128i h = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(pBase + pOffset[l])), _mm_loadl_epi64((const __m128i *)(pBase + pOffset[l+4])));
+			r[l] = _mm256_cvtph_ps(h);
+		}
+		TGather<CFloat8>::Transpose(r, pOut);
+	}
+};
+#endif
+
+#endif // __SIMD_h__
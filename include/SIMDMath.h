@@ -0,0 +1,99 @@
+// SIMDMath.h
+//
+
+#ifndef __SIMDMath_h__
+#define __SIMDMath_h__
+
+#include "SIMD.h"
+
+/*******************************************************************************
+* Vector versions of the libm functions the engine's kernels need, written
+* once as templates on the vector type so they work with CFloat4, CFloat8, or
+* any other wrapper that provides the functions in SIMD.h. They all use the
+* single precision Cephes algorithms: a range reduction done with the exponent
+* bits and a short polynomial, with no branches and no table lookups. Kernels
+* should include this header rather than SIMD.h.
+*
+* The maximum errors listed are relative to the correctly rounded result, as
+* measured by AtmosphereBench -accuracy (which sweeps each function's whole
+* range against the double precision libm functions and fails if any of these
+* bounds are exceeded). An ulp is the spacing between floats at the result.
+*******************************************************************************/
+
+// Computes e^x for each lane using a range reduction to 2^n * e^r and a 6th-order polynomial for e^r
+// Max error: 2 ulp. Lanes below -87.3 return 2^-126 and lanes above 88.4 return infinity.
+template <class F> inline F Exp(const F &x)
+{
+	F fx = Min(Max(x, F(-87.33654f)), F(88.3762626647949f));
+	F fn = Floor(fx * 1.44269504088896341f + 0.5f);
+	fx -= fn * 0.693359375f;
+	fx -= fn * -2.12194440e-4f;
+
+	F y = 1.9875691500E-4f;
+	y = y * fx + 1.3981999507E-3f;
+	y = y * fx + 8.3334519073E-3f;
+	y = y * fx + 4.1665795894E-2f;
+	y = y * fx + 1.6666665459E-1f;
+	y = y * fx + 5.0000001201E-1f;
+	y = y * (fx * fx) + fx + 1.0f;
+	return y * Pow2(fn);
+}
+
+// Computes ln(x) for each lane by splitting x into 2^n * m with m in [sqrt(0.5), sqrt(2)) and using a 9th-order polynomial for ln(m)
+// Max error: 2 ulp. Lanes that are zero, negative, or denormal are treated as the smallest normal float (giving -87.3).
+template <class F> inline F Log(const F &x)
+{
+	F fn;
+	F m = SplitExponent(Max(x, F(1.17549435e-38f)), fn);
+	F bSmall = m < 0.707106781186547524f;
+	fn -= bSmall & F(1.0f);
+	m = m + (bSmall & m) - 1.0f;				// 2m - 1 for mantissas below sqrt(0.5), m - 1 for the rest
+
+	F z = m * m;
+	F y = 7.0376836292E-2f;
+	y = y * m - 1.1514610310E-1f;
+	y = y * m + 1.1676998740E-1f;
+	y = y * m - 1.2420140846E-1f;
+	y = y * m + 1.4249322787E-1f;
+	y = y * m - 1.6668057665E-1f;
+	y = y * m + 2.0000714765E-1f;
+	y = y * m - 2.4999993993E-1f;
+	y = y * m + 3.3333331174E-1f;
+	y = y * m * z;
+	y += fn * -2.12194440e-4f;
+	y -= z * 0.5f;
+	return m + y + fn * 0.693359375f;
+}
+
+// Computes x^y for each lane as e^(y ln x), so x must not be negative (lanes where x is 0 return 0)
+// Max error: 2 ulp + |y ln x| * 2^-23 relative, since ln x is rounded to a float before it is scaled by y.
+// That is under 3 ulp for results between 1/e and e, and about 90 ulp at the ends of the float range.
+template <class F> inline F Pow(const F &x, const F &y)
+{
+	F fZero(0.0f);
+	return Select(x > fZero, Exp(y * Log(x)), fZero);
+}
+
+// Computes arccos(x) for each lane from Cephes asinf, which uses a 4th-order polynomial in x^2 for |x| <= 0.5
+// and the identity acos(x) = 2 asin(sqrt((1-x)/2)) above that. Lanes outside [-1, 1] return NaN.
+// Max error: 2 ulp, or 1.2e-7 absolute for results near 0 (within 1e-3 of x = 1).
+template <class F> inline F Acos(const F &x)
+{
+	F a = Abs(x);
+	F bBig = a > 0.5f;
+	F z = Select(bBig, (F(1.0f) - a) * 0.5f, a * a);
+	F s = Select(bBig, Sqrt(z), a);
+
+	// asin(s)
+	F p = 4.2163199048E-2f;
+	p = p * z + 2.4181311049E-2f;
+	p = p * z + 4.5470025998E-2f;
+	p = p * z + 7.4953002686E-2f;
+	p = p * z + 1.6666752422E-1f;
+	p = p * z * s + s;
+
+	F r = Select(bBig, p + p, F(1.57079632679489662f) - p);
+	return Select(x < F(0.0f), F(3.14159265358979324f) - r, r);
+}
+
+#endif // __SIMDMath_h__
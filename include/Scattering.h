@@ -0,0 +1,254 @@
+// Scattering.h
+//
+
+#ifndef __Scattering_h__
+#define __Scattering_h__
+
+#include "PixelBuffer.h"
+#include "PixelKernels.h"
+
+struct SVertex
+{
+	CVector vPos;
+	CColor cColor;
+};
+
+/*******************************************************************************
+* Struct: SScatterParams
+********************************************************************************
+* A snapshot of everything CGameEngine::SetColor() reads from the engine, so the
+* batch kernel can run without touching CGameEngine. The reciprocals of the
+* wavelength^4 values are precomputed because the kernel divides by them for
+* every sample.
+*******************************************************************************/
+struct SScatterParams
+{
+	CVector vCamera;
+	CVector vLightDirection;
+	int nSamples;
+	float fKr, fKr4PI;
+	float fKm, fKm4PI;
+	float fESun;
+	float g;
+	float fInnerRadius;
+	float fOuterRadius;
+	float fScale;
+	float fInvWavelength4[3];
+	const float *pPhase;		// A table from CPixelBuffer::MakePhaseBuffer(), or NULL to evaluate the phase functions directly
+	int nPhaseSize;
+};
+
+// Maps the cosine SetColor() passes to the phase functions to CPixelBuffer::MakePhaseBuffer()'s x coordinate
+inline float PhaseCoord(float fCos)
+{
+	float t = 1.0f - sqrtf(1.0f - Abs(fCos));
+	return 0.5f - 0.5f * (fCos < 0 ? -t : t);
+}
+
+// Linear lookup into the phase table for every lane of fCos (same math as PhaseCoord() and C3DBuffer::Interpolate)
+template <class F> inline void LookupPhase(const float *pTable, int nSize, const F &fCos, F &fRayleighPhase, F &fMiePhase)
+{
+	F t = F(1.0f) - Sqrt(F(1.0f) - Max(fCos, -fCos));
+	F fX = (F(0.5f) - Select(fCos < F(0.0f), -t, t) * 0.5f) * (float)(nSize-1);
+	F fXFloor = Truncate(Min(Max(fX, 0.0f), (float)(nSize-2)));
+	F fRatio = fX - fXFloor;
+
+	SIMD_ALIGN float fIndex[F::Width];
+	SIMD_ALIGN float fEntry[4][F::Width];
+	fXFloor.Store(fIndex);
+	for(int l=0; l<F::Width; l++)
+	{
+		const float *pValue = pTable + (int)fIndex[l] * 2;
+		for(int i=0; i<4; i++)
+			fEntry[i][l] = pValue[i];
+	}
+	fRayleighPhase = F::Load(fEntry[0]) + (F::Load(fEntry[2]) - F::Load(fEntry[0])) * fRatio;
+	fMiePhase = F::Load(fEntry[1]) + (F::Load(fEntry[3]) - F::Load(fEntry[1])) * fRatio;
+}
+
+// The Rayleigh and Mie phase functions (scaled by Kr*ESun and Km*ESun) for the cosine fAngle, from p's table if it has one
+template <class F> inline void GetPhase(const SScatterParams &p, const F &fAngle, F &fRayleighPhase, F &fMiePhase)
+{
+	if(p.pPhase)
+	{
+		LookupPhase(p.pPhase, p.nPhaseSize, fAngle, fRayleighPhase, fMiePhase);
+		return;
+	}
+
+	// Use x^1.5 = x*sqrt(x) to avoid powf
+	const float g2 = p.g * p.g;
+	const float fMiePart = 1.5f * ((1 - g2) / (2 + g2));
+	F fAngle2 = fAngle * fAngle;
+	F fMieDenom = fAngle * (-2.0f*p.g) + (1 + g2);
+	fRayleighPhase = (fAngle2 + 1.0f) * (0.75f * p.fKr * p.fESun);
+	fMiePhase = (fAngle2 + 1.0f) * (fMiePart * p.fKm * p.fESun) / (fMieDenom * Sqrt(fMieDenom));
+}
+
+// Clamps the in-scattering colors to 1, converts them the same way CColor does, and writes them to the vertices
+// of the lanes set in nValid (ScatterBatch() and CScatteringTable::LookupBatch() both finish with this)
+template <class F> inline void StoreColors(const F *fColor, SVertex *pVertex, const int *nLaneIndex, int nLanes, int nValid)
+{
+	SIMD_ALIGN float fStore[3][F::Width];
+	for(int c=0; c<3; c++)
+		Min(Max(Min(fColor[c], F(1.0f)) * 256.0f, F(0.0f)), F(255.0f)).Store(fStore[c]);
+	for(int l=0; l<nLanes; l++)
+	{
+		if(nValid & (1 << l))
+			pVertex[nLaneIndex[l]].cColor = CColor((int)fStore[0][l], (int)fStore[1][l], (int)fStore[2][l]);
+	}
+}
+
+/*******************************************************************************
+* Function: ScatterBatch
+********************************************************************************
+* Computes the in-scattering color for nCount vertices selected by pIndex, one
+* vector of F::Width vertices at a time, fetching from the optical depth table
+* with the gather policy G. T is the table's element type (float, SHalf, or
+* unsigned short, see C3DBuffer::Convert()). It is a lane-for-lane translation of
+* CGameEngine::SetColor(): every branch in the scalar version becomes a mask,
+* and lanes that would have returned early keep their old color. The positions
+* are gathered from the SVertex array into SoA registers on the way in, and the
+* colors are scattered back out at the end.
+*
+* If pSums is not NULL, the vertex colors are left alone and the integrals are
+* written there before the phase functions are applied: the Rayleigh sums for
+* red, green, and blue, followed by the Mie sum for red (4 floats per vertex,
+* indexed like pVertex). CScatteringTable is built from these.
+*******************************************************************************/
+template <class F, class G, class T> void ScatterBatch(const SScatterParams &p, const C3DBuffer &pbOpticalDepth, SVertex *pVertex, const int *pIndex, int nCount, float *pSums=NULL)
+{
+	const TBuffer<T, 4> table = pbOpticalDepth.GetView<T, 4>();
+	const F fZero(0.0f);
+	const F fOne(1.0f);
+	const float fCameraHeight = p.vCamera.Magnitude();
+	const float fCameraAltitude = (fCameraHeight - p.fInnerRadius) * p.fScale;
+	const float C = (p.vCamera | p.vCamera) - p.fOuterRadius*p.fOuterRadius;
+
+	SIMD_ALIGN float fLoad[3][F::Width];
+	SIMD_ALIGN float fStore[4][F::Width];
+	int nLaneIndex[F::Width];
+
+	for(int nStart=0; nStart<nCount; nStart+=F::Width)
+	{
+		// Gather positions (the last vector is padded by repeating its last vertex)
+		int nLanes = Min(nCount - nStart, (int)F::Width);
+		for(int l=0; l<F::Width; l++)
+		{
+			nLaneIndex[l] = pIndex[nStart + Min(l, nLanes-1)];
+			const CVector &v = pVertex[nLaneIndex[l]].vPos;
+			fLoad[0][l] = v.x;
+			fLoad[1][l] = v.y;
+			fLoad[2][l] = v.z;
+		}
+		F vPosX = F::Load(fLoad[0]), vPosY = F::Load(fLoad[1]), vPosZ = F::Load(fLoad[2]);
+
+		// Get the ray from the camera to the vertex, and its length
+		F vRayX = vPosX - p.vCamera.x, vRayY = vPosY - p.vCamera.y, vRayZ = vPosZ - p.vCamera.z;
+		F fFar = Sqrt(vRayX*vRayX + vRayY*vRayY + vRayZ*vRayZ);
+		vRayX /= fFar; vRayY /= fFar; vRayZ /= fFar;
+
+		// Calculate the closest intersection of the ray with the outer atmosphere
+		F B = (vRayX*p.vCamera.x + vRayY*p.vCamera.y + vRayZ*p.vCamera.z) * 2.0f;
+		F fDet = Max(fZero, B*B - 4.0f*C);
+		F fNear = (-B - Sqrt(fDet)) * 0.5f;
+		F bInAtmosphere = fNear <= fZero;
+
+		// Lanes with the camera inside the atmosphere look up the optical depth to the camera,
+		// the others move the start of the ray up to the near intersection point
+		F fHeight = Sqrt(vPosX*vPosX + vPosY*vPosY + vPosZ*vPosZ);
+		F bCameraAbove = (F(fCameraHeight) >= fHeight) | (fNear > fZero);
+		F fSign = Select(bCameraAbove, -fOne, fOne);
+		F fCameraDepth[4] = {fZero, fZero, fZero, fZero};
+		if(MoveMask(bInAtmosphere))
+		{
+			F fCameraAngle = fSign * (vRayX*p.vCamera.x + vRayY*p.vCamera.y + vRayZ*p.vCamera.z) / fCameraHeight;
+			Interpolate<F, G>(table, F(fCameraAltitude), F(0.5f) - fCameraAngle * 0.5f, fCameraDepth);
+			for(int i=0; i<4; i++)
+				fCameraDepth[i] = Select(bInAtmosphere, fCameraDepth[i], fZero);
+		}
+		F fOffset = Select(bInAtmosphere, fZero, fNear);
+		F vStartX = vRayX * fOffset + p.vCamera.x;
+		F vStartY = vRayY * fOffset + p.vCamera.y;
+		F vStartZ = vRayZ * fOffset + p.vCamera.z;
+		fFar -= fOffset;
+
+		// If the distance between the points on the ray is negligible, the lane keeps its old color
+		F bValid = fFar > DELTA;
+		int nValid = MoveMask(bValid);
+		if(!nValid)
+			continue;
+
+		F fSampleLength = fFar / (float)p.nSamples;
+		F fScaledLength = fSampleLength * p.fScale;
+		F vSampleRayX = vRayX * fSampleLength, vSampleRayY = vRayY * fSampleLength, vSampleRayZ = vRayZ * fSampleLength;
+		F vSampleX = vStartX + vSampleRayX * 0.5f;
+		F vSampleY = vStartY + vSampleRayY * 0.5f;
+		F vSampleZ = vStartZ + vSampleRayZ * 0.5f;
+
+		F fRayleighSum[3] = {fZero, fZero, fZero};
+		F fMieSum[3] = {fZero, fZero, fZero};
+		F fLightDepth[4], fSampleDepth[4];
+		for(int i=0; i<p.nSamples; i++)
+		{
+			F fSampleHeight = Sqrt(vSampleX*vSampleX + vSampleY*vSampleY + vSampleZ*vSampleZ);
+			F fInvHeight = fOne / fSampleHeight;
+			F fAltitude = (fSampleHeight - p.fInnerRadius) * p.fScale;
+
+			// Look up the optical depth coming from the light source to this point
+			F fLightAngle = (vSampleX*p.vLightDirection.x + vSampleY*p.vLightDirection.y + vSampleZ*p.vLightDirection.z) * fInvHeight;
+			Interpolate<F, G>(table, fAltitude, F(0.5f) - fLightAngle * 0.5f, fLightDepth);
+			F bLit = fLightDepth[0] >= DELTA;
+
+			// Then the optical depth between the sample point and the camera
+			F fSampleAngle = fSign * (vRayX*vSampleX + vRayY*vSampleY + vRayZ*vSampleZ) * fInvHeight;
+			Interpolate<F, G>(table, fAltitude, F(0.5f) - fSampleAngle * 0.5f, fSampleDepth);
+			F fRayleighDepth = fLightDepth[1] - fSign * (fSampleDepth[1] - fCameraDepth[1]);
+			F fMieDepth = fLightDepth[3] - fSign * (fSampleDepth[3] - fCameraDepth[3]);
+			fRayleighDepth *= p.fKr4PI;
+			fMieDepth *= p.fKm4PI;
+
+			// Unlit lanes add nothing and (like the scalar version's "continue") don't advance
+			F fRayleighDensity = Select(bLit, fScaledLength * fLightDepth[0], fZero);
+			F fMieDensity = Select(bLit, fScaledLength * fLightDepth[2], fZero);
+			for(int c=0; c<3; c++)
+			{
+				F fAttenuation = Exp(-fRayleighDepth * p.fInvWavelength4[c] - fMieDepth);
+				fRayleighSum[c] += fRayleighDensity * fAttenuation;
+				fMieSum[c] += fMieDensity * fAttenuation;
+			}
+			vSampleX += Select(bLit, vSampleRayX, fZero);
+			vSampleY += Select(bLit, vSampleRayY, fZero);
+			vSampleZ += Select(bLit, vSampleRayZ, fZero);
+		}
+
+		if(pSums)
+		{
+			fRayleighSum[0].Store(fStore[0]);
+			fRayleighSum[1].Store(fStore[1]);
+			fRayleighSum[2].Store(fStore[2]);
+			fMieSum[0].Store(fStore[3]);
+			for(int l=0; l<nLanes; l++)
+			{
+				if(nValid & (1 << l))
+				{
+					for(int i=0; i<4; i++)
+						pSums[nLaneIndex[l] * 4 + i] = fStore[i][l];
+				}
+			}
+			continue;
+		}
+
+		// Calculate the phase functions
+		F fAngle = -(vRayX*p.vLightDirection.x + vRayY*p.vLightDirection.y + vRayZ*p.vLightDirection.z);
+		F fRayleighPhase, fMiePhase;
+		GetPhase(p, fAngle, fRayleighPhase, fMiePhase);
+
+		// Calculate the in-scattering color
+		F fColor[3];
+		for(int c=0; c<3; c++)
+			fColor[c] = fRayleighSum[c] * fRayleighPhase * p.fInvWavelength4[c] + fMieSum[c] * fMiePhase;
+		StoreColors(fColor, pVertex, nLaneIndex, nLanes, nValid);
+	}
+}
+
+#endif // __Scattering_h__
@@ -0,0 +1,212 @@
+// ScatteringTable.h
+//
+
+#ifndef __ScatteringTable_h__
+#define __ScatteringTable_h__
+
+#include "Scattering.h"
+
+// The resolution of each axis of the table
+#define SCATTER_TABLE_NU		8		// Angle between the view ray and the light
+#define SCATTER_TABLE_MU		128		// View zenith angle (half for rays that hit the ground, half for rays that don't)
+#define SCATTER_TABLE_MUS		32		// Light zenith angle
+#define SCATTER_TABLE_R			32		// Altitude
+
+/*******************************************************************************
+* Class: CScatteringTable
+********************************************************************************
+* A precomputed single-scattering table that turns CGameEngine::SetColor()'s
+* integral into one quadrilinear lookup per vertex. Every ray SetColor() traces
+* starts either at the camera (inside the atmosphere) or where it enters the
+* atmosphere, and ends where it hits the planet or leaves the atmosphere. So
+* the color only depends on the altitude of the start point and three angles:
+* the view ray from the zenith, the light from the zenith, and the view ray
+* from the light. Each entry is filled in with ScatterBatch(), so it matches
+* the direct path apart from interpolation error.
+*
+* The entries hold the integrals before the phase functions are applied (the
+* Rayleigh sums for red, green, and blue, and the Mie sum for red, with the
+* other two Mie sums rebuilt from the Rayleigh ratios as in Bruneton and
+* Neyret's paper). The phase functions are sharp around the sun and would need
+* far more entries along the light angle axis than the integrals do, and this
+* way changing ESun or g doesn't need a new table.
+*
+* Following Bruneton and Neyret, the altitude and view zenith axes are stored
+* as distances (see SRayCoord) to put more entries near the ground and the
+* horizon, and the view zenith axis is split at the horizon so that rays that
+* hit the ground are never blended with rays that reach space.
+*
+* Builds run on their own thread against a private copy of the optical depth
+* table. Update() is called by the render thread: it swaps in finished builds
+* and starts a new one whenever the scattering constants change, so the old
+* table stays in use until the new one is ready.
+*******************************************************************************/
+class CScatteringTable
+{
+protected:
+	C4DBuffer *m_pTable;			// The table in use (NULL until the first build finishes)
+	SScatterParams m_params;		// The constants m_pTable was built with
+	int m_nVersion;					// Bumped every time a new table is swapped in
+
+	HANDLE m_hThread;				// The build running in the background (NULL if there isn't one)
+	C4DBuffer *m_pBuild;
+	SScatterParams m_buildParams;
+	int m_nBuildOpticalDepthVersion;
+	C3DBuffer m_pbBuildOpticalDepth;	// A private copy, since the engine may rebuild its own while the build runs
+	int m_nOpticalDepthVersion;		// The optical depth table the newest build (finished or not) used
+
+	static unsigned __stdcall BuildProc(void *pParam);
+	static CFloat4 LookupSums(const C4DBuffer &table, const float x, const float y, const float z, const float w);
+
+public:
+	CScatteringTable();
+	~CScatteringTable()				{ Cleanup(); }
+	void Cleanup();
+
+	// Swaps in a finished build, and starts a new one if p's constants or the optical depth table have changed
+	void Update(const SScatterParams &p, const C3DBuffer &pbOpticalDepth, int nOpticalDepthVersion);
+	bool IsReady()					{ return m_pTable != NULL; }
+	int GetVersion()				{ return m_nVersion; }
+
+	// Looks up the colors of nCount vertices selected by pIndex, as seen from p.vCamera with the light in p.vLightDirection
+	template <class F> void LookupBatch(const SScatterParams &p, SVertex *pVertex, const int *pIndex, int nCount) const;
+
+	// Fills in every entry of the table (this is what runs in the background)
+	static void Build(C4DBuffer &table, const SScatterParams &p, const C3DBuffer &pbOpticalDepth);
+};
+
+// Same as C4DBuffer::Interpolate(), but blends all 4 channels of an element at once (the table always has 4)
+inline CFloat4 CScatteringTable::LookupSums(const C4DBuffer &table, const float x, const float y, const float z, const float w)
+{
+	// Find the element below the point and the ratio to the next one along each axis
+	const float fCoord[4] = {x, y, z, w};
+	const int nSize[4] = {table.GetWidth(), table.GetHeight(), table.GetDepth(), table.GetLength()};
+	float fRatio[4];
+	size_t nStride[4];
+	size_t nOffset = 0;
+	size_t nStep = 4;
+	for(int d=0; d<4; d++)
+	{
+		float f = fCoord[d] * (nSize[d]-1);
+		int n = Min(nSize[d]-2, Max(0, (int)f));
+		fRatio[d] = f - n;
+		nStride[d] = nStep;
+		nOffset += n * nStep;
+		nStep *= nSize[d];
+	}
+
+	// Blend pairs of elements along x, then fold the 8 results along y, z, and w
+	const float *pBuffer = table.GetBuffer() + nOffset;
+	CFloat4 v[8];
+	for(int nCorner=0; nCorner<8; nCorner++)
+	{
+		const float *pValue = pBuffer + ((nCorner & 1) ? nStride[1] : 0) + ((nCorner & 2) ? nStride[2] : 0) + ((nCorner & 4) ? nStride[3] : 0);
+		CFloat4 a = CFloat4::LoadUnaligned(pValue), b = CFloat4::LoadUnaligned(pValue + 4);
+		v[nCorner] = a + (b - a) * fRatio[0];
+	}
+	for(int d=1; d<4; d++)
+	{
+		for(int i=0; i<(8 >> d); i++)
+			v[i] = v[2*i] + (v[2*i+1] - v[2*i]) * fRatio[d];
+	}
+	return v[0];
+}
+
+/*******************************************************************************
+* Finds the table coordinates of F::Width vertices at a time the same way
+* ScatterBatch() finds its rays, with the view zenith axis mapped the way
+* SRayCoord (in ScatteringTable.cpp) maps it for the build. The fetches are
+* done one lane at a time, and then the phase functions are applied and the
+* colors are converted exactly like ScatterBatch() does it.
+*******************************************************************************/
+template <class F> void CScatteringTable::LookupBatch(const SScatterParams &p, SVertex *pVertex, const int *pIndex, int nCount) const
+{
+	const F fZero(0.0f);
+	const F fOne(1.0f);
+	const float fInnerRadius = p.fInnerRadius;
+	const float fOuterRadius = p.fOuterRadius;
+	const float fHorizonMax = sqrtf(fOuterRadius*fOuterRadius - fInnerRadius*fInnerRadius);
+	const float C = (p.vCamera | p.vCamera) - fOuterRadius*fOuterRadius;
+	const int nHalf = SCATTER_TABLE_MU / 2;
+
+	SIMD_ALIGN float fLoad[3][F::Width];
+	SIMD_ALIGN float fCoord[4][F::Width];
+	SIMD_ALIGN float fStore[4][F::Width];
+	SIMD_ALIGN float fSums[4];
+	int nLaneIndex[F::Width];
+	for(int nStart=0; nStart<nCount; nStart+=F::Width)
+	{
+		// Gather positions (the last vector is padded by repeating its last vertex)
+		int nLanes = Min(nCount - nStart, (int)F::Width);
+		for(int l=0; l<F::Width; l++)
+		{
+			nLaneIndex[l] = pIndex[nStart + Min(l, nLanes-1)];
+			const CVector &v = pVertex[nLaneIndex[l]].vPos;
+			fLoad[0][l] = v.x;
+			fLoad[1][l] = v.y;
+			fLoad[2][l] = v.z;
+		}
+		F vPosX = F::Load(fLoad[0]), vPosY = F::Load(fLoad[1]), vPosZ = F::Load(fLoad[2]);
+
+		// Get the ray from the camera to the vertex
+		F vRayX = vPosX - p.vCamera.x, vRayY = vPosY - p.vCamera.y, vRayZ = vPosZ - p.vCamera.z;
+		F fFar = Sqrt(vRayX*vRayX + vRayY*vRayY + vRayZ*vRayZ);
+		int nValid = MoveMask(fFar > DELTA);
+		if(!nValid)
+			continue;
+		vRayX /= fFar; vRayY /= fFar; vRayZ /= fFar;
+
+		// If the camera is outside the atmosphere, start the ray where it enters it
+		F B = (vRayX*p.vCamera.x + vRayY*p.vCamera.y + vRayZ*p.vCamera.z) * 2.0f;
+		F fDet = Max(fZero, B*B - 4.0f*C);
+		F fNear = Max(fZero, (-B - Sqrt(fDet)) * 0.5f);
+		F vStartX = vRayX * fNear + p.vCamera.x;
+		F vStartY = vRayY * fNear + p.vCamera.y;
+		F vStartZ = vRayZ * fNear + p.vCamera.z;
+
+		// Get the altitude and the three angles
+		F r = Sqrt(vStartX*vStartX + vStartY*vStartY + vStartZ*vStartZ);
+		F fMu = (vStartX*vRayX + vStartY*vRayY + vStartZ*vRayZ) / r;
+		F fMuS = (vStartX*p.vLightDirection.x + vStartY*p.vLightDirection.y + vStartZ*p.vLightDirection.z) / r;
+		F fNu = vRayX*p.vLightDirection.x + vRayY*p.vLightDirection.y + vRayZ*p.vLightDirection.z;
+		r = Min(Max(r, F(fInnerRadius)), F(fOuterRadius));
+
+		// Rays that hit the planet go in the bottom half of the view zenith axis, the rest go in the top half
+		F fRho = Sqrt(Max(fZero, r*r - fInnerRadius*fInnerRadius));
+		F fRMu = r * fMu;
+		F fRayDet = fRMu*fRMu - r*r;
+		F fGroundDet = fRayDet + fInnerRadius*fInnerRadius;
+		F bGround = (fMu < fZero) & (fGroundDet > fZero);
+		F fDist = Select(bGround, -fRMu - Sqrt(Max(fZero, fGroundDet)), -fRMu + Sqrt(Max(fZero, fRayDet + fOuterRadius*fOuterRadius)));
+		F fMin = Select(bGround, r - fInnerRadius, F(fOuterRadius) - r);
+		F fRange = Select(bGround, fRho, fRho + fHorizonMax) - fMin;
+		F x = Select(fRange > fZero, (fDist - fMin) / Max(fRange, F(DELTA)), fZero);
+		x = Min(Max(x, fZero), fOne) * (float)(nHalf-1) + Select(bGround, fZero, F((float)nHalf));
+
+		((fNu + 1.0f) * 0.5f).Store(fCoord[0]);
+		(x * (1.0f / (SCATTER_TABLE_MU-1))).Store(fCoord[1]);
+		((fMuS + 1.0f) * 0.5f).Store(fCoord[2]);
+		(fRho * (1.0f / fHorizonMax)).Store(fCoord[3]);
+		for(int l=0; l<nLanes; l++)
+		{
+			LookupSums(*m_pTable, fCoord[0][l], fCoord[1][l], fCoord[2][l], fCoord[3][l]).Store(fSums);
+			for(int i=0; i<4; i++)
+				fStore[i][l] = fSums[i];
+		}
+		F fRayleighSum[3] = {F::Load(fStore[0]), F::Load(fStore[1]), F::Load(fStore[2])};
+		F fMieSum = F::Load(fStore[3]);
+
+		// Rebuild the green and blue Mie sums from the red one, assuming they attenuate in the same ratio as the Rayleigh sums
+		F fMieRatio = Select(fRayleighSum[0] > fZero, fMieSum / Max(fRayleighSum[0], F(DELTA)), fZero);
+
+		// Apply the phase functions and convert the colors the same way ScatterBatch() does
+		F fRayleighPhase, fMiePhase;
+		GetPhase(p, -fNu, fRayleighPhase, fMiePhase);
+		F fColor[3];
+		for(int c=0; c<3; c++)
+			fColor[c] = fRayleighSum[c] * (fRayleighPhase * p.fInvWavelength4[c] + fMieRatio * fMiePhase);
+		StoreColors(fColor, pVertex, nLaneIndex, nLanes, nValid);
+	}
+}
+
+#endif // __ScatteringTable_h__
@@ -0,0 +1,71 @@
+// SkeletonTracker.h
+//
+
+#ifndef __SkeletonTracker_h__
+#define __SkeletonTracker_h__
+
+#include "TripleBuffer.h"
+
+class SampleViewer;
+
+#define SKELETON_RETRY_DELAY	100		// Milliseconds to wait after readFrame() fails before trying again
+
+struct SSkeletonJoint
+{
+	float x, y, z;				// In millimeters, in the sensor's coordinates
+	float fConfidence;			// Of the position, from 0 to 1
+};
+
+// What the sensor thread saw in one frame
+struct SSkeletonSnapshot
+{
+	unsigned int nFrame;		// Counts up from 1 with every frame published (0 until the first one)
+	unsigned __int64 nTimestamp;	// NiTE's timestamp for the frame
+	int nUsers;
+	bool bTracked;				// The first user is neither new nor lost, so the joints below are valid
+	SSkeletonJoint head;
+	SSkeletonJoint rightHand;
+};
+
+/*******************************************************************************
+* Class: CSkeletonTracker
+********************************************************************************
+* Reads the user tracker on a thread of its own, so nothing on the render
+* thread ever waits for the sensor. Each frame the thread updates the users'
+* states (starting skeleton tracking for new ones, like NiTE's samples do),
+* copies out the first user's joints, and publishes them through a
+* TTripleBuffer. The render thread calls Update() once per frame to take the
+* newest snapshot if there is one, and GetSnapshot() returns the same one
+* until the next Update() that returns true.
+*
+* The SampleViewer's user tracker is only touched by this thread between
+* Start() and Stop().
+*******************************************************************************/
+class CSkeletonTracker
+{
+protected:
+	SampleViewer *m_pViewer;
+	HANDLE m_hThread;
+	volatile bool m_bQuit;
+	unsigned int m_nFrames;
+	TTripleBuffer<SSkeletonSnapshot> m_snapshots;
+
+	static unsigned __stdcall ThreadProc(void *pParam);
+	void ReadFrame();
+
+public:
+	CSkeletonTracker();
+	~CSkeletonTracker()			{ Stop(); }
+
+	// Starts reading pViewer's user tracker (which must already be created)
+	void Start(SampleViewer *pViewer);
+	// Waits for the thread to finish the frame it is on and exit
+	void Stop();
+	bool IsRunning()			{ return m_hThread != NULL; }
+
+	// Takes the newest snapshot the thread has published, and returns false if there wasn't a new one (it never blocks)
+	bool Update()				{ return m_snapshots.Update(); }
+	const SSkeletonSnapshot &GetSnapshot()	{ return m_snapshots.GetFront(); }
+};
+
+#endif // __SkeletonTracker_h__
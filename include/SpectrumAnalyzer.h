@@ -0,0 +1,102 @@
+// SpectrumAnalyzer.h
+//
+
+#ifndef __SpectrumAnalyzer_h__
+#define __SpectrumAnalyzer_h__
+
+#include "TripleBuffer.h"
+#include "Mixer.h"
+
+#define SPECTRUM_FFT_SIZE		1024	// Samples in each window (a power of 2, about 21 ms at 48 kHz)
+#define SPECTRUM_HOP_MS			5		// Milliseconds of sound between the starts of two windows
+#define SPECTRUM_BANDS			8		// Split at 60, 150, 400, 1000, 2500, 6000, and 12000 Hz
+#define SPECTRUM_FLOOR			-100.0f	// The lowest level reported, in dB
+#define SPECTRUM_COMPRESSION	100.0f	// How hard the magnitudes are compressed (with log(1 + c*x)) before the flux is taken
+#define SPECTRUM_FLUX_MS		250		// How long the average the flux is compared to takes to settle
+#define SPECTRUM_ONSET_RATIO	1.5f	// How many times its average the flux has to reach to be an onset
+#define SPECTRUM_ONSET_MIN		2.0f	// And how far above the average it has to be (so a quiet passage's noise doesn't count)
+#define SPECTRUM_ONSET_MS		60		// The shortest time between two onsets
+
+// What the analyzer heard in its latest window
+struct SSpectrumSnapshot
+{
+	unsigned int nHop;			// Counts up from 1 with every window analyzed (0 until the first one)
+	float fLevel;				// The whole window's RMS level, in dB relative to a full-scale square wave
+	float fBand[SPECTRUM_BANDS];	// Each band's share of it, in the same dB
+	float fFlux;				// How much the spectrum grew since the window before (the spectral flux)
+	unsigned int nOnsets;		// Onsets detected so far (it changes when there has been a new one, even if the snapshots in between were missed)
+	unsigned int nOnsetHop;		// The window the last one was detected in
+};
+
+/*******************************************************************************
+* Class: CSpectrumAnalyzer
+********************************************************************************
+* Turns a stream of PCM samples into band levels and onsets. The samples are
+* mixed down to mono into a ring of the last SPECTRUM_FFT_SIZE, and every
+* SPECTRUM_HOP_MS of them that ring is windowed (Hann) and transformed. The
+* transform is a real FFT done as a complex one of half the size (radix-4
+* stages, with one radix-2 stage first if the size needs it), and everything
+* it needs (the window, the twiddle factors, and the bit-reversed order) is
+* worked out by Init(), so analyzing a window never allocates anything.
+*
+* The power in each bin is summed into SPECTRUM_BANDS bands, and an onset is
+* a jump in the spectral flux (the sum of how much each compressed magnitude
+* grew) well above its recent average. Each window's results are published
+* through a TTripleBuffer, so one thread can feed the analyzer with Write()
+* or WritePCM() while another takes the newest snapshot with Update() and
+* GetSnapshot(), without either one waiting. Init() and Reset() have to be
+* called while neither thread is using it.
+*
+* It is also a CAudioSink, so CMixer can render straight into it.
+*******************************************************************************/
+class CSpectrumAnalyzer : public CAudioSink
+{
+protected:
+	int m_nFrequency;
+	int m_nHop;					// Samples between windows
+	int m_nBandBin[SPECTRUM_BANDS+1];	// The first bin in each band (and the one after the last)
+	int m_nReverse[SPECTRUM_FFT_SIZE/2];	// Where each complex input goes in bit-reversed order
+	float m_fWindow[SPECTRUM_FFT_SIZE];
+	float m_fCos[SPECTRUM_FFT_SIZE], m_fSin[SPECTRUM_FFT_SIZE];	// e^(-2 pi i k / SPECTRUM_FFT_SIZE) is m_fCos[k] - i m_fSin[k]
+	float m_fPowerScale;		// Turns a bin's squared magnitude into its share of the mean square
+	float m_fAmplitudeScale;	// Turns a bin's magnitude into the amplitude of a sine in it
+
+	float m_fHistory[SPECTRUM_FFT_SIZE];	// The latest samples, oldest first starting at m_nNext
+	int m_nNext;
+	int m_nUntilHop;			// Samples still to come before the next window
+	float m_fRe[SPECTRUM_FFT_SIZE/2], m_fIm[SPECTRUM_FFT_SIZE/2];
+	float m_fPower[SPECTRUM_FFT_SIZE/2+1];
+	float m_fMagnitude[SPECTRUM_FFT_SIZE/2+1];	// Compressed, from the window before, for the flux
+	float m_fFluxMean;
+	float m_fFluxDecay;			// How much of the flux goes into m_fFluxMean each window
+	int m_nOnsetWait;			// Windows to go before another onset can be detected
+	unsigned int m_nHops, m_nOnsets, m_nOnsetHop;
+	TTripleBuffer<SSpectrumSnapshot> m_snapshots;
+
+	void Transform();
+	void Analyze();
+
+public:
+	CSpectrumAnalyzer()			{ Init(48000); }
+
+	// Plans the FFT for sound at nFrequency and clears everything
+	void Init(int nFrequency);
+	// Forgets the samples and the onsets (and publishes an empty snapshot)
+	void Reset();
+	int GetFrequency()			{ return m_nFrequency; }
+	int GetHopSize()			{ return m_nHop; }
+
+	// Adds nFrames of interleaved 8-bit unsigned or 16-bit signed samples with nChannels each
+	void WritePCM(const void *pData, int nFrames, int nChannels, int nBitsPerSample);
+	virtual int GetSpace()		{ return 0x7FFFFFFF; }
+	virtual void Write(const short *pFrames, int nFrames)	{ WritePCM(pFrames, nFrames, 2, 16); }
+
+	// The last window's power in each bin, from 0 to SPECTRUM_FFT_SIZE/2 (only for the thread that feeds it)
+	const float *GetPower()		{ return m_fPower; }
+
+	// Takes the newest snapshot, and returns false if there wasn't a new one (it never blocks)
+	bool Update()				{ return m_snapshots.Update(); }
+	const SSpectrumSnapshot &GetSnapshot()	{ return m_snapshots.GetFront(); }
+};
+
+#endif // __SpectrumAnalyzer_h__
@@ -0,0 +1,330 @@
+// Sphere.h
+//
+
+#ifndef __Sphere_h__
+#define __Sphere_h__
+
+#include "Scattering.h"
+
+#define COLOR_CHUNK_SIZE	256		// Vertices per worker chunk (a multiple of the cache line and SIMD widths)
+#define CULL_BLOCK_SIZE		8		// Vertices per culling block in CSphere (CLODSphere culls whole patches)
+
+// A stored vertex color as it's drawn fBrightness times brighter (Draw() and the headless renderer both use it)
+inline CColor BrightenColor(const CColor &c, float fBrightness)
+{
+	return CColor((int)ColorClamp(c.r * fBrightness), (int)ColorClamp(c.g * fBrightness), (int)ColorClamp(c.b * fBrightness), (int)c.a);
+}
+
+/*******************************************************************************
+* Struct: SCullBlock
+********************************************************************************
+* A run of consecutive vertices that is culled as a whole. The bounding sphere
+* is grown by the longest edge touching any of its vertices, so a block is only
+* culled if every triangle it is part of is out of sight too (otherwise a
+* visible triangle could be drawn with a corner that was never colored).
+*******************************************************************************/
+struct SCullBlock
+{
+	CVector vCenter;
+	float fRadius;
+	bool bVisible;				// Set by the last CSphere::Cull()
+};
+
+/*******************************************************************************
+* Struct: SColorState
+********************************************************************************
+* What a sphere's vertex colors were last computed from. CGameEngine uses it to
+* skip the color pass when nothing has changed since the last frame, and to
+* leave alone vertices whose view ray has moved less than a small tolerance.
+* Each vertex remembers the camera position it was last colored from, so the
+* error of a reused color never grows past the tolerance however many frames
+* it is reused for.
+*******************************************************************************/
+struct SColorState
+{
+	bool bValid;				// False until the first pass, and after anything forces a full recolor
+	int nOpticalDepthVersion;	// Which optical depth table the colors were computed with
+	int nScatteringTable;		// Which scattering table they were looked up in (0 if they were integrated)
+	SScatterParams params;		// The engine state of the last pass
+	CVector *pCamera;			// The camera position each vertex was last colored from
+};
+
+class CSphere
+{
+protected:
+	float m_fRadius;
+	int m_nSlices;
+	int m_nSections;
+
+	SVertex *m_pVertex;
+	unsigned short m_nVertices;
+
+	unsigned short *m_pIndex;	// The triangles Draw() renders, as an indexed triangle list
+	int m_nIndices;
+
+	// GL_ARB_vertex_buffer_object names (0 if the driver doesn't have it, and Draw() uses client memory instead)
+	unsigned int m_nPositionBuffer;	// Static, filled in once by InitBuffers()
+	unsigned int m_nColorBuffer;	// Refilled by every Draw()
+	unsigned int m_nIndexBuffer;	// Static, a copy of m_pIndex
+	bool m_bBuffers;				// False until the buffer objects can be created (see CreateBuffers())
+	CColor *m_pDrawColor;			// The brightened colors Draw() sends from client memory
+	int m_nDrawColors;
+
+	SColorState m_colorState;
+
+	SCullBlock *m_pBlock;		// One for every m_nBlockSize vertices
+	int m_nBlocks;
+	int m_nBlockSize;
+
+	// Appends the triangles of a GL_TRIANGLE_FAN or GL_TRIANGLE_STRIP with the same winding OpenGL would give them
+	void AddFan(const unsigned short *pList, int nCount)
+	{
+		for(int i=1; i<nCount-1; i++)
+		{
+			m_pIndex[m_nIndices++] = pList[0];
+			m_pIndex[m_nIndices++] = pList[i];
+			m_pIndex[m_nIndices++] = pList[i+1];
+		}
+	}
+	void AddStrip(const unsigned short *pList, int nCount)
+	{
+		for(int i=0; i<nCount-2; i++)
+		{
+			m_pIndex[m_nIndices++] = pList[(i & 1) ? i+1 : i];
+			m_pIndex[m_nIndices++] = pList[(i & 1) ? i : i+1];
+			m_pIndex[m_nIndices++] = pList[i+2];
+		}
+	}
+
+	void InitBuffers();
+	void DeleteBuffers();
+	void InitBlocks();
+	// Points GL_COLOR_ARRAY at the colors in client memory (with no buffer object bound)
+	void SetClientColors(float fBrightness);
+
+	void BuildIndexList()
+	{
+		// Walk the vertices as the triangle fans and strips the sphere used to be drawn with (CHeadlessRenderer relies on the winding)
+		unsigned short *pList = new unsigned short[2*m_nSlices+2];
+		m_pIndex = new unsigned short[3 * (2*m_nSlices + (m_nSections-2) * 2*m_nSlices)];
+		m_nIndices = 0;
+
+		int nCount = 0;
+		pList[nCount++] = 0;
+		for(int i=0; i<m_nSlices; i++)
+			pList[nCount++] = i+1;
+		pList[nCount++] = 1;
+		AddFan(pList, nCount);
+
+		int nIndex1 = 1;
+		int nIndex2 = 1 + m_nSlices;
+		for(int j=1; j<m_nSections-1; j++)
+		{
+			nCount = 0;
+			for(int i=0; i<m_nSlices; i+=2)
+			{
+				pList[nCount++] = nIndex1+i;
+				pList[nCount++] = nIndex2+i;
+				pList[nCount++] = nIndex1+1+i;
+				pList[nCount++] = nIndex2+1+i;
+			}
+			pList[nCount++] = nIndex1;
+			pList[nCount++] = nIndex2;
+			AddStrip(pList, nCount);
+			nIndex1 += m_nSlices;
+			nIndex2 += m_nSlices;
+		}
+
+		nCount = 0;
+		pList[nCount++] = m_nVertices-1;
+		for(int i=0; i<m_nSlices; i++)
+			pList[nCount++] = m_nVertices-2-i;
+		pList[nCount++] = m_nVertices-2;
+		AddFan(pList, nCount);
+		delete[] pList;
+	}
+
+public:
+	CSphere()	{ m_pVertex = NULL; m_pIndex = NULL; m_nPositionBuffer = m_nColorBuffer = m_nIndexBuffer = 0; m_bBuffers = true; m_pDrawColor = NULL; m_nDrawColors = 0; m_colorState.pCamera = NULL; m_colorState.bValid = false; m_pBlock = NULL; m_nBlocks = 0; m_nBlockSize = CULL_BLOCK_SIZE; }
+	~CSphere()
+	{
+		DeleteBuffers();
+		if(m_pVertex)
+			_aligned_free(m_pVertex);
+		delete[] m_pIndex;
+		delete[] m_pDrawColor;
+		delete[] m_colorState.pCamera;
+		delete[] m_pBlock;
+	}
+
+	int GetVertexCount()		{ return m_nVertices; }
+	SVertex *GetVertexBuffer()	{ return m_pVertex; }
+	int GetIndexCount()			{ return m_nIndices; }
+	unsigned short *GetIndexBuffer()	{ return m_pIndex; }
+	SColorState &GetColorState()	{ return m_colorState; }
+	void InvalidateColors()		{ m_colorState.bValid = false; }
+	int GetBlockSize()			{ return m_nBlockSize; }
+	const SCullBlock *GetBlocks()	{ return m_pBlock; }
+	int i;
+
+	// Pass false for bBuffers to build the mesh on a thread without the GL context, then call CreateBuffers() on the one with it
+	void Init(float fRadius, int nSlices, int nSections, bool bBuffers=true)
+	{
+		m_bBuffers = bBuffers;
+		m_fRadius = fRadius;
+		m_nSlices = nSlices;
+		m_nSections = nSections;
+
+		m_nVertices = nSlices * (nSections-1) + 2;
+		// Align the buffer so that COLOR_CHUNK_SIZE chunks never share a cache line
+		m_pVertex = (SVertex *)_aligned_malloc(m_nVertices * sizeof(SVertex), 64);
+
+		float fSliceArc = 2*PI / nSlices;
+		float fSectionArc = PI / nSections;
+		float *fRingz = new float[nSections+1];
+		float *fRingSize = new float[nSections+1];
+		float *fRingx = new float[nSlices+1];
+		float *fRingy = new float[nSlices+1];
+		for(int i=0; i<=nSections; i++)
+		{
+			fRingz[i] = cosf(fSectionArc * i);
+			fRingSize[i] = sinf(fSectionArc * i);
+		}
+		for(i=0; i<=nSlices; i++)
+		{
+			fRingx[i] = cosf(fSliceArc * i);
+			fRingy[i] = sinf(fSliceArc * i);
+		}
+
+		int nIndex = 0;
+		m_pVertex[nIndex++].vPos = CVector(0, 0, fRadius);
+		for(int j=1; j<nSections; j++)
+		{
+			for(int i=0; i<nSlices; i++)
+			{
+				CVector v;
+				v.x = fRingx[i] * fRingSize[j];
+				v.y = fRingy[i] * fRingSize[j];
+				v.z = fRingz[j];
+				v *= fRadius / v.Magnitude();
+				m_pVertex[nIndex++].vPos = v;
+			}
+		}
+
+		m_pVertex[nIndex++].vPos = CVector(0, 0, -fRadius);
+
+		// No vertex has been colored from anywhere yet (a camera this far away never passes the reuse test)
+		m_colorState.bValid = false;
+		delete[] m_colorState.pCamera;
+		m_colorState.pCamera = new CVector[m_nVertices];
+		for(int i=0; i<m_nVertices; i++)
+			m_colorState.pCamera[i] = CVector(FLT_MAX);
+		delete[] fRingz;
+		delete[] fRingSize;
+		delete[] fRingx;
+		delete[] fRingy;
+
+		BuildIndexList();
+		InitBuffers();
+		delete[] m_pBlock;
+		m_pBlock = new SCullBlock[(m_nVertices + CULL_BLOCK_SIZE-1) / CULL_BLOCK_SIZE];
+		m_nBlockSize = CULL_BLOCK_SIZE;
+		InitBlocks();
+	}
+
+	// Marks the blocks that may be seen by a camera at vCamera looking through pFrustum, with a planet of radius
+	// fOccluderRadius in the way (pass NULL or 0 to skip either test), and returns true if any hidden block became visible
+	bool Cull(const CFrustum *pFrustum, const CVector &vCamera, float fOccluderRadius);
+
+	// Creates the buffer objects for a mesh that was built without them
+	void CreateBuffers()		{ m_bBuffers = true; InitBuffers(); }
+
+	// Draws the sphere with one glDrawElements() call, from buffer objects if InitBuffers() could create them,
+	// with every color fBrightness times brighter (the colors in the vertex buffer are left alone)
+	void Draw(float fBrightness=1.0f);
+};
+
+
+#define LOD_PATCH_SIZE		8		// Cells along each side of a CLODSphere patch
+#define LOD_PATCH_VERTICES	((LOD_PATCH_SIZE+1) * (LOD_PATCH_SIZE+1))
+#define LOD_MAX_LEVEL		12		// The deepest a face's quadtree can go (patch keys have 12 bits per coordinate)
+#define LOD_NO_NEIGHBOR		0xFFFFFFFF	// Not a valid patch key (there is no face 7)
+
+/*******************************************************************************
+* Struct: SLODPatch
+********************************************************************************
+* One leaf of a CLODSphere face quadtree. The key packs the cube face, the
+* level, and the patch's position on the face at that level, so sorting patches
+* by key makes the selection from the last update easy to find again.
+*******************************************************************************/
+struct SLODPatch
+{
+	unsigned int nKey;			// Face (3 bits), level (4 bits), x (12 bits), y (12 bits)
+	int nSlot;					// Which block of LOD_PATCH_VERTICES vertices it owns in the vertex buffer
+	unsigned int nEdge[4];		// The key of the coarser patch across each edge it was stitched to (LOD_NO_NEIGHBOR if none)
+	float fPriority;			// How much splitting it would improve the picture (only used while selecting)
+	bool bDirty;				// Its vertices have to be built again (only used while updating)
+
+	static unsigned int MakeKey(int nFace, int nLevel, int x, int y)	{ return ((unsigned int)nFace << 28) | ((unsigned int)nLevel << 24) | (x << 12) | y; }
+	int GetFace() const			{ return nKey >> 28; }
+	int GetLevel() const		{ return (nKey >> 24) & 0xF; }
+	int GetX() const			{ return (nKey >> 12) & 0xFFF; }
+	int GetY() const			{ return nKey & 0xFFF; }
+};
+
+/*******************************************************************************
+* Class: CLODSphere
+********************************************************************************
+* A view-dependent replacement for CSphere's uniform tessellation. The sphere
+* is a cube with each face warped to equal angles and split into a quadtree of
+* patches of LOD_PATCH_SIZE x LOD_PATCH_SIZE cells. Every call to Update()
+* starts from the six faces and keeps splitting the patch that covers the most
+* screen space (more near the limb, where the atmosphere is thinnest and the
+* colors change the fastest, and less on the far side of the sphere) until the
+* vertex budget runs out or no patch is worth splitting any more.
+*
+* Patches own a fixed slot of vertices, so a patch that stays selected keeps
+* its vertices and their colors (and the per-vertex color reuse in SColorState
+* keeps working). Where a patch meets a coarser neighbor, its edge vertices are
+* moved onto the neighbor's edge so there are no cracks. The vertex and index
+* buffers are laid out just like CSphere's, so UpdateColors(), Draw(), and the
+* headless renderer don't need to know the difference.
+*******************************************************************************/
+class CLODSphere : public CSphere
+{
+protected:
+	int m_nMaxPatches;			// The vertex budget, in patches
+	float m_fMinError;			// Patches with a smaller error (in radians per cell) are never split
+	SLODPatch *m_pPatch;		// The patches selected by the last Update(), sorted by key
+	int m_nPatches;
+	SLODPatch *m_pNext;			// Work space for the next selection
+	int *m_pSlotOwner;			// Work space for compacting the slots
+
+	CVector GetPosition(int nFace, float u, float v);
+	float GetPriority(const SLODPatch &patch, const CVector &vCamera);
+	void BuildPatch(const SLODPatch &patch);
+	void StitchEdge(const SLODPatch &patch, int nEdge);
+	void BuildIndexList();
+
+public:
+	CLODSphere()	{ m_pPatch = m_pNext = NULL; m_pSlotOwner = NULL; m_nPatches = m_nMaxPatches = 0; m_fMinError = 0.0015f; }
+	~CLODSphere()
+	{
+		delete[] m_pPatch;
+		delete[] m_pNext;
+		delete[] m_pSlotOwner;
+	}
+
+	// nMaxVertices is rounded down to whole patches (and can't go over what an unsigned short index can reach)
+	void Init(float fRadius, int nMaxVertices, bool bBuffers=true);
+
+	// Picks the patches for a camera at vCamera, and returns true if the vertex or index buffers changed
+	bool Update(const CVector &vCamera);
+
+	int GetPatchCount()			{ return m_nPatches; }
+	int GetMaxVertices()		{ return m_nMaxPatches * LOD_PATCH_VERTICES; }
+	float GetMinError()			{ return m_fMinError; }
+	void SetMinError(float f)	{ m_fMinError = Max(0.0f, f); }
+};
+
+#endif // __Sphere_h__
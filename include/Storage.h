@@ -0,0 +1,78 @@
+// Storage.h
+//
+
+#ifndef __Storage_h__
+#define __Storage_h__
+
+/*******************************************************************************
+* The element types lookup tables can be stored as, and how each one turns
+* back into a float when it is sampled. SHalf is an IEEE 754 half (1 sign bit,
+* 5 exponent bits, 10 mantissa bits), which keeps about 3 significant digits
+* over a range of 6e-8 to 65504. The unsigned integer types are normalized
+* (UNORM) storage: TStorage<T>::Normalized is set for them, and the buffer
+* holding them multiplies each sampled channel by a scale (see
+* C3DBuffer::Convert()).
+*******************************************************************************/
+struct SHalf
+{
+	unsigned short n;
+};
+
+// Converts a float to the nearest half (ties go to even), with overflow going to infinity
+inline unsigned short FloatToHalf(const float f)
+{
+	unsigned int n = *(const unsigned int *)&f;
+	unsigned int nSign = (n >> 16) & 0x8000;
+	unsigned int nAbs = n & 0x7FFFFFFF;
+	if(nAbs >= 0x47800000)			// 65536 or more, infinity, or NaN
+		return (unsigned short)(nSign | (nAbs > 0x7F800000 ? 0x7E00 : 0x7C00));
+	if(nAbs < 0x38800000)			// Below the smallest normal half, so it becomes a denormal (or zero)
+	{
+		if(nAbs < 0x33000000)
+			return (unsigned short)nSign;
+		unsigned int nShift = 126 - (nAbs >> 23);
+		unsigned int nMantissa = (nAbs & 0x7FFFFF) | 0x800000;
+		unsigned int nHalf = nMantissa >> nShift;
+		unsigned int nRest = nMantissa & ((1 << nShift) - 1), nMiddle = 1 << (nShift - 1);
+		if(nRest > nMiddle || (nRest == nMiddle && (nHalf & 1)))
+			nHalf++;
+		return (unsigned short)(nSign | nHalf);
+	}
+
+	// Rebias the exponent and round the mantissa to 10 bits (a carry into the exponent is still correct)
+	unsigned int nHalf = (nAbs - 0x38000000) >> 13;
+	unsigned int nRest = nAbs & 0x1FFF;
+	if(nRest > 0x1000 || (nRest == 0x1000 && (nHalf & 1)))
+		nHalf++;
+	return (unsigned short)(nSign | nHalf);
+}
+
+// Converts a half to a float (which is always exact) by moving its exponent and mantissa bits into place and rebiasing
+// the exponent. Denormal halves are normal floats, so they are rebuilt as 2^-14 * (1 + m) and then 2^-14 is subtracted.
+inline float HalfToFloat(const unsigned short h)
+{
+	unsigned int n = (h & 0x7FFF) << 13;
+	unsigned int nExponent = n & 0x0F800000;
+	n += (127 - 15) << 23;
+	if(nExponent == 0x0F800000)		// Infinity or NaN
+		n += (128 - 16) << 23;
+	else if(nExponent == 0)				// Denormal (or zero)
+	{
+		n += 1 << 23;
+		float f = *(const float *)&n - 6.10351562e-05f;
+		return (h & 0x8000) ? -f : f;
+	}
+	n |= (h & 0x8000) << 16;
+	return *(const float *)&n;
+}
+
+inline float ToFloat(const float f)				{ return f; }
+inline float ToFloat(const SHalf h)				{ return HalfToFloat(h.n); }
+inline float ToFloat(const unsigned short n)	{ return (float)n; }
+inline float ToFloat(const unsigned char n)		{ return (float)n; }
+
+template <class T> struct TStorage				{ enum { Normalized = 0 }; };
+template <> struct TStorage<unsigned short>		{ enum { Normalized = 1 }; };
+template <> struct TStorage<unsigned char>		{ enum { Normalized = 1 }; };
+
+#endif // __Storage_h__
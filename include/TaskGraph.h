@@ -0,0 +1,80 @@
+// TaskGraph.h
+//
+
+#ifndef __TaskGraph_h__
+#define __TaskGraph_h__
+
+#include "ThreadPool.h"
+
+#define TASK_MAX_TASKS			32
+#define TASK_MAX_DEPENDENTS		8
+#define TASK_MAX_THREADS		64
+
+typedef void (*PFNTASK)(void *pParam);
+
+struct STask
+{
+	const char *pszName;
+	PFNTASK pfn;
+	void *pParam;
+	bool bMainThread;			// Has to run on the thread that called Run() (i.e. anything that makes GL calls)
+	int nWaiting;				// Dependencies that haven't finished yet
+	int nDependents;
+	int nDependent[TASK_MAX_DEPENDENTS];
+	int nThread;				// The thread it ran on (0 is the one that called Run()), or -1 if it hasn't started
+	float fStart, fEnd;			// When it started and finished, in milliseconds from the start of Run()
+};
+
+/*******************************************************************************
+* Class: CTaskGraph
+********************************************************************************
+* A set of one-shot tasks and the order they have to run in, for startup work
+* that is mostly independent. Run() gives every thread in a CThreadPool a loop
+* that keeps taking the next task whose dependencies have all finished, so
+* independent tasks overlap and the whole graph takes as long as its slowest
+* chain instead of the sum of its tasks. Tasks added with bMainThread only run
+* on the calling thread. Until all of them have started, it waits for the next
+* one to be ready instead of taking other tasks, so one of them never waits
+* behind a long task the pool could have run (with no pool threads it has to
+* take everything itself).
+*
+* A task can only depend on tasks added before it, so there can never be a
+* cycle. Each task's start and end times are kept for LogTimings().
+*******************************************************************************/
+class CTaskGraph
+{
+protected:
+	STask m_task[TASK_MAX_TASKS];
+	int m_nTasks;
+
+	// The scheduler's state while Run() is going
+	CRITICAL_SECTION m_cs;
+	HANDLE m_hWake[TASK_MAX_THREADS];	// Set for every other thread each time a task finishes
+	int m_nThreads;
+	int m_nFinished;
+	double m_fStartTime;				// GetTimerSeconds() when Run() started
+	float m_fTotal;
+
+	static void RunThread(void *pParam, int nThread, int nEnd);
+	int PickTask(int nThread);
+	float GetTime();
+
+public:
+	CTaskGraph()				{ m_nTasks = 0; m_nThreads = 0; m_fTotal = 0; }
+
+	// Returns the index to pass to AddDependency()
+	int AddTask(const char *pszName, PFNTASK pfn, void *pParam, bool bMainThread=false);
+	// Makes nTask wait for nDependency to finish (nDependency has to have been added first)
+	void AddDependency(int nTask, int nDependency);
+
+	// Runs every task on pPool's threads and the calling thread (or just the calling thread if pPool is NULL) and waits for all of them
+	void Run(CThreadPool *pPool);
+	// Traces each task's thread and times, and the total
+	void LogTimings(const char *pszTitle);
+
+	int GetTaskCount()						{ return m_nTasks; }
+	const STask &GetTask(int i)				{ return m_task[i]; }
+	float GetTotalTime()					{ return m_fTotal; }
+};
+
+#endif // __TaskGraph_h__
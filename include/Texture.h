@@ -34,6 +34,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "PixelBuffer.h"
 #include "GLUtil.h"
 
+class CLUTCache;
+
 /*******************************************************************************
 * Class: CTexture
 ********************************************************************************
@@ -68,7 +70,8 @@ public:
 		}
 	}
 
-	static void InitStaticMembers(int nSeed, int nSize);
+	// Builds the shared textures (or loads them from pCache if it isn't NULL and they were saved there before)
+	static void InitStaticMembers(int nSeed, int nSize, CLUTCache *pCache=NULL);
 	static CTexture &GetCloudCell()			{ return m_tCloudCell; }
 	static CTexture &Get1DGlow()			{ return m_t1DGlow; }
 	static CTexture &Get3DNoise()			{ return m_t1DGlow; }
@@ -173,6 +176,7 @@ public:
 		_ASSERT(pBuffer->GetHeight() == m_nPartitionSize);
 		_ASSERT(pBuffer->GetFormat() == m_nFormat);
 		_ASSERT(pBuffer->GetDataType() == m_nDataType);
+		_ASSERT(pBuffer->GetLayout() == LinearLayout);
 		glTexSubImage2D(GL_TEXTURE_2D, 0, x*m_nPartitionSize, y*m_nPartitionSize, pBuffer->GetWidth(), pBuffer->GetHeight(), pBuffer->GetFormat(), pBuffer->GetDataType(), pBuffer->GetBuffer());
 	}
 
@@ -0,0 +1,70 @@
+// ThreadPool.h
+//
+
+#ifndef __ThreadPool_h__
+#define __ThreadPool_h__
+
+// A ParallelFor() callback processes the items in [nStart, nEnd)
+typedef void (*PFNPARALLELFOR)(void *pParam, int nStart, int nEnd);
+
+class CThreadPool;
+struct SWorker
+{
+	CThreadPool *pPool;
+	HANDLE hThread;
+	HANDLE hStart;				// Auto-reset event used to wake this worker up
+};
+
+/*******************************************************************************
+* Class: CThreadPool
+********************************************************************************
+* A persistent set of worker threads that sleep on an event until ParallelFor()
+* hands them a range to split up. The range is cut into fixed-size chunks, and
+* every thread (including the calling thread) keeps grabbing the next chunk
+* with an interlocked increment until there are none left. ParallelFor() does
+* not return until every worker has gone back to sleep, so nothing the callback
+* touches can still be in use once it returns.
+*
+* RunOnEachThread() hands every thread one call of its own instead, for jobs
+* that do their own scheduling (see CTaskGraph). Only one job runs at a time,
+* so a ParallelFor() called from inside a job just runs on the calling thread.
+*******************************************************************************/
+class CThreadPool
+{
+protected:
+	int m_nThreads;
+	SWorker *m_pWorker;
+	HANDLE m_hDone;				// Set by the last worker to finish the current job
+	volatile LONG m_nActive;	// Workers that haven't finished the current job yet
+	volatile LONG m_nNext;		// The next chunk to hand out
+	volatile bool m_bQuit;
+	volatile LONG m_nBusy;		// Set while a job is running
+	bool m_bEachThread;			// The current job is from RunOnEachThread()
+
+	// The current job
+	PFNPARALLELFOR m_pfnJob;
+	void *m_pParam;
+	int m_nCount;
+	int m_nChunkSize;
+	int m_nChunks;
+
+	static unsigned __stdcall WorkerProc(void *pParam);
+	void RunChunks();
+
+public:
+	CThreadPool();
+	~CThreadPool()				{ Cleanup(); }
+
+	// Starts nThreads workers, or one less than the number of processors if nThreads < 0 (the calling thread makes up the difference)
+	void Init(int nThreads=-1);
+	void Cleanup();
+
+	int GetThreadCount()		{ return m_nThreads; }
+
+	// Calls pfn on every chunk of [0, nCount) and waits for all of them to finish
+	void ParallelFor(PFNPARALLELFOR pfn, void *pParam, int nCount, int nChunkSize);
+	// Calls pfn(pParam, i, i+1) once on every thread, where i is 0 for the calling thread and 1 to GetThreadCount() for the workers, and waits for them all
+	void RunOnEachThread(PFNPARALLELFOR pfn, void *pParam);
+};
+
+#endif // __ThreadPool_h__
@@ -0,0 +1,50 @@
+// TripleBuffer.h
+//
+
+#ifndef __TripleBuffer_h__
+#define __TripleBuffer_h__
+
+#define TRIPLE_BUFFER_NEW		4		// Set in the shared index when the writer has published a slot the reader hasn't taken
+
+/*******************************************************************************
+* Template: TTripleBuffer
+********************************************************************************
+* Hands the newest copy of a T from one writer thread to one reader thread
+* without either of them ever waiting on the other. There are three slots:
+* the writer fills its back slot and Publish() swaps it with the shared slot,
+* and the reader's Update() swaps its front slot with the shared one if
+* anything new was published since the last time. Each swap is one
+* InterlockedExchange() of a slot index (which is also a full memory barrier),
+* so the reader only ever sees whole Ts, and a writer that is faster than the
+* reader just replaces what it published before.
+*******************************************************************************/
+template <class T> class TTripleBuffer
+{
+protected:
+	T m_slot[3];
+	volatile LONG m_nShared;	// The slot between the two threads, and TRIPLE_BUFFER_NEW
+	int m_nBack;				// Only the writer uses this
+	int m_nFront;				// Only the reader uses this
+
+public:
+	TTripleBuffer()				{ m_nFront = 0; m_nShared = 1; m_nBack = 2; }
+
+	// Sets every slot (only while neither thread is using it)
+	void Fill(const T &t)		{ m_slot[0] = m_slot[1] = m_slot[2] = t; }
+
+	// The writer's side
+	T &GetBack()				{ return m_slot[m_nBack]; }
+	void Publish()				{ m_nBack = InterlockedExchange(&m_nShared, m_nBack | TRIPLE_BUFFER_NEW) & 3; }
+
+	// The reader's side (Update() returns true if GetFront() changed)
+	bool Update()
+	{
+		if(!(m_nShared & TRIPLE_BUFFER_NEW))
+			return false;
+		m_nFront = InterlockedExchange(&m_nShared, m_nFront) & 3;
+		return true;
+	}
+	const T &GetFront() const	{ return m_slot[m_nFront]; }
+};
+
+#endif // __TripleBuffer_h__
@@ -162,7 +162,7 @@ public:
 		m_hInstance = hInstance;
 		m_hWndParent = hWndParent;
 	}
-	static BOOL CALLBACK DlgProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+	static INT_PTR CALLBACK DlgProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 	{
 		CDialog *pDlg;
 		switch(uMsg)
@@ -170,14 +170,14 @@ public:
 			case WM_INITDIALOG:
 			{
 				pDlg = (CDialog *)lParam;
-				::SetWindowLong(hWnd, GWL_USERDATA, (long)pDlg);
+				::SetWindowLongPtr(hWnd, GWLP_USERDATA, (LONG_PTR)pDlg);
 				pDlg->m_hWnd = hWnd;
 				pDlg->CenterDialog();
 				return pDlg->OnInitDialog(hWnd);
 			}
 			case WM_COMMAND:
 			{
-				pDlg = (CDialog *)::GetWindowLong(hWnd, GWL_USERDATA);
+				pDlg = (CDialog *)::GetWindowLongPtr(hWnd, GWLP_USERDATA);
 				if(wParam == IDOK)
 					return pDlg->OnOK();
 				if(wParam == IDCANCEL)
@@ -187,7 +187,7 @@ public:
 		}
 		return FALSE;
 	}
-	int DoModal()								{ return ::DialogBoxParam(m_hInstance, MAKEINTRESOURCE(m_nID), m_hWndParent, DlgProc, (LPARAM)this); }
+	int DoModal()								{ return (int)::DialogBoxParam(m_hInstance, MAKEINTRESOURCE(m_nID), m_hWndParent, DlgProc, (LPARAM)this); }
 	virtual bool OnInitDialog(HWND hWnd)		{ return true; }
 	virtual bool OnOK()							{ ::EndDialog(m_hWnd, IDOK); return false; }
 	virtual bool OnCancel()						{ ::EndDialog(m_hWnd, IDCANCEL); return false; }
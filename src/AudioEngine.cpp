@@ -0,0 +1,504 @@
+// AudioEngine.cpp
+//
+
+#include "Master.h"
+#include "AudioEngine.h"
+#include "Noise.h"		// For Min() and Max()
+#include <process.h>
+#include "../ALFramework/Framework.h"
+#include "../ALFramework/CWaves.h"
+
+CAudioEngine::CAudioEngine()
+{
+	m_bInit = false;
+	m_nSamples = 0;
+	m_nVoices = 0;
+	m_nPlays = 0;
+	m_szError[0] = 0;
+	m_pWaves = NULL;
+	m_nStreams = 0;
+	m_nAnalysisStream = -1;
+	m_hThread = NULL;
+	m_hWake = NULL;
+	m_bQuit = false;
+	m_nNextID = 0;
+	m_nDropped = 0;
+}
+
+bool CAudioEngine::Init()
+{
+	Cleanup();
+	ALFWInit();
+	if(!ALFWInitOpenAL())
+	{
+		sprintf(m_szError, "Failed to initialize OpenAL");
+		ALFWShutdown();
+		return false;
+	}
+
+	// Get as many sources as the device will give, up to AUDIO_MAX_VOICES
+	for(m_nVoices=0; m_nVoices<AUDIO_MAX_VOICES; m_nVoices++)
+	{
+		ALuint uiSource;
+		alGetError();
+		alGenSources(1, &uiSource);
+		if(alGetError() != AL_NO_ERROR)
+			break;
+		m_voice[m_nVoices].nSource = uiSource;
+		m_voice[m_nVoices].nID = 0;
+		m_voice[m_nVoices].nPriority = 0;
+		m_voice[m_nVoices].nStarted = 0;
+		m_voice[m_nVoices].nStream = -1;
+	}
+	m_pWaves = new CWaves();
+	m_bInit = true;
+	return true;
+}
+
+void CAudioEngine::Cleanup()
+{
+	Stop();
+	if(!m_bInit)
+		return;
+	for(int i=0; i<m_nVoices; i++)
+	{
+		ALuint uiSource = m_voice[i].nSource;
+		alSourceStop(uiSource);
+		alDeleteSources(1, &uiSource);
+	}
+	for(int i=0; i<m_nSamples; i++)
+	{
+		ALuint uiBuffer = m_sample[i].nBuffer;
+		alDeleteBuffers(1, &uiBuffer);
+	}
+	for(int i=0; i<m_nStreams; i++)
+	{
+		alDeleteBuffers(AUDIO_STREAM_BUFFERS, (ALuint *)m_stream[i].nBuffer);
+		m_pWaves->DeleteWaveFile(m_stream[i].nWaveID);
+		delete[] m_stream[i].pData;
+	}
+	delete m_pWaves;
+	m_pWaves = NULL;
+	m_nVoices = m_nSamples = m_nStreams = 0;
+	m_nAnalysisStream = -1;
+	ALFWShutdownOpenAL();
+	ALFWShutdown();
+	m_bInit = false;
+}
+
+int CAudioEngine::LoadSample(const char *pszFile)
+{
+	ASSERT(!m_hThread);
+	for(int i=0; i<m_nSamples; i++)
+	{
+		if(_stricmp(m_sample[i].szFile, pszFile) == 0)
+			return i;
+	}
+	if(!m_bInit || m_nSamples == AUDIO_MAX_SAMPLES)
+		return -1;
+
+	ALuint uiBuffer;
+	alGenBuffers(1, &uiBuffer);
+	if(!ALFWLoadWaveToBuffer(pszFile, uiBuffer))
+	{
+		sprintf(m_szError, "Failed to load %s", pszFile);
+		alDeleteBuffers(1, &uiBuffer);
+		return -1;
+	}
+	SAudioSample &sample = m_sample[m_nSamples];
+	strcpy(sample.szFile, pszFile);
+	sample.nBuffer = uiBuffer;
+	return m_nSamples++;
+}
+
+int CAudioEngine::OpenStream(const char *pszFile)
+{
+	ASSERT(!m_hThread);
+	for(int i=0; i<m_nStreams; i++)
+	{
+		if(_stricmp(m_stream[i].szFile, pszFile) == 0)
+			return i;
+	}
+	if(!m_bInit || m_nStreams == AUDIO_MAX_STREAMS)
+		return -1;
+
+	SAudioStream &stream = m_stream[m_nStreams];
+	if(FAILED(m_pWaves->OpenWaveFile(pszFile, &stream.nWaveID)))
+	{
+		sprintf(m_szError, "Failed to open %s", pszFile);
+		return -1;
+	}
+	WAVEFORMATEX wfex;
+	if(FAILED(m_pWaves->GetWaveSize(stream.nWaveID, &stream.nDataSize)) ||
+		FAILED(m_pWaves->GetWaveFrequency(stream.nWaveID, &stream.nFrequency)) ||
+		FAILED(m_pWaves->GetWaveALBufferFormat(stream.nWaveID, &alGetEnumValue, &stream.nFormat)) ||
+		FAILED(m_pWaves->GetWaveFormatExHeader(stream.nWaveID, &wfex)) ||
+		wfex.nBlockAlign == 0 || wfex.nBlockAlign > AUDIO_STREAM_BUFFER_SIZE || stream.nDataSize < wfex.nBlockAlign)
+	{
+		// FillBuffer() relies on there being at least one whole sample frame to read
+		sprintf(m_szError, "Can't stream %s", pszFile);
+		m_pWaves->DeleteWaveFile(stream.nWaveID);
+		return -1;
+	}
+	stream.nBlockAlign = wfex.nBlockAlign;
+	stream.nChannels = wfex.nChannels;
+	stream.nBitsPerSample = wfex.wBitsPerSample;
+	alGenBuffers(AUDIO_STREAM_BUFFERS, (ALuint *)stream.nBuffer);
+	stream.pData = new unsigned char[AUDIO_STREAM_BUFFERS * AUDIO_STREAM_BUFFER_SIZE];
+	stream.nHead = stream.nQueued = 0;
+	stream.nAnalyzed = 0;
+	strcpy(stream.szFile, pszFile);
+	stream.nVoice = -1;
+	stream.bLoop = stream.bEnd = false;
+	return m_nStreams++;
+}
+
+bool CAudioEngine::SetAnalysisStream(int nStream)
+{
+	ASSERT(!m_hThread);
+	if(nStream < 0 || nStream >= m_nStreams)
+		return false;
+	const SAudioStream &stream = m_stream[nStream];
+	if((stream.nBitsPerSample != 8 && stream.nBitsPerSample != 16) || stream.nBlockAlign != (unsigned long)(stream.nChannels * stream.nBitsPerSample / 8))
+		return false;
+	m_analyzer.Init(stream.nFrequency);
+	m_nAnalysisStream = nStream;
+	return true;
+}
+
+void CAudioEngine::Start()
+{
+	if(!m_bInit || m_hThread)
+		return;
+	m_bQuit = false;
+	if(m_nAnalysisStream >= 0)
+		timeBeginPeriod(1);		// Otherwise the waits are rounded up to the scheduler's tick
+	m_hWake = CreateEvent(NULL, FALSE, FALSE, NULL);
+	m_hThread = (HANDLE)_beginthreadex(NULL, 0, ThreadProc, this, 0, NULL);
+}
+
+void CAudioEngine::Stop()
+{
+	if(!m_hThread)
+		return;
+	m_bQuit = true;
+	SetEvent(m_hWake);
+	WaitForSingleObject(m_hThread, INFINITE);
+	CloseHandle(m_hThread);
+	CloseHandle(m_hWake);
+	m_hThread = m_hWake = NULL;
+	if(m_nAnalysisStream >= 0)
+		timeEndPeriod(1);
+}
+
+void CAudioEngine::Post(SAudioCommand &cmd)
+{
+	if(!m_queue.Push(cmd))
+	{
+		InterlockedIncrement(&m_nDropped);
+		cmd.nVoiceID = 0;
+		return;
+	}
+	SetEvent(m_hWake);
+}
+
+unsigned int CAudioEngine::Play(int nSample, bool bLoop, int nPriority, float fGain)
+{
+	if(!m_hThread || nSample < 0 || nSample >= m_nSamples)
+		return 0;
+	SAudioCommand cmd;
+	cmd.nCommand = AUDIO_PLAY;
+	cmd.nVoiceID = (unsigned int)InterlockedIncrement(&m_nNextID);
+	cmd.nSample = nSample;
+	cmd.nPriority = nPriority;
+	cmd.bLoop = bLoop;
+	cmd.fGain = fGain;
+	Post(cmd);
+	return cmd.nVoiceID;
+}
+
+unsigned int CAudioEngine::PlayStream(int nStream, bool bLoop, int nPriority, float fGain)
+{
+	if(!m_hThread || nStream < 0 || nStream >= m_nStreams)
+		return 0;
+	SAudioCommand cmd;
+	cmd.nCommand = AUDIO_PLAY_STREAM;
+	cmd.nVoiceID = (unsigned int)InterlockedIncrement(&m_nNextID);
+	cmd.nSample = nStream;
+	cmd.nPriority = nPriority;
+	cmd.bLoop = bLoop;
+	cmd.fGain = fGain;
+	Post(cmd);
+	return cmd.nVoiceID;
+}
+
+void CAudioEngine::StopVoice(unsigned int nVoiceID)
+{
+	if(!m_hThread || !nVoiceID)
+		return;
+	SAudioCommand cmd;
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.nCommand = AUDIO_STOP;
+	cmd.nVoiceID = nVoiceID;
+	Post(cmd);
+}
+
+void CAudioEngine::StopAll()
+{
+	if(!m_hThread)
+		return;
+	SAudioCommand cmd;
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.nCommand = AUDIO_STOP_ALL;
+	Post(cmd);
+}
+
+unsigned __stdcall CAudioEngine::ThreadProc(void *pParam)
+{
+	CAudioEngine *pAudio = (CAudioEngine *)pParam;
+	while(!pAudio->m_bQuit)
+	{
+		SAudioCommand cmd;
+		while(pAudio->m_queue.Pop(cmd))
+			pAudio->Execute(cmd);
+		pAudio->UpdateVoices();
+		WaitForSingleObject(pAudio->m_hWake, pAudio->m_nAnalysisStream >= 0 ? AUDIO_ANALYSIS_INTERVAL : AUDIO_UPDATE_INTERVAL);
+	}
+	return 0;
+}
+
+int CAudioEngine::FindVoice(int nPriority)
+{
+	// A free voice if there is one, otherwise the oldest of the lowest priority
+	int nBest = -1;
+	for(int i=0; i<m_nVoices; i++)
+	{
+		const SAudioVoice &voice = m_voice[i];
+		if(!voice.nID)
+			return i;
+		if(nBest < 0 || voice.nPriority < m_voice[nBest].nPriority ||
+			(voice.nPriority == m_voice[nBest].nPriority && (int)(voice.nStarted - m_voice[nBest].nStarted) < 0))
+			nBest = i;
+	}
+	if(nBest >= 0 && m_voice[nBest].nPriority > nPriority)
+		return -1;
+	return nBest;
+}
+
+void CAudioEngine::FreeVoice(SAudioVoice &voice)
+{
+	// Stopping marks every queued buffer processed, so clearing the buffer unqueues all of them, and a source
+	// that played a sample goes back to being undetermined (a static one won't take a stream's buffers)
+	alSourceStop(voice.nSource);
+	alSourcei(voice.nSource, AL_BUFFER, 0);
+	if(voice.nStream >= 0)
+	{
+		SAudioStream &stream = m_stream[voice.nStream];
+		stream.nVoice = -1;
+		stream.nQueued = 0;
+		voice.nStream = -1;
+	}
+	voice.nID = 0;
+}
+
+bool CAudioEngine::FillBuffer(SAudioStream &stream, int nSlot)
+{
+	// Reads whole sample frames until the buffer is full, going back to the
+	// start of the data at the end of the file if the stream loops (any partial
+	// frame at the end is skipped), and returns false if there was nothing left
+	unsigned char *pData = stream.pData + nSlot * AUDIO_STREAM_BUFFER_SIZE;
+	unsigned long nSize = AUDIO_STREAM_BUFFER_SIZE - AUDIO_STREAM_BUFFER_SIZE % stream.nBlockAlign;
+	unsigned long nFilled = 0;
+	bool bRewound = false;
+	while(nFilled < nSize && !stream.bEnd)
+	{
+		unsigned long nWant = nSize - nFilled, nRead = 0;
+		if(FAILED(m_pWaves->ReadWaveData(stream.nWaveID, pData + nFilled, nWant, &nRead)))
+			nRead = 0;
+		nRead -= nRead % stream.nBlockAlign;
+		nFilled += nRead;
+		if(nRead)
+			bRewound = false;
+		if(nRead < nWant)
+		{
+			if(!stream.bLoop || bRewound)
+				stream.bEnd = true;
+			else
+			{
+				m_pWaves->SetWaveDataOffset(stream.nWaveID, 0);
+				bRewound = true;
+			}
+		}
+	}
+	if(!nFilled)
+		return false;
+	stream.nFilled[nSlot] = nFilled;
+	alBufferData(stream.nBuffer[nSlot], stream.nFormat, pData, nFilled, stream.nFrequency);
+	return true;
+}
+
+bool CAudioEngine::QueueBuffer(SAudioStream &stream, const SAudioVoice &voice, int nSlot)
+{
+	// Only a buffer the source took is counted, so nQueued always matches its queue (if one is
+	// refused, the stream ends there instead of queueing the ones after it out of order)
+	alGetError();
+	alSourceQueueBuffers(voice.nSource, 1, (ALuint *)&stream.nBuffer[nSlot]);
+	if(alGetError() != AL_NO_ERROR)
+	{
+		stream.bEnd = true;
+		return false;
+	}
+	stream.nQueued++;
+	return true;
+}
+
+void CAudioEngine::StartStream(int nStream, int nVoice)
+{
+	SAudioStream &stream = m_stream[nStream];
+	SAudioVoice &voice = m_voice[nVoice];
+	m_pWaves->SetWaveDataOffset(stream.nWaveID, 0);
+	stream.bEnd = false;
+	stream.nHead = stream.nQueued = 0;
+	stream.nAnalyzed = 0;
+	alSourcei(voice.nSource, AL_LOOPING, AL_FALSE);
+	for(int i=0; i<AUDIO_STREAM_BUFFERS; i++)
+	{
+		if(!FillBuffer(stream, i) || !QueueBuffer(stream, voice, i))
+			break;
+	}
+	stream.nVoice = nVoice;
+	voice.nStream = nStream;
+}
+
+void CAudioEngine::UpdateStream(SAudioVoice &voice)
+{
+	// The analyzer has to be given every buffer that is about to be unqueued
+	SAudioStream &stream = m_stream[voice.nStream];
+	ALint nProcessed;
+	alGetSourcei(voice.nSource, AL_BUFFERS_PROCESSED, &nProcessed);
+	if(voice.nStream == m_nAnalysisStream)
+		AnalyzeStream(stream, voice, nProcessed);
+
+	// A buffer that is refilled goes to the back of the queue, so the buffers stay in order
+	while(nProcessed-- > 0)
+	{
+		ALuint uiBuffer;
+		alSourceUnqueueBuffers(voice.nSource, 1, &uiBuffer);
+		int nSlot = stream.nHead;
+		ASSERT(stream.nBuffer[nSlot] == uiBuffer);
+		stream.nAnalyzed -= Min(stream.nAnalyzed, stream.nFilled[nSlot]);
+		stream.nHead = (nSlot + 1) % AUDIO_STREAM_BUFFERS;
+		stream.nQueued--;
+		if(FillBuffer(stream, nSlot))
+			QueueBuffer(stream, voice, nSlot);
+	}
+}
+
+void CAudioEngine::AnalyzeStream(SAudioStream &stream, const SAudioVoice &voice, int nProcessed)
+{
+	// The play position counts from the start of the first buffer still queued (processed or not), and
+	// once the source has stopped, everything that was queued has been heard. The source keeps playing
+	// while this runs, so the nProcessed buffers it had finished before are counted as heard either way
+	// (they might have been finished and the source stopped in between the calls, which resets the offset).
+	unsigned long nQueuedSize = 0, nProcessedSize = 0;
+	for(int i=0; i<stream.nQueued; i++)
+	{
+		nQueuedSize += stream.nFilled[(stream.nHead + i) % AUDIO_STREAM_BUFFERS];
+		if(i < nProcessed)
+			nProcessedSize = nQueuedSize;
+	}
+	ALint nState, nOffset;
+	alGetSourcei(voice.nSource, AL_SOURCE_STATE, &nState);
+	alGetSourcei(voice.nSource, AL_BYTE_OFFSET, &nOffset);
+	unsigned long nPlayed = nState == AL_PLAYING ? Min(Max((unsigned long)Max(nOffset, 0), nProcessedSize), nQueuedSize) : nQueuedSize;
+	nPlayed -= nPlayed % stream.nBlockAlign;
+
+	unsigned long nStart = 0;
+	for(int i=0; i<stream.nQueued && stream.nAnalyzed < nPlayed; i++)
+	{
+		int nSlot = (stream.nHead + i) % AUDIO_STREAM_BUFFERS;
+		unsigned long nEnd = nStart + stream.nFilled[nSlot];
+		if(stream.nAnalyzed < nEnd)
+		{
+			unsigned long nFrom = stream.nAnalyzed - nStart, nTo = Min(nPlayed, nEnd) - nStart;
+			m_analyzer.WritePCM(stream.pData + nSlot * AUDIO_STREAM_BUFFER_SIZE + nFrom, (nTo - nFrom) / stream.nBlockAlign, stream.nChannels, stream.nBitsPerSample);
+			stream.nAnalyzed = nStart + nTo;
+		}
+		nStart = nEnd;
+	}
+}
+
+void CAudioEngine::Execute(const SAudioCommand &cmd)
+{
+	switch(cmd.nCommand)
+	{
+		case AUDIO_PLAY:
+		case AUDIO_PLAY_STREAM:
+		{
+			// Playing a stream that is already playing restarts it on the same voice
+			int nVoice = -1;
+			if(cmd.nCommand == AUDIO_PLAY_STREAM)
+				nVoice = m_stream[cmd.nSample].nVoice;
+			if(nVoice < 0)
+				nVoice = FindVoice(cmd.nPriority);
+			if(nVoice < 0)
+				break;
+			SAudioVoice &voice = m_voice[nVoice];
+			if(voice.nID)
+				FreeVoice(voice);
+			if(cmd.nCommand == AUDIO_PLAY_STREAM)
+			{
+				m_stream[cmd.nSample].bLoop = cmd.bLoop;
+				StartStream(cmd.nSample, nVoice);
+			}
+			else
+			{
+				alSourcei(voice.nSource, AL_BUFFER, m_sample[cmd.nSample].nBuffer);
+				alSourcei(voice.nSource, AL_LOOPING, cmd.bLoop ? AL_TRUE : AL_FALSE);
+			}
+			alSourcef(voice.nSource, AL_GAIN, cmd.fGain);
+			alSourcePlay(voice.nSource);
+			voice.nID = cmd.nVoiceID;
+			voice.nPriority = cmd.nPriority;
+			voice.nStarted = m_nPlays++;
+			break;
+		}
+		case AUDIO_STOP:
+		case AUDIO_STOP_ALL:
+			for(int i=0; i<m_nVoices; i++)
+			{
+				if(m_voice[i].nID && (cmd.nCommand == AUDIO_STOP_ALL || m_voice[i].nID == cmd.nVoiceID))
+					FreeVoice(m_voice[i]);
+			}
+			break;
+	}
+}
+
+void CAudioEngine::UpdateVoices()
+{
+	for(int i=0; i<m_nVoices; i++)
+	{
+		SAudioVoice &voice = m_voice[i];
+		if(!voice.nID)
+			continue;
+		ALint nState;
+		alGetSourcei(voice.nSource, AL_SOURCE_STATE, &nState);
+		if(voice.nStream >= 0)
+		{
+			UpdateStream(voice);
+			if(nState != AL_PLAYING)
+			{
+				// If it ran dry before it could be refilled, start it again with what was just queued
+				ALint nQueued;
+				alGetSourcei(voice.nSource, AL_BUFFERS_QUEUED, &nQueued);
+				if(nQueued > 0)
+				{
+					alSourcePlay(voice.nSource);
+					continue;
+				}
+			}
+		}
+		if(nState != AL_PLAYING)
+			FreeVoice(voice);
+	}
+}
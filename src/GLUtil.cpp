@@ -10,6 +10,9 @@ CGLUtil *CGLUtil::m_pMain = &g_glUtil;
 CGLUtil::CGLUtil()
 {
 	// Start by clearing out all the member variables
+	m_hDC = NULL;
+	m_hGLRC = NULL;
+	m_bVertexBufferObjects = false;
 }
 
 CGLUtil::~CGLUtil()
@@ -22,12 +25,26 @@ void CGLUtil::Init()
 	m_hDC = wglGetCurrentDC();
 	m_hGLRC = wglGetCurrentContext();
 
+	// Then look for the extensions we can use
+	const char *pszExtensions = (const char *)glGetString(GL_EXTENSIONS);
+	if(pszExtensions && strstr(pszExtensions, "GL_ARB_vertex_buffer_object"))
+	{
+		glGenBuffersARB = (PFNGLGENBUFFERSARBPROC)wglGetProcAddress("glGenBuffersARB");
+		glDeleteBuffersARB = (PFNGLDELETEBUFFERSARBPROC)wglGetProcAddress("glDeleteBuffersARB");
+		glBindBufferARB = (PFNGLBINDBUFFERARBPROC)wglGetProcAddress("glBindBufferARB");
+		glBufferDataARB = (PFNGLBUFFERDATAARBPROC)wglGetProcAddress("glBufferDataARB");
+		glMapBufferARB = (PFNGLMAPBUFFERARBPROC)wglGetProcAddress("glMapBufferARB");
+		glUnmapBufferARB = (PFNGLUNMAPBUFFERARBPROC)wglGetProcAddress("glUnmapBufferARB");
+		m_bVertexBufferObjects = glGenBuffersARB && glDeleteBuffersARB && glBindBufferARB && glBufferDataARB && glMapBufferARB && glUnmapBufferARB;
+	}
+
 	// Finally, initialize the default rendering context
 	InitRenderContext(m_hDC, m_hGLRC);
 }
 
 void CGLUtil::Cleanup()
 {
+	m_bVertexBufferObjects = false;
 }
 
 void CGLUtil::InitRenderContext(HDC hDC, HGLRC hGLRC)
@@ -31,6 +31,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "Master.h"
 #include "GameApp.h"
 #include "GameEngine.h"
+#include "Headless.h"
 
 #define _DEBUG 1
 
@@ -39,6 +40,14 @@ SampleViewer sampleViewernew("User Viewer");
 
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, char *pszCmdLine, int nShowCmd)
 {
+	// Bind the kernels to the best instruction set this CPU has (-simd=scalar, sse2, avx, or avx2 forces one for testing)
+	const char *pszLevel = strstr(pszCmdLine, "-simd=");
+	CKernels::Init(pszLevel ? pszLevel + 6 : NULL);
+
+	// Render a scripted camera path to image files without creating a window
+	if(strstr(pszCmdLine, "-headless"))
+		return RunHeadless(pszCmdLine);
+
 	CGameApp app(hInstance, hPrevInstance, pszCmdLine, nShowCmd);
 	if(app.InitInstance())
 		app.Run();
@@ -157,18 +166,8 @@ int CGameApp::OnCreate(HWND hWnd)
 	}
 
 
-		// openNI here
+		// openNI is initialized by the engine's startup tasks, alongside everything else
 
-		openni::Status rc = openni::STATUS_OK;
-
-		char *argv[2]; 
-		rc = sampleViewernew.Init(1, argv); // no arguments
-		if (rc != openni::STATUS_OK)
-		{
-			//return 1;					// don't exit because we want to show something even if there's no sensor connected
-			printf("status not ok");
-		}
-	
 		m_pGameEngine = new CGameEngine(&sampleViewernew);
 		//sampleViewernew.Run(); // don't run yet before stripping opengl main loop
 		//glutDisplayFunc(CGameEngine::RenderFrameStatic);
@@ -209,6 +208,8 @@ void CGameApp::OnSize(int nType, int nWidth, int nHeight)
 	gluPerspective(45.0, (double)nWidth / (double)nHeight, 0.001, 100.0);
 	glMatrixMode(GL_MODELVIEW);
 	glLoadIdentity();
+	if(m_pGameEngine)
+		m_pGameEngine->SetPerspective(45.0f, (float)nWidth / (float)nHeight, 0.001f, 100.0f);
 	CRect rect;
 	GetClientRect(&rect);
 	m_nWidth = rect.Width();
@@ -33,34 +33,18 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "GameEngine.h"
 #include "GLUtil.h"
 #include "Viewer.h"
-#include <process.h> 
- 
-#include"../ALFramework/Framework.h"
 
-char	WHITE_WAVE_FILE[30];
-char g_ALError[100];
-
-typedef struct {
-   char wavFile[30];
-   int data2;
-}t;
-
-void PlayWav(void * param);
-void PlayWavLoop(void * param);
-
-CGameEngine::CGameEngine(SampleViewer * s)
+CGameEngine::CGameEngine(SampleViewer * s, bool bHeadless)
 {
 	sampleViewer = s;
+	m_bHeadless = bHeadless;
 	m_bShowTexture = false;
+	m_lutCache.Init("LUTCache");
 
-	//GetApp()->MessageBox((const char *)glGetString(GL_EXTENSIONS));
-	GLUtil()->Init();
-	m_fFont.Init(GetGameApp()->GetHDC());
 	m_nPolygonMode = GL_FILL;
 	m_3DCamera.SetPosition(CDoubleVector(0, 0, 25));
 	m_vLight = CVector(1000, 1000, 1000);
 	m_vLightDirection = m_vLight / m_vLight.Magnitude();
-	CTexture::InitStaticMembers(238653, 256);
 
 	m_nSamples = 4;		// Number of sample rays to use in integral equation
 	m_Kr = 0.0025f;		// Rayleigh scattering constant
@@ -69,6 +53,10 @@ CGameEngine::CGameEngine(SampleViewer * s)
 	m_Km4PI = m_Km*4.0f*PI;
 	m_ESun = 15.0f;		// Sun brightness constant
 	m_g = -0.75f;		// The Mie phase asymmetry factor
+	m_bAudioReactive = true;
+	m_fESunScale = 1.0f;
+	m_fAudioBass = m_fAudioFlash = 0.0f;
+	m_nAudioOnsets = 0;
 
 	m_fInnerRadius = 10.0f;
 	m_fOuterRadius = 10.15f;
@@ -83,47 +71,342 @@ CGameEngine::CGameEngine(SampleViewer * s)
 
 	m_fRayleighScaleDepth = 0.25f;
 	m_fMieScaleDepth = 0.1f;
-	m_pbOpticalDepth.MakeOpticalDepthBuffer(m_fInnerRadius, m_fOuterRadius, m_fRayleighScaleDepth, m_fMieScaleDepth);
-
-	m_sphereInner.Init(m_fInnerRadius, 50, 50);
-	m_sphereOuter.Init(m_fOuterRadius, 100, 100);
+	m_nOpticalDepthSize = 128;
+	m_nOpticalDepthSamples = 10;
+	m_nOpticalDepthType = FloatType;
+	m_nOpticalDepthVersion = 0;
+	m_bScatteringTable = false;
+	m_bPhaseTable = true;
+	m_fPhaseConstants[0] = -1;		// Not built yet
+	m_fColorTolerance = 0.002f;
+	m_bLOD = false;
+	m_bCulling = true;
+	SetPerspective(45.0f, 4.0f / 3.0f, 0.001f, 100.0f);
+	m_nLoopStream[0] = m_nLoopStream[1] = m_nChordSample = -1;
+	m_fFPS = m_fSensorFPS = 0;
+	m_nSensorFrames = 0;
 
 	headFront = headBack = headLeft = headRight = handLeft = handRight = false;
 
 	skip = jointIdx = 0;
 	float initialH_x = initialRH_x = initialH_z = initialRH_z = 0;
+	startFly = false;
 
-	// Initialize Framework
-	ALFWInit();
+	// Everything else only depends on the settings above, so the slow stages (the sensor, the sounds, and the meshes)
+	// overlap on the thread pool, and only the stages that make GL calls are kept on this thread
+	m_threadPool.Init();
+	CTaskGraph startup;
+	int nGL = -1;
+	if(!m_bHeadless)
+	{
+		nGL = startup.AddTask("GL", StartupGL, this, true);
+		startup.AddDependency(startup.AddTask("Textures", StartupTextures, this, true), nGL);
+		if(sampleViewer)
+			startup.AddTask("Sensor", StartupSensor, this);
+		int nAudio = startup.AddTask("OpenAL", StartupAudio, this);
+		int nSamples = startup.AddTask("Samples", StartupSamples, this);
+		startup.AddDependency(nSamples, nAudio);
+		startup.AddDependency(startup.AddTask("Sounds", StartupSounds, this), nSamples);
+	}
+	int nSphere[4];
+	nSphere[0] = startup.AddTask("InnerSphere", StartupInnerSphere, this);
+	nSphere[1] = startup.AddTask("OuterSphere", StartupOuterSphere, this);
+	nSphere[2] = startup.AddTask("InnerLOD", StartupInnerLOD, this);
+	nSphere[3] = startup.AddTask("OuterLOD", StartupOuterLOD, this);
+	int nBuffers = startup.AddTask("SphereBuffers", StartupSphereBuffers, this, true);
+	for(int i=0; i<4; i++)
+		startup.AddDependency(nBuffers, nSphere[i]);
+	if(nGL >= 0)
+		startup.AddDependency(nBuffers, nGL);
+	startup.Run(&m_threadPool);
+	startup.LogTimings("Startup");
+
+	// The optical depth table isn't a task because the pool runs serially while it runs the graph, and a table
+	// that isn't in the cache yet is built with ParallelFor() on the whole pool (one that is only has to be mapped)
+	UpdateOpticalDepth(true);
+}
 
-	ALFWprintf("PlayStatic Test Application\n");
+void CGameEngine::StartupGL(void *pParam)
+{
+	CGameEngine *pEngine = (CGameEngine *)pParam;
+	//GetApp()->MessageBox((const char *)glGetString(GL_EXTENSIONS));
+	GLUtil()->Init();
+	pEngine->m_fFont.Init(GetGameApp()->GetHDC());
+}
+
+void CGameEngine::StartupTextures(void *pParam)
+{
+	CGameEngine *pEngine = (CGameEngine *)pParam;
+	CTexture::InitStaticMembers(238653, 256, &pEngine->m_lutCache);
+}
 
-	if (!ALFWInitOpenAL())
+void CGameEngine::StartupSensor(void *pParam)
+{
+	CGameEngine *pEngine = (CGameEngine *)pParam;
+	char *argv[2];
+	openni::Status rc = pEngine->sampleViewer->Init(1, argv); // no arguments
+	if (rc != openni::STATUS_OK)
 	{
-		sprintf(g_ALError, "Failed to initialize OpenAL\n");
-		ALFWShutdown();
+		// don't exit because we want to show something even if there's no sensor connected
+		printf("status not ok");
+		return;
 	}
+	pEngine->m_skeleton.Start(pEngine->sampleViewer);
+}
 
-	// http://stackoverflow.com/questions/3169009/passing-arguments-to-beginthread-whats-wrong
-	t *arg1;
-	arg1 = (t *)malloc(sizeof(t));	
-	sprintf(arg1->wavFile, "media/white_16.wav");
-	_beginthread(	PlayWavLoop, 0, (void*) arg1);
+void CGameEngine::StartupAudio(void *pParam)
+{
+	CGameEngine *pEngine = (CGameEngine *)pParam;
+	pEngine->m_audio.Init();
+}
 
-	t *arg2;
-	arg2 = (t *)malloc(sizeof(t));
-	sprintf(arg2->wavFile, "media/bass_808_1.wav");
-	_beginthread(	PlayWavLoop, 0, (void*) arg2);
+void CGameEngine::StartupSamples(void *pParam)
+{
+	// Every one-shot sound is decoded here, so a gesture never has to wait for the disk
+	// (the long loops are only opened, and the audio thread reads them as they play)
+	CGameEngine *pEngine = (CGameEngine *)pParam;
+	pEngine->m_nLoopStream[0] = pEngine->m_audio.OpenStream("media/white_16.wav");
+	pEngine->m_nLoopStream[1] = pEngine->m_audio.OpenStream("media/bass_808_1.wav");
+	pEngine->m_nChordSample = pEngine->m_audio.LoadSample("media/space_chord_1.wav");
+	pEngine->m_audio.SetAnalysisStream(pEngine->m_nLoopStream[1]);		// The sun follows the bass loop
+}
 
-	startFly = false;
+void CGameEngine::StartupSounds(void *pParam)
+{
+	CGameEngine *pEngine = (CGameEngine *)pParam;
+	pEngine->m_audio.Start();
+	for(int i=0; i<2; i++)
+		pEngine->m_audio.PlayStream(pEngine->m_nLoopStream[i], true, SOUND_PRIORITY_LOOP);
+}
+
+// The meshes are built without their buffer objects, which StartupSphereBuffers() creates on the thread with the GL context
+void CGameEngine::StartupInnerSphere(void *pParam)
+{
+	CGameEngine *pEngine = (CGameEngine *)pParam;
+	pEngine->m_sphereInner.Init(pEngine->m_fInnerRadius, 50, 50, false);
+}
+
+void CGameEngine::StartupOuterSphere(void *pParam)
+{
+	CGameEngine *pEngine = (CGameEngine *)pParam;
+	pEngine->m_sphereOuter.Init(pEngine->m_fOuterRadius, 100, 100, false);
+}
+
+void CGameEngine::StartupInnerLOD(void *pParam)
+{
+	CGameEngine *pEngine = (CGameEngine *)pParam;
+	pEngine->m_lodInner.Init(pEngine->m_fInnerRadius, 8192, false);
+}
+
+void CGameEngine::StartupOuterLOD(void *pParam)
+{
+	CGameEngine *pEngine = (CGameEngine *)pParam;
+	pEngine->m_lodOuter.Init(pEngine->m_fOuterRadius, 8192, false);
+}
+
+void CGameEngine::StartupSphereBuffers(void *pParam)
+{
+	CGameEngine *pEngine = (CGameEngine *)pParam;
+	pEngine->m_sphereInner.CreateBuffers();
+	pEngine->m_sphereOuter.CreateBuffers();
+	pEngine->m_lodInner.CreateBuffers();
+	pEngine->m_lodOuter.CreateBuffers();
 }
 
 CGameEngine::~CGameEngine()
 {
+	m_skeleton.Stop();
+	m_scatteringTable.Cleanup();
+	m_threadPool.Cleanup();
+	m_lutCache.Cleanup();
+	if(m_bHeadless)
+		return;
 	GLUtil()->Cleanup();
+	m_audio.Cleanup();
+}
+
+void CGameEngine::UpdateOpticalDepth(bool bSave)
+{
+	// The table is saved in the format the lookups read, so a cached half or unorm16 table doesn't need converting either
+	CLUTKey key("OpticalDepth", 1);
+	key.Add(m_fInnerRadius);
+	key.Add(m_fOuterRadius);
+	key.Add(m_fRayleighScaleDepth);
+	key.Add(m_fMieScaleDepth);
+	key.Add(m_nOpticalDepthSize);
+	key.Add(m_nOpticalDepthSamples);
+	key.Add(m_nOpticalDepthType);
+
+	const void *pOld = m_pbOpticalDepth.GetBuffer();
+	if(!m_lutCache.Load("OpticalDepth", key, m_pbOpticalDepth))
+	{
+		m_pbOpticalDepth.MakeOpticalDepthBuffer(m_fInnerRadius, m_fOuterRadius, m_fRayleighScaleDepth, m_fMieScaleDepth, m_nOpticalDepthSize, m_nOpticalDepthSamples, &m_threadPool);
+		if(m_nOpticalDepthType != FloatType)
+		{
+			C3DBuffer pbFloat = m_pbOpticalDepth;
+			m_pbOpticalDepth.Convert(pbFloat, m_nOpticalDepthType);
+		}
+		if(bSave)
+			m_lutCache.Save("OpticalDepth", key, m_pbOpticalDepth);
+	}
+	m_lutCache.Release(pOld);
+	m_nOpticalDepthVersion++;
+}
 
-	ALFWShutdownOpenAL();
-	ALFWShutdown();
+void CGameEngine::UpdatePhaseTable()
+{
+	// Only the constants the table is scaled by matter (it's tiny, so it is rebuilt on this thread)
+	if(m_fPhaseConstants[0] == m_ESun && m_fPhaseConstants[1] == m_Kr && m_fPhaseConstants[2] == m_Km && m_fPhaseConstants[3] == m_g)
+		return;
+	m_pbPhase.MakePhaseBuffer(m_ESun, m_Kr, m_Km, m_g);
+	m_fPhaseConstants[0] = m_ESun;
+	m_fPhaseConstants[1] = m_Kr;
+	m_fPhaseConstants[2] = m_Km;
+	m_fPhaseConstants[3] = m_g;
+}
+
+SScatterParams CGameEngine::GetScatterParams()
+{
+	SScatterParams p;
+	p.vCamera = m_3DCamera.GetPosition();
+	p.vLightDirection = m_vLightDirection;
+	p.nSamples = m_nSamples;
+	p.fKr = m_Kr;
+	p.fKr4PI = m_Kr4PI;
+	p.fKm = m_Km;
+	p.fKm4PI = m_Km4PI;
+	p.fESun = m_ESun;
+	p.g = m_g;
+	p.fInnerRadius = m_fInnerRadius;
+	p.fOuterRadius = m_fOuterRadius;
+	p.fScale = m_fScale;
+	for(int i=0; i<3; i++)
+		p.fInvWavelength4[i] = 1.0f / m_fWavelength4[i];
+	p.pPhase = NULL;
+	p.nPhaseSize = 0;
+	if(m_bPhaseTable)
+	{
+		UpdatePhaseTable();
+		p.pPhase = (const float *)m_pbPhase.GetBuffer();
+		p.nPhaseSize = m_pbPhase.GetWidth();
+	}
+	return p;
+}
+
+void CGameEngine::SetColors(SVertex *pVertex, const int *pIndex, int nCount)
+{
+	// Runs the same math as SetColor() on a vector of vertices at a time (1, 4, or 8 wide depending on the CPU)
+	CKernels::Get().pfnScatterBatch(GetScatterParams(), m_pbOpticalDepth, pVertex, pIndex, nCount, NULL);
+}
+
+// Everything a worker thread needs to color a range of one sphere's vertices
+struct SColorJob
+{
+	SScatterParams params;
+	const C3DBuffer *pbOpticalDepth;
+	SVertex *pVertex;
+	CVector *pColorCamera;		// Where each vertex was last colored from
+	const SCullBlock *pBlock;	// Which vertices can be seen
+	int nBlockSize;
+	float fTolerance2;			// Squared reuse tolerance, or less than 0 to recolor everything
+	const CScatteringTable *pTable;	// Look the colors up instead of integrating them if this is not NULL
+};
+
+static void ColorChunk(void *pParam, int nStart, int nEnd)
+{
+	SColorJob *pJob = (SColorJob *)pParam;
+	const CVector &vCamera = pJob->params.vCamera;
+	int nIndex[COLOR_CHUNK_SIZE];
+	int nCount = 0;
+	for(int i=nStart; i<nEnd; i++)
+	{
+		const CVector &vPos = pJob->pVertex[i].vPos;
+		if(!pJob->pBlock[i / pJob->nBlockSize].bVisible)
+		{
+			if(pJob->fTolerance2 < 0)
+				pJob->pColorCamera[i] = CVector(FLT_MAX);
+			continue;
+		}
+
+		// The view ray turns by about |camera movement| / |distance to the vertex| radians, so keep colors for rays that barely moved
+		if(pJob->fTolerance2 >= 0 && vCamera.DistanceSquared(pJob->pColorCamera[i]) <= pJob->fTolerance2 * vCamera.DistanceSquared(vPos))
+			continue;
+		nIndex[nCount++] = i;
+	}
+	if(pJob->pTable)
+		CKernels::Get().pfnLookupBatch(*pJob->pTable, pJob->params, pJob->pVertex, nIndex, nCount);
+	else
+		CKernels::Get().pfnScatterBatch(pJob->params, *pJob->pbOpticalDepth, pJob->pVertex, nIndex, nCount, NULL);
+	for(int i=0; i<nCount; i++)
+		pJob->pColorCamera[nIndex[i]] = vCamera;
+}
+
+// True if everything but the camera position is exactly the same in both
+static bool SameScattering(const SScatterParams &p1, const SScatterParams &p2)
+{
+	return p1.vLightDirection.x == p2.vLightDirection.x && p1.vLightDirection.y == p2.vLightDirection.y && p1.vLightDirection.z == p2.vLightDirection.z &&
+		p1.nSamples == p2.nSamples && p1.fKr == p2.fKr && p1.fKm == p2.fKm && p1.fESun == p2.fESun && p1.g == p2.g &&
+		p1.fInnerRadius == p2.fInnerRadius && p1.fOuterRadius == p2.fOuterRadius &&
+		p1.fInvWavelength4[0] == p2.fInvWavelength4[0] && p1.fInvWavelength4[1] == p2.fInvWavelength4[1] && p1.fInvWavelength4[2] == p2.fInvWavelength4[2] &&
+		(p1.pPhase != NULL) == (p2.pPhase != NULL);
+}
+
+void CGameEngine::UpdateLOD()
+{
+	if(!m_bLOD)
+		return;
+	CVector vCamera = m_3DCamera.GetPosition();
+	m_lodInner.Update(vCamera);
+	m_lodOuter.Update(vCamera);
+}
+
+void CGameEngine::UpdateColors(CSphere &sphere)
+{
+	SColorJob job;
+	job.params = GetScatterParams();
+	job.pbOpticalDepth = &m_pbOpticalDepth;
+	job.pVertex = sphere.GetVertexBuffer();
+	job.pTable = NULL;
+	if(m_bScatteringTable)
+	{
+		// Until the first table is ready (and while a new one is built), keep using what we have
+		m_scatteringTable.Update(job.params, m_pbOpticalDepth, m_nOpticalDepthVersion);
+		if(m_scatteringTable.IsReady())
+			job.pTable = &m_scatteringTable;
+	}
+	int nScatteringTable = job.pTable ? m_scatteringTable.GetVersion() : 0;
+
+	// Find the blocks of vertices that can be seen before doing any work on them
+	bool bNewlyVisible;
+	if(m_bCulling)
+	{
+		CFrustum frustum;
+		frustum.Init(job.params.vCamera, m_3DCamera, m_fFOV, m_fAspect, m_fNear, m_fFar);
+		bNewlyVisible = sphere.Cull(&frustum, job.params.vCamera, m_fInnerRadius);
+	}
+	else
+		bNewlyVisible = sphere.Cull(NULL, job.params.vCamera, 0);
+	job.pBlock = sphere.GetBlocks();
+	job.nBlockSize = sphere.GetBlockSize();
+
+	// Only the camera can have moved if the scattering constants and the tables are the same as last time
+	SColorState &state = sphere.GetColorState();
+	job.pColorCamera = state.pCamera;
+	job.fTolerance2 = -1;
+	if(state.bValid && state.nOpticalDepthVersion == m_nOpticalDepthVersion && state.nScatteringTable == nScatteringTable && SameScattering(state.params, job.params))
+	{
+		const CVector &v1 = state.params.vCamera, &v2 = job.params.vCamera;
+		if(v1.x == v2.x && v1.y == v2.y && v1.z == v2.z && !bNewlyVisible)
+			return;		// Nothing changed (and turning the camera didn't bring anything new into view), so the colors from the last pass are still exact
+		job.fTolerance2 = m_fColorTolerance * m_fColorTolerance;
+	}
+	state.bValid = true;
+	state.nOpticalDepthVersion = m_nOpticalDepthVersion;
+	state.nScatteringTable = nScatteringTable;
+	state.params = job.params;
+
+	// Split the vertex buffer into chunks for the worker threads (this thread works on them too, and waits for the rest to finish)
+	m_threadPool.ParallelFor(ColorChunk, &job, sphere.GetVertexCount(), COLOR_CHUNK_SIZE);
 }
 
 void CGameEngine::SetColor(SVertex *pVertex)
@@ -169,10 +452,7 @@ void CGameEngine::SetColor(SVertex *pVertex)
 
 	// If the distance between the points on the ray is negligible, don't bother to calculate anything
 	if(fFar <= DELTA)
-	{
-		glColor4f(0, 0, 0, 1);
 		return;
-	}
 
 	// Initialize a few variables to use inside the loop
 	float fRayleighSum[3] = {0, 0, 0};
@@ -241,15 +521,23 @@ void CGameEngine::SetColor(SVertex *pVertex)
 		vPos += vSampleRay;
 	}
 
-	// Calculate the angle and phase values (this block of code could be handled by a small 1D lookup table, or a 1D texture lookup in a pixel shader)
+	// Calculate the angle and phase values (looked up in a small 1D table unless it has been switched off)
 	float fAngle = -vRay | m_vLightDirection;
 	float fPhase[2];
-	float fAngle2 = fAngle*fAngle;
-	float g2 = m_g*m_g;
-	fPhase[0] = 0.75f * (1.0f + fAngle2);
-	fPhase[1] = 1.5f * ((1 - g2) / (2 + g2)) * (1.0f + fAngle2) / powf(1 + g2 - 2*m_g*fAngle, 1.5f);
-	fPhase[0] *= m_Kr * m_ESun;
-	fPhase[1] *= m_Km * m_ESun;
+	if(m_bPhaseTable)
+	{
+		UpdatePhaseTable();
+		m_pbPhase.Interpolate(fPhase, PhaseCoord(fAngle));
+	}
+	else
+	{
+		float fAngle2 = fAngle*fAngle;
+		float g2 = m_g*m_g;
+		fPhase[0] = 0.75f * (1.0f + fAngle2);
+		fPhase[1] = 1.5f * ((1 - g2) / (2 + g2)) * (1.0f + fAngle2) / powf(1 + g2 - 2*m_g*fAngle, 1.5f);
+		fPhase[0] *= m_Kr * m_ESun;
+		fPhase[1] *= m_Km * m_ESun;
+	}
 
 	// Calculate the in-scattering color and clamp it to the max color value
 	float fColor[3] = {0, 0, 0};
@@ -275,13 +563,16 @@ void CGameEngine::RenderFrame(int nMilliseconds)
 	if(nTime >= 1000)
 	{
 		m_fFPS = (float)(nFrames * 1000) / (float)nTime;
-		sprintf(szFrameCount, "%2.2f FPS", m_fFPS);
+		m_fSensorFPS = (float)(m_nSensorFrames * 1000) / (float)nTime;
+		sprintf(szFrameCount, "%2.2f FPS (sensor %2.2f)", m_fFPS, m_fSensorFPS);
 		nTime = nFrames = 0;
+		m_nSensorFrames = 0;
 	}
 	nFrames++;
 
 	// Move the camera
 	HandleInput(nMilliseconds * 0.001f);
+	UpdateAudio(nMilliseconds * 0.001f);
 
 	glClearColor(0, 0, 0, 0);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -295,7 +586,15 @@ void CGameEngine::RenderFrame(int nMilliseconds)
 
 	if(m_bShowTexture)
 	{
-		CTexture t(&m_pbOpticalDepth);
+		// CTexture uploads the elements as they are stored, so a half or unsigned short table is turned back into floats first
+		CPixelBuffer pbFloat, *pb = &m_pbOpticalDepth;
+		if(m_pbOpticalDepth.GetDataType() != FloatType)
+		{
+			pbFloat.Init(m_pbOpticalDepth.GetWidth(), m_pbOpticalDepth.GetHeight(), m_pbOpticalDepth.GetDepth(), m_pbOpticalDepth.GetChannels(), m_pbOpticalDepth.GetFormat(), FloatType);
+			pbFloat.Convert(m_pbOpticalDepth, FloatType);
+			pb = &pbFloat;
+		}
+		CTexture t(pb);
 		t.Enable();
 		glBegin(GL_QUADS);
 		glTexCoord2f(0, 0);
@@ -311,25 +610,15 @@ void CGameEngine::RenderFrame(int nMilliseconds)
 	}
 	else
 	{
-		// Update the color for the vertices of each sphere
-		CVector vCamera = m_3DCamera.GetPosition();
-		SVertex *pBuffer = m_sphereInner.GetVertexBuffer();
-		for(int i=0; i<m_sphereInner.GetVertexCount(); i++)
-		{
-			if((vCamera | pBuffer[i].vPos) > 0)		// Cheap optimization: Don't update vertices on the back half of the sphere
-				SetColor(&pBuffer[i]);
-		}
-		pBuffer = m_sphereOuter.GetVertexBuffer();
-		for(i=0; i<m_sphereOuter.GetVertexCount(); i++)
-		{
-			if((vCamera | pBuffer[i].vPos) > 0)		// Cheap optimization: Don't update vertices on the back half of the sphere
-				SetColor(&pBuffer[i]);
-		}
+		// Update the tessellation and the color for the vertices of each sphere
+		UpdateLOD();
+		UpdateColors(*GetInnerSphere());
+		UpdateColors(*GetOuterSphere());
 
 		// Then draw the two spheres
-		m_sphereInner.Draw();
+		GetInnerSphere()->Draw(m_fESunScale);
 		glFrontFace(GL_CW);
-		m_sphereOuter.Draw();
+		GetOuterSphere()->Draw(m_fESunScale);
 		glFrontFace(GL_CCW);
 	}
 
@@ -396,26 +685,63 @@ void CGameEngine::RenderFrame(int nMilliseconds)
 	//m_fFont.Print(sampleViewer->m_error);
 
 	//sampleViewer->Display();
-	nite::UserTrackerFrameRef userTrackerFrame;
-	openni::VideoFrameRef depthFrame;
-	nite::Status rc = sampleViewer->m_pUserTracker->readFrame(&userTrackerFrame);
+	// The sensor is read on its own thread, and the gestures only react to the frames it publishes (the rate they were tuned for)
+	if(m_skeleton.Update())
+	{
+		m_nSensorFrames++;
+		UpdateGestures(m_skeleton.GetSnapshot());
+	}
+	const SSkeletonSnapshot &skeleton = m_skeleton.GetSnapshot();
 
-	
-	int skipAmount = int(m_fFPS)*4;		// variable skip depending on the frameRate - constant in human time
-	//int skipAmount = 300;
+	sprintf(szBuffer, "initialH_x: %.1f  x:%.1f ", initialH_x, skeleton.head.x);
+	m_fFont.Print(szBuffer);
+
+	m_fFont.SetPosition(0, 30);
+	sprintf(szBuffer, "initialH_z: %.1f  z:%.1f   ", initialH_z, skeleton.head.z);
+	m_fFont.Print(szBuffer);
+
+	m_fFont.SetPosition(0, 45);	
+	//sprintf(szBuffer, "Users: %d  hf:%d hb:%d hl:%d hr:%d hal:%d har:%d skAmount: %d    v: %.3f ", users.getSize(), headFront, headBack, headLeft, headRight, handLeft, handRight, skipAmount, m_3DCamera.m_vVelocity.Magnitude());
+	sprintf(szBuffer, "Users: %d  hf:%d hb:%d   v: %.3f ", skeleton.nUsers, headFront, headBack, m_3DCamera.m_vVelocity.Magnitude());
+	m_fFont.Print(szBuffer);
+
+	m_fFont.SetPosition(0, 60);	
+//	m_fFont.Print(m_audio.GetError());
+
+
+	m_fFont.End();
+	glFlush();
+
+
+
+}
 
-if (rc != nite::STATUS_OK)
+void CGameEngine::UpdateAudio(float fSeconds)
+{
+	// The sun swells with the bass and flashes on every onset. Every color is linear in ESun and clamped to 1
+	// before it's stored, so scaling the stored colors when they're drawn gives the same picture as scaling
+	// ESun, and none of the cached colors or tables have to be redone when the music changes.
+	if(m_audio.UpdateSpectrum())
 	{
-		printf("GetNextData failed\n");
-		return;
+		const SSpectrumSnapshot &spectrum = m_audio.GetSpectrum();
+		float fBass = Max(spectrum.fBand[0], spectrum.fBand[1]);
+		m_fAudioBass = Clamp(0.0f, 1.0f, (fBass - SUN_BASS_FLOOR) / (SUN_BASS_CEILING - SUN_BASS_FLOOR));
+		if(spectrum.nOnsets != m_nAudioOnsets)
+		{
+			m_nAudioOnsets = spectrum.nOnsets;
+			m_fAudioFlash = 1.0f;
+		}
 	}
+	m_fAudioFlash = Max(0.0f, m_fAudioFlash - fSeconds / SUN_ONSET_TIME);
+	float fBoost = m_bAudioReactive ? SUN_BASS_BOOST * m_fAudioBass + SUN_ONSET_BOOST * m_fAudioFlash : 0.0f;
+	m_fESunScale = 1.0f + fBoost;
+}
 
-	depthFrame = userTrackerFrame.getDepthFrame();
-	const nite::UserMap& userLabels = userTrackerFrame.getUserMap();
+void CGameEngine::UpdateGestures(const SSkeletonSnapshot &skeleton)
+{
+	int skipAmount = int(m_fSensorFPS)*4;		// variable skip depending on the sensor's frame rate - constant in human time
+	//int skipAmount = 300;
 
-	const nite::Array<nite::UserData>& users = userTrackerFrame.getUsers();
-	
-	
 	float x,y,z;
 	x = y = z = 0;
 
@@ -424,32 +750,24 @@ if (rc != nite::STATUS_OK)
 		skip = 1;
 
 
-	if (users.getSize() > 0 && skipAmount > 0)
-{
+	if (skeleton.nUsers > 0 && skipAmount > 0)
+	{
 		if (jointIdx < 500) {
 			jointIdx++;
 		}
 		else
 			jointIdx = 0;
 
-		//user 0 
-		const nite::UserData& user = users[0];
-		sampleViewer->updateUserState(user, userTrackerFrame.getTimestamp());
-		if (user.isNew())
-		{
-			sampleViewer->m_pUserTracker->startSkeletonTracking(user.getId());
-			sampleViewer->m_pUserTracker->startPoseDetection(user.getId(), nite::POSE_CROSSED_HANDS);
-		}
-		else if (!user.isLost())
-		{
-
+		//user 0 (the sensor thread already updated its state)
+		if (!skeleton.bTracked)
+			return;
 
-		nite::SkeletonJoint jh = users[0].getSkeleton().getJoint(nite::JOINT_HEAD);
-		nite::SkeletonJoint jrh = users[0].getSkeleton().getJoint(nite::JOINT_RIGHT_HAND);
+		const SSkeletonJoint &jh = skeleton.head;
+		const SSkeletonJoint &jrh = skeleton.rightHand;
 			 
 		// HEAD
-		if (jh.getPositionConfidence() > 0.5f)  {
-			x = jh.getPosition().x;	y = jh.getPosition().y;	z = jh.getPosition().z;
+		if (jh.fConfidence > 0.5f)  {
+			x = jh.x;	y = jh.y;	z = jh.z;
 			jointHistoryH[jointIdx] = jh;
 
 			if (initial || 	skip%skipAmount ==0) {
@@ -504,10 +822,7 @@ if (rc != nite::STATUS_OK)
 				m_3DCamera.SetVelocity(-m_3DCamera.GetVelocity());
 			}
 
-			t *arg1;
-			arg1 = (t *)malloc(sizeof(t));	
-			sprintf(arg1->wavFile, "media/space_chord_1.wav");
-			_beginthread(	PlayWav, 0, (void*) arg1);
+			m_audio.Play(m_nChordSample);
 			
 		}
 
@@ -517,13 +832,11 @@ if (rc != nite::STATUS_OK)
 			else
 				headLeft = true;
 
-		sprintf(szBuffer, "initialH_x: %.1f  x:%.1f ", initialH_x, x);
-		m_fFont.Print(szBuffer);
 
 
 		// RIGHT HAND
-		if (jrh.getPositionConfidence() > 0.5f)  {
-			x = jrh.getPosition().x;	y = jrh.getPosition().y;	z = jrh.getPosition().z;
+		if (jrh.fConfidence > 0.5f)  {
+			x = jrh.x;	y = jrh.y;	z = jrh.z;
 			jointHistoryRH[jointIdx] = jrh;
 
 			if (initial || 	skip%skipAmount ==0)  {
@@ -540,125 +853,6 @@ if (rc != nite::STATUS_OK)
 			else
 				handLeft  = true;
 	}
-
-	}
-	
-
-	//PlayWav(WHITE_WAVE_FILE);
-
-	m_fFont.SetPosition(0, 30);
-	sprintf(szBuffer, "initialH_z: %.1f  z:%.1f   ", initialH_z, z);
-	m_fFont.Print(szBuffer);
-
-	m_fFont.SetPosition(0, 45);	
-	//sprintf(szBuffer, "Users: %d  hf:%d hb:%d hl:%d hr:%d hal:%d har:%d skAmount: %d    v: %.3f ", users.getSize(), headFront, headBack, headLeft, headRight, handLeft, handRight, skipAmount, m_3DCamera.m_vVelocity.Magnitude());
-	sprintf(szBuffer, "Users: %d  hf:%d hb:%d   v: %.3f ", users.getSize(), headFront, headBack, m_3DCamera.m_vVelocity.Magnitude());
-	m_fFont.Print(szBuffer);
-
-	m_fFont.SetPosition(0, 60);	
-//	m_fFont.Print(g_ALError);
-
-
-	m_fFont.End();
-	glFlush();
-
-
-
-}
-
-void PlayWavLoop(void * param)
-{
-	ALuint      uiBuffer;
-	ALuint      uiSource;
-	ALint       iState;
-
-	t *args = (t*) param;
-   char sound[30];
-   sprintf(sound, args->wavFile);
-   //int y = args->data2;
-   free(args);
-   
-	// Generate an AL Buffer
-	alGenBuffers( 1, &uiBuffer );
-
-	// Load Wave file into OpenAL Buffer
-	if (!ALFWLoadWaveToBuffer(sound, uiBuffer))
-	{
-		sprintf(g_ALError, "Failed to load %s\n", sound);
-		return;
-	}
-
-	// Generate a Source to playback the Buffer
-    alGenSources( 1, &uiSource );
-
-	// Attach Source to Buffer
-	alSourcei( uiSource, AL_BUFFER, uiBuffer );
-
-	while (true) { // loop forever
-
-		// Play Source
-		alSourcePlay( uiSource );
-		sprintf(g_ALError, "Playing Source ");
-		
-		do
-		{
-			Sleep(100);
-			// Get Source State
-			alGetSourcei( uiSource, AL_SOURCE_STATE, &iState);
-		} while (iState == AL_PLAYING);
-	
-	}
-	// Clean up by deleting Source(s) and Buffer(s)
-	alSourceStop(uiSource);
-    alDeleteSources(1, &uiSource);
-	alDeleteBuffers(1, &uiBuffer);
-
-}
-
-void PlayWav(void * param)
-{
-	ALuint      uiBuffer;
-	ALuint      uiSource;
-	ALint       iState;
-
-	t *args = (t*) param;
-   char sound[30];
-   sprintf(sound, args->wavFile);
-   //int y = args->data2;
-   free(args);
-   
-	// Generate an AL Buffer
-	alGenBuffers( 1, &uiBuffer );
-
-	// Load Wave file into OpenAL Buffer
-	if (!ALFWLoadWaveToBuffer(sound, uiBuffer))
-	{
-		sprintf(g_ALError, "Failed to load %s\n", sound);
-		return;
-	}
-
-	// Generate a Source to playback the Buffer
-    alGenSources( 1, &uiSource );
-
-	// Attach Source to Buffer
-	alSourcei( uiSource, AL_BUFFER, uiBuffer );
-
-	// Play Source
-    alSourcePlay( uiSource );
-	sprintf(g_ALError, "Playing Source ");
-		
-	do
-	{
-		Sleep(100);
-		// Get Source State
-		alGetSourcei( uiSource, AL_SOURCE_STATE, &iState);
-	} while (iState == AL_PLAYING);
-
-	// Clean up by deleting Source(s) and Buffer(s)
-	alSourceStop(uiSource);
-    alDeleteSources(1, &uiSource);
-	alDeleteBuffers(1, &uiBuffer);
-
 }
 
 void CGameEngine::OnChar(WPARAM c)
@@ -676,7 +870,45 @@ void CGameEngine::OnChar(WPARAM c)
 			m_nSamples++;
 			break;
 		case '-':
-			m_nSamples--;
+			m_nSamples = Max(1, m_nSamples-1);
+			break;
+		case 'l':
+			// Switch between the uniform spheres and the view-dependent ones
+			m_bLOD = !m_bLOD;
+			break;
+		case 'h':
+			// Switch between the phase function table and evaluating them directly
+			m_bPhaseTable = !m_bPhaseTable;
+			break;
+		case 'c':
+			// Switch frustum and horizon culling on and off
+			m_bCulling = !m_bCulling;
+			break;
+		case 'm':
+			// Switch the sun following the music on and off
+			m_bAudioReactive = !m_bAudioReactive;
+			break;
+		case '4':
+			// Switch between integrating every vertex and looking it up in the precomputed 4D table
+			m_bScatteringTable = !m_bScatteringTable;
+			break;
+		case 'o':
+			// Cycle the optical depth table through 128x128 (10 samples), 256x256 (20) and 512x512 (50)
+			if(m_nOpticalDepthSize >= 512)
+				SetOpticalDepthQuality(128, 10);
+			else if(m_nOpticalDepthSize >= 256)
+				SetOpticalDepthQuality(512, 50);
+			else
+				SetOpticalDepthQuality(256, 20);
+			break;
+		case 'f':
+			// Cycle the optical depth table's format through float, half float, and 16-bit normalized
+			if(m_nOpticalDepthType == FloatType)
+				SetOpticalDepthType(HalfFloatType);
+			else if(m_nOpticalDepthType == HalfFloatType)
+				SetOpticalDepthType(UnsignedShortType);
+			else
+				SetOpticalDepthType(FloatType);
 			break;
 	}
 }
@@ -0,0 +1,519 @@
+// Headless.cpp
+//
+
+#include "Master.h"
+#include "Headless.h"
+#include "Platform.h"
+
+// A vertex in eye space, before it is projected (used for clipping against the near plane)
+struct SClipVertex
+{
+	CVector vEye;
+	float r, g, b;
+};
+
+// Key frames for RunCameraPath(), which moves linearly between them
+static const struct { float vFrom[3]; float vAt[3]; } g_cameraPath[] =
+{
+	{{0.0f, 0.0f, 25.0f}, {0.0f, 0.0f, 0.0f}},		// The starting view from CGameEngine
+	{{18.0f, 6.0f, 12.0f}, {0.0f, 0.0f, 0.0f}},		// Swing around toward the sunlit side
+	{{12.0f, 4.0f, -3.0f}, {0.0f, 0.0f, 0.0f}},		// Down to the edge of the atmosphere
+	{{10.05f, 0.3f, 0.0f}, {9.0f, 1.5f, -5.0f}},	// Inside the atmosphere, looking at the horizon
+};
+#define CAMERA_KEYS		(sizeof(g_cameraPath) / sizeof(g_cameraPath[0]))
+
+CHeadlessRenderer::CHeadlessRenderer(CGameEngine *pEngine, int nWidth, int nHeight)
+{
+	m_pEngine = pEngine;
+	m_nWidth = nWidth;
+	m_nHeight = nHeight;
+	m_fFOV = 45.0f;
+	m_fNear = 0.001f;
+	m_pbColor.Init(nWidth, nHeight, 1, 3, GL_RGB, GL_UNSIGNED_BYTE);
+	m_pbDepth.Init(nWidth, nHeight, 1, GL_FLOAT, 1);
+	m_pEngine->SetPerspective(m_fFOV, (float)nWidth / (float)nHeight, m_fNear, 100.0f);
+	SetCamera(CVector(0, 0, 25), CVector(0, 0, 0));
+}
+
+void CHeadlessRenderer::SetCamera(const CVector &vFrom, const CVector &vAt, const CVector &vUp)
+{
+	CMatrix m;
+	m.ModelMatrix(vFrom, vAt, vUp);
+	C3DObject *pCamera = m_pEngine->GetCamera();
+	*pCamera = m;
+
+	// The GL path loads GetViewMatrix() and then offsets every model by the camera's position, so do the same here
+	m_mView = pCamera->GetViewMatrix();
+	m_vCamera = pCamera->GetPosition();
+}
+
+void CHeadlessRenderer::RenderFrame(float *pfColorTime, float *pfDrawTime)
+{
+	double dStart = GetTimerSeconds();
+	m_pEngine->UpdateLOD();
+	m_pEngine->UpdateColors(*m_pEngine->GetInnerSphere());
+	m_pEngine->UpdateColors(*m_pEngine->GetOuterSphere());
+	double dColor = GetTimerSeconds();
+
+	m_pbColor.ClearBuffer();
+	m_pbDepth.ClearBuffer();
+	DrawSphere(m_pEngine->GetInnerSphere(), false);
+	DrawSphere(m_pEngine->GetOuterSphere(), true);
+	double dDraw = GetTimerSeconds();
+
+	if(pfColorTime)
+		*pfColorTime = (float)((dColor - dStart) * 1000.0);
+	if(pfDrawTime)
+		*pfDrawTime = (float)((dDraw - dColor) * 1000.0);
+}
+
+void CHeadlessRenderer::DrawSphere(CSphere *pSphere, bool bFrontCW)
+{
+	SVertex *pVertex = pSphere->GetVertexBuffer();
+	int nVertices = pSphere->GetVertexCount();
+	unsigned short *pIndex = pSphere->GetIndexBuffer();
+	int nIndices = pSphere->GetIndexCount();
+
+	// Transform every vertex to eye space once (with the colors brightened the way CSphere::Draw() does it)
+	float fBrightness = m_pEngine->GetESunScale();
+	SClipVertex *pEye = new SClipVertex[nVertices];
+	for(int i=0; i<nVertices; i++)
+	{
+		CColor c = BrightenColor(pVertex[i].cColor, fBrightness);
+		pEye[i].vEye = m_mView.TransformVector(pVertex[i].vPos - m_vCamera);
+		pEye[i].r = c.r;
+		pEye[i].g = c.g;
+		pEye[i].b = c.b;
+	}
+
+	float fYScale = 1.0f / tanf(DEGTORAD(m_fFOV * 0.5f));
+	float fXScale = fYScale * (float)m_nHeight / (float)m_nWidth;
+	for(int i=0; i<nIndices; i+=3)
+	{
+		// Clip the triangle against the near plane (w = -z in eye space), which can turn it into a quad
+		SClipVertex *pIn[3] = {&pEye[pIndex[i]], &pEye[pIndex[i+1]], &pEye[pIndex[i+2]]};
+		SClipVertex clip[4];
+		int nClip = 0;
+		for(int j=0; j<3; j++)
+		{
+			SClipVertex *p1 = pIn[j];
+			SClipVertex *p2 = pIn[(j+1) % 3];
+			float w1 = -p1->vEye.z, w2 = -p2->vEye.z;
+			if(w1 >= m_fNear)
+				clip[nClip++] = *p1;
+			if((w1 >= m_fNear) != (w2 >= m_fNear))
+			{
+				float t = (m_fNear - w1) / (w2 - w1);
+				SClipVertex &v = clip[nClip++];
+				v.vEye = p1->vEye + (p2->vEye - p1->vEye) * t;
+				v.r = p1->r + (p2->r - p1->r) * t;
+				v.g = p1->g + (p2->g - p1->g) * t;
+				v.b = p1->b + (p2->b - p1->b) * t;
+			}
+		}
+		if(nClip < 3)
+			continue;
+
+		// Project to window coordinates
+		SScreenVertex screen[4];
+		for(int j=0; j<nClip; j++)
+		{
+			float fInvW = -1.0f / clip[j].vEye.z;
+			screen[j].x = (clip[j].vEye.x * fXScale * fInvW + 1.0f) * 0.5f * m_nWidth;
+			screen[j].y = (clip[j].vEye.y * fYScale * fInvW + 1.0f) * 0.5f * m_nHeight;
+			screen[j].fInvW = fInvW;
+			screen[j].r = clip[j].r * fInvW;
+			screen[j].g = clip[j].g * fInvW;
+			screen[j].b = clip[j].b * fInvW;
+		}
+		DrawPolygon(screen, nClip, bFrontCW);
+	}
+	delete[] pEye;
+}
+
+void CHeadlessRenderer::DrawPolygon(SScreenVertex *pVertex, int nVertices, bool bFrontCW)
+{
+	for(int i=1; i<nVertices-1; i++)
+		DrawTriangle(pVertex[0], pVertex[i], pVertex[i+1], bFrontCW);
+}
+
+void CHeadlessRenderer::DrawTriangle(const SScreenVertex &v0, const SScreenVertex &v1, const SScreenVertex &v2, bool bFrontCW)
+{
+	// Counter-clockwise triangles (in OpenGL's window coordinates) have a positive area
+	float fArea = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+	if(bFrontCW ? fArea >= 0 : fArea <= 0)
+		return;
+	float fInvArea = 1.0f / fArea;
+
+	int nMinX = Max(0, (int)floorf(Min(v0.x, Min(v1.x, v2.x))));
+	int nMaxX = Min(m_nWidth-1, (int)ceilf(Max(v0.x, Max(v1.x, v2.x))));
+	int nMinY = Max(0, (int)floorf(Min(v0.y, Min(v1.y, v2.y))));
+	int nMaxY = Min(m_nHeight-1, (int)ceilf(Max(v0.y, Max(v1.y, v2.y))));
+
+	unsigned char *pColor = (unsigned char *)m_pbColor.GetBuffer();
+	float *pDepth = (float *)m_pbDepth.GetBuffer();
+	for(int y=nMinY; y<=nMaxY; y++)
+	{
+		float py = y + 0.5f;
+		for(int x=nMinX; x<=nMaxX; x++)
+		{
+			// Sample at the pixel center, using the barycentric coordinates to test coverage and interpolate
+			float px = x + 0.5f;
+			float b0 = ((v2.x - v1.x) * (py - v1.y) - (v2.y - v1.y) * (px - v1.x)) * fInvArea;
+			float b1 = ((v0.x - v2.x) * (py - v2.y) - (v0.y - v2.y) * (px - v2.x)) * fInvArea;
+			float b2 = 1.0f - b0 - b1;
+			if(b0 < 0 || b1 < 0 || b2 < 0)
+				continue;
+
+			int nPixel = y * m_nWidth + x;
+			float fInvW = b0 * v0.fInvW + b1 * v1.fInvW + b2 * v2.fInvW;
+			if(fInvW < pDepth[nPixel])
+				continue;
+			pDepth[nPixel] = fInvW;
+
+			float w = 1.0f / fInvW;
+			unsigned char *p = &pColor[nPixel * 3];
+			p[0] = (unsigned char)Min(255.0f, (b0 * v0.r + b1 * v1.r + b2 * v2.r) * w + 0.5f);
+			p[1] = (unsigned char)Min(255.0f, (b0 * v0.g + b1 * v1.g + b2 * v2.g) * w + 0.5f);
+			p[2] = (unsigned char)Min(255.0f, (b0 * v0.b + b1 * v1.b + b2 * v2.b) * w + 0.5f);
+		}
+	}
+}
+
+bool CHeadlessRenderer::WritePPM(const char *pszFile)
+{
+	FILE *pFile = fopen(pszFile, "wb");
+	if(!pFile)
+		return false;
+	fprintf(pFile, "P6\n%d %d\n255\n", m_nWidth, m_nHeight);
+	unsigned char *pColor = (unsigned char *)m_pbColor.GetBuffer();
+	for(int y=m_nHeight-1; y>=0; y--)
+		fwrite(&pColor[y * m_nWidth * 3], 3, m_nWidth, pFile);
+	fclose(pFile);
+	return true;
+}
+
+static unsigned int g_nCRCTable[256];
+static unsigned int UpdateCRC(unsigned int nCRC, const unsigned char *pData, int nLength)
+{
+	if(!g_nCRCTable[1])
+	{
+		for(unsigned int n=0; n<256; n++)
+		{
+			unsigned int c = n;
+			for(int k=0; k<8; k++)
+				c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			g_nCRCTable[n] = c;
+		}
+	}
+	for(int i=0; i<nLength; i++)
+		nCRC = g_nCRCTable[(nCRC ^ pData[i]) & 0xFF] ^ (nCRC >> 8);
+	return nCRC;
+}
+
+static void WriteBigEndian(unsigned char *p, unsigned int n)
+{
+	p[0] = (unsigned char)(n >> 24);
+	p[1] = (unsigned char)(n >> 16);
+	p[2] = (unsigned char)(n >> 8);
+	p[3] = (unsigned char)n;
+}
+
+static void WritePNGChunk(FILE *pFile, const char *pszType, const unsigned char *pData, int nLength)
+{
+	unsigned char szHeader[8];
+	WriteBigEndian(szHeader, nLength);
+	memcpy(&szHeader[4], pszType, 4);
+	unsigned int nCRC = UpdateCRC(0xFFFFFFFF, &szHeader[4], 4);
+	nCRC = UpdateCRC(nCRC, pData, nLength) ^ 0xFFFFFFFF;
+	unsigned char szCRC[4];
+	WriteBigEndian(szCRC, nCRC);
+	fwrite(szHeader, 1, 8, pFile);
+	fwrite(pData, 1, nLength, pFile);
+	fwrite(szCRC, 1, 4, pFile);
+}
+
+bool CHeadlessRenderer::WritePNG(const char *pszFile)
+{
+	FILE *pFile = fopen(pszFile, "wb");
+	if(!pFile)
+		return false;
+	static const unsigned char szSignature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+	fwrite(szSignature, 1, 8, pFile);
+
+	unsigned char szIHDR[13];
+	WriteBigEndian(&szIHDR[0], m_nWidth);
+	WriteBigEndian(&szIHDR[4], m_nHeight);
+	szIHDR[8] = 8;		// Bits per channel
+	szIHDR[9] = 2;		// RGB
+	szIHDR[10] = szIHDR[11] = szIHDR[12] = 0;
+	WritePNGChunk(pFile, "IHDR", szIHDR, 13);
+
+	// Build the raw scanlines (top row first, each with a "none" filter byte), then wrap them in uncompressed deflate blocks
+	int nRowSize = m_nWidth * 3 + 1;
+	int nRawSize = nRowSize * m_nHeight;
+	unsigned char *pRaw = new unsigned char[nRawSize];
+	unsigned char *pColor = (unsigned char *)m_pbColor.GetBuffer();
+	for(int y=0; y<m_nHeight; y++)
+	{
+		pRaw[y * nRowSize] = 0;
+		memcpy(&pRaw[y * nRowSize + 1], &pColor[(m_nHeight-1-y) * m_nWidth * 3], m_nWidth * 3);
+	}
+
+	int nBlocks = (nRawSize + 65534) / 65535;
+	unsigned char *pData = new unsigned char[2 + nBlocks * 5 + nRawSize + 4];
+	int nLength = 0;
+	pData[nLength++] = 0x78;	// zlib header: deflate with a 32K window, no preset dictionary
+	pData[nLength++] = 0x01;
+	unsigned int nAdlerA = 1, nAdlerB = 0;
+	for(int nOffset=0; nOffset<nRawSize; nOffset+=65535)
+	{
+		int nBlock = Min(65535, nRawSize - nOffset);
+		pData[nLength++] = (nOffset + nBlock == nRawSize) ? 1 : 0;
+		pData[nLength++] = (unsigned char)(nBlock & 0xFF);
+		pData[nLength++] = (unsigned char)(nBlock >> 8);
+		pData[nLength++] = (unsigned char)(~nBlock & 0xFF);
+		pData[nLength++] = (unsigned char)((~nBlock >> 8) & 0xFF);
+		memcpy(&pData[nLength], &pRaw[nOffset], nBlock);
+		nLength += nBlock;
+		for(int i=0; i<nBlock; i++)
+		{
+			nAdlerA = (nAdlerA + pRaw[nOffset + i]) % 65521;
+			nAdlerB = (nAdlerB + nAdlerA) % 65521;
+		}
+	}
+	WriteBigEndian(&pData[nLength], (nAdlerB << 16) | nAdlerA);
+	nLength += 4;
+	WritePNGChunk(pFile, "IDAT", pData, nLength);
+	WritePNGChunk(pFile, "IEND", NULL, 0);
+
+	delete[] pData;
+	delete[] pRaw;
+	fclose(pFile);
+	return true;
+}
+
+static unsigned int ReadBigEndian(const unsigned char *p)
+{
+	return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+}
+
+// Reads the pixels of a file written by WritePPM(), top row first (NULL if it isn't one or isn't nWidth by nHeight)
+static unsigned char *ReadPPM(FILE *pFile, int nWidth, int nHeight)
+{
+	int w, h, nMax;
+	if(fscanf(pFile, "P6 %d %d %d", &w, &h, &nMax) != 3 || w != nWidth || h != nHeight || nMax != 255 || fgetc(pFile) == EOF)
+		return NULL;
+	unsigned char *pRGB = new unsigned char[nWidth * nHeight * 3];
+	if(fread(pRGB, nWidth * 3, nHeight, pFile) != (size_t)nHeight)
+	{
+		delete[] pRGB;
+		return NULL;
+	}
+	return pRGB;
+}
+
+// Reads the pixels of a file written by WritePNG(), top row first. It only understands what WritePNG() writes
+// (8-bit RGB in uncompressed deflate blocks with no row filters), and returns NULL for anything else.
+static unsigned char *ReadPNG(FILE *pFile, int nWidth, int nHeight)
+{
+	fseek(pFile, 0, SEEK_END);
+	long nFileSize = ftell(pFile);
+	fseek(pFile, 0, SEEK_SET);
+	if(nFileSize < 8)
+		return NULL;
+	unsigned char *pFileData = new unsigned char[nFileSize];
+	unsigned char *pIDAT = new unsigned char[nFileSize];
+	int nRowSize = nWidth * 3 + 1;
+	int nRawSize = nRowSize * nHeight;
+	unsigned char *pRaw = new unsigned char[nRawSize];
+	unsigned char *pRGB = NULL;
+
+	// Gather the IDAT chunks after checking the header matches
+	static const unsigned char szSignature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+	bool bHeader = false;
+	long nIDAT = 0;
+	long nOffset = 8;
+	bool bValid = fread(pFileData, nFileSize, 1, pFile) == 1 && memcmp(pFileData, szSignature, 8) == 0;
+	while(bValid && nOffset + 12 <= nFileSize)
+	{
+		long nLength = ReadBigEndian(&pFileData[nOffset]);
+		const unsigned char *pType = &pFileData[nOffset + 4];
+		const unsigned char *pData = &pFileData[nOffset + 8];
+		if(nLength > nFileSize - nOffset - 12)
+			bValid = false;
+		else if(memcmp(pType, "IHDR", 4) == 0)
+			bHeader = bValid = nLength == 13 && (int)ReadBigEndian(pData) == nWidth && (int)ReadBigEndian(pData + 4) == nHeight &&
+				pData[8] == 8 && pData[9] == 2 && pData[10] == 0 && pData[11] == 0 && pData[12] == 0;
+		else if(memcmp(pType, "IDAT", 4) == 0)
+		{
+			memcpy(&pIDAT[nIDAT], pData, nLength);
+			nIDAT += nLength;
+		}
+		nOffset += nLength + 12;
+	}
+
+	// Unwrap the stored deflate blocks after the 2-byte zlib header
+	int nRaw = 0;
+	long nPos = 2;
+	bool bFinal = false;
+	bValid = bValid && bHeader;
+	while(bValid && !bFinal)
+	{
+		if(nPos + 5 > nIDAT || (pIDAT[nPos] & 0x06) != 0)
+		{
+			bValid = false;
+			break;
+		}
+		bFinal = (pIDAT[nPos] & 1) != 0;
+		int nBlock = pIDAT[nPos + 1] | (pIDAT[nPos + 2] << 8);
+		nPos += 5;
+		if(nBlock > nIDAT - nPos || nBlock > nRawSize - nRaw)
+		{
+			bValid = false;
+			break;
+		}
+		memcpy(&pRaw[nRaw], &pIDAT[nPos], nBlock);
+		nRaw += nBlock;
+		nPos += nBlock;
+	}
+
+	if(bValid && nRaw == nRawSize)
+	{
+		pRGB = new unsigned char[nWidth * nHeight * 3];
+		for(int y=0; y<nHeight && pRGB; y++)
+		{
+			if(pRaw[y * nRowSize] != 0)
+			{
+				delete[] pRGB;
+				pRGB = NULL;
+			}
+			else
+				memcpy(&pRGB[y * nWidth * 3], &pRaw[y * nRowSize + 1], nWidth * 3);
+		}
+	}
+	delete[] pRaw;
+	delete[] pIDAT;
+	delete[] pFileData;
+	return pRGB;
+}
+
+int CHeadlessRenderer::CompareImage(const char *pszFile)
+{
+	FILE *pFile = fopen(pszFile, "rb");
+	if(!pFile)
+		return -1;
+	int c = fgetc(pFile);
+	rewind(pFile);
+	unsigned char *pRGB = NULL;
+	if(c == 'P')
+		pRGB = ReadPPM(pFile, m_nWidth, m_nHeight);
+	else if(c == 137)
+		pRGB = ReadPNG(pFile, m_nWidth, m_nHeight);
+	fclose(pFile);
+	if(!pRGB)
+		return -1;
+
+	// The file is top row first, the image bottom row first
+	int nMaxDiff = 0;
+	const unsigned char *pColor = (const unsigned char *)m_pbColor.GetBuffer();
+	for(int y=0; y<m_nHeight; y++)
+	{
+		const unsigned char *pRow = &pColor[(m_nHeight-1-y) * m_nWidth * 3];
+		const unsigned char *pRef = &pRGB[y * m_nWidth * 3];
+		for(int i=0; i<m_nWidth*3; i++)
+			nMaxDiff = Max(nMaxDiff, abs((int)pRow[i] - (int)pRef[i]));
+	}
+	delete[] pRGB;
+	return nMaxDiff;
+}
+
+bool CHeadlessRenderer::RunCameraPath(const char *pszPath, int nFrames, bool bPNG, const char *pszReference, int nTolerance)
+{
+	char szFile[_MAX_PATH];
+	if(!MakeDirectory(pszPath))
+		return false;
+	sprintf(szFile, "%s/timing.txt", pszPath);
+	FILE *pLog = fopen(szFile, "wt");
+	if(!pLog)
+		return false;
+	fprintf(pLog, "# %dx%d, %d frames, simd=%s\n", m_nWidth, m_nHeight, nFrames, CKernels::GetLevelName(CKernels::Get().nLevel));
+	fprintf(pLog, "# frame  color(ms)  draw(ms)\n");
+
+	float fColorTotal = 0, fDrawTotal = 0;
+	int nMismatches = 0;
+	for(int n=0; n<nFrames; n++)
+	{
+		// Find the position along the path
+		float t = (nFrames > 1) ? (float)n / (float)(nFrames-1) * (CAMERA_KEYS-1) : 0.0f;
+		int nKey = Min((int)t, (int)CAMERA_KEYS-2);
+		t -= nKey;
+		CVector vFrom0(g_cameraPath[nKey].vFrom), vFrom1(g_cameraPath[nKey+1].vFrom);
+		CVector vAt0(g_cameraPath[nKey].vAt), vAt1(g_cameraPath[nKey+1].vAt);
+		SetCamera(vFrom0 + (vFrom1 - vFrom0) * t, vAt0 + (vAt1 - vAt0) * t);
+
+		float fColorTime, fDrawTime;
+		RenderFrame(&fColorTime, &fDrawTime);
+		fColorTotal += fColorTime;
+		fDrawTotal += fDrawTime;
+		fprintf(pLog, "%5d  %9.3f  %8.3f\n", n, fColorTime, fDrawTime);
+
+		sprintf(szFile, "%s/frame%04d.%s", pszPath, n, bPNG ? "png" : "ppm");
+		if(!(bPNG ? WritePNG(szFile) : WritePPM(szFile)))
+		{
+			fclose(pLog);
+			return false;
+		}
+
+		if(pszReference)
+		{
+			sprintf(szFile, "%s/frame%04d.%s", pszReference, n, bPNG ? "png" : "ppm");
+			int nDiff = CompareImage(szFile);
+			if(nDiff < 0)
+				fprintf(pLog, "# frame %d: can't read %s\n", n, szFile);
+			else if(nDiff > nTolerance)
+				fprintf(pLog, "# frame %d: differs from %s by up to %d\n", n, szFile, nDiff);
+			if(nDiff < 0 || nDiff > nTolerance)
+				nMismatches++;
+		}
+	}
+	if(nFrames > 0)
+		fprintf(pLog, "# average  %9.3f  %8.3f\n", fColorTotal / nFrames, fDrawTotal / nFrames);
+	if(pszReference)
+		fprintf(pLog, "# %d of %d frames don't match %s (tolerance %d)\n", nMismatches, nFrames, pszReference, nTolerance);
+	fclose(pLog);
+	return nMismatches == 0;
+}
+
+int RunHeadless(const char *pszCmdLine)
+{
+	// Options: -out=<dir> -frames=<n> -size=<width>x<height> -ppm -lod -nocull -half -unorm16 -compare=<dir> -tolerance=<n>
+	char szPath[_MAX_PATH] = "headless", szReference[_MAX_PATH] = "";
+	int nFrames = 60, nWidth = 640, nHeight = 480, nTolerance = 0;
+	bool bPNG = true;
+	const char *psz;
+	if((psz = strstr(pszCmdLine, "-out=")) != NULL)
+		sscanf(psz + 5, "%259s", szPath);
+	if((psz = strstr(pszCmdLine, "-frames=")) != NULL)
+		sscanf(psz + 8, "%d", &nFrames);
+	if((psz = strstr(pszCmdLine, "-size=")) != NULL)
+		sscanf(psz + 6, "%dx%d", &nWidth, &nHeight);
+	if(strstr(pszCmdLine, "-ppm"))
+		bPNG = false;
+	if((psz = strstr(pszCmdLine, "-compare=")) != NULL)
+		sscanf(psz + 9, "%259s", szReference);
+	if((psz = strstr(pszCmdLine, "-tolerance=")) != NULL)
+		sscanf(psz + 11, "%d", &nTolerance);
+	if(nWidth <= 0 || nHeight <= 0 || nFrames < 0)
+		return 1;
+
+	CGameEngine engine(NULL, true);
+	engine.UseLOD(strstr(pszCmdLine, "-lod") != NULL);
+	engine.UseCulling(strstr(pszCmdLine, "-nocull") == NULL);
+	if(strstr(pszCmdLine, "-half"))
+		engine.SetOpticalDepthType(HalfFloatType);
+	else if(strstr(pszCmdLine, "-unorm16"))
+		engine.SetOpticalDepthType(UnsignedShortType);
+	CHeadlessRenderer renderer(&engine, nWidth, nHeight);
+	return renderer.RunCameraPath(szPath, nFrames, bPNG, szReference[0] ? szReference : NULL, nTolerance) ? 0 : 1;
+}
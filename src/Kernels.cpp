@@ -0,0 +1,195 @@
+// Kernels.cpp
+//
+
+#include "Master.h"
+#include "Kernels.h"
+#include "ScatteringTable.h"
+#include <intrin.h>
+
+SKernels CKernels::m_kernels;
+unsigned int CKernels::m_nFeatures;
+bool CKernels::m_bDetected;
+
+static const char *g_pszLevelName[SIMD_LEVELS] = {"scalar", "sse2", "avx", "avx2"};
+
+// Each wrapper runs one kernel for vector type F, then lets F clean up after itself
+template <class F, class G> static void ScatterBatchKernel(const SScatterParams &p, const C3DBuffer &pbOpticalDepth, SVertex *pVertex, const int *pIndex, int nCount, float *pSums)
+{
+	switch(pbOpticalDepth.GetDataType())
+	{
+		case HalfFloatType: ScatterBatch<F, G, SHalf>(p, pbOpticalDepth, pVertex, pIndex, nCount, pSums); break;
+		case UnsignedShortType: ScatterBatch<F, G, unsigned short>(p, pbOpticalDepth, pVertex, pIndex, nCount, pSums); break;
+		default: ScatterBatch<F, G, float>(p, pbOpticalDepth, pVertex, pIndex, nCount, pSums); break;
+	}
+	F::EndBatch();
+}
+
+template <class F> static void LookupBatchKernel(const CScatteringTable &table, const SScatterParams &p, SVertex *pVertex, const int *pIndex, int nCount)
+{
+	table.LookupBatch<F>(p, pVertex, pIndex, nCount);
+	F::EndBatch();
+}
+
+template <class F> static void MakeOpticalDepthRowsKernel(const SOpticalDepthJob &job, int nStart, int nEnd)
+{
+	for(int nAngle=nStart; nAngle<nEnd; nAngle++)
+		MakeOpticalDepthRow<F>(job, nAngle);
+	F::EndBatch();
+}
+
+template <class F> static void MakeCloudRowKernel(float *pRow, int nWidth, float fDy, float fExpose, float fSizeDisc)
+{
+	MakeCloudRow<F>(pRow, nWidth, fDy, fExpose, fSizeDisc);
+	F::EndBatch();
+}
+
+template <class F, class G> static void InterpolateBatch1DKernel(const TBuffer<float, 4> &buf, const float *pX, int nCount, float *ppOut[4])
+{
+	InterpolateBatch<F, G>(buf, pX, nCount, ppOut);
+	F::EndBatch();
+}
+
+template <class F, class G> static void InterpolateBatch2DKernel(const TBuffer<float, 4> &buf, const float *pX, const float *pY, int nCount, float *ppOut[4])
+{
+	InterpolateBatch<F, G>(buf, pX, pY, nCount, ppOut);
+	F::EndBatch();
+}
+
+template <class F, class G> static void InterpolateBatch3DKernel(const TBuffer<float, 4> &buf, const float *pX, const float *pY, const float *pZ, int nCount, float *ppOut[4])
+{
+	InterpolateBatch<F, G>(buf, pX, pY, pZ, nCount, ppOut);
+	F::EndBatch();
+}
+
+template <class F, class G> static void MixVoiceKernel(const SMixJob &job)
+{
+	MixVoice<F, G>(job);
+	F::EndBatch();
+}
+
+// F is the vector type and G the gather policy for table fetches (see SIMD.h)
+template <class F, class G> static void BindKernels(SKernels &k)
+{
+	k.nWidth = F::Width;
+	k.pfnScatterBatch = ScatterBatchKernel<F, G>;
+	k.pfnLookupBatch = LookupBatchKernel<F>;
+	k.pfnMakeOpticalDepthRows = MakeOpticalDepthRowsKernel<F>;
+	k.pfnMakeCloudRow = MakeCloudRowKernel<F>;
+	k.pfnInterpolateBatch1D = InterpolateBatch1DKernel<F, G>;
+	k.pfnInterpolateBatch2D = InterpolateBatch2DKernel<F, G>;
+	k.pfnInterpolateBatch3D = InterpolateBatch3DKernel<F, G>;
+	k.pfnMixVoice = MixVoiceKernel<F, G>;
+}
+
+unsigned int CKernels::GetFeatures()
+{
+	if(m_bDetected)
+		return m_nFeatures;
+
+	int nInfo[4];
+	__cpuid(nInfo, 0);
+	int nMaxFunction = nInfo[0];
+	unsigned int nFeatures = 0;
+	if(nMaxFunction >= 1)
+	{
+		__cpuid(nInfo, 1);
+		if(nInfo[3] & (1 << 26))
+			nFeatures |= CPU_SSE2;
+		if(nInfo[2] & (1 << 19))
+			nFeatures |= CPU_SSE41;
+
+		// AVX also needs the OS to save the upper halves of the YMM registers on a context switch (XCR0 bits 1 and 2)
+		unsigned __int64 nXCR0 = 0;
+		if(nInfo[2] & (1 << 27))
+			nXCR0 = _xgetbv(0);
+		bool bYMM = (nXCR0 & 0x06) == 0x06;
+		bool bZMM = (nXCR0 & 0xE6) == 0xE6;
+		if(bYMM && (nInfo[2] & (1 << 28)))
+		{
+			nFeatures |= CPU_AVX;
+			if(nInfo[2] & (1 << 12))
+				nFeatures |= CPU_FMA;
+			if(nInfo[2] & (1 << 29))
+				nFeatures |= CPU_F16C;
+		}
+		if(nMaxFunction >= 7)
+		{
+			__cpuidex(nInfo, 7, 0);
+			if((nFeatures & CPU_AVX) && (nInfo[1] & (1 << 5)))
+				nFeatures |= CPU_AVX2;
+			if(bZMM && (nInfo[1] & (1 << 16)))
+				nFeatures |= CPU_AVX512F;
+		}
+	}
+	m_nFeatures = nFeatures;
+	m_bDetected = true;
+	return m_nFeatures;
+}
+
+bool CKernels::IsSupported(ESIMDLevel nLevel)
+{
+	static const unsigned int nRequired[SIMD_LEVELS] = {0, CPU_SSE2, CPU_AVX, CPU_AVX | CPU_AVX2 | CPU_F16C};
+	return nLevel >= SIMD_SCALAR && nLevel < SIMD_LEVELS && (GetFeatures() & nRequired[nLevel]) == nRequired[nLevel];
+}
+
+ESIMDLevel CKernels::GetBestLevel()
+{
+	int nLevel = SIMD_LEVELS-1;
+	while(nLevel > SIMD_SCALAR && !IsSupported((ESIMDLevel)nLevel))
+		nLevel--;
+	return (ESIMDLevel)nLevel;
+}
+
+const char *CKernels::GetLevelName(ESIMDLevel nLevel)
+{
+	return (nLevel >= SIMD_SCALAR && nLevel < SIMD_LEVELS) ? g_pszLevelName[nLevel] : "unknown";
+}
+
+void CKernels::Init(ESIMDLevel nLevel)
+{
+	if(!IsSupported(nLevel))
+		nLevel = GetBestLevel();
+
+	SKernels k;
+	k.nLevel = nLevel;
+	switch(nLevel)
+	{
+		case SIMD_SCALAR:
+			BindKernels<CFloat1, TGather<CFloat1> >(k);
+			break;
+		case SIMD_SSE2:
+			BindKernels<CFloat4, TGather<CFloat4> >(k);
+			break;
+#ifdef SIMD_AVX2_INTRINSICS
+		case SIMD_AVX2:
+			BindKernels<CFloat8, SGatherAVX2>(k);
+			break;
+#endif
+		default:
+			BindKernels<CFloat8, TGather<CFloat8> >(k);
+			break;
+	}
+	m_kernels = k;
+}
+
+bool CKernels::Init(const char *pszLevel)
+{
+	if(!pszLevel)
+	{
+		Init(GetBestLevel());
+		return true;
+	}
+
+	// The name ends at the next space on the command line
+	for(int nLevel=0; nLevel<SIMD_LEVELS; nLevel++)
+	{
+		int nLength = (int)strlen(g_pszLevelName[nLevel]);
+		if(_strnicmp(pszLevel, g_pszLevelName[nLevel], nLength) == 0 && (pszLevel[nLength] == 0 || pszLevel[nLength] == ' '))
+		{
+			Init((ESIMDLevel)nLevel);
+			return m_kernels.nLevel == nLevel;
+		}
+	}
+	Init(GetBestLevel());
+	return false;
+}
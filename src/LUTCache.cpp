@@ -0,0 +1,197 @@
+// LUTCache.cpp
+//
+
+#include "Master.h"
+#include "LUTCache.h"
+#include "Platform.h"
+
+void CLUTCache::Init(const char *pszDirectory)
+{
+	Cleanup();
+	strcpy(m_szDirectory, pszDirectory);
+	if(m_szDirectory[0])
+		MakeDirectory(m_szDirectory);
+}
+
+void CLUTCache::Cleanup()
+{
+	EnterCriticalSection(&m_cs);
+	while(m_nMappings > 0)
+		Release((const unsigned char *)m_mapping[0].pView + LUT_DATA_OFFSET);
+	LeaveCriticalSection(&m_cs);
+}
+
+void CLUTCache::GetPath(char *pszPath, const char *pszName, const CLUTKey &key)
+{
+	sprintf(pszPath, "%s/%s-%08x%08x.lut", m_szDirectory, pszName, (unsigned int)(key.Get() >> 32), (unsigned int)key.Get());
+}
+
+bool CLUTCache::Load(const char *pszName, const CLUTKey &key, CPixelBuffer &pb)
+{
+	if(!IsEnabled())
+		return false;
+
+	// The lock is held until the mapping is added, so the table can't fill up in between
+	EnterCriticalSection(&m_cs);
+	if(m_nMappings == LUT_MAX_MAPPINGS)
+	{
+		LeaveCriticalSection(&m_cs);
+		return false;
+	}
+
+	char szPath[_MAX_PATH];
+	GetPath(szPath, pszName, key);
+	HANDLE hFile = CreateFile(szPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(hFile == INVALID_HANDLE_VALUE)
+	{
+		LeaveCriticalSection(&m_cs);
+		return false;
+	}
+
+	LARGE_INTEGER nFileSize;
+	HANDLE hMapping = NULL;
+	void *pView = NULL;
+	if(GetFileSizeEx(hFile, &nFileSize) && nFileSize.QuadPart >= LUT_DATA_OFFSET)
+		hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(hMapping)
+		pView = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+
+	// Only use the file if it was written by this version for exactly this table, and it has all of the data
+	bool bValid = false;
+	if(pView)
+	{
+		const SLUTHeader &h = *(const SLUTHeader *)pView;
+		if(memcmp(h.szMagic, "LUT", 4) == 0 && h.nVersion == LUT_CACHE_VERSION && h.nKey == key.Get() &&
+			h.nWidth > 0 && h.nHeight > 0 && h.nDepth > 0 && h.nChannels >= 1 && h.nChannels <= 4 &&
+			(h.nLayout == LinearLayout || h.nLayout == BrickLayout) && GetDataTypeSize(h.nDataType) > 0 &&
+			(unsigned __int64)nFileSize.QuadPart == LUT_DATA_OFFSET + h.nDataSize)
+		{
+			// The buffer's size is checked against what C3DBuffer would expect for the same dimensions
+			void *pData = (unsigned char *)pView + LUT_DATA_OFFSET;
+			C3DBuffer check(h.nWidth, h.nHeight, h.nDepth, h.nDataType, h.nChannels, pData, h.nLayout);
+			if(check.GetBufferSize() == h.nDataSize)
+			{
+				// Init() keeps the old memory if the settings match, so it has to be freed first
+				pb.Cleanup();
+				pb.Init(h.nWidth, h.nHeight, h.nDepth, h.nChannels, h.nFormat, h.nDataType, pData, h.nLayout);
+				for(int i=0; i<4; i++)
+					pb.SetScale(i, h.fScale[i]);
+				bValid = true;
+			}
+		}
+	}
+
+	if(!bValid)
+	{
+		if(pView)
+			UnmapViewOfFile(pView);
+		if(hMapping)
+			CloseHandle(hMapping);
+		CloseHandle(hFile);
+		LeaveCriticalSection(&m_cs);
+		return false;
+	}
+
+	m_mapping[m_nMappings].hFile = hFile;
+	m_mapping[m_nMappings].hMapping = hMapping;
+	m_mapping[m_nMappings].pView = pView;
+	m_nMappings++;
+	LeaveCriticalSection(&m_cs);
+	return true;
+}
+
+bool CLUTCache::Save(const char *pszName, const CLUTKey &key, const CPixelBuffer &pb)
+{
+	if(!IsEnabled())
+		return false;
+
+	ASSERT(sizeof(SLUTHeader) <= LUT_DATA_OFFSET);
+	unsigned char szHeader[LUT_DATA_OFFSET];
+	memset(szHeader, 0, sizeof(szHeader));
+	SLUTHeader &h = *(SLUTHeader *)szHeader;
+	memcpy(h.szMagic, "LUT", 4);
+	h.nVersion = LUT_CACHE_VERSION;
+	h.nKey = key.Get();
+	h.nDataSize = pb.GetBufferSize();
+	h.nWidth = pb.GetWidth();
+	h.nHeight = pb.GetHeight();
+	h.nDepth = pb.GetDepth();
+	h.nDataType = pb.GetDataType();
+	h.nChannels = pb.GetChannels();
+	h.nLayout = pb.GetLayout();
+	h.nFormat = pb.GetFormat();
+	for(int i=0; i<4; i++)
+		h.fScale[i] = pb.GetScale(i);
+
+	char szPath[_MAX_PATH], szTemp[_MAX_PATH];
+	GetPath(szPath, pszName, key);
+	sprintf(szTemp, "%s.tmp", szPath);
+	FILE *pFile = fopen(szTemp, "wb");
+	if(!pFile)
+		return false;
+	bool bWritten = fwrite(szHeader, sizeof(szHeader), 1, pFile) == 1 && fwrite(pb.GetBuffer(), pb.GetBufferSize(), 1, pFile) == 1;
+	if(fclose(pFile) != 0)
+		bWritten = false;
+
+	// rename() won't replace an existing file on Windows
+	remove(szPath);
+	if(!bWritten || rename(szTemp, szPath) != 0)
+	{
+		remove(szTemp);
+		return false;
+	}
+	Trim(szPath);
+	return true;
+}
+
+void CLUTCache::Trim(const char *pszKeep)
+{
+	char szPattern[_MAX_PATH], szPath[_MAX_PATH], szOldest[_MAX_PATH];
+	sprintf(szPattern, "%s/*.lut", m_szDirectory);
+	for(;;)
+	{
+		// Count the tables and find the oldest one that may be deleted
+		int nFiles = 0;
+		unsigned __int64 nSize = 0;
+		FILETIME ftOldest;
+		szOldest[0] = 0;
+		WIN32_FIND_DATA fd;
+		HANDLE hFind = FindFirstFile(szPattern, &fd);
+		if(hFind == INVALID_HANDLE_VALUE)
+			return;
+		do
+		{
+			if(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				continue;
+			nFiles++;
+			nSize += ((unsigned __int64)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+			sprintf(szPath, "%s/%s", m_szDirectory, fd.cFileName);
+			if(strcmp(szPath, pszKeep) != 0 && (!szOldest[0] || CompareFileTime(&fd.ftLastWriteTime, &ftOldest) < 0))
+			{
+				strcpy(szOldest, szPath);
+				ftOldest = fd.ftLastWriteTime;
+			}
+		} while(FindNextFile(hFind, &fd));
+		FindClose(hFind);
+
+		if((nFiles <= LUT_MAX_FILES && nSize <= LUT_MAX_SIZE) || !szOldest[0] || !DeleteFile(szOldest))
+			return;
+	}
+}
+
+void CLUTCache::Release(const void *pBuffer)
+{
+	EnterCriticalSection(&m_cs);
+	for(int i=0; i<m_nMappings; i++)
+	{
+		if((const unsigned char *)m_mapping[i].pView + LUT_DATA_OFFSET == pBuffer)
+		{
+			UnmapViewOfFile(m_mapping[i].pView);
+			CloseHandle(m_mapping[i].hMapping);
+			CloseHandle(m_mapping[i].hFile);
+			m_mapping[i] = m_mapping[--m_nMappings];
+			break;
+		}
+	}
+	LeaveCriticalSection(&m_cs);
+}
@@ -0,0 +1,386 @@
+// Mixer.cpp
+//
+
+#include "Master.h"
+#include "Mixer.h"
+#include "Kernels.h"
+#include "../ALFramework/Framework.h"
+#include "../ALFramework/CWaves.h"
+
+void CNullSink::Write(const short *pFrames, int nFrames)
+{
+	const unsigned char *p = (const unsigned char *)pFrames;
+	for(int i=0; i<nFrames*4; i++)
+		m_nHash = (m_nHash ^ p[i]) * 16777619u;
+	for(int i=0; i<nFrames*2; i++)
+	{
+		int n = abs(pFrames[i]);
+		if(n > m_nPeak)
+			m_nPeak = n;
+	}
+	m_nFrames += nFrames;
+}
+
+bool CWaveSink::Open(const char *pszFile, int nFrequency)
+{
+	Close();
+	m_pFile = fopen(pszFile, "wb");
+	if(!m_pFile)
+		return false;
+	m_nFrequency = nFrequency;
+	m_nFrames = 0;
+	WriteHeader();
+	return true;
+}
+
+void CWaveSink::Close()
+{
+	if(!m_pFile)
+		return;
+	fseek(m_pFile, 0, SEEK_SET);
+	WriteHeader();
+	fclose(m_pFile);
+	m_pFile = NULL;
+}
+
+void CWaveSink::WriteHeader()
+{
+	// Every field is naturally aligned, so there's no padding to pack away
+	struct
+	{
+		char szRIFF[4];
+		unsigned int nRIFFSize;
+		char szWAVE[4];
+		char szFmt[4];
+		unsigned int nFmtSize;
+		unsigned short nFormatTag, nChannels;
+		unsigned int nSamplesPerSec, nAvgBytesPerSec;
+		unsigned short nBlockAlign, nBitsPerSample;
+		char szData[4];
+		unsigned int nDataSize;
+	} header;
+	memcpy(header.szRIFF, "RIFF", 4);
+	memcpy(header.szWAVE, "WAVE", 4);
+	memcpy(header.szFmt, "fmt ", 4);
+	memcpy(header.szData, "data", 4);
+	header.nFmtSize = 16;
+	header.nFormatTag = 1;			// WAVE_FORMAT_PCM
+	header.nChannels = 2;
+	header.nSamplesPerSec = m_nFrequency;
+	header.nBlockAlign = 4;
+	header.nBitsPerSample = 16;
+	header.nAvgBytesPerSec = m_nFrequency * 4;
+	header.nDataSize = m_nFrames * 4;
+	header.nRIFFSize = header.nDataSize + sizeof(header) - 8;
+	fwrite(&header, sizeof(header), 1, m_pFile);
+}
+
+void CWaveSink::Write(const short *pFrames, int nFrames)
+{
+	if(!m_pFile)
+		return;
+	fwrite(pFrames, 4, nFrames, m_pFile);
+	m_nFrames += nFrames;
+}
+
+bool COpenALSink::Open(int nFrequency)
+{
+	Close();
+	ALuint uiSource;
+	alGetError();
+	alGenSources(1, &uiSource);
+	if(alGetError() != AL_NO_ERROR)
+		return false;
+	m_nSource = uiSource;
+	alGenBuffers(MIXER_SINK_BUFFERS, (ALuint *)m_nBuffer);
+	for(int i=0; i<MIXER_SINK_BUFFERS; i++)
+		m_nFree[i] = m_nBuffer[i];
+	m_nFreeCount = MIXER_SINK_BUFFERS;
+	m_nFrequency = nFrequency;
+	return true;
+}
+
+void COpenALSink::Close()
+{
+	if(!m_nFrequency)
+		return;
+	ALuint uiSource = m_nSource;
+	alSourceStop(uiSource);
+	alSourcei(uiSource, AL_BUFFER, 0);
+	alDeleteSources(1, &uiSource);
+	alDeleteBuffers(MIXER_SINK_BUFFERS, (ALuint *)m_nBuffer);
+	m_nFrequency = 0;
+	m_nFreeCount = 0;
+}
+
+int COpenALSink::GetSpace()
+{
+	if(!m_nFrequency)
+		return 0;
+	ALint nProcessed;
+	alGetSourcei(m_nSource, AL_BUFFERS_PROCESSED, &nProcessed);
+	while(nProcessed-- > 0)
+	{
+		ALuint uiBuffer;
+		alSourceUnqueueBuffers(m_nSource, 1, &uiBuffer);
+		m_nFree[m_nFreeCount++] = uiBuffer;
+	}
+	return m_nFreeCount * MIXER_BLOCK_SIZE;
+}
+
+void COpenALSink::Write(const short *pFrames, int nFrames)
+{
+	if(!m_nFrequency)
+		return;
+	while(nFrames > 0 && m_nFreeCount > 0)
+	{
+		int n = nFrames < MIXER_BLOCK_SIZE ? nFrames : MIXER_BLOCK_SIZE;
+		ALuint uiBuffer = m_nFree[--m_nFreeCount];
+		alBufferData(uiBuffer, AL_FORMAT_STEREO16, pFrames, n * 4, m_nFrequency);
+		alSourceQueueBuffers(m_nSource, 1, &uiBuffer);
+		pFrames += n * 2;
+		nFrames -= n;
+	}
+
+	// Start it the first time, and again if the mixer fell behind and it ran dry
+	ALint nState;
+	alGetSourcei(m_nSource, AL_SOURCE_STATE, &nState);
+	if(nState != AL_PLAYING)
+		alSourcePlay(m_nSource);
+}
+
+CMixer::CMixer()
+{
+	m_nFrequency = 44100;
+	m_nInterpolation = MIXER_LINEAR;
+	m_nSamples = 0;
+	m_nVoices = 0;
+	m_nNextID = 0;
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void CMixer::Init(int nFrequency, int nInterpolation)
+{
+	Cleanup();
+	m_nFrequency = nFrequency;
+	m_nInterpolation = nInterpolation;
+}
+
+void CMixer::Cleanup()
+{
+	for(int i=0; i<m_nSamples; i++)
+		delete[] m_sample[i].pAlloc;
+	m_nSamples = 0;
+	m_nVoices = 0;
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+int CMixer::AddSample(const float *pFrames, int nFrames, int nChannels, int nFrequency, bool bLoop)
+{
+	if(m_nSamples == MIXER_MAX_SAMPLES || nFrames <= 0 || nChannels < 1 || nChannels > 2 || nFrequency <= 0)
+		return -1;
+
+	SMixerSample &sample = m_sample[m_nSamples];
+	int nStride = nFrames + MIXER_GUARD_FRAMES * 2;
+	sample.pAlloc = new float[nStride * nChannels];
+	for(int c=0; c<nChannels; c++)
+	{
+		float *p = sample.pAlloc + c * nStride + MIXER_GUARD_FRAMES;
+		sample.pChannel[c] = p;
+		for(int i=0; i<nFrames; i++)
+			p[i] = pFrames[i * nChannels + c];
+
+		// The guard frames wrap around for a looping sample, and are silent otherwise
+		for(int i=1; i<=MIXER_GUARD_FRAMES; i++)
+		{
+			p[-i] = bLoop ? p[((-i) % nFrames + nFrames) % nFrames] : 0.0f;
+			p[nFrames - 1 + i] = bLoop ? p[(i - 1) % nFrames] : 0.0f;
+		}
+	}
+	if(nChannels == 1)
+		sample.pChannel[1] = sample.pChannel[0];
+	sample.szFile[0] = 0;
+	sample.nFrames = nFrames;
+	sample.nFrequency = nFrequency;
+	sample.bLoop = bLoop;
+	return m_nSamples++;
+}
+
+int CMixer::LoadSample(const char *pszFile, bool bLoop)
+{
+	for(int i=0; i<m_nSamples; i++)
+	{
+		if(m_sample[i].bLoop == bLoop && _stricmp(m_sample[i].szFile, pszFile) == 0)
+			return i;
+	}
+
+	// The file is only mapped while it's converted (CWaves unmaps it when it goes away)
+	CWaves waves;
+	WAVEID nWaveID;
+	WAVEFORMATEX wfex;
+	unsigned long nSize;
+	unsigned char *pData;
+	if(FAILED(waves.MapWaveFile(pszFile, &nWaveID)) ||
+		FAILED(waves.GetWaveFormatExHeader(nWaveID, &wfex)) ||
+		FAILED(waves.GetWaveSize(nWaveID, &nSize)) ||
+		FAILED(waves.GetWaveData(nWaveID, (void **)&pData)))
+		return -1;
+	int nChannels = wfex.nChannels, nBits = wfex.wBitsPerSample;
+	if((nBits != 8 && nBits != 16) || nChannels < 1 || nChannels > 2)
+		return -1;
+
+	int nFrames = nSize / (nChannels * nBits / 8);
+	float *pFrames = new float[nFrames * nChannels];
+	for(int i=0; i<nFrames*nChannels; i++)
+		pFrames[i] = nBits == 16 ? ((const short *)pData)[i] * (1.0f / 32768.0f) : (pData[i] - 128) * (1.0f / 128.0f);
+	int nSample = AddSample(pFrames, nFrames, nChannels, wfex.nSamplesPerSec, bLoop);
+	delete[] pFrames;
+	if(nSample >= 0)
+		strcpy(m_sample[nSample].szFile, pszFile);
+	return nSample;
+}
+
+SMixerVoice *CMixer::FindVoice(unsigned int nID)
+{
+	if(!nID)
+		return NULL;
+	for(int i=0; i<m_nVoices; i++)
+	{
+		if(m_voice[i].nSample >= 0 && m_voice[i].nID == nID)
+			return &m_voice[i];
+	}
+	return NULL;
+}
+
+unsigned int CMixer::Play(int nSample, float fGain, float fPan, float fPitch)
+{
+	if(nSample < 0 || nSample >= m_nSamples)
+		return 0;
+	int nVoice;
+	for(nVoice=0; nVoice<m_nVoices; nVoice++)
+	{
+		if(m_voice[nVoice].nSample < 0)
+			break;
+	}
+	if(nVoice == MIXER_MAX_VOICES)
+		return 0;
+	if(nVoice == m_nVoices)
+		m_nVoices++;
+
+	SMixerVoice &voice = m_voice[nVoice];
+	if(++m_nNextID == 0)
+		m_nNextID++;
+	voice.nSample = nSample;
+	voice.nID = m_nNextID;
+	voice.dPosition = 0;
+	SetVoice(voice.nID, fGain, fPan, fPitch);
+	return voice.nID;
+}
+
+void CMixer::SetVoice(unsigned int nID, float fGain, float fPan, float fPitch)
+{
+	SMixerVoice *pVoice = FindVoice(nID);
+	if(!pVoice)
+		return;
+	pVoice->fGain = fGain;
+	pVoice->fPan = fPan < -1.0f ? -1.0f : fPan > 1.0f ? 1.0f : fPan;
+	pVoice->fPitch = fPitch < 0.0f ? 0.0f : fPitch;
+}
+
+void CMixer::Stop(unsigned int nID)
+{
+	SMixerVoice *pVoice = FindVoice(nID);
+	if(pVoice)
+		pVoice->nSample = -1;
+}
+
+void CMixer::StopAll()
+{
+	m_nVoices = 0;
+}
+
+void CMixer::MixBlock(int nFrames)
+{
+	memset(m_fBlock, 0, sizeof(m_fBlock));
+	const SKernels &k = CKernels::Get();
+	int nPlaying = 0;
+	for(int i=0; i<m_nVoices; i++)
+	{
+		SMixerVoice &voice = m_voice[i];
+		if(voice.nSample < 0)
+			continue;
+		nPlaying++;
+
+		const SMixerSample &sample = m_sample[voice.nSample];
+		float fAngle = (voice.fPan + 1.0f) * 0.785398163f;		// A constant-power pan, from 0 to pi/2
+		SMixJob job;
+		job.pChannel[0] = sample.pChannel[0];
+		job.pChannel[1] = sample.pChannel[1];
+		job.fStep = voice.fPitch * sample.nFrequency / m_nFrequency;
+		job.fGain[0] = voice.fGain * cosf(fAngle);
+		job.fGain[1] = voice.fGain * sinf(fAngle);
+		job.nInterpolation = m_nInterpolation;
+
+		// Mix up to the end of the sample, then loop back or stop
+		int nDone = 0;
+		while(nDone < nFrames)
+		{
+			int nCount = nFrames - nDone;
+			double dLeft = ceil((sample.nFrames - voice.dPosition) / job.fStep);
+			if(dLeft < nCount)
+				nCount = (int)dLeft;
+			if(nCount > 0)
+			{
+				job.dPosition = voice.dPosition;
+				job.pOut[0] = m_fBlock[0] + nDone;
+				job.pOut[1] = m_fBlock[1] + nDone;
+				job.nCount = nCount;
+				k.pfnMixVoice(job);
+				voice.dPosition += nCount * (double)job.fStep;
+				nDone += nCount;
+			}
+			if(voice.dPosition >= sample.nFrames)
+			{
+				if(!sample.bLoop)
+				{
+					voice.nSample = -1;
+					break;
+				}
+				voice.dPosition = fmod(voice.dPosition, (double)sample.nFrames);
+			}
+		}
+	}
+	while(m_nVoices > 0 && m_voice[m_nVoices-1].nSample < 0)
+		m_nVoices--;
+	if(nPlaying > m_stats.nPeakVoices)
+		m_stats.nPeakVoices = nPlaying;
+}
+
+void CMixer::Render(CAudioSink *pSink, int nFrames)
+{
+	LARGE_INTEGER nFrequency, nStart, nEnd;
+	QueryPerformanceFrequency(&nFrequency);
+	const __m128 fMax = _mm_set1_ps(32767.0f), fMin = _mm_set1_ps(-32768.0f);
+	while(nFrames > 0)
+	{
+		int n = nFrames < MIXER_BLOCK_SIZE ? nFrames : MIXER_BLOCK_SIZE;
+		QueryPerformanceCounter(&nStart);
+		MixBlock(n);
+
+		// Interleave 4 frames at a time, rounding to the nearest sample and clipping
+		for(int i=0; i<n; i+=4)
+		{
+			__m128 l = _mm_mul_ps(_mm_loadu_ps(m_fBlock[0] + i), fMax);
+			__m128 r = _mm_mul_ps(_mm_loadu_ps(m_fBlock[1] + i), fMax);
+			__m128i nLo = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(_mm_unpacklo_ps(l, r), fMax), fMin));
+			__m128i nHi = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(_mm_unpackhi_ps(l, r), fMax), fMin));
+			_mm_storeu_si128((__m128i *)(m_nPCM + i * 2), _mm_packs_epi32(nLo, nHi));
+		}
+		QueryPerformanceCounter(&nEnd);
+		m_stats.dSeconds += (double)(nEnd.QuadPart - nStart.QuadPart) / nFrequency.QuadPart;
+		m_stats.nFrames += n;
+
+		pSink->Write(m_nPCM, n);
+		nFrames -= n;
+	}
+}
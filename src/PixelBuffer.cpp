@@ -30,6 +30,8 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "Master.h"
 #include "PixelBuffer.h"
+#include "ThreadPool.h"
+#include "Kernels.h"
 
 
 void CPixelBuffer::MakeCloudCell(float fExpose, float fSizeDisc)
@@ -37,34 +39,32 @@ void CPixelBuffer::MakeCloudCell(float fExpose, float fSizeDisc)
 	int i;
 	int n = 0;
 	unsigned char nIntensity;
+	float *pRow = new float[m_nWidth];
 	for(int y=0; y<m_nHeight; y++)
 	{
-		float fDy = (y+0.5f)/m_nHeight - 0.5f;
+		CKernels::Get().pfnMakeCloudRow(pRow, m_nWidth, (y+0.5f)/m_nHeight - 0.5f, fExpose, fSizeDisc);
 		for(int x=0; x<m_nWidth; x++)
 		{
-			float fDx = (x+0.5f)/m_nWidth - 0.5f;
-			float fDist = sqrtf(fDx*fDx + fDy*fDy);
-			float fIntensity = 2.0f - Min(2.0f, powf(2.0f, Max(fDist-fSizeDisc,0.0f)*fExpose));
 			switch(m_nDataType)
 			{
 				case GL_UNSIGNED_BYTE:
-					nIntensity = (unsigned char)(fIntensity*255 + 0.5f);
+					nIntensity = (unsigned char)(pRow[x]*255 + 0.5f);
 					for(i=0; i<m_nChannels; i++)
 						((unsigned char *)m_pBuffer)[n++] = nIntensity;
 					break;
 				case GL_FLOAT:
 					for(i=0; i<m_nChannels; i++)
-						((float *)m_pBuffer)[n++] = fIntensity;
+						((float *)m_pBuffer)[n++] = pRow[x];
 					break;
 			}
 		}
 	}
+	delete[] pRow;
 }
 
 void CPixelBuffer::Make3DNoise(int nSeed)
 {
 	CFractal noise(3, nSeed, 0.5f, 2.0f);
-	int n = 0;
 	float fValues[3];
 	for(int z=0; z<m_nDepth; z++)
 	{
@@ -79,9 +79,9 @@ void CPixelBuffer::Make3DNoise(int nSeed)
 				if(fIntensity < 0.0)
 					fIntensity = 0.0f;
 				fIntensity = 1.0f - powf(0.9f, fIntensity*255);
-				unsigned char nIntensity = (unsigned char)(fIntensity*255 + 0.5f);
-				((unsigned char *)m_pBuffer)[n++] = 255;
-				((unsigned char *)m_pBuffer)[n++] = nIntensity;
+				unsigned char *pElement = (unsigned char *)(*this)(x, y, z);
+				pElement[0] = 255;
+				pElement[1] = (unsigned char)(fIntensity*255 + 0.5f);
 			}
 		}
 	}
@@ -99,96 +99,157 @@ void CPixelBuffer::MakeGlow1D()
 	}
 }
 
-void CPixelBuffer::MakeOpticalDepthBuffer(float fInnerRadius, float fOuterRadius, float fRayleighScaleHeight, float fMieScaleHeight)
+void C3DBuffer::InitBricks()
 {
-	const int nSize = 128;
-	const int nSamples = 10;
-	const float fScale = 1.0f / (fOuterRadius - fInnerRadius);
+	// Only the axes the buffer is more than 1 element long on are split into bricks and interleaved
+	int nSize[3] = {m_nWidth, m_nHeight, m_nDepth};
+	int nBricked = 0, nAxisBit[3];
+	for(int a=0; a<3; a++)
+		nAxisBit[a] = nSize[a] > 1 ? nBricked++ : -1;
+	size_t nBrickElements = (size_t)1 << (2 * nBricked);
 
-	Init(nSize, nSize, 1, 4, GL_RGBA, GL_FLOAT);
-	int nIndex = 0;
-	for(int nAngle=0; nAngle<nSize; nAngle++)
+	size_t nBrickStride = nBrickElements;
+	m_pAxisOffset = new size_t[m_nWidth + m_nHeight + m_nDepth];
+	size_t *pOffset = m_pAxisOffset;
+	for(int a=0; a<3; a++)
 	{
-		// As the y tex coord goes from 0 to 1, the angle goes from 0 to 180 degrees
-		float fCos = 1.0f - (nAngle+nAngle) / (float)nSize;
-		float fAngle = acosf(fCos);
-		CVector vRay(sinf(fAngle), cosf(fAngle), 0);	// Ray pointing to the viewpoint
-		for(int nHeight=0; nHeight<nSize; nHeight++)
+		for(int i=0; i<nSize[a]; i++)
 		{
-			// As the x tex coord goes from 0 to 1, the height goes from the bottom of the atmosphere to the top
-			float fHeight = DELTA + fInnerRadius + ((fOuterRadius - fInnerRadius) * nHeight) / nSize;
-			CVector vPos(0, fHeight, 0);				// The position of the camera
-
-			// If the ray from vPos heading in the vRay direction intersects the inner radius (i.e. the planet), then this spot is not visible from the viewpoint
-			float B = 2.0f * (vPos | vRay);
-			float Bsq = B * B;
-			float Cpart = (vPos | vPos);
-			float C = Cpart - fInnerRadius*fInnerRadius;
-			float fDet = Bsq - 4.0f * C;
-			bool bVisible = (fDet < 0 || (0.5f * (-B - sqrtf(fDet)) <= 0) && (0.5f * (-B + sqrtf(fDet)) <= 0));
-			float fRayleighDensityRatio;
-			float fMieDensityRatio;
-			if(bVisible)
-			{
-				fRayleighDensityRatio = expf(-(fHeight - fInnerRadius) * fScale / fRayleighScaleHeight);
-				fMieDensityRatio = expf(-(fHeight - fInnerRadius) * fScale / fMieScaleHeight);
-			}
-			else
-			{
-				// Smooth the transition from light to shadow (it is a soft shadow after all)
-				fRayleighDensityRatio = ((float *)m_pBuffer)[nIndex - nSize*m_nChannels] * 0.75f;
-				fMieDensityRatio = ((float *)m_pBuffer)[nIndex+2 - nSize*m_nChannels] * 0.75f;
-			}
+			// Bit 0 of the position in the brick goes to bit nAxisBit[a] of the Morton index, and bit 1 to nAxisBit[a] + nBricked
+			size_t nMorton = 0;
+			if(nAxisBit[a] >= 0)
+				nMorton = ((size_t)(i & 1) << nAxisBit[a]) | ((size_t)((i >> 1) & 1) << (nAxisBit[a] + nBricked));
+			*pOffset++ = (size_t)(i / BRICK_SIZE) * nBrickStride + nMorton;
+		}
+		nBrickStride *= (nSize[a] + BRICK_SIZE - 1) / BRICK_SIZE;
+	}
+	m_nElementCount = nBrickStride;
+}
 
-			// Determine where the ray intersects the outer radius (the top of the atmosphere)
-			// This is the end of our ray for determining the optical depth (vPos is the start)
-			C = Cpart - fOuterRadius*fOuterRadius;
-			fDet = Bsq - 4.0f * C;
-			float fFar = 0.5f * (-B + sqrtf(fDet));
-
-			// Next determine the length of each sample, scale the sample ray, and make sure position checks are at the center of a sample ray
-			float fSampleLength = fFar / nSamples;
-			float fScaledLength = fSampleLength * fScale;
-			CVector vSampleRay = vRay * fSampleLength;
-			vPos += vSampleRay * 0.5f;
-
-			// Iterate through the samples to sum up the optical depth for the distance the ray travels through the atmosphere
-			float fRayleighDepth = 0;
-			float fMieDepth = 0;
-			for(int i=0; i<nSamples; i++)
-			{
-				float fHeight = vPos.Magnitude();
-				float fAltitude = (fHeight - fInnerRadius) * fScale;
-				fAltitude = Max(fAltitude, 0.0f);
-				fRayleighDepth += expf(-fAltitude / fRayleighScaleHeight);
-				fMieDepth += expf(-fAltitude / fMieScaleHeight);
-				vPos += vSampleRay;
-			}
+void C3DBuffer::SetLayout(const int nLayout)
+{
+	if(nLayout == m_nLayout)
+		return;
+	C3DBuffer buf(m_nWidth, m_nHeight, m_nDepth, m_nDataType, m_nChannels, NULL, nLayout);
+	memcpy(buf.m_fScale, m_fScale, sizeof(m_fScale));
+	for(int z=0; z<m_nDepth; z++)
+	{
+		for(int y=0; y<m_nHeight; y++)
+		{
+			for(int x=0; x<m_nWidth; x++)
+				memcpy(buf(x, y, z), (*this)(x, y, z), m_nElementSize);
+		}
+	}
+	*this = buf;
+}
 
-			// Multiply the sums by the length the ray traveled
-			fRayleighDepth *= fScaledLength;
-			fMieDepth *= fScaledLength;
+template <class T> static void ConvertToFloat(const T *pSrc, float *pDest, size_t nCount, int nChannels, const float *pScale)
+{
+	for(size_t i=0; i<nCount; i++)
+	{
+		pDest[i] = ToFloat(pSrc[i]);
+		if(TStorage<T>::Normalized)
+			pDest[i] *= pScale[i % nChannels];
+	}
+}
 
-			// Store the results for Rayleigh to the light source, Rayleigh to the camera, Mie to the light source, and Mie to the camera
-			((float *)m_pBuffer)[nIndex++] = fRayleighDensityRatio;
-			((float *)m_pBuffer)[nIndex++] = fRayleighDepth;
-			((float *)m_pBuffer)[nIndex++] = fMieDensityRatio;
-			((float *)m_pBuffer)[nIndex++] = fMieDepth;
+void C3DBuffer::Convert(const C3DBuffer &buf, const int nDataType)
+{
+	if(nDataType == FloatType)
+	{
+		// Every element is converted in memory order, so the copy keeps buf's layout
+		ASSERT(buf.m_nChannels <= 4);
+		Init(buf.m_nWidth, buf.m_nHeight, buf.m_nDepth, FloatType, buf.m_nChannels, NULL, buf.m_nLayout);
+		const size_t nCount = m_nElementCount * m_nChannels;
+		switch(buf.m_nDataType)
+		{
+			case HalfFloatType: ConvertToFloat((const SHalf *)buf.m_pBuffer, (float *)m_pBuffer, nCount, m_nChannels, buf.m_fScale); break;
+			case UnsignedShortType: ConvertToFloat((const unsigned short *)buf.m_pBuffer, (float *)m_pBuffer, nCount, m_nChannels, buf.m_fScale); break;
+			case UnsignedByteType: ConvertToFloat((const unsigned char *)buf.m_pBuffer, (float *)m_pBuffer, nCount, m_nChannels, buf.m_fScale); break;
+			default: ConvertToFloat((const float *)buf.m_pBuffer, (float *)m_pBuffer, nCount, m_nChannels, buf.m_fScale); break;
 		}
+		return;
+	}
+
+	ASSERT(buf.m_nDataType == FloatType && buf.m_nChannels <= 4 && (nDataType == HalfFloatType || nDataType == UnsignedShortType));
+	Init(buf.m_nWidth, buf.m_nHeight, buf.m_nDepth, nDataType, buf.m_nChannels);
+	const size_t nCount = (size_t)m_nWidth * m_nHeight * m_nDepth * m_nChannels;
+	const float *pSrc = (const float *)buf.m_pBuffer;
+	unsigned short *pDest = (unsigned short *)m_pBuffer;
+	if(nDataType == HalfFloatType)
+	{
+		for(size_t i=0; i<nCount; i++)
+			pDest[i] = FloatToHalf(pSrc[i]);
+		return;
+	}
+
+	// Find the largest value in each channel so it can map to 65535
+	float fMax[4] = {0, 0, 0, 0};
+	for(size_t i=0; i<nCount; i++)
+		fMax[i % m_nChannels] = Max(fMax[i % m_nChannels], pSrc[i]);
+	float fInvScale[4];
+	for(int c=0; c<m_nChannels; c++)
+	{
+		m_fScale[c] = fMax[c] > 0.0f ? fMax[c] / 65535.0f : 1.0f / 65535.0f;
+		fInvScale[c] = 1.0f / m_fScale[c];
+	}
+	for(size_t i=0; i<nCount; i++)
+		pDest[i] = (unsigned short)Min(65535.0f, Max(0.0f, pSrc[i] * fInvScale[i % m_nChannels] + 0.5f));
+}
+
+static void MakeOpticalDepthRows(void *pParam, int nStart, int nEnd)
+{
+	const SOpticalDepthJob &job = *(const SOpticalDepthJob *)pParam;
+	CKernels::Get().pfnMakeOpticalDepthRows(job, nStart, nEnd);
+}
+
+void CPixelBuffer::MakeOpticalDepthBuffer(float fInnerRadius, float fOuterRadius, float fRayleighScaleHeight, float fMieScaleHeight, int nSize, int nSamples, CThreadPool *pPool)
+{
+	Init(nSize, nSize, 1, 4, GL_RGBA, GL_FLOAT);
+
+	SOpticalDepthJob job;
+	job.pTable = (float *)m_pBuffer;
+	job.nSize = nSize;
+	job.nSamples = Max(1, nSamples);
+	job.fInnerRadius = fInnerRadius;
+	job.fOuterRadius = fOuterRadius;
+	job.fScale = 1.0f / (fOuterRadius - fInnerRadius);
+	job.fRayleighScaleHeight = fRayleighScaleHeight;
+	job.fMieScaleHeight = fMieScaleHeight;
+
+	// The rows don't depend on each other until the soft-shadow pass below, so they can be built in any order
+	if(pPool)
+		pPool->ParallelFor(MakeOpticalDepthRows, &job, nSize, 4);
+	else
+		MakeOpticalDepthRows(&job, 0, nSize);
+
+	// Smooth the transition from light to shadow (it is a soft shadow after all). Each shadowed
+	// texel fades the one above it in the previous angle row, so this has to run top to bottom.
+	float *pTexel = job.pTable;
+	const int nRow = nSize * 4;
+	for(int i=0; i<nSize*nSize; i++, pTexel+=4)
+	{
+		if(pTexel[0] != SHADOW_MARKER)
+			continue;
+		pTexel[0] = i < nSize ? 0.0f : pTexel[-nRow] * 0.75f;
+		pTexel[2] = i < nSize ? 0.0f : pTexel[2-nRow] * 0.75f;
 	}
 }
 
-void CPixelBuffer::MakePhaseBuffer(float ESun, float Kr, float Km, float g)
+void CPixelBuffer::MakePhaseBuffer(float ESun, float Kr, float Km, float g, int nSize)
 {
+	Init(nSize, 1, 1, 2, GL_LUMINANCE_ALPHA, GL_FLOAT);
 	Km *= ESun;
 	Kr *= ESun;
 	float g2 = g*g;
 	float fMiePart = 1.5f * (1.0f - g2) / (2.0f + g2);
 
+	// The Mie peak is only about (1-|g|)^2 wide, so bunch the entries up toward both ends (1-|cos| grows with the square of the distance from the end)
 	int nIndex = 0;
 	for(int nAngle=0; nAngle<m_nWidth; nAngle++)
 	{
-		float fCos = 1.0f - (nAngle+nAngle) / (float)m_nWidth;
+		float t = 1.0f - (nAngle+nAngle) / (float)(m_nWidth-1);
+		float fCos = (1.0f - (1.0f - Abs(t)) * (1.0f - Abs(t))) * (t < 0 ? -1.0f : 1.0f);
 		float fCos2 = fCos*fCos;
 		float fRayleighPhase = 0.75f * (1.0f + fCos2);
 		float fMiePhase = fMiePart * (1.0f + fCos2) / powf(1.0f + g2 - 2.0f*g*fCos, 1.5f);
@@ -0,0 +1,207 @@
+// ScatteringTable.cpp
+//
+
+#include "Master.h"
+#include "ScatteringTable.h"
+#include "Kernels.h"
+#include <process.h>
+
+#define ALTITUDE_MARGIN		1e-5f		// Keeps the table's sample points strictly between the planet and the top of the atmosphere
+#define OUTSIDE_MARGIN		1e-4f		// How far above the atmosphere the top slice's camera goes for rays heading down
+
+// True if two sets of constants give the same table (ESun and g only scale the phase functions, which are applied after the lookup)
+static bool SameTable(const SScatterParams &p1, const SScatterParams &p2)
+{
+	return p1.nSamples == p2.nSamples && p1.fKr4PI == p2.fKr4PI && p1.fKm4PI == p2.fKm4PI &&
+		p1.fInnerRadius == p2.fInnerRadius && p1.fOuterRadius == p2.fOuterRadius &&
+		p1.fInvWavelength4[0] == p2.fInvWavelength4[0] && p1.fInvWavelength4[1] == p2.fInvWavelength4[1] && p1.fInvWavelength4[2] == p2.fInvWavelength4[2];
+}
+
+/*******************************************************************************
+* The altitude and view zenith axes are stored the way Bruneton's reference
+* implementation stores them. Altitude is the distance to the horizon, which
+* puts more entries near the ground. The view zenith axis is split at the
+* horizon, and each half stores the distance from the start of the ray to the
+* planet (bottom half) or to the top of the atmosphere (top half), which puts
+* more entries near the horizon where the integrals change the fastest.
+*******************************************************************************/
+struct SRayCoord
+{
+	float r;					// Distance from the center of the planet to the start of the ray
+	float fRho;					// Distance from there to the horizon
+	float fHorizonMax;			// Distance from the top of the atmosphere to the horizon
+	float fMinGround, fMaxGround;	// Range of distances to the planet for rays that hit it
+	float fMinSky, fMaxSky;		// Range of distances to the top of the atmosphere for rays that don't
+
+	void Init(float fRadius, float fInnerRadius, float fOuterRadius)
+	{
+		r = fRadius;
+		fRho = sqrtf(Max(0.0f, r*r - fInnerRadius*fInnerRadius));
+		fHorizonMax = sqrtf(fOuterRadius*fOuterRadius - fInnerRadius*fInnerRadius);
+		fMinGround = r - fInnerRadius;
+		fMaxGround = fRho;
+		fMinSky = fOuterRadius - r;
+		fMaxSky = fRho + fHorizonMax;
+	}
+	float GetAltitudeCoord()	{ return fRho / fHorizonMax; }
+};
+
+// Maps a distance from dMin to dMax to the element range [nFirst, nFirst+nCount-1]
+static inline float DistanceToElement(float d, float dMin, float dMax, int nFirst, int nCount)
+{
+	float x = dMax > dMin ? (d - dMin) / (dMax - dMin) : 0.0f;
+	return nFirst + Min(Max(x, 0.0f), 1.0f) * (nCount-1);
+}
+
+// Returns the cosine of the view zenith angle of a ray from radius r that travels d to reach a sphere of radius fRadius
+static inline float DistanceToMu(float r, float d, float fRadius)
+{
+	return d > 0 ? Min(Max((fRadius*fRadius - r*r - d*d) / (2.0f * r * d), -1.0f), 1.0f) : -1.0f;
+}
+
+CScatteringTable::CScatteringTable()
+{
+	m_pTable = NULL;
+	m_nVersion = 0;
+	m_hThread = NULL;
+	m_pBuild = NULL;
+	m_nBuildOpticalDepthVersion = -1;
+	m_nOpticalDepthVersion = -1;
+}
+
+void CScatteringTable::Cleanup()
+{
+	if(m_hThread)
+	{
+		WaitForSingleObject(m_hThread, INFINITE);
+		CloseHandle(m_hThread);
+		m_hThread = NULL;
+	}
+	delete m_pBuild;
+	delete m_pTable;
+	m_pBuild = m_pTable = NULL;
+}
+
+unsigned __stdcall CScatteringTable::BuildProc(void *pParam)
+{
+	CScatteringTable *pTable = (CScatteringTable *)pParam;
+	Build(*pTable->m_pBuild, pTable->m_buildParams, pTable->m_pbBuildOpticalDepth);
+	return 0;
+}
+
+void CScatteringTable::Update(const SScatterParams &p, const C3DBuffer &pbOpticalDepth, int nOpticalDepthVersion)
+{
+	if(m_hThread)
+	{
+		// Keep using the old table until the build finishes (any changes made in the meantime are picked up after that)
+		if(WaitForSingleObject(m_hThread, 0) != WAIT_OBJECT_0)
+			return;
+		CloseHandle(m_hThread);
+		m_hThread = NULL;
+		delete m_pTable;
+		m_pTable = m_pBuild;
+		m_pBuild = NULL;
+		m_params = m_buildParams;
+		m_nOpticalDepthVersion = m_nBuildOpticalDepthVersion;
+		m_nVersion++;
+	}
+
+	if(m_pTable && m_nOpticalDepthVersion == nOpticalDepthVersion && SameTable(m_params, p))
+		return;
+
+	m_buildParams = p;
+	m_nBuildOpticalDepthVersion = nOpticalDepthVersion;
+	m_pbBuildOpticalDepth = pbOpticalDepth;
+	m_pBuild = new C4DBuffer;
+	m_hThread = (HANDLE)_beginthreadex(NULL, 0, BuildProc, this, 0, NULL);
+	if(!m_hThread)
+	{
+		delete m_pBuild;
+		m_pBuild = NULL;
+	}
+}
+
+void CScatteringTable::Build(C4DBuffer &table, const SScatterParams &params, const C3DBuffer &pbOpticalDepth)
+{
+	const float fInnerRadius = params.fInnerRadius;
+	const float fOuterRadius = params.fOuterRadius;
+	const int nHalf = SCATTER_TABLE_MU / 2;
+
+	table.Init(SCATTER_TABLE_NU, SCATTER_TABLE_MU, SCATTER_TABLE_MUS, SCATTER_TABLE_R, 4);
+	table.ClearBuffer();
+
+	// Each (altitude, light zenith) slice is one camera and one light looking at a fan of vertices
+	const int nSlice = SCATTER_TABLE_NU * SCATTER_TABLE_MU;
+	SVertex *pVertex = new SVertex[nSlice];
+	int *pIndex = new int[nSlice];
+
+	// The top slice is what a camera out in space sees. SetColor() integrates those rays from a camera above the
+	// atmosphere, looking the optical depth up back towards space instead of along the ray (which runs into huge
+	// depths near the horizon and loses most of its precision), so rays heading down from there do the same.
+	SScatterParams p = params;
+	SScatterParams pOutside = params;
+	pOutside.vCamera = CVector(0, fOuterRadius + OUTSIDE_MARGIN, 0);
+	for(int nR=0; nR<SCATTER_TABLE_R; nR++)
+	{
+		// Invert GetAltitudeCoord(), staying a hair inside the atmosphere so the camera never counts as being above it
+		SRayCoord coord;
+		coord.Init(fOuterRadius, fInnerRadius, fOuterRadius);
+		float fRho = coord.fHorizonMax * nR / (SCATTER_TABLE_R-1);
+		float r = sqrtf(fRho*fRho + fInnerRadius*fInnerRadius);
+		r = Min(Max(r, fInnerRadius + ALTITUDE_MARGIN), fOuterRadius - ALTITUDE_MARGIN);
+		coord.Init(r, fInnerRadius, fOuterRadius);
+		p.vCamera = CVector(0, r, 0);
+
+		for(int nMuS=0; nMuS<SCATTER_TABLE_MUS; nMuS++)
+		{
+			float fMuS = -1.0f + 2.0f * nMuS / (SCATTER_TABLE_MUS-1);
+			float fSinMuS = sqrtf(Max(0.0f, 1.0f - fMuS*fMuS));
+			p.vLightDirection = CVector(fSinMuS, fMuS, 0);
+
+			pOutside.vLightDirection = p.vLightDirection;
+
+			// Rays that start inside the atmosphere fill pIndex from the front, the top slice's rays heading down fill it from the back
+			int nInside = 0, nOutside = nSlice;
+			SVertex *pSliceVertex = pVertex;
+			for(int nMu=0; nMu<SCATTER_TABLE_MU; nMu++)
+			{
+				// Find how far the ray goes before it hits the planet or leaves the atmosphere, and its view zenith angle
+				float fFar, fMu;
+				if(nMu < nHalf)
+				{
+					fFar = coord.fMinGround + (coord.fMaxGround - coord.fMinGround) * nMu / (nHalf-1);
+					fMu = DistanceToMu(r, fFar, fInnerRadius);
+				}
+				else
+				{
+					fFar = coord.fMinSky + (coord.fMaxSky - coord.fMinSky) * (nMu - nHalf) / (nHalf-1);
+					fMu = DistanceToMu(r, fFar, fOuterRadius);
+				}
+				float fSinMu = sqrtf(Max(0.0f, 1.0f - fMu*fMu));
+
+				for(int nNu=0; nNu<SCATTER_TABLE_NU; nNu++)
+				{
+					// Turn the view ray around the zenith until its angle to the light is right (or as close as it can get)
+					float fNu = -1.0f + 2.0f * nNu / (SCATTER_TABLE_NU-1);
+					float fCosPhi = 1.0f;
+					if(fSinMu * fSinMuS > DELTA)
+						fCosPhi = Min(Max((fNu - fMu*fMuS) / (fSinMu*fSinMuS), -1.0f), 1.0f);
+					float fSinPhi = sqrtf(1.0f - fCosPhi*fCosPhi);
+					CVector vRay(fCosPhi * fSinMu, fMu, fSinPhi * fSinMu);
+					int nIndex = (int)(pSliceVertex - pVertex);
+					if(nR == SCATTER_TABLE_R-1 && fMu < 0)
+						pIndex[--nOutside] = nIndex;
+					else
+						pIndex[nInside++] = nIndex;
+					(pSliceVertex++)->vPos = p.vCamera + vRay * fFar;
+				}
+			}
+			CKernels::Get().pfnScatterBatch(p, pbOpticalDepth, pVertex, pIndex, nInside, table(0, 0, nMuS, nR));
+			if(nOutside < nSlice)
+				CKernels::Get().pfnScatterBatch(pOutside, pbOpticalDepth, pVertex, pIndex + nOutside, nSlice - nOutside, table(0, 0, nMuS, nR));
+		}
+	}
+
+	delete[] pVertex;
+	delete[] pIndex;
+}
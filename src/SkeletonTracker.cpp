@@ -0,0 +1,90 @@
+// SkeletonTracker.cpp
+//
+
+#include "Master.h"
+#include "SkeletonTracker.h"
+#include "Viewer.h"
+#include <process.h>
+
+static void GetJoint(const nite::UserData &user, nite::JointType nType, SSkeletonJoint &joint)
+{
+	const nite::SkeletonJoint &j = user.getSkeleton().getJoint(nType);
+	joint.x = j.getPosition().x;
+	joint.y = j.getPosition().y;
+	joint.z = j.getPosition().z;
+	joint.fConfidence = j.getPositionConfidence();
+}
+
+CSkeletonTracker::CSkeletonTracker()
+{
+	m_pViewer = NULL;
+	m_hThread = NULL;
+	m_bQuit = false;
+	m_nFrames = 0;
+	SSkeletonSnapshot empty;
+	memset(&empty, 0, sizeof(empty));
+	m_snapshots.Fill(empty);
+}
+
+void CSkeletonTracker::Start(SampleViewer *pViewer)
+{
+	Stop();
+	m_pViewer = pViewer;
+	m_bQuit = false;
+	m_hThread = (HANDLE)_beginthreadex(NULL, 0, ThreadProc, this, 0, NULL);
+}
+
+void CSkeletonTracker::Stop()
+{
+	if(!m_hThread)
+		return;
+	m_bQuit = true;
+	WaitForSingleObject(m_hThread, INFINITE);
+	CloseHandle(m_hThread);
+	m_hThread = NULL;
+}
+
+unsigned __stdcall CSkeletonTracker::ThreadProc(void *pParam)
+{
+	CSkeletonTracker *pTracker = (CSkeletonTracker *)pParam;
+	while(!pTracker->m_bQuit)
+		pTracker->ReadFrame();
+	return 0;
+}
+
+void CSkeletonTracker::ReadFrame()
+{
+	// This waits for the sensor's next frame, which is the point of having this thread
+	nite::UserTrackerFrameRef userTrackerFrame;
+	if(m_pViewer->m_pUserTracker->readFrame(&userTrackerFrame) != nite::STATUS_OK)
+	{
+		printf("GetNextData failed\n");
+		Sleep(SKELETON_RETRY_DELAY);
+		return;
+	}
+
+	const nite::Array<nite::UserData>& users = userTrackerFrame.getUsers();
+	SSkeletonSnapshot &snapshot = m_snapshots.GetBack();
+	memset(&snapshot, 0, sizeof(snapshot));
+	snapshot.nFrame = ++m_nFrames;
+	snapshot.nTimestamp = userTrackerFrame.getTimestamp();
+	snapshot.nUsers = users.getSize();
+	if(users.getSize() > 0)
+	{
+		//user 0
+		const nite::UserData& user = users[0];
+		m_pViewer->updateUserState(user, userTrackerFrame.getTimestamp());
+		if (user.isNew())
+		{
+			m_pViewer->m_pUserTracker->startSkeletonTracking(user.getId());
+			m_pViewer->m_pUserTracker->startPoseDetection(user.getId(), nite::POSE_CROSSED_HANDS);
+		}
+		else if (!user.isLost())
+		{
+			snapshot.bTracked = true;
+			GetJoint(user, nite::JOINT_HEAD, snapshot.head);
+			GetJoint(user, nite::JOINT_RIGHT_HAND, snapshot.rightHand);
+		}
+	}
+	m_snapshots.Publish();
+}
@@ -0,0 +1,217 @@
+// SpectrumAnalyzer.cpp
+//
+
+#include "Master.h"
+#include "SpectrumAnalyzer.h"
+#include "Noise.h"		// For Min() and Max()
+
+// Where the bands are split, in Hz (the last band goes up to the Nyquist frequency)
+static const float g_fBandEdge[SPECTRUM_BANDS-1] = {60, 150, 400, 1000, 2500, 6000, 12000};
+
+static float ToDecibels(float fPower)
+{
+	return Max(SPECTRUM_FLOOR, 10.0f * log10f(fPower + 1e-20f));
+}
+
+void CSpectrumAnalyzer::Init(int nFrequency)
+{
+	const int N = SPECTRUM_FFT_SIZE, M = SPECTRUM_FFT_SIZE/2;
+	const double dTwoPi = 6.283185307179586;
+	m_nFrequency = nFrequency;
+	m_nHop = Max(1, nFrequency * SPECTRUM_HOP_MS / 1000);
+
+	// A periodic Hann window, and the scales that make a full-scale square wave 0 dB and a full-scale sine's amplitude 1
+	double dSum = 0, dSum2 = 0;
+	for(int n=0; n<N; n++)
+	{
+		m_fWindow[n] = (float)(0.5 - 0.5 * cos(dTwoPi * n / N));
+		dSum += m_fWindow[n];
+		dSum2 += m_fWindow[n] * m_fWindow[n];
+	}
+	m_fPowerScale = (float)(2.0 / (N * dSum2));
+	m_fAmplitudeScale = (float)(2.0 / dSum);
+
+	for(int k=0; k<N; k++)
+	{
+		m_fCos[k] = (float)cos(dTwoPi * k / N);
+		m_fSin[k] = (float)sin(dTwoPi * k / N);
+	}
+	int nBits = 0;
+	while((1 << nBits) < M)
+		nBits++;
+	for(int n=0; n<M; n++)
+	{
+		int r = 0;
+		for(int b=0; b<nBits; b++)
+			r |= ((n >> b) & 1) << (nBits - 1 - b);
+		m_nReverse[n] = r;
+	}
+
+	// Every band gets at least one bin (the DC bin is left out)
+	m_nBandBin[0] = 1;
+	for(int b=1; b<SPECTRUM_BANDS; b++)
+	{
+		int nBin = (int)(g_fBandEdge[b-1] * N / nFrequency + 0.5f);
+		m_nBandBin[b] = Min(Max(nBin, m_nBandBin[b-1] + 1), M + 1 - (SPECTRUM_BANDS - b));
+	}
+	m_nBandBin[SPECTRUM_BANDS] = M + 1;
+
+	m_fFluxDecay = Min(1.0f, (float)SPECTRUM_HOP_MS / SPECTRUM_FLUX_MS);
+	Reset();
+}
+
+void CSpectrumAnalyzer::Reset()
+{
+	memset(m_fHistory, 0, sizeof(m_fHistory));
+	memset(m_fPower, 0, sizeof(m_fPower));
+	memset(m_fMagnitude, 0, sizeof(m_fMagnitude));
+	m_nNext = 0;
+	m_nUntilHop = m_nHop;
+	m_fFluxMean = 0;
+	m_nOnsetWait = SPECTRUM_FLUX_MS / SPECTRUM_HOP_MS;	// Until the average has settled
+	m_nHops = m_nOnsets = m_nOnsetHop = 0;
+
+	SSpectrumSnapshot s;
+	memset(&s, 0, sizeof(s));
+	s.fLevel = SPECTRUM_FLOOR;
+	for(int b=0; b<SPECTRUM_BANDS; b++)
+		s.fBand[b] = SPECTRUM_FLOOR;
+	m_snapshots.Fill(s);
+}
+
+void CSpectrumAnalyzer::WritePCM(const void *pData, int nFrames, int nChannels, int nBitsPerSample)
+{
+	const unsigned char *p8 = (const unsigned char *)pData;
+	const short *p16 = (const short *)pData;
+	float fScale = 1.0f / nChannels;
+	for(int i=0; i<nFrames; i++)
+	{
+		float fSample = 0;
+		if(nBitsPerSample == 8)
+		{
+			for(int c=0; c<nChannels; c++)
+				fSample += (*p8++ - 128) * (1.0f / 128.0f);
+		}
+		else
+		{
+			for(int c=0; c<nChannels; c++)
+				fSample += *p16++ * (1.0f / 32768.0f);
+		}
+		m_fHistory[m_nNext] = fSample * fScale;
+		m_nNext = (m_nNext + 1) & (SPECTRUM_FFT_SIZE-1);
+		if(--m_nUntilHop == 0)
+		{
+			Analyze();
+			m_nUntilHop = m_nHop;
+		}
+	}
+}
+
+void CSpectrumAnalyzer::Transform()
+{
+	// An in-place decimation-in-time FFT of m_fRe and m_fIm (which are already in bit-reversed order).
+	// Each radix-4 butterfly does the work of two radix-2 stages, with W = e^(-2 pi i / 4h):
+	//   a + W^2j b + W^j c + W^3j d,  (a - W^2j b) - i(W^j c - W^3j d),  a + W^2j b - W^j c - W^3j d,  (a - W^2j b) + i(W^j c - W^3j d)
+	const int M = SPECTRUM_FFT_SIZE/2;
+	float *pRe = m_fRe, *pIm = m_fIm;
+	int h = 1;
+	if((M & 0x55555555) == 0)
+	{
+		// M is twice a power of 4, so the first radix-2 stage is done on its own
+		for(int i=0; i<M; i+=2)
+		{
+			float fRe = pRe[i+1], fIm = pIm[i+1];
+			pRe[i+1] = pRe[i] - fRe;
+			pIm[i+1] = pIm[i] - fIm;
+			pRe[i] += fRe;
+			pIm[i] += fIm;
+		}
+		h = 2;
+	}
+	for(; h<M; h*=4)
+	{
+		int nStep = SPECTRUM_FFT_SIZE / (4*h);	// W^j is the table's entry j*nStep
+		for(int j=0; j<h; j++)
+		{
+			float fCos1 = m_fCos[j*nStep], fSin1 = m_fSin[j*nStep];
+			float fCos2 = m_fCos[2*j*nStep], fSin2 = m_fSin[2*j*nStep];
+			float fCos3 = m_fCos[3*j*nStep], fSin3 = m_fSin[3*j*nStep];
+			for(int g=j; g<M; g+=4*h)
+			{
+				float aRe = pRe[g], aIm = pIm[g];
+				float bRe = pRe[g+h] * fCos2 + pIm[g+h] * fSin2, bIm = pIm[g+h] * fCos2 - pRe[g+h] * fSin2;
+				float cRe = pRe[g+2*h] * fCos1 + pIm[g+2*h] * fSin1, cIm = pIm[g+2*h] * fCos1 - pRe[g+2*h] * fSin1;
+				float dRe = pRe[g+3*h] * fCos3 + pIm[g+3*h] * fSin3, dIm = pIm[g+3*h] * fCos3 - pRe[g+3*h] * fSin3;
+				float sRe = aRe + bRe, sIm = aIm + bIm;		// a + b
+				float tRe = aRe - bRe, tIm = aIm - bIm;		// a - b
+				float uRe = cRe + dRe, uIm = cIm + dIm;		// c + d
+				float vRe = cRe - dRe, vIm = cIm - dIm;		// c - d
+				pRe[g] = sRe + uRe;			pIm[g] = sIm + uIm;
+				pRe[g+h] = tRe + vIm;		pIm[g+h] = tIm - vRe;
+				pRe[g+2*h] = sRe - uRe;		pIm[g+2*h] = sIm - uIm;
+				pRe[g+3*h] = tRe - vIm;		pIm[g+3*h] = tIm + vRe;
+			}
+		}
+	}
+}
+
+void CSpectrumAnalyzer::Analyze()
+{
+	const int N = SPECTRUM_FFT_SIZE, M = SPECTRUM_FFT_SIZE/2;
+
+	// Window the ring (oldest first), with the even samples going into the real parts and the odd ones into the imaginary parts
+	for(int n=0; n<M; n++)
+	{
+		int i = (m_nNext + 2*n) & (N-1);
+		m_fRe[m_nReverse[n]] = m_fHistory[i] * m_fWindow[2*n];
+		m_fIm[m_nReverse[n]] = m_fHistory[(i+1) & (N-1)] * m_fWindow[2*n+1];
+	}
+	Transform();
+
+	// Untangle the real FFT's bins: with Z the complex FFT, the even samples' FFT is (Z[k] + Z*[M-k]) / 2,
+	// the odd samples' is (Z[k] - Z*[M-k]) / 2i, and X[k] = even + e^(-2 pi i k / N) odd
+	float fTotal = 0, fFlux = 0;
+	for(int k=0; k<=M; k++)
+	{
+		int k1 = k & (M-1), k2 = (M - k) & (M-1);
+		float aRe = m_fRe[k1], aIm = m_fIm[k1], bRe = m_fRe[k2], bIm = m_fIm[k2];
+		float eRe = 0.5f * (aRe + bRe), eIm = 0.5f * (aIm - bIm);
+		float oRe = 0.5f * (aIm + bIm), oIm = -0.5f * (aRe - bRe);
+		float xRe = eRe + oRe * m_fCos[k] + oIm * m_fSin[k];
+		float xIm = eIm + oIm * m_fCos[k] - oRe * m_fSin[k];
+		float fSquared = xRe * xRe + xIm * xIm;
+		m_fPower[k] = fSquared * m_fPowerScale * (k == 0 || k == M ? 0.5f : 1.0f);
+		fTotal += m_fPower[k];
+
+		float fMagnitude = logf(1.0f + SPECTRUM_COMPRESSION * m_fAmplitudeScale * sqrtf(fSquared));
+		if(k > 0)
+			fFlux += Max(0.0f, fMagnitude - m_fMagnitude[k]);
+		m_fMagnitude[k] = fMagnitude;
+	}
+
+	SSpectrumSnapshot &s = m_snapshots.GetBack();
+	s.nHop = ++m_nHops;
+	s.fLevel = ToDecibels(fTotal);
+	for(int b=0; b<SPECTRUM_BANDS; b++)
+	{
+		float fPower = 0;
+		for(int k=m_nBandBin[b]; k<m_nBandBin[b+1]; k++)
+			fPower += m_fPower[k];
+		s.fBand[b] = ToDecibels(fPower);
+	}
+
+	// The flux is compared to its average before the average takes it in, so an onset doesn't raise its own threshold
+	s.fFlux = fFlux;
+	if(m_nOnsetWait > 0)
+		m_nOnsetWait--;
+	else if(fFlux > m_fFluxMean * SPECTRUM_ONSET_RATIO && fFlux > m_fFluxMean + SPECTRUM_ONSET_MIN)
+	{
+		m_nOnsets++;
+		m_nOnsetHop = m_nHops;
+		m_nOnsetWait = SPECTRUM_ONSET_MS / SPECTRUM_HOP_MS;
+	}
+	m_fFluxMean += (fFlux - m_fFluxMean) * m_fFluxDecay;
+	s.nOnsets = m_nOnsets;
+	s.nOnsetHop = m_nOnsetHop;
+	m_snapshots.Publish();
+}
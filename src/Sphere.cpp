@@ -0,0 +1,563 @@
+// Sphere.cpp
+//
+
+#include "Master.h"
+#include "Sphere.h"
+#include "GLUtil.h"
+
+static void CopyColors(CColor *pColor, const SVertex *pVertex, int nCount, float fBrightness)
+{
+	if(fBrightness == 1.0f)
+	{
+		for(int i=0; i<nCount; i++)
+			pColor[i] = pVertex[i].cColor;
+	}
+	else
+	{
+		for(int i=0; i<nCount; i++)
+			pColor[i] = BrightenColor(pVertex[i].cColor, fBrightness);
+	}
+}
+
+void CSphere::InitBuffers()
+{
+	DeleteBuffers();
+	CGLUtil *pGL = GLUtil();
+	if(!m_bBuffers || !pGL->HasVertexBufferObjects())
+		return;
+
+	// The positions and triangles only change with the tessellation, so they only go across the bus when it does
+	pGL->glGenBuffersARB(1, &m_nPositionBuffer);
+	pGL->glBindBufferARB(GL_ARRAY_BUFFER_ARB, m_nPositionBuffer);
+	pGL->glBufferDataARB(GL_ARRAY_BUFFER_ARB, m_nVertices * sizeof(CVector), NULL, GL_STATIC_DRAW_ARB);
+	CVector *pPos = (CVector *)pGL->glMapBufferARB(GL_ARRAY_BUFFER_ARB, GL_WRITE_ONLY_ARB);
+	if(pPos)
+	{
+		for(int i=0; i<m_nVertices; i++)
+			pPos[i] = m_pVertex[i].vPos;
+	}
+	bool bOK = pPos && pGL->glUnmapBufferARB(GL_ARRAY_BUFFER_ARB);
+	pGL->glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+
+	pGL->glGenBuffersARB(1, &m_nIndexBuffer);
+	pGL->glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, m_nIndexBuffer);
+	pGL->glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER_ARB, m_nIndices * sizeof(unsigned short), m_pIndex, GL_STATIC_DRAW_ARB);
+	pGL->glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
+
+	// The colors are refilled by every Draw()
+	pGL->glGenBuffersARB(1, &m_nColorBuffer);
+
+	// Fall back to client memory if the positions didn't make it
+	if(!bOK)
+		DeleteBuffers();
+}
+
+void CSphere::DeleteBuffers()
+{
+	CGLUtil *pGL = GLUtil();
+	if(m_nPositionBuffer && pGL->HasVertexBufferObjects())
+	{
+		unsigned int nBuffer[3] = {m_nPositionBuffer, m_nColorBuffer, m_nIndexBuffer};
+		pGL->glDeleteBuffersARB(3, nBuffer);
+	}
+	m_nPositionBuffer = m_nColorBuffer = m_nIndexBuffer = 0;
+}
+
+void CSphere::SetClientColors(float fBrightness)
+{
+	// The colors can be sent straight out of the vertex buffer unless they have to be brightened first
+	if(fBrightness == 1.0f)
+	{
+		glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(SVertex), &m_pVertex[0].cColor);
+		return;
+	}
+	if(m_nDrawColors < m_nVertices)
+	{
+		delete[] m_pDrawColor;
+		m_pDrawColor = new CColor[m_nVertices];
+		m_nDrawColors = m_nVertices;
+	}
+	CopyColors(m_pDrawColor, m_pVertex, m_nVertices, fBrightness);
+	glColorPointer(4, GL_UNSIGNED_BYTE, 0, m_pDrawColor);
+}
+
+void CSphere::Draw(float fBrightness)
+{
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	if(m_nPositionBuffer)
+	{
+		// Orphan last frame's colors so the driver never has to wait for the GPU to finish with them before we write the new ones
+		CGLUtil *pGL = GLUtil();
+		pGL->glBindBufferARB(GL_ARRAY_BUFFER_ARB, m_nColorBuffer);
+		pGL->glBufferDataARB(GL_ARRAY_BUFFER_ARB, m_nVertices * sizeof(CColor), NULL, GL_STREAM_DRAW_ARB);
+		CColor *pColor = (CColor *)pGL->glMapBufferARB(GL_ARRAY_BUFFER_ARB, GL_WRITE_ONLY_ARB);
+		bool bOK = false;
+		if(pColor)
+		{
+			CopyColors(pColor, m_pVertex, m_nVertices, fBrightness);
+			bOK = pGL->glUnmapBufferARB(GL_ARRAY_BUFFER_ARB) != GL_FALSE;
+		}
+		if(bOK)
+			glColorPointer(4, GL_UNSIGNED_BYTE, 0, BUFFER_OFFSET(0));
+		else
+		{
+			// The buffer is undefined if it couldn't be mapped or its contents were lost before the unmap, so send the colors from client memory this time
+			pGL->glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+			SetClientColors(fBrightness);
+		}
+		pGL->glBindBufferARB(GL_ARRAY_BUFFER_ARB, m_nPositionBuffer);
+		glVertexPointer(3, GL_FLOAT, 0, BUFFER_OFFSET(0));
+		pGL->glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, m_nIndexBuffer);
+		glDrawElements(GL_TRIANGLES, m_nIndices, GL_UNSIGNED_SHORT, BUFFER_OFFSET(0));
+		pGL->glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
+		pGL->glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
+	}
+	else
+	{
+		// Without buffer objects, the same call works straight out of the vertex buffer
+		SetClientColors(fBrightness);
+		glVertexPointer(3, GL_FLOAT, sizeof(SVertex), &m_pVertex[0].vPos);
+		glDrawElements(GL_TRIANGLES, m_nIndices, GL_UNSIGNED_SHORT, m_pIndex);
+	}
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+void CSphere::InitBlocks()
+{
+	// Find the longest edge touching each vertex
+	float *pEdge = new float[m_nVertices];
+	for(int i=0; i<m_nVertices; i++)
+		pEdge[i] = 0;
+	for(int i=0; i<m_nIndices; i+=3)
+	{
+		for(int j=0; j<3; j++)
+		{
+			int n1 = m_pIndex[i+j], n2 = m_pIndex[i+(j+1)%3];
+			float fLength = m_pVertex[n1].vPos.Distance(m_pVertex[n2].vPos);
+			pEdge[n1] = Max(pEdge[n1], fLength);
+			pEdge[n2] = Max(pEdge[n2], fLength);
+		}
+	}
+
+	m_nBlocks = (m_nVertices + m_nBlockSize-1) / m_nBlockSize;
+	for(int nBlock=0; nBlock<m_nBlocks; nBlock++)
+	{
+		SCullBlock &block = m_pBlock[nBlock];
+		int nStart = nBlock * m_nBlockSize;
+		int nEnd = Min(nStart + m_nBlockSize, (int)m_nVertices);
+		block.vCenter = CVector(0.0f);
+		for(int i=nStart; i<nEnd; i++)
+			block.vCenter += m_pVertex[i].vPos;
+		block.vCenter /= (float)(nEnd - nStart);
+		block.fRadius = 0;
+		for(int i=nStart; i<nEnd; i++)
+			block.fRadius = Max(block.fRadius, block.vCenter.Distance(m_pVertex[i].vPos) + pEdge[i]);
+		block.bVisible = false;		// So the next Cull() reports it if it can be seen
+	}
+	delete[] pEdge;
+}
+
+bool CSphere::Cull(const CFrustum *pFrustum, const CVector &vCamera, float fOccluderRadius)
+{
+	// The planet hides whatever is inside the cone of rays that hit it and farther away than the horizon
+	// (the first hit of any ray in the cone is never farther away than that)
+	float fDistance2 = vCamera.MagnitudeSquared();
+	bool bHorizon = fOccluderRadius > 0 && fDistance2 > fOccluderRadius*fOccluderRadius;
+	float fDistance = sqrtf(fDistance2);
+	float fHorizon = sqrtf(Max(0.0f, fDistance2 - fOccluderRadius*fOccluderRadius));
+	float fCosCone = fHorizon / Max(fDistance, DELTA);
+
+	bool bNewlyVisible = false;
+	for(int nBlock=0; nBlock<m_nBlocks; nBlock++)
+	{
+		SCullBlock &block = m_pBlock[nBlock];
+		bool bVisible = !pFrustum || pFrustum->IsInFrustum(block.vCenter, block.fRadius);
+		if(bVisible && bHorizon)
+		{
+			CVector vRay = block.vCenter - vCamera;
+			float fRay = vRay.Magnitude();
+			if(fRay - block.fRadius > fHorizon)
+			{
+				// Hidden if the angle between the ray and the planet's center plus the bounding sphere's angular radius still fits in the cone
+				float fCos = -(vRay | vCamera) / (fRay * fDistance);
+				float fSin = sqrtf(Max(0.0f, 1.0f - fCos*fCos));
+				float fSinRadius = block.fRadius / fRay;
+				float fCosRadius = sqrtf(Max(0.0f, 1.0f - fSinRadius*fSinRadius));
+				if(fCos > 0 && fCos * fCosRadius - fSin * fSinRadius > fCosCone)
+					bVisible = false;
+			}
+		}
+		bNewlyVisible |= bVisible && !block.bVisible;
+		block.bVisible = bVisible;
+	}
+	return bNewlyVisible;
+}
+
+
+// The frame of each cube face: its normal, then the directions u and v run in (u x v points out, so the triangles are wound like CSphere's)
+static const float g_fFaceAxis[6][3][3] =
+{
+	{{ 1, 0, 0}, {0, 1, 0}, {0, 0, 1}},
+	{{-1, 0, 0}, {0, 0, 1}, {0, 1, 0}},
+	{{ 0, 1, 0}, {0, 0, 1}, {1, 0, 0}},
+	{{ 0,-1, 0}, {1, 0, 0}, {0, 0, 1}},
+	{{ 0, 0, 1}, {1, 0, 0}, {0, 1, 0}},
+	{{ 0, 0,-1}, {0, 1, 0}, {1, 0, 0}},
+};
+
+#define LOD_LIMB_WEIGHT		4.0f		// How much more a patch on the limb is worth splitting
+#define LOD_FAR_WEIGHT		0.25f		// How much less a patch facing away from the camera is worth splitting
+
+static inline CVector GetFaceAxis(int nFace, int nAxis)
+{
+	return CVector(g_fFaceAxis[nFace][nAxis][0], g_fFaceAxis[nFace][nAxis][1], g_fFaceAxis[nFace][nAxis][2]);
+}
+
+// Face coordinates run from -1 to 1, warped so that equal steps cover equal angles on the sphere
+static inline float Warp(float u)		{ return tanf(u * (PI * 0.25f)); }
+static inline float Unwarp(float x)		{ return atanf(x) * (4.0f / PI); }
+
+static inline CVector GetCubePoint(int nFace, float u, float v)
+{
+	return GetFaceAxis(nFace, 0) + GetFaceAxis(nFace, 1) * Warp(u) + GetFaceAxis(nFace, 2) * Warp(v);
+}
+
+// Finds the coordinates of a direction on a face (which it must not be pointing away from)
+static inline void GetFaceCoord(int nFace, const CVector &vDir, float &u, float &v)
+{
+	float fNormal = vDir | GetFaceAxis(nFace, 0);
+	u = Unwarp((vDir | GetFaceAxis(nFace, 1)) / fNormal);
+	v = Unwarp((vDir | GetFaceAxis(nFace, 2)) / fNormal);
+}
+
+// Finds the face a direction goes through
+static inline int GetFace(const CVector &vDir)
+{
+	float x = Abs(vDir.x), y = Abs(vDir.y), z = Abs(vDir.z);
+	if(x >= y && x >= z)
+		return vDir.x >= 0 ? 0 : 1;
+	if(y >= z)
+		return vDir.y >= 0 ? 2 : 3;
+	return vDir.z >= 0 ? 4 : 5;
+}
+
+// Gets the corner and the size of a patch in face coordinates
+static inline void GetBounds(unsigned int nKey, float &u0, float &v0, float &fSize)
+{
+	SLODPatch patch;
+	patch.nKey = nKey;
+	fSize = 2.0f / (1 << patch.GetLevel());
+	u0 = -1.0f + patch.GetX() * fSize;
+	v0 = -1.0f + patch.GetY() * fSize;
+}
+
+static int ComparePatches(const void *p1, const void *p2)
+{
+	unsigned int nKey1 = ((const SLODPatch *)p1)->nKey, nKey2 = ((const SLODPatch *)p2)->nKey;
+	return nKey1 < nKey2 ? -1 : nKey1 > nKey2 ? 1 : 0;
+}
+
+// Finds the patch (in a list sorted by key) that covers a point on a face, or NULL if none of them do
+static const SLODPatch *FindPatch(const SLODPatch *pPatch, int nPatches, int nFace, float u, float v)
+{
+	SLODPatch patch;
+	for(int nLevel=0; nLevel<=LOD_MAX_LEVEL; nLevel++)
+	{
+		int nSize = 1 << nLevel;
+		int x = Min(Max((int)((u + 1.0f) * 0.5f * nSize), 0), nSize-1);
+		int y = Min(Max((int)((v + 1.0f) * 0.5f * nSize), 0), nSize-1);
+		patch.nKey = SLODPatch::MakeKey(nFace, nLevel, x, y);
+		const SLODPatch *pFound = (const SLODPatch *)bsearch(&patch, pPatch, nPatches, sizeof(SLODPatch), ComparePatches);
+		if(pFound)
+			return pFound;
+	}
+	return NULL;
+}
+
+void CLODSphere::Init(float fRadius, int nMaxVertices, bool bBuffers)
+{
+	m_bBuffers = bBuffers;
+	m_fRadius = fRadius;
+	m_nSlices = m_nSections = 0;
+	m_nMaxPatches = Max(6, Min(nMaxVertices, 65535) / LOD_PATCH_VERTICES);
+	int nMaxIndices = m_nMaxPatches * LOD_PATCH_SIZE * LOD_PATCH_SIZE * 6;
+
+	DeleteBuffers();
+	if(m_pVertex)
+		_aligned_free(m_pVertex);
+	delete[] m_pIndex;
+	delete[] m_colorState.pCamera;
+	delete[] m_pPatch;
+	delete[] m_pNext;
+	delete[] m_pSlotOwner;
+
+	// Align the buffer so that COLOR_CHUNK_SIZE chunks never share a cache line
+	m_pVertex = (SVertex *)_aligned_malloc(m_nMaxPatches * LOD_PATCH_VERTICES * sizeof(SVertex), 64);
+	m_pIndex = new unsigned short[nMaxIndices];
+	m_colorState.pCamera = new CVector[m_nMaxPatches * LOD_PATCH_VERTICES];
+	m_colorState.bValid = false;
+	m_pPatch = new SLODPatch[m_nMaxPatches];
+	m_pNext = new SLODPatch[m_nMaxPatches];
+	m_pSlotOwner = new int[m_nMaxPatches];
+	delete[] m_pBlock;
+	m_pBlock = new SCullBlock[m_nMaxPatches];
+	m_nBlockSize = LOD_PATCH_VERTICES;
+	m_nBlocks = 0;
+	m_nPatches = 0;
+	m_nVertices = 0;
+	m_nIndices = 0;
+
+	// Start with the six faces, as seen from far away
+	Update(CVector(0, 0, fRadius * 1000.0f));
+}
+
+CVector CLODSphere::GetPosition(int nFace, float u, float v)
+{
+	CVector vDir = GetCubePoint(nFace, u, v);
+	return vDir * (m_fRadius / vDir.Magnitude());
+}
+
+float CLODSphere::GetPriority(const SLODPatch &patch, const CVector &vCamera)
+{
+	float u0, v0, fSize;
+	GetBounds(patch.nKey, u0, v0, fSize);
+	CVector vCenter = GetPosition(patch.GetFace(), u0 + fSize * 0.5f, v0 + fSize * 0.5f);
+	float fRadius = vCenter.Distance(GetPosition(patch.GetFace(), u0, v0));
+
+	// The angle one cell covers, roughly
+	CVector vToCamera = vCamera - vCenter;
+	float fDistance = vToCamera.Magnitude();
+	float fError = fRadius / (Max(fDistance - fRadius, DELTA) * LOD_PATCH_SIZE);
+
+	// Compare the angle between the patch and the view ray to how far the normal turns across the patch
+	float fFacing = (vCenter | vToCamera) / (m_fRadius * Max(fDistance, DELTA));
+	if(Abs(fFacing) <= fRadius / m_fRadius)
+		fError *= LOD_LIMB_WEIGHT;
+	else if(fFacing < 0 && vCamera.MagnitudeSquared() > m_fRadius*m_fRadius)
+		fError *= LOD_FAR_WEIGHT;
+	return fError;
+}
+
+void CLODSphere::BuildPatch(const SLODPatch &patch)
+{
+	float u0, v0, fSize;
+	GetBounds(patch.nKey, u0, v0, fSize);
+	float fStep = fSize / LOD_PATCH_SIZE;
+	int nFace = patch.GetFace();
+	int nIndex = patch.nSlot * LOD_PATCH_VERTICES;
+	for(int j=0; j<=LOD_PATCH_SIZE; j++)
+	{
+		for(int i=0; i<=LOD_PATCH_SIZE; i++)
+		{
+			m_pVertex[nIndex].vPos = GetPosition(nFace, u0 + i * fStep, v0 + j * fStep);
+			m_pVertex[nIndex].cColor = CColor(0, 0, 0);
+			m_colorState.pCamera[nIndex] = CVector(FLT_MAX);
+			nIndex++;
+		}
+	}
+	for(int nEdge=0; nEdge<4; nEdge++)
+	{
+		if(patch.nEdge[nEdge] != LOD_NO_NEIGHBOR)
+			StitchEdge(patch, nEdge);
+	}
+}
+
+void CLODSphere::StitchEdge(const SLODPatch &patch, int nEdge)
+{
+	float u0, v0, fSize;
+	GetBounds(patch.nKey, u0, v0, fSize);
+	float fStep = fSize / LOD_PATCH_SIZE;
+	int nFace = patch.GetFace();
+
+	SLODPatch neighbor;
+	neighbor.nKey = patch.nEdge[nEdge];
+	int nNeighborFace = neighbor.GetFace();
+	float nu0, nv0, fNeighborSize;
+	GetBounds(neighbor.nKey, nu0, nv0, fNeighborSize);
+	float fNeighborStep = fNeighborSize / LOD_PATCH_SIZE;
+
+	for(int k=0; k<=LOD_PATCH_SIZE; k++)
+	{
+		// Edges run along v=v0, u=u1, v=v1, and u=u0
+		int i = (nEdge == 0 || nEdge == 2) ? k : (nEdge == 1) ? LOD_PATCH_SIZE : 0;
+		int j = (nEdge == 1 || nEdge == 3) ? k : (nEdge == 2) ? LOD_PATCH_SIZE : 0;
+		float u, v;
+		GetFaceCoord(nNeighborFace, GetCubePoint(nFace, u0 + i * fStep, v0 + j * fStep), u, v);
+
+		// The vertex sits on one of the neighbor's sides, so snap it to that side and move it onto the chord between the neighbor's vertices
+		float fUBoundary = Abs(u - nu0) < Abs(u - (nu0 + fNeighborSize)) ? nu0 : nu0 + fNeighborSize;
+		float fVBoundary = Abs(v - nv0) < Abs(v - (nv0 + fNeighborSize)) ? nv0 : nv0 + fNeighborSize;
+		CVector v1, v2;
+		float t;
+		if(Abs(u - fUBoundary) < Abs(v - fVBoundary))
+		{
+			t = (v - nv0) / fNeighborStep;
+			int n = Min(Max((int)floorf(t), 0), LOD_PATCH_SIZE-1);
+			t -= n;
+			v1 = GetPosition(nNeighborFace, fUBoundary, nv0 + n * fNeighborStep);
+			v2 = GetPosition(nNeighborFace, fUBoundary, nv0 + (n+1) * fNeighborStep);
+		}
+		else
+		{
+			t = (u - nu0) / fNeighborStep;
+			int n = Min(Max((int)floorf(t), 0), LOD_PATCH_SIZE-1);
+			t -= n;
+			v1 = GetPosition(nNeighborFace, nu0 + n * fNeighborStep, fVBoundary);
+			v2 = GetPosition(nNeighborFace, nu0 + (n+1) * fNeighborStep, fVBoundary);
+		}
+		m_pVertex[patch.nSlot * LOD_PATCH_VERTICES + j * (LOD_PATCH_SIZE+1) + i].vPos = v1 + (v2 - v1) * t;
+	}
+}
+
+void CLODSphere::BuildIndexList()
+{
+	// Every slot gets the same grid of triangles, so this only changes with the number of patches
+	m_nIndices = 0;
+	for(int nSlot=0; nSlot<m_nPatches; nSlot++)
+	{
+		int nBase = nSlot * LOD_PATCH_VERTICES;
+		for(int j=0; j<LOD_PATCH_SIZE; j++)
+		{
+			for(int i=0; i<LOD_PATCH_SIZE; i++)
+			{
+				unsigned short n1 = (unsigned short)(nBase + j * (LOD_PATCH_SIZE+1) + i);
+				unsigned short n2 = n1 + 1;
+				unsigned short n3 = n1 + (LOD_PATCH_SIZE+1);
+				unsigned short n4 = n3 + 1;
+				m_pIndex[m_nIndices++] = n1;
+				m_pIndex[m_nIndices++] = n2;
+				m_pIndex[m_nIndices++] = n4;
+				m_pIndex[m_nIndices++] = n1;
+				m_pIndex[m_nIndices++] = n4;
+				m_pIndex[m_nIndices++] = n3;
+			}
+		}
+	}
+}
+
+bool CLODSphere::Update(const CVector &vCamera)
+{
+	// Start with the six faces, and keep splitting the patch that is most worth it until the budget runs out
+	int nNext = 0;
+	for(int nFace=0; nFace<6; nFace++)
+	{
+		SLODPatch &patch = m_pNext[nNext++];
+		patch.nKey = SLODPatch::MakeKey(nFace, 0, 0, 0);
+		patch.fPriority = GetPriority(patch, vCamera);
+	}
+	while(nNext + 3 <= m_nMaxPatches)
+	{
+		int nBest = -1;
+		float fBest = m_fMinError;
+		for(int i=0; i<nNext; i++)
+		{
+			if(m_pNext[i].fPriority > fBest && m_pNext[i].GetLevel() < LOD_MAX_LEVEL)
+			{
+				nBest = i;
+				fBest = m_pNext[i].fPriority;
+			}
+		}
+		if(nBest < 0)
+			break;
+
+		// The first child takes the parent's place
+		int nFace = m_pNext[nBest].GetFace();
+		int nLevel = m_pNext[nBest].GetLevel() + 1;
+		int x = m_pNext[nBest].GetX() * 2;
+		int y = m_pNext[nBest].GetY() * 2;
+		for(int i=0; i<4; i++)
+		{
+			SLODPatch &child = (i == 0) ? m_pNext[nBest] : m_pNext[nNext++];
+			child.nKey = SLODPatch::MakeKey(nFace, nLevel, x + (i & 1), y + (i >> 1));
+			child.fPriority = GetPriority(child, vCamera);
+		}
+	}
+	qsort(m_pNext, nNext, sizeof(SLODPatch), ComparePatches);
+
+	// Patches that were already selected keep their slots, and their vertices unless a neighbor changed
+	for(int i=0; i<m_nMaxPatches; i++)
+		m_pSlotOwner[i] = -1;
+	bool bChanged = (nNext != m_nPatches);
+	for(int i=0; i<nNext; i++)
+	{
+		SLODPatch &patch = m_pNext[i];
+		float u0, v0, fSize;
+		GetBounds(patch.nKey, u0, v0, fSize);
+		for(int nEdge=0; nEdge<4; nEdge++)
+		{
+			// Look just across the middle of the edge (which may be on another face)
+			float fOut = fSize * 0.001f;
+			float u = (nEdge == 1) ? u0 + fSize + fOut : (nEdge == 3) ? u0 - fOut : u0 + fSize * 0.5f;
+			float v = (nEdge == 2) ? v0 + fSize + fOut : (nEdge == 0) ? v0 - fOut : v0 + fSize * 0.5f;
+			CVector vDir = GetCubePoint(patch.GetFace(), u, v);
+			int nFace = GetFace(vDir);
+			GetFaceCoord(nFace, vDir, u, v);
+			const SLODPatch *pNeighbor = FindPatch(m_pNext, nNext, nFace, u, v);
+			patch.nEdge[nEdge] = (pNeighbor && pNeighbor->GetLevel() < patch.GetLevel()) ? pNeighbor->nKey : LOD_NO_NEIGHBOR;
+		}
+
+		const SLODPatch *pOld = (const SLODPatch *)bsearch(&patch, m_pPatch, m_nPatches, sizeof(SLODPatch), ComparePatches);
+		patch.nSlot = pOld ? pOld->nSlot : -1;
+		patch.bDirty = !pOld || memcmp(pOld->nEdge, patch.nEdge, sizeof(patch.nEdge)) != 0;
+		if(pOld)
+			m_pSlotOwner[pOld->nSlot] = i;
+		bChanged |= patch.bDirty;
+	}
+
+	// New patches take the slots the dropped ones left behind first
+	int nFree = 0;
+	for(int i=0; i<nNext; i++)
+	{
+		if(m_pNext[i].nSlot >= 0)
+			continue;
+		while(m_pSlotOwner[nFree] >= 0)
+			nFree++;
+		m_pNext[i].nSlot = nFree;
+		m_pSlotOwner[nFree] = i;
+	}
+
+	// Then the patches at the end move down into any holes that are left, so the vertex buffer has no gaps
+	int nLast = m_nMaxPatches-1;
+	for(int nHole=0; nHole<nNext; nHole++)
+	{
+		if(m_pSlotOwner[nHole] >= 0)
+			continue;
+		while(m_pSlotOwner[nLast] < 0)
+			nLast--;
+		int i = m_pSlotOwner[nLast];
+		memcpy(&m_pVertex[nHole * LOD_PATCH_VERTICES], &m_pVertex[nLast * LOD_PATCH_VERTICES], LOD_PATCH_VERTICES * sizeof(SVertex));
+		memcpy(&m_colorState.pCamera[nHole * LOD_PATCH_VERTICES], &m_colorState.pCamera[nLast * LOD_PATCH_VERTICES], LOD_PATCH_VERTICES * sizeof(CVector));
+		m_pNext[i].nSlot = nHole;
+		m_pSlotOwner[nHole] = i;
+		m_pSlotOwner[nLast] = -1;
+		bChanged = true;
+	}
+
+	for(int i=0; i<nNext; i++)
+	{
+		if(m_pNext[i].bDirty)
+			BuildPatch(m_pNext[i]);
+	}
+
+	SLODPatch *pSwap = m_pPatch;
+	m_pPatch = m_pNext;
+	m_pNext = pSwap;
+	bool bNewCount = (nNext != m_nPatches);
+	m_nPatches = nNext;
+	m_nVertices = (unsigned short)(nNext * LOD_PATCH_VERTICES);
+	if(!bChanged)
+		return false;
+
+	if(bNewCount)
+		BuildIndexList();
+	InitBuffers();
+	InitBlocks();
+
+	// UpdateColors() skips the whole pass if the camera hasn't moved, which would leave the new vertices black
+	const CVector &vLast = m_colorState.params.vCamera;
+	if(m_colorState.bValid && vLast.x == vCamera.x && vLast.y == vCamera.y && vLast.z == vCamera.z)
+		m_colorState.bValid = false;
+	return true;
+}
@@ -0,0 +1,133 @@
+// TaskGraph.cpp
+//
+
+#include "Master.h"
+#include "TaskGraph.h"
+#include "Platform.h"
+
+int CTaskGraph::AddTask(const char *pszName, PFNTASK pfn, void *pParam, bool bMainThread)
+{
+	ASSERT(m_nTasks < TASK_MAX_TASKS);
+	STask &task = m_task[m_nTasks];
+	task.pszName = pszName;
+	task.pfn = pfn;
+	task.pParam = pParam;
+	task.bMainThread = bMainThread;
+	task.nWaiting = 0;
+	task.nDependents = 0;
+	task.nThread = -1;
+	task.fStart = task.fEnd = 0;
+	return m_nTasks++;
+}
+
+void CTaskGraph::AddDependency(int nTask, int nDependency)
+{
+	ASSERT(nDependency >= 0 && nDependency < nTask && nTask < m_nTasks);
+	STask &dependency = m_task[nDependency];
+	ASSERT(dependency.nDependents < TASK_MAX_DEPENDENTS);
+	dependency.nDependent[dependency.nDependents++] = nTask;
+	m_task[nTask].nWaiting++;
+}
+
+float CTaskGraph::GetTime()
+{
+	return (float)((GetTimerSeconds() - m_fStartTime) * 1000.0);
+}
+
+int CTaskGraph::PickTask(int nThread)
+{
+	// The calling thread only takes tasks the pool could run once every main-thread task has started, so GL calls
+	// never wait behind a long CPU task (unless there are no other threads to run those on)
+	if(nThread == 0)
+	{
+		bool bMainLeft = false;
+		for(int i=0; i<m_nTasks; i++)
+		{
+			if(m_task[i].bMainThread && m_task[i].nThread < 0)
+			{
+				if(m_task[i].nWaiting == 0)
+					return i;
+				bMainLeft = true;
+			}
+		}
+		if(bMainLeft && m_nThreads > 1)
+			return -1;
+	}
+	for(int i=0; i<m_nTasks; i++)
+	{
+		if(!m_task[i].bMainThread && m_task[i].nThread < 0 && m_task[i].nWaiting == 0)
+			return i;
+	}
+	return -1;
+}
+
+void CTaskGraph::RunThread(void *pParam, int nThread, int nEnd)
+{
+	CTaskGraph *pGraph = (CTaskGraph *)pParam;
+	if(nThread >= pGraph->m_nThreads)
+		return;
+
+	EnterCriticalSection(&pGraph->m_cs);
+	while(pGraph->m_nFinished < pGraph->m_nTasks)
+	{
+		int nTask = pGraph->PickTask(nThread);
+		if(nTask < 0)
+		{
+			// Whatever finishes next sets this event, so a task finishing in between isn't missed
+			LeaveCriticalSection(&pGraph->m_cs);
+			WaitForSingleObject(pGraph->m_hWake[nThread], INFINITE);
+			EnterCriticalSection(&pGraph->m_cs);
+			continue;
+		}
+
+		STask &task = pGraph->m_task[nTask];
+		task.nThread = nThread;
+		task.fStart = pGraph->GetTime();
+		LeaveCriticalSection(&pGraph->m_cs);
+		task.pfn(task.pParam);
+		EnterCriticalSection(&pGraph->m_cs);
+		task.fEnd = pGraph->GetTime();
+
+		pGraph->m_nFinished++;
+		for(int i=0; i<task.nDependents; i++)
+			pGraph->m_task[task.nDependent[i]].nWaiting--;
+		for(int i=0; i<pGraph->m_nThreads; i++)
+		{
+			if(i != nThread)
+				SetEvent(pGraph->m_hWake[i]);
+		}
+	}
+	LeaveCriticalSection(&pGraph->m_cs);
+}
+
+void CTaskGraph::Run(CThreadPool *pPool)
+{
+	m_fStartTime = GetTimerSeconds();
+	m_nFinished = 0;
+	m_nThreads = pPool ? pPool->GetThreadCount() + 1 : 1;
+	if(m_nThreads > TASK_MAX_THREADS)
+		m_nThreads = TASK_MAX_THREADS;
+	InitializeCriticalSection(&m_cs);
+	for(int i=0; i<m_nThreads; i++)
+		m_hWake[i] = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+	if(pPool)
+		pPool->RunOnEachThread(RunThread, this);
+	else
+		RunThread(this, 0, 1);
+
+	for(int i=0; i<m_nThreads; i++)
+		CloseHandle(m_hWake[i]);
+	DeleteCriticalSection(&m_cs);
+	m_fTotal = GetTime();
+}
+
+void CTaskGraph::LogTimings(const char *pszTitle)
+{
+	Trace("%s: %d tasks on %d threads took %.2f ms", pszTitle, m_nTasks, m_nThreads, m_fTotal);
+	for(int i=0; i<m_nTasks; i++)
+	{
+		const STask &task = m_task[i];
+		Trace("  %-20s thread %2d  %8.2f - %8.2f ms  (%.2f ms)", task.pszName, task.nThread, task.fStart, task.fEnd, task.fEnd - task.fStart);
+	}
+}
@@ -30,26 +30,59 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "Master.h"
 #include "Texture.h"
+#include "LUTCache.h"
 
 CTexture CTexture::m_tCloudCell;
 CTexture CTexture::m_t1DGlow;
 
-void CTexture::InitStaticMembers(int nSeed, int nSize)
+void CTexture::InitStaticMembers(int nSeed, int nSize, CLUTCache *pCache)
 {
 	CPixelBuffer pb;
 
 	// Initialize the shared cloud cell texture
-	pb.Init(16, 16, 1, 2, GL_LUMINANCE_ALPHA);
-	pb.MakeCloudCell(2, 0);
+	CLUTKey keyCloud("CloudCell", 1);
+	keyCloud.Add(16);
+	keyCloud.Add(2.0f);
+	keyCloud.Add(0.0f);
+	if(!pCache || !pCache->Load("CloudCell", keyCloud, pb))
+	{
+		pb.Init(16, 16, 1, 2, GL_LUMINANCE_ALPHA);
+		pb.MakeCloudCell(2, 0);
+		if(pCache)
+			pCache->Save("CloudCell", keyCloud, pb);
+	}
 	m_tCloudCell.Init(&pb);
 
-	pb.Init(64, 1, 1, 2, GL_LUMINANCE_ALPHA);
-	pb.MakeGlow1D();
+	// The textures keep their own copies, so each mapping can be released as soon as it is uploaded
+	CLUTKey keyGlow("Glow1D", 1);
+	keyGlow.Add(64);
+	const void *pMapped = pb.GetBuffer();
+	if(!pCache || !pCache->Load("Glow1D", keyGlow, pb))
+	{
+		pb.Init(64, 1, 1, 2, GL_LUMINANCE_ALPHA);
+		pb.MakeGlow1D();
+		if(pCache)
+			pCache->Save("Glow1D", keyGlow, pb);
+	}
 	m_t1DGlow.Init(&pb);
+	if(pCache)
+	{
+		pCache->Release(pMapped);
+		pCache->Release(pb.GetBuffer());
+	}
 }
 
 void CTexture::Init(CPixelBuffer *pBuffer, bool bClamp, bool bMipmap)
 {
+	// OpenGL only takes pixels in row-major order
+	if(pBuffer->GetLayout() != LinearLayout)
+	{
+		CPixelBuffer pbLinear = *pBuffer;
+		pbLinear.SetLayout(LinearLayout);
+		Init(&pbLinear, bClamp, bMipmap);
+		return;
+	}
+
 	Cleanup();
 	m_nType = (pBuffer->GetHeight() > 1) ? GL_TEXTURE_2D : GL_TEXTURE_1D;
 
@@ -80,6 +113,14 @@ void CTexture::Init(CPixelBuffer *pBuffer, bool bClamp, bool bMipmap)
 
 void CTexture::Update(CPixelBuffer *pBuffer, int nLevel)
 {
+	if(pBuffer->GetLayout() != LinearLayout)
+	{
+		CPixelBuffer pbLinear = *pBuffer;
+		pbLinear.SetLayout(LinearLayout);
+		Update(&pbLinear, nLevel);
+		return;
+	}
+
 	Bind();
 	switch(m_nType)
 	{
@@ -0,0 +1,155 @@
+// ThreadPool.cpp
+//
+
+#include "Master.h"
+#include "ThreadPool.h"
+#include <process.h>
+
+CThreadPool::CThreadPool()
+{
+	m_nThreads = 0;
+	m_pWorker = NULL;
+	m_hDone = NULL;
+	m_nActive = 0;
+	m_nNext = 0;
+	m_bQuit = false;
+	m_nBusy = 0;
+	m_bEachThread = false;
+	m_pfnJob = NULL;
+	m_pParam = NULL;
+	m_nCount = m_nChunkSize = m_nChunks = 0;
+}
+
+void CThreadPool::Init(int nThreads)
+{
+	Cleanup();
+	if(nThreads < 0)
+	{
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		nThreads = (int)si.dwNumberOfProcessors - 1;
+	}
+	if(nThreads <= 0)
+		return;
+
+	m_bQuit = false;
+	m_hDone = CreateEvent(NULL, FALSE, FALSE, NULL);
+	m_pWorker = new SWorker[nThreads];
+	for(m_nThreads=0; m_nThreads<nThreads; m_nThreads++)
+	{
+		SWorker *pWorker = &m_pWorker[m_nThreads];
+		pWorker->pPool = this;
+		pWorker->hStart = CreateEvent(NULL, FALSE, FALSE, NULL);
+		pWorker->hThread = (HANDLE)_beginthreadex(NULL, 0, WorkerProc, pWorker, 0, NULL);
+		if(!pWorker->hThread)
+		{
+			CloseHandle(pWorker->hStart);
+			break;
+		}
+	}
+}
+
+void CThreadPool::Cleanup()
+{
+	if(m_nThreads)
+	{
+		m_bQuit = true;
+		for(int i=0; i<m_nThreads; i++)
+			SetEvent(m_pWorker[i].hStart);
+		for(int i=0; i<m_nThreads; i++)
+		{
+			WaitForSingleObject(m_pWorker[i].hThread, INFINITE);
+			CloseHandle(m_pWorker[i].hThread);
+			CloseHandle(m_pWorker[i].hStart);
+		}
+	}
+	if(m_hDone)
+		CloseHandle(m_hDone);
+	delete[] m_pWorker;
+	m_pWorker = NULL;
+	m_hDone = NULL;
+	m_nThreads = 0;
+}
+
+unsigned __stdcall CThreadPool::WorkerProc(void *pParam)
+{
+	SWorker *pWorker = (SWorker *)pParam;
+	CThreadPool *pPool = pWorker->pPool;
+	for(;;)
+	{
+		WaitForSingleObject(pWorker->hStart, INFINITE);
+		if(pPool->m_bQuit)
+			break;
+		if(pPool->m_bEachThread)
+		{
+			int nIndex = (int)(pWorker - pPool->m_pWorker) + 1;
+			pPool->m_pfnJob(pPool->m_pParam, nIndex, nIndex+1);
+		}
+		else
+			pPool->RunChunks();
+		if(InterlockedDecrement(&pPool->m_nActive) == 0)
+			SetEvent(pPool->m_hDone);
+	}
+	return 0;
+}
+
+void CThreadPool::RunChunks()
+{
+	int nChunk;
+	while((nChunk = InterlockedIncrement(&m_nNext) - 1) < m_nChunks)
+	{
+		int nStart = nChunk * m_nChunkSize;
+		int nEnd = nStart + m_nChunkSize;
+		m_pfnJob(m_pParam, nStart, nEnd < m_nCount ? nEnd : m_nCount);
+	}
+}
+
+void CThreadPool::ParallelFor(PFNPARALLELFOR pfn, void *pParam, int nCount, int nChunkSize)
+{
+	if(nCount <= 0)
+		return;
+
+	// Not worth waking anyone up for a single chunk (callers may rely on never seeing more than nChunkSize items at once),
+	// and the workers can't be woken up if they're already running a job (the caller is one of them)
+	if(m_nThreads == 0 || nCount <= nChunkSize || InterlockedCompareExchange(&m_nBusy, 1, 0) != 0)
+	{
+		for(int nStart=0; nStart<nCount; nStart+=nChunkSize)
+			pfn(pParam, nStart, nStart + nChunkSize < nCount ? nStart + nChunkSize : nCount);
+		return;
+	}
+
+	m_pfnJob = pfn;
+	m_pParam = pParam;
+	m_nCount = nCount;
+	m_nChunkSize = nChunkSize;
+	m_nChunks = (nCount + nChunkSize - 1) / nChunkSize;
+	m_bEachThread = false;
+	m_nActive = m_nThreads;
+	InterlockedExchange(&m_nNext, 0);	// Also acts as a full memory barrier for the job members above
+	for(int i=0; i<m_nThreads; i++)
+		SetEvent(m_pWorker[i].hStart);
+
+	RunChunks();
+	WaitForSingleObject(m_hDone, INFINITE);
+	InterlockedExchange(&m_nBusy, 0);
+}
+
+void CThreadPool::RunOnEachThread(PFNPARALLELFOR pfn, void *pParam)
+{
+	if(m_nThreads == 0 || InterlockedCompareExchange(&m_nBusy, 1, 0) != 0)
+	{
+		pfn(pParam, 0, 1);
+		return;
+	}
+
+	m_pfnJob = pfn;
+	m_pParam = pParam;
+	m_bEachThread = true;
+	InterlockedExchange(&m_nActive, m_nThreads);
+	for(int i=0; i<m_nThreads; i++)
+		SetEvent(m_pWorker[i].hStart);
+
+	pfn(pParam, 0, 1);
+	WaitForSingleObject(m_hDone, INFINITE);
+	InterlockedExchange(&m_nBusy, 0);
+}